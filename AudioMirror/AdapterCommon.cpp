@@ -17,6 +17,12 @@ AdapterCommon::~AdapterCommon()
 		ExFreePoolWithTag(m_pDeviceHelper, MINIADAPTER_POOLTAG);
 	}
 
+	if (m_pScheduler)
+	{
+		delete m_pScheduler;
+		m_pScheduler = NULL;
+	}
+
 	InterlockedDecrement(&AdapterCommon::m_Instances);
 	ASSERT(AdapterCommon::m_Instances == 0);
 }
@@ -112,6 +118,15 @@ NTSTATUS __stdcall AdapterCommon::Init(IRP* StartupIrp, PDEVICE_OBJECT DeviceObj
 		if (!NT_SUCCESS(ntStatus)) DPF(D_TERSE, ("PcGetPhysicalDeviceObject failed, 0x%x", ntStatus));
 	}
 
+	// Without the scheduler every stream ticks wherever its timer fires.
+	m_pScheduler = new(NonPagedPoolNx, MINIADAPTER_POOLTAG) CableScheduler();
+	if (m_pScheduler && !NT_SUCCESS(m_pScheduler->Init()))
+	{
+		DPF(D_TERSE, ("CableScheduler::Init failed, cables are not sharded"));
+		delete m_pScheduler;
+		m_pScheduler = NULL;
+	}
+
 	ntStatus = InstallVirtualCable(StartupIrp);
 	IF_FAILED_ACTION_RETURN(ntStatus, DPF(D_TERSE, ("InstallVirtualCable failed, 0x%x", ntStatus)));
 
@@ -142,6 +157,14 @@ NTSTATUS AdapterCommon::InstallVirtualCable(IRP * irp)
 	ntStatus = unknownSpeaker->QueryInterface(IID_MiniportWaveRT, (PVOID*)&speaker);
 	microphone->SetPairedMiniport(speaker);
 
+	// Both ends of the cable tick on the same processor.
+	ULONG homeProcessor;
+	if (m_pScheduler && NT_SUCCESS(m_pScheduler->AddCable(&homeProcessor)))
+	{
+		speaker->SetCableScheduler(m_pScheduler, homeProcessor);
+		microphone->SetCableScheduler(m_pScheduler, homeProcessor);
+	}
+
 	return STATUS_SUCCESS;
 }
 
@@ -4,6 +4,7 @@
 #include "Macros.h"
 #include "IAdapterCommon.h"
 #include "SubdeviceHelper.h"
+#include "CableScheduler.h"
 
 class AdapterCommon : public IAdapterCommon, public CUnknown
 {
@@ -13,6 +14,7 @@ class AdapterCommon : public IAdapterCommon, public CUnknown
 		PDEVICE_OBJECT m_pPhysicalDeviceObject;
 		SubdeviceHelper* m_pDeviceHelper;
 		PPORTCLSETWHELPER m_pPortClsEtwHelper;
+		CableScheduler* m_pScheduler;
 
 		NTSTATUS InstallVirtualMic(IRP* Irp, IUnknown** unknownMiniport);
 		NTSTATUS InstallVirtualSpeaker(IRP* Irp, IUnknown** unknownMiniport);
@@ -0,0 +1,245 @@
+#pragma once
+
+/*++
+
+Module Name:
+
+	AudioMirrorProperties.h
+
+Abstract:
+
+	Private KS property set exposed on the AudioMirror wave filters.
+
+	This header is shared with user mode tools. It only depends on the basic
+	Windows types and DEFINE_GUID, so it can be included after <windows.h>
+	and <ks.h> as well as from the driver.
+
+--*/
+
+// {9FA388B4-F5FE-43DC-93B8-DF537220AACA}
+#define STATIC_KSPROPSETID_AudioMirror \
+	0x9fa388b4, 0xf5fe, 0x43dc, 0x93, 0xb8, 0xdf, 0x53, 0x72, 0x20, 0xaa, 0xca
+DEFINE_GUID(KSPROPSETID_AudioMirror, STATIC_KSPROPSETID_AudioMirror);
+
+typedef enum
+{
+	// GET: KSMULTIPLE_ITEM followed by one AUDIOMIRROR_STREAM_STATISTICS per open stream.
+	KSPROPERTY_AUDIOMIRROR_STREAM_STATISTICS = 0,
+	// SET: ULONG, non zero enables the render to capture latency measurement and
+	//      clears the histograms.
+	// GET: KSMULTIPLE_ITEM followed by one AUDIOMIRROR_LATENCY_HISTOGRAM per open
+	//      capture stream. Only supported on the capture filter.
+	KSPROPERTY_AUDIOMIRROR_LATENCY_MEASUREMENT = 1,
+	// GET: AUDIOMIRROR_TAP_MAPPING. Maps a read-only view of the cable tap
+	//      (see AudioMirrorTap.h) into the calling process. Every GET maps a
+	//      new view, the caller releases it with UnmapViewOfFile. Only
+	//      supported on the render filter, which owns the cable.
+	KSPROPERTY_AUDIOMIRROR_TAP = 2,
+	// SET: AUDIOMIRROR_TAP_EVENT. Registers or removes an event the driver
+	//      sets once for every block it writes to the tap.
+	KSPROPERTY_AUDIOMIRROR_TAP_EVENT = 3,
+	// GET: AUDIOMIRROR_TAP_MAPPING. Maps a writable view of the injection
+	//      ring (see AudioMirrorTap.h) into the calling process. Only
+	//      supported on the capture filter.
+	KSPROPERTY_AUDIOMIRROR_INJECT = 4,
+	// SET: AUDIOMIRROR_TAP_EVENT. Registers or removes an event the driver
+	//      sets whenever the capture streams consumed injected audio.
+	KSPROPERTY_AUDIOMIRROR_INJECT_EVENT = 5,
+	// SET: ULONG, non zero locks the position of the capture streams to the
+	//      audio the render side delivers into the cable instead of their own
+	//      timer. Capture streams opened while it is set get a smaller cable
+	//      ring. A locked stream runs on its own timer while the render side
+	//      delivers nothing.
+	// GET: ULONG, the current setting. Only supported on the capture filter.
+	KSPROPERTY_AUDIOMIRROR_CLOCK_LOCK = 6,
+	// GET: KSMULTIPLE_ITEM followed by one AUDIOMIRROR_PROCESSOR_STATISTICS per
+	//      processor the cables are spread across. Supported on both filters,
+	//      they share the scheduler.
+	KSPROPERTY_AUDIOMIRROR_SCHEDULER = 7,
+	// SET: ULONG, non zero moves the block processing of streams opened from
+	//      then on out of the timer DPC to a real-time worker thread per
+	//      stream. Loopback and clock locked streams always process in the DPC.
+	// GET: ULONG, the current setting. Supported on both filters.
+	KSPROPERTY_AUDIOMIRROR_WORKER_THREADS = 8,
+	// SET: ULONG, AUDIOMIRROR_OVERRUN_*. What the cable ring of capture
+	//      streams opened from then on discards when the render side
+	//      delivers more than it holds. Running streams keep their policy.
+	// GET: ULONG, the current setting. Only supported on the capture filter.
+	KSPROPERTY_AUDIOMIRROR_OVERRUN_POLICY = 9,
+	// SET: ULONG, milliseconds of pre-roll, 0 to AUDIOMIRROR_PREROLL_MAX_MS.
+	//      A capture stream opened from then on that enters KSSTATE_RUN while
+	//      the render side is playing starts with up to that much of the
+	//      audio it just played, limited to the cable ring, instead of
+	//      silence until the ring has filled.
+	// GET: ULONG, the current setting. Only supported on the capture filter.
+	KSPROPERTY_AUDIOMIRROR_PREROLL = 10,
+} KSPROPERTY_AUDIOMIRROR;
+
+#define AUDIOMIRROR_PREROLL_MAX_MS              1000
+
+//
+// Overrun policies. Every policy discards whole frames and counts them in
+// the OverrunBytes of the stream statistics.
+//
+#define AUDIOMIRROR_OVERRUN_DROP_OLDEST         0   // Default, drops just enough of the oldest audio.
+#define AUDIOMIRROR_OVERRUN_DROP_NEWEST         1   // Keeps the ring, drops the delivered frames that do not fit.
+#define AUDIOMIRROR_OVERRUN_SKIP_TO_LATENCY     2   // Drops the oldest audio down to the fill the ring started at.
+
+#define AUDIOMIRROR_STATISTICS_VERSION          7
+
+//
+// Timing histograms use power of two buckets in microseconds. Bucket n counts
+// samples in [2^(n-1), 2^n) us, bucket 0 counts samples below 1 us.
+//
+#define AUDIOMIRROR_TIMING_HISTOGRAM_BUCKETS    24
+
+typedef struct _AUDIOMIRROR_TIMING_SUMMARY
+{
+	ULONGLONG   SampleCount;
+	ULONG       P50Us;          // Upper bound of the bucket holding the percentile.
+	ULONG       P90Us;
+	ULONG       P99Us;
+	ULONG       MaxUs;          // Exact maximum observed.
+} AUDIOMIRROR_TIMING_SUMMARY, *PAUDIOMIRROR_TIMING_SUMMARY;
+
+#define AUDIOMIRROR_STREAM_FLAG_CAPTURE         0x00000001
+#define AUDIOMIRROR_STREAM_FLAG_RUNNING         0x00000002
+#define AUDIOMIRROR_STREAM_FLAG_PAIRED          0x00000004
+#define AUDIOMIRROR_STREAM_FLAG_LOOPBACK        0x00000008
+#define AUDIOMIRROR_STREAM_FLAG_CLOCK_LOCKED    0x00000010  // Position currently follows the render side.
+#define AUDIOMIRROR_STREAM_FLAG_WORKER          0x00000020  // Blocks are processed on a worker thread.
+#define AUDIOMIRROR_STREAM_FLAG_IDLE            0x00000040  // The timer runs at the idle rate.
+
+typedef struct _AUDIOMIRROR_STREAM_STATISTICS
+{
+	ULONG       Size;           // sizeof(AUDIOMIRROR_STREAM_STATISTICS)
+	ULONG       Version;        // AUDIOMIRROR_STATISTICS_VERSION
+	ULONG       PinId;
+	ULONG       Flags;          // AUDIOMIRROR_STREAM_FLAG_*
+	ULONGLONG   LinearPosition;
+
+	// Cable ring fill level in bytes. Min and max are tracked since the stream
+	// last entered KSSTATE_RUN.
+	ULONG       RingSize;
+	ULONG       RingFillCurrent;
+	ULONG       RingFillMin;
+	ULONG       RingFillMax;
+
+	ULONGLONG   Overruns;       // Puts that did not fit the ring.
+	ULONGLONG   OverrunBytes;   // Discarded by the overrun policy, whole frames.
+	ULONGLONG   Underruns;      // Transitions from delivering audio to zero filling.
+	ULONGLONG   ZeroFilledBytes;
+	ULONGLONG   DroppedPackets; // Capture packets the client never read.
+
+	ULONGLONG   TimerTicks;
+	AUDIOMIRROR_TIMING_SUMMARY DpcTime;
+	AUDIOMIRROR_TIMING_SUMMARY TimerLateness;
+
+	// Version 2. Position requests that reached the driver through a property
+	// call and the time spent serving them. Reads of the position register are
+	// plain memory loads in the audio engine and never show up here.
+	ULONGLONG   PositionQueries;
+	ULONGLONG   PositionQueryTimeNs;
+
+	// Version 3. Times a clock locked capture stream fell back to its own
+	// timer because the render side stopped delivering.
+	ULONGLONG   ClockLockFallbacks;
+
+	// Version 4. Processor index the cable of this stream is homed on,
+	// AUDIOMIRROR_NO_PROCESSOR when its ticks run wherever its timer fires.
+	ULONG       HomeProcessor;
+	ULONG       Reserved;
+
+	// Version 5. Streams with AUDIOMIRROR_STREAM_FLAG_WORKER. A miss is a
+	// block the worker had not started by its deadline: the timer DPC zero
+	// filled it on a capture stream and dropped it on a render stream. A late
+	// block was started in time but not finished by then. DpcTime above then
+	// only covers the position update.
+	ULONGLONG   WorkerBlocks;
+	ULONGLONG   WorkerMisses;
+	ULONGLONG   WorkerLateBlocks;
+	ULONGLONG   WorkerFallbackBytes;
+	AUDIOMIRROR_TIMING_SUMMARY WorkerTime;      // Processing one block.
+	AUDIOMIRROR_TIMING_SUMMARY WorkerDelay;     // Block queued to the worker starting it.
+
+	// Version 6. Capture streams, since they last entered KSSTATE_RUN: the
+	// stream time until the first frame that was not silence,
+	// AUDIOMIRROR_NO_FIRST_AUDIO until there was one, and the bytes of
+	// render history the ring started with.
+	ULONG       FirstAudioUs;
+	ULONG       PrerollBytes;
+
+	// Version 7. The part of TimerTicks that ran at the idle rate, with
+	// nothing to deliver the stream only wakes up for its packets.
+	ULONGLONG   IdleTimerTicks;
+} AUDIOMIRROR_STREAM_STATISTICS, *PAUDIOMIRROR_STREAM_STATISTICS;
+
+#define AUDIOMIRROR_NO_PROCESSOR                0xFFFFFFFF
+#define AUDIOMIRROR_NO_FIRST_AUDIO              0xFFFFFFFF
+
+//
+// Timer work of one processor. Every cable has a home processor and the
+// ticks of both its streams run there: in place when the timer fired on it,
+// otherwise from the processor's work queue.
+//
+typedef struct _AUDIOMIRROR_PROCESSOR_STATISTICS
+{
+	ULONG       Size;           // sizeof(AUDIOMIRROR_PROCESSOR_STATISTICS)
+	ULONG       Version;        // AUDIOMIRROR_STATISTICS_VERSION
+	ULONG       Processor;      // Processor index.
+	ULONG       Cables;         // Cables homed on this processor.
+	ULONGLONG   LocalTicks;     // Ticks whose timer fired on this processor.
+	ULONGLONG   ForwardedTicks; // Ticks whose timer fired elsewhere, run from the queue.
+	ULONGLONG   CoalescedTicks; // Ticks folded into one still waiting in the queue.
+	ULONGLONG   QueueRuns;      // Work queue DPCs that ran.
+	ULONG       QueueDepthMax;  // Most streams waiting in the queue at once.
+	ULONG       Reserved;
+	ULONGLONG   BusyTimeNs;     // Time spent running ticks.
+	AUDIOMIRROR_TIMING_SUMMARY QueueDelay;  // Forwarded tick to it running.
+} AUDIOMIRROR_PROCESSOR_STATISTICS, *PAUDIOMIRROR_PROCESSOR_STATISTICS;
+
+//
+// Render to capture latency: time from a block entering the cable ring in the
+// render ReadBytes to the same bytes being copied into the capture DMA buffer.
+// Buckets are linear, the last bucket counts everything above its lower bound.
+//
+#define AUDIOMIRROR_LATENCY_HISTOGRAM_BUCKETS   128
+#define AUDIOMIRROR_LATENCY_BUCKET_WIDTH_US     500
+
+typedef struct _AUDIOMIRROR_LATENCY_HISTOGRAM
+{
+	ULONG       Size;           // sizeof(AUDIOMIRROR_LATENCY_HISTOGRAM)
+	ULONG       Version;        // AUDIOMIRROR_STATISTICS_VERSION
+	ULONG       PinId;
+	ULONG       Enabled;
+	ULONG       BucketWidthUs;
+	ULONG       BucketCount;
+	ULONGLONG   SampleCount;
+	ULONGLONG   LostMarkers;    // Blocks overwritten by an overrun before delivery.
+	ULONG       MinUs;
+	ULONG       MaxUs;
+	ULONGLONG   SumUs;
+	ULONG       Buckets[AUDIOMIRROR_LATENCY_HISTOGRAM_BUCKETS];
+} AUDIOMIRROR_LATENCY_HISTOGRAM, *PAUDIOMIRROR_LATENCY_HISTOGRAM;
+
+typedef struct _AUDIOMIRROR_TAP_MAPPING
+{
+	ULONG       Size;           // sizeof(AUDIOMIRROR_TAP_MAPPING)
+	ULONG       Version;        // AUDIOMIRROR_TAP_VERSION
+	ULONGLONG   ViewAddress;    // Start of the view in the calling process.
+	ULONGLONG   ViewSize;
+} AUDIOMIRROR_TAP_MAPPING, *PAUDIOMIRROR_TAP_MAPPING;
+
+//
+// At most AUDIOMIRROR_TAP_MAX_EVENTS events are registered at a time. A
+// registration beyond that drops the oldest one, so readers that exited
+// without removing their event never lock out new ones.
+//
+#define AUDIOMIRROR_TAP_MAX_EVENTS      4
+
+typedef struct _AUDIOMIRROR_TAP_EVENT
+{
+	ULONGLONG   EventHandle;    // Event handle in the calling process.
+	ULONG       Register;       // Non zero registers, zero removes.
+	ULONG       Reserved;
+} AUDIOMIRROR_TAP_EVENT, *PAUDIOMIRROR_TAP_EVENT;
@@ -0,0 +1,115 @@
+#pragma once
+
+/*++
+
+Module Name:
+
+	AudioMirrorTap.h
+
+Abstract:
+
+	Layouts of the sections the driver shares with user mode: the cable
+	tap, a read-only view of the cable that KSPROPERTY_AUDIOMIRROR_TAP maps
+	into the calling process, and the injection ring a process fills for
+	the microphone through KSPROPERTY_AUDIOMIRROR_INJECT.
+
+	The tap view starts with one AUDIOMIRROR_TAP_HEADER page, the ring data
+	follows at HeaderSize. Byte n of the cable lives at
+	Data[n % DataSize]. The driver only ever writes the view, readers keep
+	their own read position and never write back.
+
+	This header is shared with user mode tools and the reader library. It
+	only uses the basic Windows integer types, which a non Windows build
+	defines before including it.
+
+	Reading the tap without a lock:
+
+	1. w = WritePosition. Bytes below w are complete.
+	2. Copy [r, w), starting no earlier than w - DataSize.
+	3. l = WriteLimit. The driver may have overwritten every byte below
+	   l - DataSize while the copy ran, those are lost and must be dropped.
+
+	The driver publishes WriteLimit before it touches the data and
+	WritePosition after, both with a full barrier.
+
+--*/
+
+#define AUDIOMIRROR_TAP_MAGIC           0x50415441  // 'ATAP'
+#define AUDIOMIRROR_TAP_VERSION         1
+#define AUDIOMIRROR_TAP_HEADER_SIZE     4096
+
+typedef struct _AUDIOMIRROR_TAP_HEADER
+{
+	// Constant for the lifetime of the view.
+	ULONG       Magic;          // AUDIOMIRROR_TAP_MAGIC
+	ULONG       Version;        // AUDIOMIRROR_TAP_VERSION
+	ULONG       HeaderSize;     // Offset of the ring data from the start of the view.
+	ULONG       DataSize;       // Ring size in bytes, a multiple of BlockAlign.
+	ULONG       SamplesPerSec;
+	USHORT      Channels;
+	USHORT      BitsPerSample;  // 16 bit PCM, the format the cable runs at.
+	USHORT      BlockAlign;
+	USHORT      Reserved0;
+	ULONG       Reserved1;
+	ULONGLONG   QpcFrequency;
+	ULONGLONG   Reserved2[3];
+
+	// Cursor, on its own cache line. Updated for every block the driver writes.
+	volatile ULONGLONG  WritePosition;  // Bytes completely written.
+	volatile ULONGLONG  WriteLimit;     // Bytes being written, >= WritePosition.
+	volatile ULONGLONG  PacketCount;    // Blocks written, the reader event is set once per block.
+	volatile ULONGLONG  LastWriteQpc;   // QPC at which WritePosition last moved.
+} AUDIOMIRROR_TAP_HEADER, *PAUDIOMIRROR_TAP_HEADER;
+
+/*
+	Injection ring. The view starts with one AUDIOMIRROR_INJECT_HEADER page,
+	the ring data follows at HeaderSize and byte n of the stream lives at
+	Data[n % DataSize], like in the tap.
+
+	The writer fills [WritePosition, ReadPosition + DataSize) and then
+	publishes WritePosition with a release barrier. The capture streams of
+	the microphone add the audio below WritePosition to what they deliver and
+	publish ReadPosition once every running stream has consumed it. The
+	driver sets the registered events whenever ReadPosition moves.
+
+	A capture stream that needs more than the writer has provided plays
+	silence for the rest. Every change from delivering to starving counts
+	one underrun, UnderrunBytes counts the silence. Nothing counts before the
+	writer wrote its first byte.
+
+	The driver reads only WritePosition from the view, a writer cannot make
+	it read outside the ring.
+*/
+
+#define AUDIOMIRROR_INJECT_MAGIC        0x4A4E4941  // 'AINJ'
+#define AUDIOMIRROR_INJECT_VERSION      1
+#define AUDIOMIRROR_INJECT_HEADER_SIZE  4096
+
+typedef struct _AUDIOMIRROR_INJECT_HEADER
+{
+	// Constant for the lifetime of the view, written by the driver.
+	ULONG       Magic;          // AUDIOMIRROR_INJECT_MAGIC
+	ULONG       Version;        // AUDIOMIRROR_INJECT_VERSION
+	ULONG       HeaderSize;     // Offset of the ring data from the start of the view.
+	ULONG       DataSize;       // Ring size in bytes, a multiple of BlockAlign.
+	ULONG       SamplesPerSec;
+	USHORT      Channels;
+	USHORT      BitsPerSample;  // 16 bit PCM.
+	USHORT      BlockAlign;
+	USHORT      Reserved0;
+	ULONG       Reserved1;
+	ULONGLONG   QpcFrequency;
+	ULONGLONG   Reserved2[3];
+
+	// Writer cursor, on its own cache line. Only the writer stores here.
+	volatile ULONGLONG  WritePosition;  // Bytes completely written.
+	ULONGLONG           Reserved3[7];
+
+	// Driver cursor and underrun report, on their own cache line.
+	volatile ULONGLONG  ReadPosition;   // Bytes every running capture stream consumed.
+	volatile ULONGLONG  Underruns;
+	volatile ULONGLONG  UnderrunBytes;
+	volatile ULONGLONG  LastUnderrunQpc;
+	volatile ULONGLONG  PacketCount;    // Times ReadPosition moved.
+	volatile ULONGLONG  Readers;        // Capture streams currently consuming.
+} AUDIOMIRROR_INJECT_HEADER, *PAUDIOMIRROR_INJECT_HEADER;
@@ -0,0 +1,237 @@
+#include "CableInjector.h"
+
+C_ASSERT(AUDIOMIRROR_INJECT_HEADER_SIZE == PAGE_SIZE);
+C_ASSERT(sizeof(AUDIOMIRROR_INJECT_HEADER) <= AUDIOMIRROR_INJECT_HEADER_SIZE);
+C_ASSERT(FIELD_OFFSET(AUDIOMIRROR_INJECT_HEADER, WritePosition) == 64);
+C_ASSERT(FIELD_OFFSET(AUDIOMIRROR_INJECT_HEADER, ReadPosition) == 128);
+
+#pragma code_seg("PAGE")
+CableInjector::CableInjector()
+	: m_pHeader(NULL), m_pData(NULL), m_ulDataSize(0), m_ulChannels(0), m_ulSamplesPerSec(0),
+	m_ullReadPosition(0), m_ullUnderruns(0), m_ullUnderrunBytes(0), m_ullPacketCount(0)
+{
+	PAGED_CODE();
+
+	KeInitializeSpinLock(&m_Lock);
+	RtlZeroMemory(m_Readers, sizeof(m_Readers));
+}
+
+#pragma code_seg("PAGE")
+NTSTATUS CableInjector::Init(PWAVEFORMATEX format)
+{
+	LARGE_INTEGER       qpcFrequency;
+	ULONG               dataBytes;
+	NTSTATUS            ntStatus;
+
+	PAGED_CODE();
+
+	if (format->wBitsPerSample != 16 || format->nChannels == 0 ||
+		format->nBlockAlign != format->nChannels * sizeof(SHORT) || format->nAvgBytesPerSec == 0)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	m_ulChannels = format->nChannels;
+	m_ulSamplesPerSec = format->nSamplesPerSec;
+	dataBytes = ROUND_TO_PAGES(format->nAvgBytesPerSec);
+	m_ulDataSize = dataBytes - (dataBytes % format->nBlockAlign);
+
+	ntStatus = m_Section.Init(AUDIOMIRROR_INJECT_HEADER_SIZE + dataBytes);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	m_pHeader = (PAUDIOMIRROR_INJECT_HEADER)m_Section.GetSystemAddress();
+	m_pData = (const BYTE*)m_pHeader + AUDIOMIRROR_INJECT_HEADER_SIZE;
+
+	KeQueryPerformanceCounter(&qpcFrequency);
+	m_pHeader->Magic = AUDIOMIRROR_INJECT_MAGIC;
+	m_pHeader->Version = AUDIOMIRROR_INJECT_VERSION;
+	m_pHeader->HeaderSize = AUDIOMIRROR_INJECT_HEADER_SIZE;
+	m_pHeader->DataSize = m_ulDataSize;
+	m_pHeader->SamplesPerSec = format->nSamplesPerSec;
+	m_pHeader->Channels = format->nChannels;
+	m_pHeader->BitsPerSample = format->wBitsPerSample;
+	m_pHeader->BlockAlign = format->nBlockAlign;
+	m_pHeader->QpcFrequency = qpcFrequency.QuadPart;
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+BOOL CableInjector::IsFormatSupported(PWAVEFORMATEX format)
+{
+	return format->wBitsPerSample == 16 &&
+		format->nChannels == m_ulChannels &&
+		format->nSamplesPerSec == m_ulSamplesPerSec;
+}
+
+#pragma code_seg()
+ULONGLONG CableInjector::GetWriterPosition()
+{
+	ULONGLONG position = m_pHeader->WritePosition;
+
+	// Pairs with the writer's release, the data below the position is complete.
+	KeMemoryBarrier();
+	return position;
+}
+
+#pragma code_seg()
+NTSTATUS CableInjector::AddReader(PULONG readerId)
+{
+	KIRQL oldIrql;
+	NTSTATUS ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	for (ULONG i = 0; i < CABLE_INJECTOR_MAX_READERS; ++i)
+	{
+		if (!m_Readers[i].InUse)
+		{
+			m_Readers[i].InUse = TRUE;
+			m_Readers[i].Starved = FALSE;
+			m_Readers[i].Position = m_ullReadPosition;
+			*readerId = i;
+			ntStatus = STATUS_SUCCESS;
+			break;
+		}
+	}
+	PublishLocked(FALSE);
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+
+	return ntStatus;
+}
+
+#pragma code_seg()
+VOID CableInjector::RemoveReader(ULONG readerId)
+{
+	KIRQL oldIrql;
+
+	if (readerId >= CABLE_INJECTOR_MAX_READERS)
+	{
+		return;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	m_Readers[readerId].InUse = FALSE;
+	PublishLocked(FALSE);
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+VOID CableInjector::PublishLocked(BOOL readPositionMoved)
+{
+	ULONGLONG readers = 0;
+
+	for (ULONG i = 0; i < CABLE_INJECTOR_MAX_READERS; ++i)
+	{
+		if (m_Readers[i].InUse)
+		{
+			readers++;
+		}
+	}
+
+	m_pHeader->Underruns = m_ullUnderruns;
+	m_pHeader->UnderrunBytes = m_ullUnderrunBytes;
+	m_pHeader->Readers = readers;
+	if (readPositionMoved)
+	{
+		m_pHeader->PacketCount = ++m_ullPacketCount;
+	}
+	InterlockedExchange64((volatile LONG64*)&m_pHeader->ReadPosition, (LONG64)m_ullReadPosition);
+}
+
+#pragma code_seg()
+VOID CableInjector::Add(ULONG readerId, BYTE* pTarget, ULONG count, EndpointGain* gain)
+{
+	LONG gains[ENDPOINT_GAIN_MAX_CHANNELS];
+	ULONGLONG writePosition;
+	ULONGLONG available;
+	ULONGLONG readPosition = MAXULONGLONG;
+	ULONG take;
+	BOOL moved = FALSE;
+
+	if (readerId >= CABLE_INJECTOR_MAX_READERS)
+	{
+		return;
+	}
+
+	for (ULONG c = 0; c < m_ulChannels && c < ENDPOINT_GAIN_MAX_CHANNELS; ++c)
+	{
+		gains[c] = gain ? gain->GetGain(c) : ENDPOINT_GAIN_UNITY;
+	}
+
+	KeAcquireSpinLockAtDpcLevel(&m_Lock);
+
+	INJECT_READER* reader = &m_Readers[readerId];
+	if (!reader->InUse)
+	{
+		KeReleaseSpinLockFromDpcLevel(&m_Lock);
+		return;
+	}
+
+	// The writer position comes from user mode. One that went backwards
+	// provides nothing, one that ran past the ring loses the oldest audio.
+	writePosition = GetWriterPosition();
+	available = (writePosition > reader->Position) ? writePosition - reader->Position : 0;
+	if (available > m_ulDataSize)
+	{
+		reader->Position = writePosition - m_ulDataSize;
+		available = m_ulDataSize;
+	}
+
+	take = (ULONG)min(available, (ULONGLONG)count);
+	take -= take % sizeof(SHORT);
+
+	SHORT* pSamples = (SHORT*)pTarget;
+	ULONG channel = (ULONG)((reader->Position / sizeof(SHORT)) % m_ulChannels);
+	ULONG offset = (ULONG)(reader->Position % m_ulDataSize);
+	for (ULONG i = 0; i < take / sizeof(SHORT); ++i)
+	{
+		LONG gain = (channel < ENDPOINT_GAIN_MAX_CHANNELS) ? gains[channel] : ENDPOINT_GAIN_UNITY;
+		LONG sample = pSamples[i] + ((*(const SHORT*)(m_pData + offset) * gain) >> 16);
+
+		pSamples[i] = (SHORT)((sample > SHRT_MAX) ? SHRT_MAX : (sample < SHRT_MIN) ? SHRT_MIN : sample);
+		offset += sizeof(SHORT);
+		if (offset >= m_ulDataSize) offset = 0;
+		channel = (channel + 1 == m_ulChannels) ? 0 : channel + 1;
+	}
+	reader->Position += take;
+
+	// Only a writer that has started can underrun.
+	if (take < count && writePosition > 0)
+	{
+		if (!reader->Starved)
+		{
+			m_ullUnderruns++;
+			m_pHeader->LastUnderrunQpc = KeQueryPerformanceCounter(NULL).QuadPart;
+		}
+		m_ullUnderrunBytes += count - take;
+		reader->Starved = TRUE;
+	}
+	else if (take > 0)
+	{
+		reader->Starved = FALSE;
+	}
+
+	for (ULONG i = 0; i < CABLE_INJECTOR_MAX_READERS; ++i)
+	{
+		if (m_Readers[i].InUse)
+		{
+			readPosition = min(readPosition, m_Readers[i].Position);
+		}
+	}
+	if (readPosition > m_ullReadPosition)
+	{
+		m_ullReadPosition = readPosition;
+		moved = TRUE;
+	}
+	PublishLocked(moved);
+
+	KeReleaseSpinLockFromDpcLevel(&m_Lock);
+
+	if (moved)
+	{
+		m_Section.SignalEvents();
+	}
+}
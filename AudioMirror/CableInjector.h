@@ -0,0 +1,87 @@
+#pragma once
+#include "Globals.h"
+#include "AudioMirrorProperties.h"
+#include "AudioMirrorTap.h"
+#include "SharedSection.h"
+#include "EndpointGain.h"
+
+#define CABLE_INJECTOR_MAX_READERS  4
+#define CABLE_INJECTOR_NO_READER    MAXULONG
+
+/*
+	Injection ring a user mode process fills for the microphone, so
+	synthesized audio reaches the capture streams without a trip through the
+	virtual speaker and the audio engine.
+
+	Every running capture stream is a reader with its own cursor and adds the
+	injected audio on top of the cable in its WriteBytes. The ring is freed
+	for the writer once all readers moved past it. Readers come and go in the
+	timer DPCs of their streams, so the cursors are protected by a spin lock.
+*/
+class CableInjector
+{
+private:
+	typedef struct _INJECT_READER
+	{
+		BOOLEAN     InUse;
+		BOOLEAN     Starved;
+		ULONGLONG   Position;
+	} INJECT_READER;
+
+	SharedSection               m_Section;
+	KSPIN_LOCK                  m_Lock;
+	PAUDIOMIRROR_INJECT_HEADER  m_pHeader;
+	const BYTE*                 m_pData;
+	ULONG                       m_ulDataSize;
+	ULONG                       m_ulChannels;
+	ULONG                       m_ulSamplesPerSec;
+	ULONGLONG                   m_ullReadPosition;
+	ULONGLONG                   m_ullUnderruns;
+	ULONGLONG                   m_ullUnderrunBytes;
+	ULONGLONG                   m_ullPacketCount;
+	INJECT_READER               m_Readers[CABLE_INJECTOR_MAX_READERS];
+
+	ULONGLONG GetWriterPosition();
+	VOID PublishLocked(_In_ BOOL readPositionMoved);
+public:
+	CableInjector();
+
+	/*
+		Creates the section for about a second of audio in the given format.
+		Only 16 bit PCM is supported.
+	*/
+	NTSTATUS Init(_In_ PWAVEFORMATEX format);
+
+	/*
+		Returns TRUE if a capture stream in the given format can add the
+		injected audio.
+	*/
+	BOOL IsFormatSupported(_In_ PWAVEFORMATEX format);
+
+	/*
+		Maps a writable view into the current process.
+	*/
+	NTSTATUS MapIntoCurrentProcess(_Out_ PAUDIOMIRROR_TAP_MAPPING mapping)
+	{
+		return m_Section.MapIntoCurrentProcess(PAGE_READWRITE, AUDIOMIRROR_INJECT_VERSION, mapping);
+	}
+
+	NTSTATUS RegisterEvent(_In_ HANDLE eventHandle, _In_ BOOL registerEvent)
+	{
+		return m_Section.RegisterEvent(eventHandle, registerEvent);
+	}
+
+	/*
+		A reader starts at the oldest audio the writer may not overwrite yet.
+		Readers that leave KSSTATE_RUN are removed, so they do not hold the
+		writer back.
+	*/
+	NTSTATUS AddReader(_Out_ PULONG readerId);
+	VOID RemoveReader(_In_ ULONG readerId);
+
+	/*
+		Adds the next count bytes of injected audio to pTarget with the gain
+		applied, saturating. Called at DISPATCH_LEVEL.
+	*/
+	VOID Add(_In_ ULONG readerId, _Inout_updates_bytes_(count) BYTE* pTarget, _In_ ULONG count, _In_opt_ EndpointGain* gain);
+};
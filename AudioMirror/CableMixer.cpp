@@ -0,0 +1,464 @@
+#include "CableMixer.h"
+#include "CableStream.h"
+
+#define CABLE_MIXER_POOLTAG     'xiMC'
+
+#pragma code_seg()
+CableMixer::CableMixer()
+	: m_pAccumulator(NULL), m_pStaging(NULL), m_ulFrames(0), m_ulChannels(0), m_ulBlockAlign(0),
+	m_ullEmitted(0), m_pEndpointGain(NULL), m_pTap(NULL)
+{
+	KeInitializeSpinLock(&m_Lock);
+	RtlZeroMemory(m_Inputs, sizeof(m_Inputs));
+	RtlZeroMemory(m_pSinks, sizeof(m_pSinks));
+}
+
+#pragma code_seg()
+CableMixer::~CableMixer()
+{
+	if (m_pAccumulator != NULL)
+	{
+		ExFreePoolWithTag(m_pAccumulator, CABLE_MIXER_POOLTAG);
+		m_pAccumulator = NULL;
+	}
+
+	if (m_pStaging != NULL)
+	{
+		ExFreePoolWithTag(m_pStaging, CABLE_MIXER_POOLTAG);
+		m_pStaging = NULL;
+	}
+
+	if (m_pTap != NULL)
+	{
+		delete m_pTap;
+		m_pTap = NULL;
+	}
+}
+
+#pragma code_seg("PAGE")
+NTSTATUS CableMixer::Init(PWAVEFORMATEX format, EndpointGain* endpointGain)
+{
+	PAGED_CODE();
+
+	if (format->wBitsPerSample != 16 ||
+		format->nChannels == 0 || format->nChannels > CABLE_MIXER_MAX_CHANNELS ||
+		format->nBlockAlign != format->nChannels * sizeof(SHORT))
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	m_pEndpointGain = endpointGain;
+	m_ulChannels = format->nChannels;
+	m_ulBlockAlign = format->nBlockAlign;
+	m_ulFrames = CABLE_MIXER_FRAMES;
+
+	m_pAccumulator = (LONG*)ExAllocatePoolWithTag(NonPagedPoolNx, m_ulFrames * m_ulChannels * sizeof(LONG), CABLE_MIXER_POOLTAG);
+	if (m_pAccumulator == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	RtlZeroMemory(m_pAccumulator, m_ulFrames * m_ulChannels * sizeof(LONG));
+
+	m_pStaging = (SHORT*)ExAllocatePoolWithTag(NonPagedPoolNx, m_ulFrames * m_ulBlockAlign, CABLE_MIXER_POOLTAG);
+	if (m_pStaging == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+NTSTATUS CableMixer::AddInput(PULONG inputId)
+{
+	KIRQL oldIrql;
+	NTSTATUS ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	for (ULONG i = 0; i < CABLE_MIXER_MAX_INPUTS; ++i)
+	{
+		if (!m_Inputs[i].InUse)
+		{
+			m_Inputs[i].InUse = TRUE;
+			m_Inputs[i].Active = FALSE;
+			m_Inputs[i].Position = 0;
+			*inputId = i;
+			ntStatus = STATUS_SUCCESS;
+			break;
+		}
+	}
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+
+	return ntStatus;
+}
+
+#pragma code_seg()
+VOID CableMixer::RemoveInput(ULONG inputId)
+{
+	KIRQL oldIrql;
+
+	if (inputId >= CABLE_MIXER_MAX_INPUTS)
+	{
+		return;
+	}
+
+	StopInput(inputId);
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	m_Inputs[inputId].InUse = FALSE;
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+VOID CableMixer::StopInput(ULONG inputId)
+{
+	KIRQL oldIrql;
+
+	if (inputId >= CABLE_MIXER_MAX_INPUTS)
+	{
+		return;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+
+	MIXER_INPUT* input = &m_Inputs[inputId];
+	if (input->InUse && input->Active)
+	{
+		CABLE_SIMD_CONTEXT simd;
+
+		input->Active = FALSE;
+
+		// The remaining inputs may already be complete past the emit point.
+		// Without any, flush what the stopped input left behind.
+		CableSimdEnter(&simd);
+		EmitLocked(GetCompletePosition(input->Position), simd.Kernels);
+		CableSimdLeave(&simd);
+	}
+
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+NTSTATUS CableMixer::AddSink(CableStream* sink)
+{
+	KIRQL oldIrql;
+	NTSTATUS ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	for (ULONG i = 0; i < CABLE_MIXER_MAX_SINKS; ++i)
+	{
+		if (m_pSinks[i] == NULL)
+		{
+			m_pSinks[i] = sink;
+			ntStatus = STATUS_SUCCESS;
+			break;
+		}
+	}
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+
+	return ntStatus;
+}
+
+#pragma code_seg()
+VOID CableMixer::RemoveSink(CableStream* sink)
+{
+	KIRQL oldIrql;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	for (ULONG i = 0; i < CABLE_MIXER_MAX_SINKS; ++i)
+	{
+		if (m_pSinks[i] == sink)
+		{
+			m_pSinks[i] = NULL;
+		}
+	}
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+BOOLEAN CableMixer::HasConsumer()
+{
+	KIRQL oldIrql;
+	BOOLEAN consumer;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	consumer = (m_pTap != NULL);
+	for (ULONG i = 0; i < CABLE_MIXER_MAX_SINKS && !consumer; ++i)
+	{
+		consumer = (m_pSinks[i] != NULL && m_pSinks[i]->GetCableState() == KSSTATE_RUN);
+	}
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+
+	return consumer;
+}
+
+#pragma code_seg()
+VOID CableMixer::AttachTap(CableTap* tap)
+{
+	KIRQL oldIrql;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	m_pTap = tap;
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+VOID CableMixer::WriteSinksLocked(BYTE* pBytes, ULONG count)
+{
+	for (ULONG i = 0; i < CABLE_MIXER_MAX_SINKS; ++i)
+	{
+		if (m_pSinks[i] != NULL)
+		{
+			m_pSinks[i]->WriteAudioPacket(pBytes, count, FALSE);
+		}
+	}
+
+	if (m_pTap != NULL)
+	{
+		m_pTap->Write(pBytes, count);
+	}
+}
+
+#pragma code_seg()
+ULONG CableMixer::GetActiveInputCount()
+{
+	ULONG count = 0;
+
+	for (ULONG i = 0; i < CABLE_MIXER_MAX_INPUTS; ++i)
+	{
+		if (m_Inputs[i].InUse && m_Inputs[i].Active)
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+#pragma code_seg()
+ULONGLONG CableMixer::GetCompletePosition(ULONGLONG fallback)
+{
+	ULONGLONG complete = MAXULONGLONG;
+
+	for (ULONG i = 0; i < CABLE_MIXER_MAX_INPUTS; ++i)
+	{
+		if (m_Inputs[i].InUse && m_Inputs[i].Active)
+		{
+			complete = min(complete, m_Inputs[i].Position);
+		}
+	}
+
+	return (complete == MAXULONGLONG) ? fallback : complete;
+}
+
+#pragma code_seg()
+VOID CableMixer::EmitLocked(ULONGLONG position, PCCABLE_SIMD_KERNELS kernels)
+{
+	while (m_ullEmitted < position)
+	{
+		ULONG index = (ULONG)(m_ullEmitted % m_ulFrames);
+		ULONG run = (ULONG)min(position - m_ullEmitted, (ULONGLONG)(m_ulFrames - index));
+		LONG* pAccumulator = m_pAccumulator + index * m_ulChannels;
+		ULONG samples = run * m_ulChannels;
+
+		kernels->ClampToShort(m_pStaging, pAccumulator, samples);
+
+		m_pEndpointGain->TrackPeaks(m_pStaging, run, m_ulChannels, kernels);
+
+		WriteSinksLocked((BYTE*)m_pStaging, run * m_ulBlockAlign);
+
+		m_ullEmitted += run;
+	}
+
+	// Inputs that fell behind lose the frames that were emitted without them.
+	for (ULONG i = 0; i < CABLE_MIXER_MAX_INPUTS; ++i)
+	{
+		if (m_Inputs[i].InUse && m_Inputs[i].Active && m_Inputs[i].Position < m_ullEmitted)
+		{
+			m_Inputs[i].Position = m_ullEmitted;
+		}
+	}
+}
+
+#pragma code_seg()
+BOOL CableMixer::ComputeGains(const BOOL* mutes, LONG* gains, LONG* steps)
+{
+	BOOL unity = TRUE;
+
+	for (ULONG c = 0; c < m_ulChannels; ++c)
+	{
+		LONG endpointGain = m_pEndpointGain->GetGain(c);
+
+		if (mutes && mutes[c])
+		{
+			gains[c] = 0;
+			steps[c] = 0;
+		}
+		else if (endpointGain != ENDPOINT_GAIN_UNITY)
+		{
+			// The endpoint gain scales the whole ramp, so the step scales with it.
+			gains[c] = (LONG)(((LONGLONG)gains[c] * endpointGain) >> 16);
+			steps[c] = (LONG)(((LONGLONG)steps[c] * endpointGain) >> 16);
+		}
+
+		unity = unity && (gains[c] == CABLE_MIXER_UNITY_GAIN) && (steps[c] == 0);
+	}
+
+	return unity;
+}
+
+#pragma code_seg()
+VOID CableMixer::AccumulateRamp(LONG* pAccumulator, const SHORT* pSamples, ULONG frames, ULONG channels, LONG* gains, const LONG* steps)
+{
+	// Stereo keeps both gains in registers and leaves the compiler a loop
+	// without a channel index to vectorize.
+	if (channels == 2)
+	{
+		LONG gain0 = gains[0], gain1 = gains[1];
+		const LONG step0 = steps[0], step1 = steps[1];
+
+		for (ULONG f = 0; f < frames; ++f)
+		{
+			pAccumulator[2 * f] += ((LONG)pSamples[2 * f] * (gain0 >> VOLUME_RAMP_SHIFT)) >> 16;
+			pAccumulator[2 * f + 1] += ((LONG)pSamples[2 * f + 1] * (gain1 >> VOLUME_RAMP_SHIFT)) >> 16;
+			gain0 += step0;
+			gain1 += step1;
+		}
+
+		gains[0] = gain0;
+		gains[1] = gain1;
+		return;
+	}
+
+	for (ULONG f = 0; f < frames; ++f)
+	{
+		for (ULONG c = 0; c < channels; ++c)
+		{
+			pAccumulator[c] += ((LONG)pSamples[c] * (gains[c] >> VOLUME_RAMP_SHIFT)) >> 16;
+			gains[c] += steps[c];
+		}
+		pAccumulator += channels;
+		pSamples += channels;
+	}
+}
+
+#pragma code_seg()
+VOID CableMixer::AccumulateLocked(MIXER_INPUT* input, const SHORT* pSamples, ULONG frames, LONG* gains, const LONG* steps, PCCABLE_SIMD_KERNELS kernels)
+{
+	LONG scaled[CABLE_MIXER_MAX_CHANNELS];
+	BOOL constant = TRUE;
+
+	// Without a fade the gains stay put for the whole block and the vector
+	// kernel takes them as Q16, the scalar loop is left for the ramps.
+	for (ULONG c = 0; c < m_ulChannels; ++c)
+	{
+		scaled[c] = gains[c] >> VOLUME_RAMP_SHIFT;
+		constant = constant && (steps[c] == 0);
+	}
+
+	while (frames > 0)
+	{
+		ULONG run = min(frames, m_ulFrames);
+
+		// Never run more than the window ahead of the slowest input, the
+		// frames that would be overwritten are emitted without it.
+		if (input->Position + run - m_ullEmitted > m_ulFrames)
+		{
+			EmitLocked(input->Position + run - m_ulFrames, kernels);
+		}
+
+		ULONG index = (ULONG)(input->Position % m_ulFrames);
+		ULONG contiguous = min(run, m_ulFrames - index);
+
+		if (constant)
+		{
+			kernels->AccumulateScaled(m_pAccumulator + index * m_ulChannels, pSamples, contiguous, m_ulChannels, scaled);
+			if (contiguous < run)
+			{
+				kernels->AccumulateScaled(m_pAccumulator, pSamples + contiguous * m_ulChannels, run - contiguous, m_ulChannels, scaled);
+			}
+		}
+		else
+		{
+			AccumulateRamp(m_pAccumulator + index * m_ulChannels, pSamples, contiguous, m_ulChannels, gains, steps);
+			if (contiguous < run)
+			{
+				AccumulateRamp(m_pAccumulator, pSamples + contiguous * m_ulChannels, run - contiguous, m_ulChannels, gains, steps);
+			}
+		}
+
+		pSamples += run * m_ulChannels;
+		input->Position += run;
+		frames -= run;
+	}
+}
+
+#pragma code_seg()
+VOID CableMixer::Mix(ULONG inputId, BYTE* pBytes, ULONG count, VolumeRamp* volume, const BOOL* mutes, PCCABLE_SIMD_KERNELS kernels)
+{
+	KIRQL oldIrql;
+	LONG gains[CABLE_MIXER_MAX_CHANNELS];
+	LONG steps[CABLE_MIXER_MAX_CHANNELS];
+	ULONG frames = (m_ulBlockAlign > 0) ? count / m_ulBlockAlign : 0;
+	const SHORT* pSamples = (const SHORT*)pBytes;
+
+	if (inputId >= CABLE_MIXER_MAX_INPUTS || frames == 0)
+	{
+		return;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+
+	MIXER_INPUT* input = &m_Inputs[inputId];
+	if (!input->InUse)
+	{
+		KeReleaseSpinLock(&m_Lock, oldIrql);
+		return;
+	}
+
+	// A (re)started input joins at the current emit point.
+	if (!input->Active)
+	{
+		input->Active = TRUE;
+		input->Position = m_ullEmitted;
+	}
+
+	// A fade splits the block into segments with a constant step per channel.
+	while (frames > 0)
+	{
+		ULONG segment = frames;
+
+		if (volume)
+		{
+			segment = volume->Next(frames, gains, steps);
+		}
+		else
+		{
+			for (ULONG c = 0; c < CABLE_MIXER_MAX_CHANNELS; ++c)
+			{
+				gains[c] = CABLE_MIXER_UNITY_GAIN;
+				steps[c] = 0;
+			}
+		}
+
+		if (ComputeGains(mutes, gains, steps) && input->Position == m_ullEmitted && GetActiveInputCount() == 1)
+		{
+			m_pEndpointGain->TrackPeaks(pSamples, segment, m_ulChannels, kernels);
+
+			WriteSinksLocked((BYTE*)pSamples, segment * m_ulBlockAlign);
+			input->Position += segment;
+			m_ullEmitted = input->Position;
+		}
+		else
+		{
+			AccumulateLocked(input, pSamples, segment, gains, steps, kernels);
+		}
+
+		pSamples += segment * m_ulChannels;
+		frames -= segment;
+	}
+
+	EmitLocked(GetCompletePosition(m_ullEmitted), kernels);
+
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
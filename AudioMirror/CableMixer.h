@@ -0,0 +1,135 @@
+#pragma once
+#include "Globals.h"
+#include "EndpointGain.h"
+#include "VolumeRamp.h"
+#include "CableTap.h"
+#include "CableSimd.h"
+
+#define CABLE_MIXER_MAX_INPUTS      8
+#define CABLE_MIXER_MAX_SINKS       4
+#define CABLE_MIXER_MAX_CHANNELS    ENDPOINT_GAIN_MAX_CHANNELS
+#define CABLE_MIXER_FRAMES          8192
+
+#define CABLE_MIXER_UNITY_GAIN      VOLUME_RAMP_UNITY
+
+class CableStream;
+
+/*
+	Sums the host and offload render streams of the speaker into the cable.
+
+	Every input owns a cursor on a shared frame timeline. An input adds its
+	block into a 32 bit accumulator at its cursor, and the frames every active
+	input has moved past are saturated to 16 bit and handed to every capture
+	stream. Inputs run in their own timer DPCs, so the accumulator is protected
+	by a spin lock.
+
+	A single active input with unity gain bypasses the accumulator and is
+	copied to the cable unchanged. Gains are Q30 and may ramp per frame, a
+	stream volume fade is applied in the same pass that sums it. Blocks
+	without a fade, and the saturation and peak metering of every block,
+	run on the vector kernels of CableSimd.
+*/
+class CableMixer
+{
+private:
+	typedef struct _MIXER_INPUT
+	{
+		BOOLEAN     InUse;
+		BOOLEAN     Active;     // Contributing, only active inputs hold back the output.
+		ULONGLONG   Position;   // Frame the next block of this input is added at.
+	} MIXER_INPUT;
+
+	KSPIN_LOCK              m_Lock;
+	LONG*                   m_pAccumulator;
+	SHORT*                  m_pStaging;
+	ULONG                   m_ulFrames;
+	ULONG                   m_ulChannels;
+	ULONG                   m_ulBlockAlign;
+	ULONGLONG               m_ullEmitted;
+	MIXER_INPUT             m_Inputs[CABLE_MIXER_MAX_INPUTS];
+	EndpointGain*           m_pEndpointGain;
+	CableStream*            m_pSinks[CABLE_MIXER_MAX_SINKS];
+	CableTap*               m_pTap;
+
+	ULONG GetActiveInputCount();
+	ULONGLONG GetCompletePosition(_In_ ULONGLONG fallback);
+	VOID EmitLocked(_In_ ULONGLONG position, _In_ PCCABLE_SIMD_KERNELS kernels);
+	VOID WriteSinksLocked(_In_reads_bytes_(count) BYTE* pBytes, _In_ ULONG count);
+	VOID AccumulateLocked(_Inout_ MIXER_INPUT* input, _In_ const SHORT* pSamples, _In_ ULONG frames, _Inout_ LONG* gains, _In_ const LONG* steps, _In_ PCCABLE_SIMD_KERNELS kernels);
+	BOOL ComputeGains(_In_opt_ const BOOL* mutes, _Inout_updates_(CABLE_MIXER_MAX_CHANNELS) LONG* gains, _Inout_updates_(CABLE_MIXER_MAX_CHANNELS) LONG* steps);
+
+	static VOID AccumulateRamp
+	(
+		_Inout_updates_(frames * channels) LONG* pAccumulator,
+		_In_reads_(frames * channels) const SHORT* pSamples,
+		_In_ ULONG frames,
+		_In_ ULONG channels,
+		_Inout_updates_(channels) LONG* gains,
+		_In_reads_(channels) const LONG* steps
+	);
+public:
+	CableMixer();
+	~CableMixer();
+
+	/*
+		Sets up the accumulator for the given format. Only 16 bit PCM is supported.
+		The endpoint gain is applied on top of the stream gains and its peak
+		meter follows the mix.
+	*/
+	NTSTATUS Init(_In_ PWAVEFORMATEX format, _In_ EndpointGain* endpointGain);
+
+	NTSTATUS AddInput(_Out_ PULONG inputId);
+	VOID RemoveInput(_In_ ULONG inputId);
+
+	/*
+		Takes an input out of the mix until it delivers data again, used when
+		its stream leaves KSSTATE_RUN.
+	*/
+	VOID StopInput(_In_ ULONG inputId);
+
+	/*
+		Adds a block of an input to the mix. volume and mutes are the engine
+		node settings of the stream, NULL means unity. The volume ramp is moved
+		past the frames of the block. kernels are the ones of the caller's
+		CableSimdEnter bracket.
+	*/
+	VOID Mix
+	(
+		_In_ ULONG inputId,
+		_In_reads_bytes_(count) BYTE* pBytes,
+		_In_ ULONG count,
+		_In_opt_ VolumeRamp* volume,
+		_In_opt_ const BOOL* mutes,
+		_In_ PCCABLE_SIMD_KERNELS kernels
+	);
+
+	/*
+		Adds or removes a capture stream the mix is written to. Every capture
+		stream of the microphone, one per signal processing mode, gets the
+		same mix.
+	*/
+	NTSTATUS AddSink(_In_ CableStream* sink);
+	VOID RemoveSink(_In_ CableStream* sink);
+
+	/*
+		Whether anything takes the mix right now: a running capture stream
+		or a tap. Render streams without one may tick at the idle rate.
+	*/
+	BOOLEAN HasConsumer();
+
+	/*
+		Hands the mixer a tap that receives everything written to the cable
+		from now on. The mixer owns the tap and deletes it with itself.
+	*/
+	VOID AttachTap(_In_ CableTap* tap);
+
+	CableTap* GetTap()
+	{
+		return m_pTap;
+	}
+
+	ULONG GetChannels()
+	{
+		return m_ulChannels;
+	}
+};
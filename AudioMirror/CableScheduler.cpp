@@ -0,0 +1,306 @@
+#include "CableScheduler.h"
+
+#pragma code_seg("PAGE")
+CableScheduler::CableScheduler()
+	: m_pAllocation(NULL), m_pProcessors(NULL), m_ulProcessorCount(0), m_ulNextProcessor(0),
+	m_llQpcFrequency(0)
+{
+	PAGED_CODE();
+
+	KeInitializeSpinLock(&m_Lock);
+}
+
+#pragma code_seg("PAGE")
+CableScheduler::~CableScheduler()
+{
+	PAGED_CODE();
+
+	if (m_pAllocation != NULL)
+	{
+		for (ULONG i = 0; i < m_ulProcessorCount; ++i)
+		{
+			KeRemoveQueueDpc(&m_pProcessors[i].Dpc);
+		}
+		KeFlushQueuedDpcs();
+
+		ExFreePoolWithTag(m_pAllocation, CABLE_SCHEDULER_POOLTAG);
+		m_pAllocation = NULL;
+		m_pProcessors = NULL;
+	}
+}
+
+#pragma code_seg("PAGE")
+NTSTATUS CableScheduler::Init()
+{
+	LARGE_INTEGER qpcFrequency;
+	SIZE_T size;
+
+	PAGED_CODE();
+
+	KeQueryPerformanceCounter(&qpcFrequency);
+	m_llQpcFrequency = qpcFrequency.QuadPart;
+
+	m_ulProcessorCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+	if (m_ulProcessorCount == 0)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	// Every processor's queue and counters get cache lines of their own, pool
+	// allocations are only aligned to 16 bytes.
+	size = m_ulProcessorCount * sizeof(CABLE_SCHEDULER_PROCESSOR) + SYSTEM_CACHE_ALIGNMENT_SIZE;
+	m_pAllocation = ExAllocatePoolWithTag(NonPagedPoolNx, size, CABLE_SCHEDULER_POOLTAG);
+	if (m_pAllocation == NULL)
+	{
+		m_ulProcessorCount = 0;
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	RtlZeroMemory(m_pAllocation, size);
+	m_pProcessors = (PCABLE_SCHEDULER_PROCESSOR)(((ULONG_PTR)m_pAllocation + SYSTEM_CACHE_ALIGNMENT_SIZE - 1) & ~(ULONG_PTR)(SYSTEM_CACHE_ALIGNMENT_SIZE - 1));
+
+	for (ULONG i = 0; i < m_ulProcessorCount; ++i)
+	{
+		PCABLE_SCHEDULER_PROCESSOR processor = &m_pProcessors[i];
+		PROCESSOR_NUMBER number;
+		NTSTATUS ntStatus;
+
+		processor->Scheduler = this;
+		processor->Index = i;
+		KeInitializeSpinLock(&processor->QueueLock);
+		InitializeListHead(&processor->Queue);
+		processor->QueueDelay.Reset();
+
+		KeInitializeDpc(&processor->Dpc, QueueDpc, processor);
+		ntStatus = KeGetProcessorNumberFromIndex(i, &number);
+		if (NT_SUCCESS(ntStatus))
+		{
+			ntStatus = KeSetTargetProcessorDpcEx(&processor->Dpc, &number);
+		}
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		// A forwarded tick is as urgent as the timer it came from.
+		KeSetImportanceDpc(&processor->Dpc, MediumHighImportance);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+NTSTATUS CableScheduler::AddCable(PULONG Processor)
+{
+	KIRQL oldIrql;
+	ULONG best = CABLE_SCHEDULER_NO_PROCESSOR;
+
+	*Processor = CABLE_SCHEDULER_NO_PROCESSOR;
+	if (m_ulProcessorCount == 0)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	for (ULONG n = 0; n < m_ulProcessorCount; ++n)
+	{
+		ULONG i = (m_ulNextProcessor + n) % m_ulProcessorCount;
+		if (best == CABLE_SCHEDULER_NO_PROCESSOR || m_pProcessors[i].Cables < m_pProcessors[best].Cables)
+		{
+			best = i;
+		}
+	}
+	m_pProcessors[best].Cables++;
+	m_ulNextProcessor = (best + 1) % m_ulProcessorCount;
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+
+	*Processor = best;
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+VOID CableScheduler::RemoveCable(ULONG Processor)
+{
+	KIRQL oldIrql;
+
+	if (Processor >= m_ulProcessorCount)
+	{
+		return;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	if (m_pProcessors[Processor].Cables > 0)
+	{
+		m_pProcessors[Processor].Cables--;
+	}
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+VOID CableScheduler::InitEntry
+(
+	PCABLE_SCHEDULER_ENTRY Entry,
+	ULONG Processor,
+	PCABLE_SCHEDULER_ROUTINE Routine,
+	PVOID Context
+)
+{
+	InitializeListHead(&Entry->ListEntry);
+	Entry->Routine = Routine;
+	Entry->Context = Context;
+	Entry->Processor = (Processor < m_ulProcessorCount) ? Processor : CABLE_SCHEDULER_NO_PROCESSOR;
+	Entry->Queued = FALSE;
+	Entry->QueuedQpc = 0;
+}
+
+#pragma code_seg()
+VOID CableScheduler::RunEntry(PCABLE_SCHEDULER_PROCESSOR Processor, PCABLE_SCHEDULER_ENTRY Entry)
+{
+	LARGE_INTEGER qpcStart = KeQueryPerformanceCounter(NULL);
+
+	Entry->Routine(Entry->Context);
+
+	LARGE_INTEGER qpcEnd = KeQueryPerformanceCounter(NULL);
+	Processor->BusyTimeNs += (ULONGLONG)(qpcEnd.QuadPart - qpcStart.QuadPart) * 1000000000 / m_llQpcFrequency;
+}
+
+#pragma code_seg()
+VOID CableScheduler::Dispatch(PCABLE_SCHEDULER_ENTRY Entry)
+{
+	PCABLE_SCHEDULER_PROCESSOR home;
+
+	if (Entry->Processor >= m_ulProcessorCount)
+	{
+		Entry->Routine(Entry->Context);
+		return;
+	}
+	home = &m_pProcessors[Entry->Processor];
+
+	if (KeGetCurrentProcessorIndex() == Entry->Processor)
+	{
+		home->LocalTicks++;
+		RunEntry(home, Entry);
+		return;
+	}
+
+	KeAcquireSpinLockAtDpcLevel(&home->QueueLock);
+	if (Entry->Queued)
+	{
+		home->CoalescedTicks++;
+	}
+	else
+	{
+		Entry->Queued = TRUE;
+		Entry->QueuedQpc = KeQueryPerformanceCounter(NULL).QuadPart;
+		InsertTailList(&home->Queue, &Entry->ListEntry);
+		home->QueueDepth++;
+		if (home->QueueDepth > home->QueueDepthMax)
+		{
+			home->QueueDepthMax = home->QueueDepth;
+		}
+	}
+	KeReleaseSpinLockFromDpcLevel(&home->QueueLock);
+
+	// Already queued is fine, it has not started on the queue yet.
+	KeInsertQueueDpc(&home->Dpc, NULL, NULL);
+}
+
+#pragma code_seg()
+VOID CableScheduler::Cancel(PCABLE_SCHEDULER_ENTRY Entry)
+{
+	PCABLE_SCHEDULER_PROCESSOR home;
+	KIRQL oldIrql;
+
+	if (Entry->Processor >= m_ulProcessorCount)
+	{
+		return;
+	}
+	home = &m_pProcessors[Entry->Processor];
+
+	KeAcquireSpinLock(&home->QueueLock, &oldIrql);
+	if (Entry->Queued)
+	{
+		RemoveEntryList(&Entry->ListEntry);
+		InitializeListHead(&Entry->ListEntry);
+		Entry->Queued = FALSE;
+		home->QueueDepth--;
+	}
+	KeReleaseSpinLock(&home->QueueLock, oldIrql);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableScheduler::QueueDpc
+(
+	PKDPC Dpc,
+	PVOID DeferredContext,
+	PVOID SystemArgument1,
+	PVOID SystemArgument2
+)
+/*++
+
+Routine Description:
+
+  Runs the ticks that were forwarded to this processor, in the order they
+  arrived. The queue lock is dropped while a tick runs, the timer DPCs of
+  other processors keep queueing meanwhile and those ticks run in this pass.
+
+--*/
+{
+	PCABLE_SCHEDULER_PROCESSOR processor = (PCABLE_SCHEDULER_PROCESSOR)DeferredContext;
+	CableScheduler* scheduler = processor->Scheduler;
+
+	UNREFERENCED_PARAMETER(Dpc);
+	UNREFERENCED_PARAMETER(SystemArgument1);
+	UNREFERENCED_PARAMETER(SystemArgument2);
+
+	_IRQL_limited_to_(DISPATCH_LEVEL);
+
+	KeAcquireSpinLockAtDpcLevel(&processor->QueueLock);
+	while (!IsListEmpty(&processor->Queue))
+	{
+		PCABLE_SCHEDULER_ENTRY entry = CONTAINING_RECORD(RemoveHeadList(&processor->Queue), CABLE_SCHEDULER_ENTRY, ListEntry);
+		ULONGLONG queuedQpc = entry->QueuedQpc;
+
+		InitializeListHead(&entry->ListEntry);
+		entry->Queued = FALSE;
+		processor->QueueDepth--;
+		KeReleaseSpinLockFromDpcLevel(&processor->QueueLock);
+
+		LARGE_INTEGER qpc = KeQueryPerformanceCounter(NULL);
+		processor->QueueDelay.Record((ULONG)(((ULONGLONG)qpc.QuadPart - queuedQpc) * 1000000 / scheduler->m_llQpcFrequency));
+		processor->ForwardedTicks++;
+		scheduler->RunEntry(processor, entry);
+
+		KeAcquireSpinLockAtDpcLevel(&processor->QueueLock);
+	}
+	KeReleaseSpinLockFromDpcLevel(&processor->QueueLock);
+
+	processor->QueueRuns++;
+}
+
+#pragma code_seg()
+VOID CableScheduler::GetProcessorStatistics
+(
+	ULONG Processor,
+	PAUDIOMIRROR_PROCESSOR_STATISTICS Statistics
+)
+{
+	RtlZeroMemory(Statistics, sizeof(*Statistics));
+	Statistics->Size = sizeof(*Statistics);
+	Statistics->Version = AUDIOMIRROR_STATISTICS_VERSION;
+	Statistics->Processor = Processor;
+
+	if (Processor >= m_ulProcessorCount)
+	{
+		return;
+	}
+
+	PCABLE_SCHEDULER_PROCESSOR processor = &m_pProcessors[Processor];
+	Statistics->Cables = processor->Cables;
+	Statistics->LocalTicks = processor->LocalTicks;
+	Statistics->ForwardedTicks = processor->ForwardedTicks;
+	Statistics->CoalescedTicks = processor->CoalescedTicks;
+	Statistics->QueueRuns = processor->QueueRuns;
+	Statistics->QueueDepthMax = processor->QueueDepthMax;
+	Statistics->BusyTimeNs = processor->BusyTimeNs;
+	processor->QueueDelay.Summarize(&Statistics->QueueDelay);
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "Globals.h"
+#include "AudioMirrorProperties.h"
+#include "StreamStatistics.h"
+
+#define CABLE_SCHEDULER_POOLTAG         'hcSC'
+#define CABLE_SCHEDULER_NO_PROCESSOR    AUDIOMIRROR_NO_PROCESSOR
+
+typedef VOID CABLE_SCHEDULER_ROUTINE(_In_ PVOID Context);
+typedef CABLE_SCHEDULER_ROUTINE* PCABLE_SCHEDULER_ROUTINE;
+
+//
+// The timer tick of one stream. Lives in the stream, the scheduler links it
+// into the work queue of the home processor when the tick has to move there.
+//
+typedef struct _CABLE_SCHEDULER_ENTRY
+{
+	LIST_ENTRY                  ListEntry;
+	PCABLE_SCHEDULER_ROUTINE    Routine;
+	PVOID                       Context;
+	ULONG                       Processor;  // Home processor, CABLE_SCHEDULER_NO_PROCESSOR for none.
+	BOOLEAN                     Queued;
+	ULONGLONG                   QueuedQpc;
+} CABLE_SCHEDULER_ENTRY, *PCABLE_SCHEDULER_ENTRY;
+
+/*
+	Spreads the cables across the processors.
+
+	Every cable gets a home processor when it is installed, the one with the
+	fewest cables, and the timer ticks of both streams of the pair run there.
+	That keeps the cable ring in the caches of one processor and stops the
+	timer work of many cables from piling up on whichever processors the
+	timers happen to expire on.
+
+	An EX_TIMER cannot be bound to a processor, so a tick that fires
+	elsewhere is queued on the home processor and a DPC targeted at it runs
+	the queue. A tick that arrives while the previous one of the same stream
+	is still queued is folded into it, the position catches up from the
+	performance counter either way.
+*/
+class CableScheduler
+{
+private:
+	typedef struct DECLSPEC_CACHEALIGN _CABLE_SCHEDULER_PROCESSOR
+	{
+		CableScheduler* Scheduler;
+		KDPC            Dpc;
+		KSPIN_LOCK      QueueLock;
+		LIST_ENTRY      Queue;
+		ULONG           QueueDepth;
+		ULONG           QueueDepthMax;
+		ULONG           Cables;
+		ULONG           Index;
+		// Only ever written on this processor or under the queue lock.
+		ULONGLONG       LocalTicks;
+		ULONGLONG       ForwardedTicks;
+		ULONGLONG       CoalescedTicks;
+		ULONGLONG       QueueRuns;
+		ULONGLONG       BusyTimeNs;
+		TimingHistogram QueueDelay;
+	} CABLE_SCHEDULER_PROCESSOR, *PCABLE_SCHEDULER_PROCESSOR;
+
+	KSPIN_LOCK                  m_Lock;
+	PVOID                       m_pAllocation;
+	PCABLE_SCHEDULER_PROCESSOR  m_pProcessors;
+	ULONG                       m_ulProcessorCount;
+	ULONG                       m_ulNextProcessor;
+	LONGLONG                    m_llQpcFrequency;
+
+	VOID RunEntry(_Inout_ PCABLE_SCHEDULER_PROCESSOR Processor, _In_ PCABLE_SCHEDULER_ENTRY Entry);
+
+	static KDEFERRED_ROUTINE QueueDpc;
+public:
+	CableScheduler();
+	~CableScheduler();
+
+	/*
+		Sets up a work queue for every active processor.
+	*/
+	NTSTATUS Init();
+
+	ULONG GetProcessorCount()
+	{
+		return m_ulProcessorCount;
+	}
+
+	/*
+		Picks the home processor of a new cable: the one with the fewest
+		cables, ties go round-robin.
+	*/
+	NTSTATUS AddCable(_Out_ PULONG Processor);
+	VOID RemoveCable(_In_ ULONG Processor);
+
+	VOID InitEntry
+	(
+		_Out_ PCABLE_SCHEDULER_ENTRY Entry,
+		_In_ ULONG Processor,
+		_In_ PCABLE_SCHEDULER_ROUTINE Routine,
+		_In_opt_ PVOID Context
+	);
+
+	/*
+		Called from the timer callback at DISPATCH_LEVEL. Runs the tick in
+		place on the home processor, queues it there otherwise.
+	*/
+	VOID Dispatch(_Inout_ PCABLE_SCHEDULER_ENTRY Entry);
+
+	/*
+		Takes a queued tick back out. The caller still has to flush the
+		queued DPCs before the entry goes away, one may be running it.
+	*/
+	VOID Cancel(_Inout_ PCABLE_SCHEDULER_ENTRY Entry);
+
+	VOID GetProcessorStatistics
+	(
+		_In_ ULONG Processor,
+		_Out_ PAUDIOMIRROR_PROCESSOR_STATISTICS Statistics
+	);
+};
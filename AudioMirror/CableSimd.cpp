@@ -0,0 +1,237 @@
+#include "CableSimdKernels.h"
+
+#ifdef CABLE_SIMD_X86
+#ifdef AUDIOMIRROR_HOST
+#include <cpuid.h>
+#else
+#include <intrin.h>
+#endif
+#endif
+
+#pragma code_seg()
+VOID CableSimdClampToShortScalar(SHORT* pTarget, LONG* pAccumulator, ULONG samples)
+{
+	for (ULONG i = 0; i < samples; ++i)
+	{
+		LONG value = pAccumulator[i];
+		pTarget[i] = (SHORT)((value > SHRT_MAX) ? SHRT_MAX : (value < SHRT_MIN) ? SHRT_MIN : value);
+		pAccumulator[i] = 0;
+	}
+}
+
+#pragma code_seg()
+VOID CableSimdAccumulateScaledScalar(LONG* pAccumulator, const SHORT* pSamples, ULONG frames, ULONG channels, const LONG* gains)
+{
+	for (ULONG f = 0; f < frames; ++f)
+	{
+		for (ULONG c = 0; c < channels; ++c)
+		{
+			pAccumulator[c] += ((LONG)pSamples[c] * gains[c]) >> 16;
+		}
+		pAccumulator += channels;
+		pSamples += channels;
+	}
+}
+
+#pragma code_seg()
+VOID CableSimdTrackPeaksScalar(const SHORT* pSamples, ULONG frames, ULONG channels, LONG* peaks)
+{
+	for (ULONG f = 0; f < frames; ++f)
+	{
+		for (ULONG c = 0; c < channels; ++c)
+		{
+			LONG sample = pSamples[c];
+			if (sample < 0) sample = (sample == SHRT_MIN) ? SHRT_MAX : -sample;
+			if (sample > peaks[c]) peaks[c] = sample;
+		}
+		pSamples += channels;
+	}
+}
+
+static const CABLE_SIMD_KERNELS g_CableSimdScalarKernels =
+{
+	CableSimdScalar,
+	"scalar",
+	0,
+	CableSimdClampToShortScalar,
+	CableSimdAccumulateScaledScalar,
+	CableSimdTrackPeaksScalar
+};
+
+// Supported tables, filled in once by CableSimdInitialize.
+static PCCABLE_SIMD_KERNELS g_CableSimdTables[CableSimdIsaCount] = { &g_CableSimdScalarKernels };
+static PCCABLE_SIMD_KERNELS volatile g_pCableSimdSelected = &g_CableSimdScalarKernels;
+
+#ifdef CABLE_SIMD_X86
+static VOID CableSimdCpuid(_In_ ULONG leaf, _Out_writes_(4) ULONG* registers)
+{
+#ifdef AUDIOMIRROR_HOST
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+	if (__get_cpuid_max(0, NULL) >= leaf)
+	{
+		__cpuid_count(leaf, 0, eax, ebx, ecx, edx);
+	}
+	registers[0] = eax;
+	registers[1] = ebx;
+	registers[2] = ecx;
+	registers[3] = edx;
+#else
+	int info[4];
+
+	__cpuid(info, 0);
+	if ((ULONG)info[0] >= leaf)
+	{
+		__cpuidex(info, (int)leaf, 0);
+	}
+	else
+	{
+		info[0] = info[1] = info[2] = info[3] = 0;
+	}
+	RtlCopyMemory(registers, info, sizeof(info));
+#endif
+}
+#endif // CABLE_SIMD_X86
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID CableSimdInitialize()
+/*++
+
+Routine Description:
+
+Fills in the tables the processor can run. AVX2 and AVX-512 also need the
+OS to have enabled their register state, which only XSAVE capable systems
+report through RtlGetEnabledExtendedFeatures.
+
+--*/
+{
+	PAGED_CODE();
+
+#ifdef CABLE_SIMD_X86
+	ULONG basic[4];
+	ULONG extended[4];
+	ULONG64 enabled;
+
+	CableSimdCpuid(1, basic);
+	CableSimdCpuid(7, extended);
+	enabled = RtlGetEnabledExtendedFeatures(XSTATE_MASK_AVX | XSTATE_MASK_AVX512);
+
+	if (basic[3] & (1 << 26))
+	{
+		g_CableSimdTables[CableSimdSse2] = &g_CableSimdSse2Kernels;
+
+		if (basic[2] & (1 << 9))
+		{
+			g_CableSimdTables[CableSimdSsse3] = &g_CableSimdSsse3Kernels;
+		}
+	}
+
+	if ((extended[1] & (1 << 5)) && (enabled & XSTATE_MASK_AVX) == XSTATE_MASK_AVX)
+	{
+		g_CableSimdTables[CableSimdAvx2] = &g_CableSimdAvx2Kernels;
+
+		// The kernels need the byte and word instructions on top of the foundation.
+		if ((extended[1] & (1 << 16)) && (extended[1] & (1 << 30)) &&
+			(enabled & XSTATE_MASK_AVX512) == XSTATE_MASK_AVX512)
+		{
+			g_CableSimdTables[CableSimdAvx512] = &g_CableSimdAvx512Kernels;
+		}
+	}
+#endif // CABLE_SIMD_X86
+
+	for (LONG isa = CableSimdIsaCount - 1; isa >= CableSimdScalar; --isa)
+	{
+		if (g_CableSimdTables[isa] != NULL)
+		{
+			g_pCableSimdSelected = g_CableSimdTables[isa];
+			break;
+		}
+	}
+
+	DPF(D_TERSE, ("[CableSimdInitialize] selected %s kernels", g_pCableSimdSelected->Name));
+}
+
+//=============================================================================
+#pragma code_seg()
+PCCABLE_SIMD_KERNELS CableSimdGetKernels
+(
+	_In_ CABLE_SIMD_ISA isa
+)
+{
+	return (isa >= CableSimdScalar && isa < CableSimdIsaCount) ? g_CableSimdTables[isa] : NULL;
+}
+
+//=============================================================================
+#pragma code_seg()
+NTSTATUS CableSimdSelect
+(
+	_In_ CABLE_SIMD_ISA isa
+)
+{
+	PCCABLE_SIMD_KERNELS kernels = CableSimdGetKernels(isa);
+
+	if (kernels == NULL)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	g_pCableSimdSelected = kernels;
+	return STATUS_SUCCESS;
+}
+
+//=============================================================================
+#pragma code_seg()
+PCCABLE_SIMD_KERNELS CableSimdGetSelected()
+{
+	return g_pCableSimdSelected;
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableSimdEnter
+(
+	_Out_ PCABLE_SIMD_CONTEXT context
+)
+/*++
+
+Routine Description:
+
+Saves the extended state of the selected kernels. The save only fails when
+the system runs out of memory for it, the block is then processed with the
+scalar kernels rather than dropped.
+
+--*/
+{
+	PCCABLE_SIMD_KERNELS kernels = g_pCableSimdSelected;
+
+	context->Kernels = kernels;
+	context->Saved = FALSE;
+
+	if (kernels->StateMask != 0)
+	{
+		if (NT_SUCCESS(KeSaveExtendedProcessorState(kernels->StateMask, &context->State)))
+		{
+			context->Saved = TRUE;
+		}
+		else
+		{
+			context->Kernels = &g_CableSimdScalarKernels;
+		}
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableSimdLeave
+(
+	_Inout_ PCABLE_SIMD_CONTEXT context
+)
+{
+	if (context->Saved)
+	{
+		KeRestoreExtendedProcessorState(&context->State);
+		context->Saved = FALSE;
+	}
+	context->Kernels = NULL;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "Globals.h"
+
+#if defined(_M_AMD64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CABLE_SIMD_X86              1
+#endif
+
+#define CABLE_SIMD_MAX_CHANNELS     8
+
+/*
+	Instruction sets the kernels come in, in the order they are preferred.
+*/
+typedef enum _CABLE_SIMD_ISA
+{
+	CableSimdScalar,
+	CableSimdSse2,
+	CableSimdSsse3,
+	CableSimdAvx2,
+	CableSimdAvx512,
+	CableSimdIsaCount
+} CABLE_SIMD_ISA;
+
+/*
+	Saturates 32 bit accumulator samples to 16 bit and clears the accumulator.
+*/
+typedef VOID CABLE_SIMD_CLAMP_TO_SHORT
+(
+	_Out_writes_(samples) SHORT* pTarget,
+	_Inout_updates_(samples) LONG* pAccumulator,
+	_In_ ULONG samples
+);
+typedef CABLE_SIMD_CLAMP_TO_SHORT* PCABLE_SIMD_CLAMP_TO_SHORT;
+
+/*
+	Adds interleaved samples scaled by a constant Q16 gain per channel into
+	the accumulator, (sample * gain) >> 16 like the scalar mixer. Gains are
+	0 to 0x10000, channels at most CABLE_SIMD_MAX_CHANNELS.
+*/
+typedef VOID CABLE_SIMD_ACCUMULATE_SCALED
+(
+	_Inout_updates_(frames * channels) LONG* pAccumulator,
+	_In_reads_(frames * channels) const SHORT* pSamples,
+	_In_ ULONG frames,
+	_In_ ULONG channels,
+	_In_reads_(channels) const LONG* gains
+);
+typedef CABLE_SIMD_ACCUMULATE_SCALED* PCABLE_SIMD_ACCUMULATE_SCALED;
+
+/*
+	Raises the peak of every channel to the largest sample magnitude of the
+	block. Magnitudes saturate at SHRT_MAX, -32768 counts as 32767.
+*/
+typedef VOID CABLE_SIMD_TRACK_PEAKS
+(
+	_In_reads_(frames * channels) const SHORT* pSamples,
+	_In_ ULONG frames,
+	_In_ ULONG channels,
+	_Inout_updates_(channels) LONG* peaks
+);
+typedef CABLE_SIMD_TRACK_PEAKS* PCABLE_SIMD_TRACK_PEAKS;
+
+typedef struct _CABLE_SIMD_KERNELS
+{
+	CABLE_SIMD_ISA                  Isa;
+	const CHAR*                     Name;
+	ULONG64                         StateMask;  // Extended state saved around the kernels, 0 for none.
+	PCABLE_SIMD_CLAMP_TO_SHORT      ClampToShort;
+	PCABLE_SIMD_ACCUMULATE_SCALED   AccumulateScaled;
+	PCABLE_SIMD_TRACK_PEAKS         TrackPeaks;
+} CABLE_SIMD_KERNELS;
+typedef const CABLE_SIMD_KERNELS* PCCABLE_SIMD_KERNELS;
+
+/*
+	A block of vector work. CableSimdEnter saves the extended processor
+	state the selected kernels use and CableSimdLeave restores it, so a
+	DPC brackets everything it processes in a tick once instead of every
+	kernel call. Kernels holds the table to call in between, the scalar
+	one if the state could not be saved.
+*/
+typedef struct _CABLE_SIMD_CONTEXT
+{
+	PCCABLE_SIMD_KERNELS    Kernels;
+	BOOLEAN                 Saved;
+	XSTATE_SAVE             State;
+} CABLE_SIMD_CONTEXT, *PCABLE_SIMD_CONTEXT;
+
+/*
+	Detects the instruction sets the processor and the OS support and
+	selects the widest. Called once from DriverEntry, until then every
+	bracket gets the scalar kernels.
+*/
+VOID CableSimdInitialize();
+
+/*
+	Returns the kernels of an instruction set, NULL if it is not supported.
+	Lets tests and benchmarks compare every table against the scalar one.
+*/
+PCCABLE_SIMD_KERNELS CableSimdGetKernels(_In_ CABLE_SIMD_ISA isa);
+
+/*
+	Selects the kernels brackets get from now on. Fails for an instruction
+	set that is not supported.
+*/
+NTSTATUS CableSimdSelect(_In_ CABLE_SIMD_ISA isa);
+
+PCCABLE_SIMD_KERNELS CableSimdGetSelected();
+
+VOID CableSimdEnter(_Out_ PCABLE_SIMD_CONTEXT context);
+
+VOID CableSimdLeave(_Inout_ PCABLE_SIMD_CONTEXT context);
@@ -0,0 +1,64 @@
+#include "CableSimdKernels.h"
+
+#ifdef CABLE_SIMD_X86
+#include <immintrin.h>
+
+namespace
+{
+	struct VECTOR_AVX2
+	{
+		typedef __m256i Type;
+		static const ULONG Lanes = 16;
+
+		static Type Load(const VOID* p) { return _mm256_loadu_si256((const __m256i*)p); }
+		static VOID Store(VOID* p, Type v) { _mm256_storeu_si256((__m256i*)p, v); }
+		static Type Zero() { return _mm256_setzero_si256(); }
+		static Type Add16(Type a, Type b) { return _mm256_add_epi16(a, b); }
+		static Type Add32(Type a, Type b) { return _mm256_add_epi32(a, b); }
+		static Type And(Type a, Type b) { return _mm256_and_si256(a, b); }
+		static Type MulHigh16(Type a, Type b) { return _mm256_mulhi_epi16(a, b); }
+		static Type Max16(Type a, Type b) { return _mm256_max_epi16(a, b); }
+		static Type Magnitude16(Type v) { return _mm256_abs_epi16(_mm256_max_epi16(v, _mm256_set1_epi16(-SHRT_MAX))); }
+
+		// VPACKSSDW packs within each 128 bit half, the permute puts the
+		// quarters back in order.
+		static Type Pack32(Type low, Type high)
+		{
+			return _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+		}
+
+		static Type Widen16(Type v, ULONG half)
+		{
+			return _mm256_cvtepi16_epi32(half ? _mm256_extracti128_si256(v, 1) : _mm256_castsi256_si128(v));
+		}
+	};
+}
+
+#pragma code_seg()
+static VOID CableSimdClampToShortAvx2(SHORT* pTarget, LONG* pAccumulator, ULONG samples)
+{
+	CableSimdClampToShortT<VECTOR_AVX2>(pTarget, pAccumulator, samples);
+}
+
+#pragma code_seg()
+static VOID CableSimdAccumulateScaledAvx2(LONG* pAccumulator, const SHORT* pSamples, ULONG frames, ULONG channels, const LONG* gains)
+{
+	CableSimdAccumulateScaledT<VECTOR_AVX2>(pAccumulator, pSamples, frames, channels, gains);
+}
+
+#pragma code_seg()
+static VOID CableSimdTrackPeaksAvx2(const SHORT* pSamples, ULONG frames, ULONG channels, LONG* peaks)
+{
+	CableSimdTrackPeaksT<VECTOR_AVX2>(pSamples, frames, channels, peaks);
+}
+
+const CABLE_SIMD_KERNELS g_CableSimdAvx2Kernels =
+{
+	CableSimdAvx2,
+	"avx2",
+	CABLE_SIMD_SSE_STATE_MASK | XSTATE_MASK_AVX,
+	CableSimdClampToShortAvx2,
+	CableSimdAccumulateScaledAvx2,
+	CableSimdTrackPeaksAvx2
+};
+#endif // CABLE_SIMD_X86
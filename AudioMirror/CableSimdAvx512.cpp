@@ -0,0 +1,64 @@
+#include "CableSimdKernels.h"
+
+#ifdef CABLE_SIMD_X86
+#include <immintrin.h>
+
+namespace
+{
+	// AVX-512F and BW, the 16 bit lane instructions are BW.
+	struct VECTOR_AVX512
+	{
+		typedef __m512i Type;
+		static const ULONG Lanes = 32;
+
+		static Type Load(const VOID* p) { return _mm512_loadu_si512(p); }
+		static VOID Store(VOID* p, Type v) { _mm512_storeu_si512(p, v); }
+		static Type Zero() { return _mm512_setzero_si512(); }
+		static Type Add16(Type a, Type b) { return _mm512_add_epi16(a, b); }
+		static Type Add32(Type a, Type b) { return _mm512_add_epi32(a, b); }
+		static Type And(Type a, Type b) { return _mm512_and_si512(a, b); }
+		static Type MulHigh16(Type a, Type b) { return _mm512_mulhi_epi16(a, b); }
+		static Type Max16(Type a, Type b) { return _mm512_max_epi16(a, b); }
+		static Type Magnitude16(Type v) { return _mm512_abs_epi16(_mm512_max_epi16(v, _mm512_set1_epi16(-SHRT_MAX))); }
+
+		// VPMOVSDW narrows in order, unlike the in lane VPACKSSDW.
+		static Type Pack32(Type low, Type high)
+		{
+			return _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvtsepi32_epi16(low)), _mm512_cvtsepi32_epi16(high), 1);
+		}
+
+		static Type Widen16(Type v, ULONG half)
+		{
+			return _mm512_cvtepi16_epi32(half ? _mm512_extracti64x4_epi64(v, 1) : _mm512_castsi512_si256(v));
+		}
+	};
+}
+
+#pragma code_seg()
+static VOID CableSimdClampToShortAvx512(SHORT* pTarget, LONG* pAccumulator, ULONG samples)
+{
+	CableSimdClampToShortT<VECTOR_AVX512>(pTarget, pAccumulator, samples);
+}
+
+#pragma code_seg()
+static VOID CableSimdAccumulateScaledAvx512(LONG* pAccumulator, const SHORT* pSamples, ULONG frames, ULONG channels, const LONG* gains)
+{
+	CableSimdAccumulateScaledT<VECTOR_AVX512>(pAccumulator, pSamples, frames, channels, gains);
+}
+
+#pragma code_seg()
+static VOID CableSimdTrackPeaksAvx512(const SHORT* pSamples, ULONG frames, ULONG channels, LONG* peaks)
+{
+	CableSimdTrackPeaksT<VECTOR_AVX512>(pSamples, frames, channels, peaks);
+}
+
+const CABLE_SIMD_KERNELS g_CableSimdAvx512Kernels =
+{
+	CableSimdAvx512,
+	"avx512",
+	CABLE_SIMD_SSE_STATE_MASK | XSTATE_MASK_AVX | XSTATE_MASK_AVX512,
+	CableSimdClampToShortAvx512,
+	CableSimdAccumulateScaledAvx512,
+	CableSimdTrackPeaksAvx512
+};
+#endif // CABLE_SIMD_X86
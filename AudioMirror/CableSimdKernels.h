@@ -0,0 +1,163 @@
+#pragma once
+#include "CableSimd.h"
+
+/*
+	Kernel bodies of the vector tables. Every instruction set has a source
+	file of its own, compiled for that instruction set alone, which
+	instantiates these with a VECTOR type local to it:
+
+		Type                vector register type.
+		Lanes               16 bit lanes of a vector.
+		Load, Store         unaligned.
+		Zero                all lanes 0.
+		Add16, Add32        wrapping lane adds.
+		And                 bitwise and.
+		MulHigh16           high half of the signed 16 bit products.
+		Max16               signed 16 bit maximum.
+		Magnitude16         absolute value saturated to SHRT_MAX.
+		Pack32(low, high)   saturates two vectors of 32 bit lanes to one
+		                    vector of 16 bit lanes, in order.
+		Widen16(v, half)    sign extends the lower or upper half of the 16
+		                    bit lanes to 32 bit lanes, in order.
+
+	The scalar kernels handle the remainder that does not fill a vector.
+	They live in CableSimd.cpp, compiled for the baseline, since an inline
+	copy here could be emitted for one of the wider instruction sets.
+*/
+
+CABLE_SIMD_CLAMP_TO_SHORT CableSimdClampToShortScalar;
+CABLE_SIMD_ACCUMULATE_SCALED CableSimdAccumulateScaledScalar;
+CABLE_SIMD_TRACK_PEAKS CableSimdTrackPeaksScalar;
+
+#ifdef CABLE_SIMD_X86
+extern const CABLE_SIMD_KERNELS g_CableSimdSse2Kernels;
+extern const CABLE_SIMD_KERNELS g_CableSimdSsse3Kernels;
+extern const CABLE_SIMD_KERNELS g_CableSimdAvx2Kernels;
+extern const CABLE_SIMD_KERNELS g_CableSimdAvx512Kernels;
+
+// The SSSE3 table only replaces the peak kernel of the SSE2 one.
+CABLE_SIMD_CLAMP_TO_SHORT CableSimdClampToShortSse2;
+CABLE_SIMD_ACCUMULATE_SCALED CableSimdAccumulateScaledSse2;
+
+// The SSE registers are volatile in x64 kernel code, x86 has to save them.
+#if defined(_M_AMD64) || defined(__x86_64__)
+#define CABLE_SIMD_SSE_STATE_MASK   0
+#else
+#define CABLE_SIMD_SSE_STATE_MASK   XSTATE_MASK_LEGACY
+#endif
+#endif // CABLE_SIMD_X86
+
+/*
+	Channels repeat every channels samples and a vector holds Lanes of them,
+	so the lane to channel mapping repeats every period vectors. Lanes is a
+	power of two, the period is channels without its factors of two up to
+	Lanes.
+*/
+static inline ULONG CableSimdPeriod(_In_ ULONG lanes, _In_ ULONG channels)
+{
+	ULONG period = channels;
+
+	while (lanes > 1 && (period & 1) == 0)
+	{
+		period >>= 1;
+		lanes >>= 1;
+	}
+
+	return period;
+}
+
+template <class VECTOR>
+VOID CableSimdClampToShortT(SHORT* pTarget, LONG* pAccumulator, ULONG samples)
+{
+	const typename VECTOR::Type zero = VECTOR::Zero();
+	ULONG i = 0;
+
+	for (; i + VECTOR::Lanes <= samples; i += VECTOR::Lanes)
+	{
+		typename VECTOR::Type low = VECTOR::Load(pAccumulator + i);
+		typename VECTOR::Type high = VECTOR::Load(pAccumulator + i + VECTOR::Lanes / 2);
+
+		VECTOR::Store(pTarget + i, VECTOR::Pack32(low, high));
+		VECTOR::Store(pAccumulator + i, zero);
+		VECTOR::Store(pAccumulator + i + VECTOR::Lanes / 2, zero);
+	}
+
+	CableSimdClampToShortScalar(pTarget + i, pAccumulator + i, samples - i);
+}
+
+template <class VECTOR>
+VOID CableSimdAccumulateScaledT(LONG* pAccumulator, const SHORT* pSamples, ULONG frames, ULONG channels, const LONG* gains)
+{
+	SHORT multipliers[CABLE_SIMD_MAX_CHANNELS][VECTOR::Lanes];
+	SHORT masks[CABLE_SIMD_MAX_CHANNELS][VECTOR::Lanes];
+	ULONG period = CableSimdPeriod(VECTOR::Lanes, channels);
+	ULONG samples = frames * channels;
+	ULONG i = 0;
+
+	// A Q16 gain from 0x8000 on does not fit a signed 16 bit multiplier.
+	// (s * g) >> 16 equals ((s * (g - 0x10000)) >> 16) + s, so those lanes
+	// multiply by g - 0x10000 and add the sample back through the mask.
+	for (ULONG v = 0; v < period; ++v)
+	{
+		for (ULONG l = 0; l < VECTOR::Lanes; ++l)
+		{
+			LONG gain = gains[(v * VECTOR::Lanes + l) % channels];
+
+			multipliers[v][l] = (SHORT)((gain < 0x8000) ? gain : gain - 0x10000);
+			masks[v][l] = (SHORT)((gain < 0x8000) ? 0 : -1);
+		}
+	}
+
+	while (i + period * VECTOR::Lanes <= samples)
+	{
+		for (ULONG v = 0; v < period; ++v, i += VECTOR::Lanes)
+		{
+			typename VECTOR::Type sample = VECTOR::Load(pSamples + i);
+			typename VECTOR::Type scaled = VECTOR::Add16(
+				VECTOR::MulHigh16(sample, VECTOR::Load(multipliers[v])),
+				VECTOR::And(sample, VECTOR::Load(masks[v])));
+			LONG* pTarget = pAccumulator + i;
+
+			VECTOR::Store(pTarget, VECTOR::Add32(VECTOR::Load(pTarget), VECTOR::Widen16(scaled, 0)));
+			VECTOR::Store(pTarget + VECTOR::Lanes / 2, VECTOR::Add32(VECTOR::Load(pTarget + VECTOR::Lanes / 2), VECTOR::Widen16(scaled, 1)));
+		}
+	}
+
+	// A whole number of periods ends on a frame.
+	CableSimdAccumulateScaledScalar(pAccumulator + i, pSamples + i, frames - i / channels, channels, gains);
+}
+
+template <class VECTOR>
+VOID CableSimdTrackPeaksT(const SHORT* pSamples, ULONG frames, ULONG channels, LONG* peaks)
+{
+	typename VECTOR::Type maxima[CABLE_SIMD_MAX_CHANNELS];
+	SHORT lanes[VECTOR::Lanes];
+	ULONG period = CableSimdPeriod(VECTOR::Lanes, channels);
+	ULONG samples = frames * channels;
+	ULONG i = 0;
+
+	for (ULONG v = 0; v < period; ++v)
+	{
+		maxima[v] = VECTOR::Zero();
+	}
+
+	while (i + period * VECTOR::Lanes <= samples)
+	{
+		for (ULONG v = 0; v < period; ++v, i += VECTOR::Lanes)
+		{
+			maxima[v] = VECTOR::Max16(maxima[v], VECTOR::Magnitude16(VECTOR::Load(pSamples + i)));
+		}
+	}
+
+	for (ULONG v = 0; v < period; ++v)
+	{
+		VECTOR::Store(lanes, maxima[v]);
+		for (ULONG l = 0; l < VECTOR::Lanes; ++l)
+		{
+			ULONG c = (v * VECTOR::Lanes + l) % channels;
+			if (lanes[l] > peaks[c]) peaks[c] = lanes[l];
+		}
+	}
+
+	CableSimdTrackPeaksScalar(pSamples + i, frames - i / channels, channels, peaks);
+}
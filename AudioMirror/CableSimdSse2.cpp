@@ -0,0 +1,61 @@
+#include "CableSimdKernels.h"
+
+#ifdef CABLE_SIMD_X86
+#include <emmintrin.h>
+
+namespace
+{
+	struct VECTOR_SSE2
+	{
+		typedef __m128i Type;
+		static const ULONG Lanes = 8;
+
+		static Type Load(const VOID* p) { return _mm_loadu_si128((const __m128i*)p); }
+		static VOID Store(VOID* p, Type v) { _mm_storeu_si128((__m128i*)p, v); }
+		static Type Zero() { return _mm_setzero_si128(); }
+		static Type Add16(Type a, Type b) { return _mm_add_epi16(a, b); }
+		static Type Add32(Type a, Type b) { return _mm_add_epi32(a, b); }
+		static Type And(Type a, Type b) { return _mm_and_si128(a, b); }
+		static Type MulHigh16(Type a, Type b) { return _mm_mulhi_epi16(a, b); }
+		static Type Max16(Type a, Type b) { return _mm_max_epi16(a, b); }
+		static Type Pack32(Type low, Type high) { return _mm_packs_epi32(low, high); }
+
+		// 0 - -32768 saturates to 32767.
+		static Type Magnitude16(Type v) { return _mm_max_epi16(v, _mm_subs_epi16(_mm_setzero_si128(), v)); }
+
+		// Every lane doubled into a 32 bit lane, the arithmetic shift keeps its sign.
+		static Type Widen16(Type v, ULONG half)
+		{
+			return _mm_srai_epi32(half ? _mm_unpackhi_epi16(v, v) : _mm_unpacklo_epi16(v, v), 16);
+		}
+	};
+}
+
+#pragma code_seg()
+VOID CableSimdClampToShortSse2(SHORT* pTarget, LONG* pAccumulator, ULONG samples)
+{
+	CableSimdClampToShortT<VECTOR_SSE2>(pTarget, pAccumulator, samples);
+}
+
+#pragma code_seg()
+VOID CableSimdAccumulateScaledSse2(LONG* pAccumulator, const SHORT* pSamples, ULONG frames, ULONG channels, const LONG* gains)
+{
+	CableSimdAccumulateScaledT<VECTOR_SSE2>(pAccumulator, pSamples, frames, channels, gains);
+}
+
+#pragma code_seg()
+static VOID CableSimdTrackPeaksSse2(const SHORT* pSamples, ULONG frames, ULONG channels, LONG* peaks)
+{
+	CableSimdTrackPeaksT<VECTOR_SSE2>(pSamples, frames, channels, peaks);
+}
+
+const CABLE_SIMD_KERNELS g_CableSimdSse2Kernels =
+{
+	CableSimdSse2,
+	"sse2",
+	CABLE_SIMD_SSE_STATE_MASK,
+	CableSimdClampToShortSse2,
+	CableSimdAccumulateScaledSse2,
+	CableSimdTrackPeaksSse2
+};
+#endif // CABLE_SIMD_X86
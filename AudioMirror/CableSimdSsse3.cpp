@@ -0,0 +1,39 @@
+#include "CableSimdKernels.h"
+
+#ifdef CABLE_SIMD_X86
+#include <tmmintrin.h>
+
+namespace
+{
+	// Only the peak kernel differs from SSE2, PABSW takes the magnitude.
+	struct VECTOR_SSSE3
+	{
+		typedef __m128i Type;
+		static const ULONG Lanes = 8;
+
+		static Type Load(const VOID* p) { return _mm_loadu_si128((const __m128i*)p); }
+		static VOID Store(VOID* p, Type v) { _mm_storeu_si128((__m128i*)p, v); }
+		static Type Zero() { return _mm_setzero_si128(); }
+		static Type Max16(Type a, Type b) { return _mm_max_epi16(a, b); }
+
+		// PABSW leaves -32768 as it is, lift it to -32767 first.
+		static Type Magnitude16(Type v) { return _mm_abs_epi16(_mm_max_epi16(v, _mm_set1_epi16(-SHRT_MAX))); }
+	};
+}
+
+#pragma code_seg()
+static VOID CableSimdTrackPeaksSsse3(const SHORT* pSamples, ULONG frames, ULONG channels, LONG* peaks)
+{
+	CableSimdTrackPeaksT<VECTOR_SSSE3>(pSamples, frames, channels, peaks);
+}
+
+const CABLE_SIMD_KERNELS g_CableSimdSsse3Kernels =
+{
+	CableSimdSsse3,
+	"ssse3",
+	CABLE_SIMD_SSE_STATE_MASK,
+	CableSimdClampToShortSse2,
+	CableSimdAccumulateScaledSse2,
+	CableSimdTrackPeaksSsse3
+};
+#endif // CABLE_SIMD_X86
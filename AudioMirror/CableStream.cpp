@@ -0,0 +1,2002 @@
+#include "CableStream.h"
+#pragma warning (disable : 4127)
+
+//=============================================================================
+// CableStream
+//=============================================================================
+
+//=============================================================================
+#pragma code_seg("PAGE")
+CableStream::CableStream()
+	: m_ullDmaTimeStamp(0), m_hnsElapsedTimeCarryForward(0), m_ullPresentationPosition(0),
+	m_ullPlayPosition(0), m_ullWritePosition(0), m_ullLinearPosition(0), m_llPacketCounter(0),
+	m_llNotifiedPacketCounter(0), m_ullLastTimerQpc(0), m_ullTimerIntervalQpc(0),
+	m_ullLastAudioPosition(0), m_pDmaBuffer(NULL), m_RingBuffer(NULL), m_pRegisterPage(NULL),
+	m_pNotificationTimer(NULL), m_pWorker(NULL), m_pMixer(NULL), m_byteDisplacementCarryForward(0),
+	m_ulDmaMovementRate(0), m_ulBlockAlign(0), m_ulDmaBufferSize(0), m_ulPacketSize(0),
+	m_ulCurrentWritePosition(0), m_IsCurrentWritePositionUpdated(0), m_KsState(KSSTATE_STOP),
+	m_ulMixerInput(0), m_bCapture(FALSE), m_bClockLock(FALSE), m_bEoSReceived(FALSE),
+	m_bLastBufferRendered(FALSE), m_bLoopback(FALSE), m_bRawPath(FALSE), m_bTimerRunning(FALSE),
+	m_bTimerIdle(FALSE), m_ulNotificationsPerBuffer(0), m_ulLastOsReadPacket(ULONG_MAX),
+	m_ulLastOsWritePacket(ULONG_MAX), m_pWfExt(NULL), m_plVolumeLevel(NULL), m_plPeakMeter(NULL),
+	m_pbMuted(NULL), m_PairedStream(NULL), m_bCaptureStarved(TRUE), m_bRegistersMapped(FALSE),
+	m_pLoopbackSource(NULL), m_lLoopbackReaders(0), m_ullLoopbackCursor(LOOPBACK_CURSOR_UNSYNCED),
+	m_ulRingBufferCount(CABLE_RING_BUFFERS_DEFAULT), m_bMirroredRing(FALSE), m_pEndpointGain(NULL),
+	m_pInjector(NULL), m_ulInjectReader(CABLE_INJECTOR_NO_READER), m_bClockLocked(FALSE),
+	m_ulClockLockOffset(0), m_ullClockLockSource(0), m_hnsClockLockProgress(0), m_pScheduler(NULL),
+	m_ullWorkQueued(0), m_ulWorkLookahead(0), m_OverrunPolicy(RingOverrunDropOldest),
+	m_ulPrerollBytes(0), m_ullHistoryStart(0), m_ullHistoryQpc(0), m_ullRunPosition(0),
+	m_bFirstAudioSeen(TRUE), m_bCableShutDown(FALSE)
+{
+	PAGED_CODE();
+
+	m_ullPerformanceCounterFrequency.QuadPart = 0;
+	m_Statistics.Reset();
+	m_LatencyProbe.Init();
+
+	// Initialize the spinlock to synchronize position updates
+	KeInitializeSpinLock(&m_PositionSpinLock);
+}
+
+//=============================================================================
+#pragma code_seg("PAGE")
+CableStream::~CableStream()
+{
+	PAGED_CODE();
+
+	ShutdownCable();
+
+	// The per-channel controls share the format's allocation.
+	if (m_pWfExt)
+	{
+		ExFreePoolWithTag(m_pWfExt, MINWAVERTSTREAM_POOLTAG);
+		m_pWfExt = NULL;
+		m_plVolumeLevel = NULL;
+		m_plPeakMeter = NULL;
+		m_pbMuted = NULL;
+	}
+	if (m_pRegisterPage)
+	{
+		ExFreePoolWithTag(m_pRegisterPage, MINWAVERTSTREAM_POOLTAG);
+		m_pRegisterPage = NULL;
+	}
+	m_RingBuffer = NULL;
+}
+
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS CableStream::InitCable
+(
+	_In_ PWAVEFORMATEX Format,
+	_In_ const CABLE_STREAM_CONFIG* Config
+)
+{
+	SIZE_T formatSize;
+	SIZE_T channelsSize;
+	NTSTATUS ntStatus;
+
+	PAGED_CODE();
+
+	m_bCapture = Config->Capture;
+	m_bLoopback = Config->Loopback;
+	m_bRawPath = Config->RawPath;
+	m_ulRingBufferCount = Config->RingBufferCount;
+	m_bMirroredRing = Config->MirroredRing;
+	m_OverrunPolicy = Config->OverrunPolicy;
+	m_pEndpointGain = Config->Gain;
+	m_bClockLock = Config->Capture && !Config->Loopback && Config->ClockLocked;
+	m_ulDmaMovementRate = Format->nAvgBytesPerSec;
+
+	if (Config->Scheduler != NULL)
+	{
+		m_pScheduler = Config->Scheduler;
+		m_pScheduler->InitEntry(&m_SchedulerEntry, Config->HomeProcessor, ScheduledTimerTick, this);
+	}
+
+	if (m_ulDmaMovementRate == 0 || Format->nBlockAlign == 0 || Format->nChannels == 0)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	m_ulPrerollBytes = (ULONG)min((ULONGLONG)m_ulDmaMovementRate * Config->PrerollMs / 1000, (ULONGLONG)MAXULONG);
+	m_ulPrerollBytes -= m_ulPrerollBytes % Format->nBlockAlign;
+
+	// The capture stream owns the cable ring, so it is the one measuring.
+	if (m_bCapture && !m_bLoopback && Config->MeasureLatency)
+	{
+		m_LatencyProbe.Enable(TRUE);
+	}
+
+	m_pNotificationTimer = ExAllocateTimer(
+		TimerNotifyRT,
+		this,
+		EX_TIMER_HIGH_RESOLUTION
+	);
+	if (!m_pNotificationTimer)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	// One allocation for the format and the volume, peak meter and mute
+	// arrays behind it, each array sized from the channel count.
+	formatSize = ALIGN_UP_BY(sizeof(WAVEFORMATEX) + Format->cbSize, sizeof(LONGLONG));
+	channelsSize = Format->nChannels * (sizeof(LONG) + sizeof(LONG) + sizeof(BOOL));
+	m_pWfExt = (PWAVEFORMATEXTENSIBLE)ExAllocatePoolWithTag(NonPagedPoolNx, formatSize + channelsSize, MINWAVERTSTREAM_POOLTAG);
+	if (m_pWfExt == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	RtlZeroMemory(m_pWfExt, formatSize + channelsSize);
+	RtlCopyMemory(m_pWfExt, Format, sizeof(WAVEFORMATEX) + Format->cbSize);
+	m_ulBlockAlign = Format->nBlockAlign;
+
+	m_plVolumeLevel = (PLONG)((BYTE*)m_pWfExt + formatSize);
+	m_plPeakMeter = m_plVolumeLevel + Format->nChannels;
+	m_pbMuted = (PBOOL)(m_plPeakMeter + Format->nChannels);
+	m_VolumeRamp.Init(m_pWfExt->Format.nChannels, m_pWfExt->Format.nSamplesPerSec);
+
+	// Allocations of a page or more are page aligned, so the register page
+	// shares its physical page with nothing else.
+	m_pRegisterPage = (PSTREAM_REGISTER_PAGE)ExAllocatePoolWithTag(NonPagedPoolNx, PAGE_SIZE, MINWAVERTSTREAM_POOLTAG);
+	if (m_pRegisterPage == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	RtlZeroMemory(m_pRegisterPage, PAGE_SIZE);
+
+	// Host and offload render streams both feed the cable through the mixer.
+	if (!m_bCapture && Config->Mixer != NULL)
+	{
+		ntStatus = Config->Mixer->AddInput(&m_ulMixerInput);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		m_pMixer = Config->Mixer;
+	}
+
+	// A loopback stream copies under the source's position lock and a
+	// locked stream's position depends on the ring, both stay in the DPC.
+	if (Config->WorkerThread && !m_bLoopback && !m_bClockLock)
+	{
+		m_pWorker = new(NonPagedPoolNx, CABLE_WORKER_POOLTAG) CableWorker;
+		if (m_pWorker == NULL)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+		ntStatus = m_pWorker->Init(RunWork, this, GetHomeProcessor(), &m_Statistics);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			delete m_pWorker;
+			m_pWorker = NULL;
+			return ntStatus;
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID CableStream::ShutdownCable()
+{
+	PAGED_CODE();
+
+	if (m_bCableShutDown)
+	{
+		return;
+	}
+	m_bCableShutDown = TRUE;
+
+	if (m_pNotificationTimer)
+	{
+		ExDeleteTimer
+		(
+			m_pNotificationTimer,
+			TRUE, // Cancel the timer if it is currently set.
+			TRUE, // Wait for the timer to finish expiring and for any callback to a ExTimerCallback routine to finish.
+			NULL
+		);
+		m_pNotificationTimer = NULL;
+		if (m_pScheduler)
+		{
+			m_pScheduler->Cancel(&m_SchedulerEntry);
+		}
+		// Since we just cancelled the notification timer, wait for all queued
+		// DPCs to complete before we free the notification DPC.
+		//
+		KeFlushQueuedDpcs();
+	}
+
+	// Nothing queues blocks any more, let the worker finish the last ones.
+	if (m_pWorker)
+	{
+		m_pWorker->Flush();
+		delete m_pWorker;
+		m_pWorker = NULL;
+	}
+
+	if (m_pMixer)
+	{
+		m_pMixer->RemoveInput(m_ulMixerInput);
+		m_pMixer = NULL;
+	}
+
+	DetachInjector();
+
+	if (m_PairedStream) {
+		m_PairedStream->SetPairedStream(NULL);
+		m_PairedStream = NULL;
+	}
+}
+
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS CableStream::PrepareBuffer
+(
+	_In_ ULONG NotificationCount,
+	_Inout_ PULONG RequestedSize,
+	_Out_ PULONG PacketSize
+)
+{
+	ULONG ulPacketSize = 0;
+	ULONG requestedSize = *RequestedSize;
+	NTSTATUS ntStatus;
+
+	PAGED_CODE();
+
+	*PacketSize = 0;
+
+	if ((0 == requestedSize) || (requestedSize < m_pWfExt->Format.nBlockAlign))
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	if ((NotificationCount == 0) || (requestedSize % NotificationCount != 0))
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	// Every packet has to start on a frame, so align the packet rather than
+	// the whole buffer and keep the buffer an exact multiple of the packet.
+	ulPacketSize = requestedSize / NotificationCount;
+	ulPacketSize -= ulPacketSize % (m_pWfExt->Format.nBlockAlign);
+	if (ulPacketSize == 0)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+	requestedSize = ulPacketSize * NotificationCount;
+
+	// Loopback streams read the render buffer directly and need no ring.
+	if (!m_bLoopback)
+	{
+		// A new buffer for the same stream, the ring resizes under its own lock.
+		m_ullHistoryStart = 0;
+		ntStatus = m_Ring.Init(requestedSize * m_ulRingBufferCount, m_ulBlockAlign, m_bMirroredRing);
+		if (!NT_SUCCESS(ntStatus) && m_bMirroredRing)
+		{
+			// Out of system PTEs for the mirror, a pooled ring works as well.
+			ntStatus = m_Ring.Init(requestedSize * m_ulRingBufferCount, m_ulBlockAlign);
+		}
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+
+		// The mixer may already write into this stream, publish the ring only
+		// once it is set up.
+		if (m_RingBuffer == NULL)
+		{
+			InterlockedExchangePointer((PVOID*)&m_RingBuffer, &m_Ring);
+		}
+	}
+
+	ApplyClockLock();
+
+	*RequestedSize = requestedSize;
+	*PacketSize = ulPacketSize;
+
+	return STATUS_SUCCESS;
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::SetClockLock
+(
+	_In_ BOOLEAN Enable
+)
+{
+	KIRQL oldIrql;
+
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+	m_bClockLock = m_bCapture && !m_bLoopback && m_pWorker == NULL && Enable;
+	m_bClockLocked = FALSE;
+	ApplyClockLock();
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::ApplyClockLock()
+/*++
+
+Routine Description:
+
+Sets the offset a locked stream keeps behind the render side and lets the
+ring deliver from that fill level on, it never drains further. Unlocked rings
+go back to starting at half full.
+
+--*/
+{
+	if (m_RingBuffer == NULL)
+	{
+		return;
+	}
+
+	if (m_bClockLock)
+	{
+		m_ulClockLockOffset = m_ulDmaMovementRate * CABLE_CLOCK_LOCK_OFFSET_MS / 1000;
+		m_ulClockLockOffset = min(m_ulClockLockOffset, (ULONG)(m_RingBuffer->GetSize() / 2));
+		m_ulClockLockOffset -= m_ulClockLockOffset % m_pWfExt->Format.nBlockAlign;
+		m_RingBuffer->SetStartThreshold(m_ulClockLockOffset);
+	}
+	else
+	{
+		m_RingBuffer->SetStartThreshold(m_RingBuffer->GetSize() / 2);
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::AttachDmaBuffer
+(
+	_In_ BYTE* Buffer,
+	_In_ ULONG Size,
+	_In_ ULONG NotificationCount,
+	_In_ ULONG PacketSize
+)
+{
+	KIRQL oldIrql;
+
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+	m_pDmaBuffer = Buffer;
+	m_ulNotificationsPerBuffer = NotificationCount;
+	m_ulPacketSize = PacketSize;
+	m_ulDmaBufferSize = Size;
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+}
+
+//=============================================================================
+#pragma code_seg()
+BYTE* CableStream::DetachDmaBuffer()
+{
+	KIRQL oldIrql;
+	BYTE* pDmaBuffer;
+
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+	pDmaBuffer = m_pDmaBuffer;
+	m_pDmaBuffer = NULL;
+	m_ulDmaBufferSize = 0;
+	m_ulNotificationsPerBuffer = 0;
+	m_ulPacketSize = 0;
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+	return pDmaBuffer;
+}
+
+//=============================================================================
+#pragma code_seg()
+NTSTATUS CableStream::SetCableState
+(
+	_In_    KSSTATE State_
+)
+{
+	KIRQL oldIrql;
+
+	switch (State_)
+	{
+	case KSSTATE_STOP:
+		KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+		// Reset DMA
+		m_llPacketCounter = 0;
+		m_llNotifiedPacketCounter = 0;
+		m_ullPlayPosition = 0;
+		m_ullWritePosition = 0;
+		m_ullLinearPosition = 0;
+		m_ullPresentationPosition = 0;
+
+		// Reset OS read/write positions
+		m_ulLastOsReadPacket = ULONG_MAX;
+		m_ulCurrentWritePosition = 0;
+		m_ulLastOsWritePacket = ULONG_MAX;
+		m_bEoSReceived = FALSE;
+		m_bLastBufferRendered = FALSE;
+
+		if (m_pRegisterPage)
+		{
+			m_pRegisterPage->PositionRegister = 0;
+			m_pRegisterPage->ClockRegister = 0;
+		}
+
+		KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+		break;
+
+	case KSSTATE_ACQUIRE:
+		break;
+
+	case KSSTATE_PAUSE:
+
+		if (m_KsState > KSSTATE_PAUSE)
+		{
+			//
+			// Run -> Pause
+			//
+
+			// Pause DMA. Packet completion is derived from the linear position,
+			// so nothing needs to be carried over to the next RUN.
+			if (m_ulNotificationsPerBuffer > 0 || m_bRegistersMapped)
+			{
+				// A tick still in flight must not set the timer again.
+				KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+				m_bTimerRunning = FALSE;
+				m_bTimerIdle = FALSE;
+				KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+				ExCancelTimer(m_pNotificationTimer, NULL);
+				if (m_pScheduler)
+				{
+					m_pScheduler->Cancel(&m_SchedulerEntry);
+				}
+				KeFlushQueuedDpcs();
+			}
+
+			// Stop holding back the other mixer inputs while paused.
+			if (m_pMixer)
+			{
+				m_pMixer->StopInput(m_ulMixerInput);
+			}
+
+			// Nobody reads the ring until the next RUN, it keeps the newest
+			// bytes as the history for the pre-roll.
+			if (m_RingBuffer)
+			{
+				m_RingBuffer->SetOverrunPolicy(RingOverrunDropOldest);
+			}
+		}
+		// This call updates the linear buffer and presentation positions.
+		GetPositions(NULL, NULL, NULL);
+
+		// The worker may still be busy with the blocks queued up to here.
+		if (m_pWorker)
+		{
+			m_pWorker->Flush();
+		}
+
+		// A paused stream must not hold back the injection writer.
+		DetachInjector();
+		break;
+
+	case KSSTATE_RUN:
+
+		// Start DMA
+		LARGE_INTEGER ullPerfCounterTemp;
+
+		ullPerfCounterTemp = KeQueryPerformanceCounter(&m_ullPerformanceCounterFrequency);
+		m_ullDmaTimeStamp = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ullPerfCounterTemp);
+
+		// Start from the render history, or from an empty ring.
+		ULONG prerollBytes;
+		prerollBytes = 0;
+		if (m_RingBuffer)
+		{
+			m_RingBuffer->SetOverrunPolicy(m_OverrunPolicy);
+			prerollBytes = (ULONG)m_RingBuffer->Restart(GetPrerollBytes(ullPerfCounterTemp.QuadPart));
+		}
+		m_ullRunPosition = m_ullLinearPosition;
+		m_ullLastAudioPosition = m_ullLinearPosition;
+		m_bFirstAudioSeen = !m_bCapture;
+		m_LatencyProbe.ClearMarkers();
+		m_ullLoopbackCursor = LOOPBACK_CURSOR_UNSYNCED;
+		m_ullLastTimerQpc = 0;
+		m_bCaptureStarved = TRUE;
+		m_bClockLocked = FALSE;
+		m_ullClockLockSource = 0;
+		m_Statistics.RecordRingFill(prerollBytes);
+		m_Statistics.ResetRingFill();
+		m_Statistics.StartRun(prerollBytes);
+
+		if (m_pWorker)
+		{
+			// Flushed when the stream paused, the worker is idle.
+			m_pWorker->Reset();
+			m_ullWorkQueued = m_ullLinearPosition;
+			m_ulWorkLookahead = m_ulDmaMovementRate * CABLE_WORKER_LOOKAHEAD_MS / 1000;
+			if (m_ulPacketSize > 0)
+			{
+				m_ulWorkLookahead = min(m_ulWorkLookahead, m_ulPacketSize);
+			}
+			m_ulWorkLookahead = min(m_ulWorkLookahead, m_ulDmaBufferSize / 2);
+			m_ulWorkLookahead -= m_ulWorkLookahead % m_pWfExt->Format.nBlockAlign;
+		}
+
+		// The timer also drives the position register, so it runs whenever the
+		// audio engine asked for it, even outside of event driven mode.
+		if (m_ulNotificationsPerBuffer > 0 || m_bRegistersMapped)
+		{
+			// Set timer for 1 ms. This will cause DPC to run every 1 ms but driver will send out
+			// notification events only when a packet boundary was crossed. This timer is used by Sysvad to
+			// emulate hardware and send out notification event. Real hardware should not use this
+			// timer to fire notification event as it will drain power if the timer is running at 1 msec.
+			// An idle stream slows it down, see RearmTimer.
+			m_bTimerRunning = TRUE;
+			m_bTimerIdle = FALSE;
+			m_ullTimerIntervalQpc = m_ullPerformanceCounterFrequency.QuadPart * CABLE_TIMER_PERIOD_HNS / 10000000;
+			ExSetTimer
+			(
+				m_pNotificationTimer,
+				(-1) * CABLE_TIMER_PERIOD_HNS,
+				CABLE_TIMER_PERIOD_HNS, // 1 ms
+				NULL
+			);
+
+		}
+
+		break;
+	}
+
+	m_KsState = State_;
+
+	return STATUS_SUCCESS;
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::GetDmaPosition
+(
+	_Out_ PULONGLONG PlayOffset,
+	_Out_ PULONGLONG WriteOffset
+)
+{
+	LARGE_INTEGER qpcFrequency;
+	LARGE_INTEGER qpcEntry = KeQueryPerformanceCounter(&qpcFrequency);
+
+	KIRQL oldIrql;
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+
+	if (m_KsState == KSSTATE_RUN)
+	{
+		//
+		// Get the current time and update position.
+		//
+		LARGE_INTEGER ilQPC = KeQueryPerformanceCounter(NULL);
+		UpdatePosition(ilQPC);
+	}
+
+	*PlayOffset = m_ullPlayPosition;
+	*WriteOffset = m_ullWritePosition;
+
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+	m_Statistics.RecordPositionQuery(
+		(ULONG)((KeQueryPerformanceCounter(NULL).QuadPart - qpcEntry.QuadPart) * 1000000000 / qpcFrequency.QuadPart));
+}
+
+//linear and presentation positions
+#pragma code_seg()
+NTSTATUS CableStream::GetPositions
+(
+	_Out_opt_  ULONGLONG *      _pullLinearBufferPosition,
+	_Out_opt_  ULONGLONG *      _pullPresentationPosition,
+	_Out_opt_  LARGE_INTEGER *  _pliQPCTime
+)
+{
+	LARGE_INTEGER   ilQPC;
+	LARGE_INTEGER   qpcFrequency;
+	LARGE_INTEGER   qpcEntry;
+	KIRQL           oldIrql;
+
+	qpcEntry = KeQueryPerformanceCounter(&qpcFrequency);
+
+	// Update *_pullLinearBufferPosition with the the number of bytes fetched from waveRT ever since a stream got set into RUN
+	// state.
+	// Once the stream is set to STOP state, any further read on this call would return zero.
+
+	//
+	// Get the current time and update position.
+	//
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+	ilQPC = KeQueryPerformanceCounter(NULL);
+	if (m_KsState == KSSTATE_RUN)
+	{
+		UpdatePosition(ilQPC);
+	}
+	if (_pullLinearBufferPosition)
+	{
+		*_pullLinearBufferPosition = m_ullLinearPosition;
+	}
+	if (_pullPresentationPosition)
+	{
+		*_pullPresentationPosition = m_ullPresentationPosition;
+	}
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+	if (_pliQPCTime)
+	{
+		*_pliQPCTime = ilQPC;
+	}
+
+	m_Statistics.RecordPositionQuery(
+		(ULONG)((KeQueryPerformanceCounter(NULL).QuadPart - qpcEntry.QuadPart) * 1000000000 / qpcFrequency.QuadPart));
+
+	return STATUS_SUCCESS;
+}
+
+//=============================================================================
+// CableStream::GetNextReadPacket
+//
+//  Returns information about the next packet for the OS to read.
+//
+// Return value
+//
+//  Returns STATUS_DEVICE_NOT_READY if no new packets are available and
+//  the next packet is in progress.
+//
+// IRQL - PASSIVE_LEVEL
+//
+// Remarks
+//  Although called at passive level, this routine is non-paged code because
+//  it is called in the streaming path where page faults should be avoided.
+//
+//  Packets are returned oldest first. If the OS fell behind, every completed
+//  packet that is still intact in the WaveRT buffer can be drained with
+//  MoreData = TRUE, only packets the DMA position already overwrote are
+//  dropped.
+#pragma code_seg()
+NTSTATUS CableStream::GetNextReadPacket
+(
+	_Out_ ULONG     *PacketNumber,
+	_Out_ ULONG64   *PerformanceCounterValue,
+	_Out_ BOOL      *MoreData
+)
+{
+	ULONG nextPacketNumber;
+	ULONG completedPackets;
+	ULONG pendingPackets;
+	ULONG maxPendingPackets;
+	ULONG droppedPackets = 0;
+
+	// The call must be from event driven mode
+	if (m_ulNotificationsPerBuffer == 0)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	if (m_KsState < KSSTATE_PAUSE)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	KIRQL oldIrql;
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+
+	LONGLONG packetCounter = m_llPacketCounter;
+	ULONGLONG ullLinearPosition = m_ullLinearPosition;
+	ULONGLONG hnsElapsedTimeCarryForward = m_hnsElapsedTimeCarryForward;
+	ULONGLONG ullDmaTimeStamp = m_ullDmaTimeStamp;
+
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+	// The 0-based number of the next packet the OS has not read yet and the
+	// 1-based count of completed packets. Both wrap modulo 2^32.
+	nextPacketNumber = m_ulLastOsReadPacket + 1;    // ULONG_MAX + 1 == 0 before the first read
+	completedPackets = LODWORD(packetCounter);
+
+	// If no new packets are available...
+	if (nextPacketNumber == completedPackets)
+	{
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	// The packet in progress occupies the slot of the packet one buffer
+	// earlier, so at most m_ulNotificationsPerBuffer - 1 completed packets
+	// are still intact. Anything older was overwritten, i.e. a glitch occurred.
+	pendingPackets = completedPackets - nextPacketNumber;    // Modulo arithmetic
+	maxPendingPackets = (m_ulNotificationsPerBuffer > 1) ? m_ulNotificationsPerBuffer - 1 : 1;
+	if (pendingPackets > maxPendingPackets)
+	{
+		droppedPackets = pendingPackets - maxPendingPackets;
+		nextPacketNumber += droppedPackets;
+		pendingPackets = maxPendingPackets;
+		m_Statistics.RecordDroppedPackets(droppedPackets);
+	}
+
+	// Return next packet number to be read
+	*PacketNumber = nextPacketNumber;
+
+	// Compute and return timestamp corresponding to the first sample of the returned packet. It is
+	// extrapolated from the internal position correlation [m_ullLinearPosition @ m_ullDmaTimeStamp],
+	// which holds for any packet since the simulated DMA moves at a constant rate.
+	ULONGLONG linearPositionOfPacket = (ULONGLONG)(packetCounter - pendingPackets) * m_ulPacketSize;
+	// Need to divide by (1000 * 10000 because m_ulDmaMovementRate is average bytes per sec
+	ULONGLONG carryForwardBytes = (hnsElapsedTimeCarryForward * m_ulDmaMovementRate) / 10000000;
+	ULONGLONG deltaLinearPosition = ullLinearPosition + carryForwardBytes - linearPositionOfPacket;
+	ULONGLONG deltaTimeInHns = deltaLinearPosition * 10000000 / m_ulDmaMovementRate;
+	ULONGLONG timeOfPacketInHns = ullDmaTimeStamp - deltaTimeInHns;
+	ULONGLONG timeOfPacketInQpc = timeOfPacketInHns * m_ullPerformanceCounterFrequency.QuadPart / 10000000;
+
+	*PerformanceCounterValue = timeOfPacketInQpc;
+
+	// Tell the OS to call again if further completed packets are waiting.
+	*MoreData = (pendingPackets > 1) ? TRUE : FALSE;
+
+	// Update the last packet read by the OS
+	m_ulLastOsReadPacket = nextPacketNumber;
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+NTSTATUS CableStream::SubmitWritePacket
+(
+	_In_ ULONG      PacketNumber,
+	_In_ BOOL       EndOfStream,
+	_In_ ULONG      EosPacketLength
+)
+{
+	NTSTATUS ntStatus;
+
+	// The call must be from event driven mode
+	if (m_ulNotificationsPerBuffer == 0)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	ULONG oldLastOsWritePacket = m_ulLastOsWritePacket;
+
+	// This function should not be called once EoS has been set.
+	if (m_bEoSReceived)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	KIRQL oldIrql;
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+	// 1-based count of completed packets, 0-based packet number of current packet
+	LONGLONG currentPacket = m_llPacketCounter;
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+	// If not running, the current packet hasn't actually started transfering so OS should be writing
+	// to the current packet. If running, then the current packing is already transfering to hardware
+	// so the OS should write the packet after the current packet.
+	ULONG expectedPacket = LODWORD(currentPacket);
+	if (m_KsState == KSSTATE_RUN)
+	{
+		expectedPacket++;
+	}
+
+	// Check if OS PacketNumber is behind or too far ahead of current packet
+	LONG deltaFromExpectedPacket = PacketNumber - expectedPacket;   // Modulo arithemetic
+	if (deltaFromExpectedPacket < 0)
+	{
+		return STATUS_DATA_LATE_ERROR;
+	}
+	else if (deltaFromExpectedPacket > 0)
+	{
+		return STATUS_DATA_OVERRUN;
+	}
+
+	ULONG packetSize = m_ulPacketSize;
+	ULONG packetIndex = PacketNumber % m_ulNotificationsPerBuffer;
+	ULONG ulCurrentWritePosition = packetIndex * packetSize;
+
+	// Check if EOS flag was passed
+	if (EndOfStream)
+	{
+		if (EosPacketLength > packetSize)
+		{
+			return STATUS_INVALID_PARAMETER;
+		}
+		else {
+			// EOS position will be after the total completed packets, plus the packet in progress,
+			// plus this EOS packet length
+			m_ulLastOsWritePacket = PacketNumber;
+			ulCurrentWritePosition += EosPacketLength;
+			ntStatus = SetLastBufferWritePosition(ulCurrentWritePosition);
+		}
+	}
+	else
+	{
+		m_ulLastOsWritePacket = PacketNumber;
+
+		// This function sets the current write position to the specified byte in the DMA buffer.
+		// Will check if the write position is smaller than the DMA buffer size.
+		// Will not return an error when the passed in parameter is 0.
+		// Will also check if this function was called with the same write position(in event mode only)
+		// Underruning will also be checked via timer mechanism
+		KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+		ntStatus = SetCurrentWritePositionInternal(ulCurrentWritePosition);
+		KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+	}
+
+	if (!NT_SUCCESS(ntStatus))
+	{
+		m_ulLastOsWritePacket = oldLastOsWritePacket;
+	}
+
+	return ntStatus;
+}
+
+//=============================================================================
+#pragma code_seg()
+NTSTATUS CableStream::GetCompletedPacketCount
+(
+	_Out_ ULONG *pPacketCount
+)
+{
+	// The call must be from event driven mode
+	if (m_ulNotificationsPerBuffer == 0)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	KIRQL oldIrql;
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+
+	if (m_KsState == KSSTATE_RUN)
+	{
+		// Get the current time and update simulated position.
+		LARGE_INTEGER ilQPC = KeQueryPerformanceCounter(NULL);
+		UpdatePosition(ilQPC);
+	}
+
+	*pPacketCount = LODWORD(m_llPacketCounter);
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+NTSTATUS CableStream::SetLastBufferWritePosition(_In_ ULONG _ulWritePosition)
+{
+	NTSTATUS        ntStatus;
+	KIRQL           oldIrql;
+
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+
+	// Miniport driver needs to prepare to signal buffer completion event
+	// when it's done with reading the last valid byte - an _ulWritePosition offset from the beginning WaveRT buffer
+	// Note: _ulWritePosition will be smaller than buffer size in most of the cases
+	ntStatus = SetCurrentWritePositionInternal(_ulWritePosition);
+	if (NT_SUCCESS(ntStatus))
+	{
+		m_bEoSReceived = TRUE;
+	}
+
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+	return ntStatus;
+}
+
+#pragma code_seg()
+NTSTATUS CableStream::SetCurrentWritePositionInternal(_In_  ULONG _ulCurrentWritePosition)
+{
+
+	ASSERT(m_bEoSReceived == FALSE);
+
+	if (m_bEoSReceived)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	if (_ulCurrentWritePosition > m_ulDmaBufferSize)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	OnWritePositionChanged(_ulCurrentWritePosition);
+
+	m_ulCurrentWritePosition = _ulCurrentWritePosition;
+	InterlockedExchange(&m_IsCurrentWritePositionUpdated, 1);
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg("PAGE")
+void CableStream::SetPairedStream(CableStream* stream)
+{
+	PAGED_CODE();
+	if (m_RingBuffer)
+	{
+		m_RingBuffer->Clear();
+		m_ullHistoryStart = m_RingBuffer->GetWritePosition();
+	}
+	m_LatencyProbe.ClearMarkers();
+	m_PairedStream = stream;
+}
+
+#pragma code_seg("PAGE")
+VOID CableStream::PairStreams
+(
+	_In_opt_ CableStream* Render,
+	_In_opt_ CableStream* Capture
+)
+{
+	PAGED_CODE();
+
+	if (Render) Render->SetPairedStream(Capture);
+	if (Capture) Capture->SetPairedStream(Render);
+}
+
+#pragma code_seg()
+NTSTATUS CableStream::WriteAudioPacket(BYTE* buffer, ULONG packetSize, BOOL eos)
+{
+	UNREFERENCED_PARAMETER(buffer);
+	UNREFERENCED_PARAMETER(packetSize);
+	UNREFERENCED_PARAMETER(eos);
+
+	//only allowed on capture stream
+	if (!m_bCapture) return STATUS_NOT_IMPLEMENTED;
+	//the writer is either the paired render stream or the speaker's mixer,
+	//which feeds every capture stream whether it is paired or not
+	if (m_RingBuffer == NULL) return STATUS_DEVICE_NOT_READY;
+	if (packetSize > m_RingBuffer->GetSize()) return STATUS_BUFFER_TOO_SMALL;
+
+	if (m_LatencyProbe.IsEnabled())
+	{
+		m_LatencyProbe.MarkWritten(m_RingBuffer->GetWritePosition(), KeQueryPerformanceCounter(NULL).QuadPart);
+	}
+
+	BOOLEAN running = (m_KsState == KSSTATE_RUN);
+
+	// While stopped the ring collects the history for the pre-roll, which
+	// starts over after a gap in what the render side delivers.
+	if (!running && m_ulPrerollBytes > 0)
+	{
+		LARGE_INTEGER frequency;
+		ULONGLONG qpc = KeQueryPerformanceCounter(&frequency).QuadPart;
+
+		if (qpc - m_ullHistoryQpc > (ULONGLONG)frequency.QuadPart * CABLE_PREROLL_GAP_MS / 1000)
+		{
+			m_ullHistoryStart = m_RingBuffer->GetWritePosition();
+		}
+		m_ullHistoryQpc = qpc;
+	}
+
+	SIZE_T discardedBytes = 0;
+	NTSTATUS state = m_RingBuffer->Put(buffer, packetSize, &discardedBytes);
+	m_Statistics.RecordRingFill((ULONG)m_RingBuffer->GetFillBytes());
+	switch (state)
+	{
+	case STATUS_BUFFER_TOO_SMALL:
+		return state;
+	case STATUS_BUFFER_OVERFLOW:
+		// A stopped stream only keeps the newest bytes, nothing is lost.
+		if (running)
+		{
+			m_Statistics.RecordOverrun((ULONG)discardedBytes);
+		}
+		return STATUS_SUCCESS;
+	default:
+		return STATUS_SUCCESS;
+		break;
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+ULONG CableStream::GetPrerollBytes
+(
+	_In_ ULONGLONG Qpc
+)
+/*++
+
+Routine Description:
+
+Bytes of render history a capture stream entering RUN at Qpc keeps in its
+ring. Only a render side that delivered within the gap has any. The bytes it
+played since its last put, a whole packet for an idle render stream, arrive
+with its next tick and count toward the pre-roll. A locked stream drains
+everything above its offset at once, so it keeps no more.
+
+--*/
+{
+	ULONG preroll = m_ulPrerollBytes;
+	ULONGLONG owed;
+
+	if (preroll == 0 || m_RingBuffer == NULL ||
+		Qpc - m_ullHistoryQpc > (ULONGLONG)m_ullPerformanceCounterFrequency.QuadPart * CABLE_PREROLL_GAP_MS / 1000)
+	{
+		return 0;
+	}
+
+	owed = (Qpc - m_ullHistoryQpc) * m_ulDmaMovementRate / m_ullPerformanceCounterFrequency.QuadPart;
+	owed -= owed % m_ulBlockAlign;
+	if (owed >= preroll)
+	{
+		return 0;
+	}
+	preroll -= (ULONG)owed;
+
+	if (m_bClockLock)
+	{
+		preroll = min(preroll, m_ulClockLockOffset);
+	}
+
+	return (ULONG)min((ULONGLONG)preroll, m_RingBuffer->GetWritePosition() - m_ullHistoryStart);
+}
+
+//=============================================================================
+#pragma code_seg()
+static ULONG CableFindSound
+(
+	_In_reads_bytes_(Count) const BYTE* Bytes,
+	_In_ ULONG Count
+)
+/*++
+
+Routine Description:
+
+Returns the offset of the first byte that is not zero, Count for silence.
+
+--*/
+{
+	ULONG i = 0;
+
+	while (i < Count && Bytes[i] == 0)
+	{
+		++i;
+	}
+
+	return i;
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::FindFirstAudio
+(
+	_In_ ULONGLONG LinearPosition,
+	_In_reads_bytes_(Count) const BYTE* Bytes,
+	_In_ ULONG Count
+)
+/*++
+
+Routine Description:
+
+Records the stream time from RUN to the first frame that is not all zero
+bytes, once per RUN. Only the bytes up to that frame are ever scanned.
+
+--*/
+{
+	ULONG i = CableFindSound(Bytes, Count);
+
+	if (i < Count)
+	{
+		ULONGLONG offset = (LinearPosition + i > m_ullRunPosition) ? LinearPosition + i - m_ullRunPosition : 0;
+
+		offset -= offset % m_ulBlockAlign;
+		m_Statistics.RecordFirstAudio((ULONG)min(offset * 1000000 / m_ulDmaMovementRate, (ULONGLONG)MAXULONG));
+		m_bFirstAudioSeen = TRUE;
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+BOOLEAN CableStream::IsIdle()
+/*++
+
+Routine Description:
+
+Whether the stream can tick at the idle rate. Only event driven streams can,
+one polled through the position register or processed by a worker needs
+every tick. A render stream is idle while no running capture stream takes
+its audio and no loopback stream reads it. A capture stream is idle once it
+delivered nothing but silence for CABLE_IDLE_SILENCE_MS, which also covers
+a render side that stopped or went away.
+
+--*/
+{
+	if (m_ulPacketSize == 0 || m_pWorker != NULL || m_bEoSReceived || m_bRegistersMapped)
+	{
+		return FALSE;
+	}
+
+	if (m_bCapture)
+	{
+		return m_ullLinearPosition - m_ullLastAudioPosition >= (ULONGLONG)m_ulDmaMovementRate * CABLE_IDLE_SILENCE_MS / 1000;
+	}
+
+	if (m_lLoopbackReaders > 0)
+	{
+		return FALSE;
+	}
+
+	if (m_pMixer)
+	{
+		return !m_pMixer->HasConsumer();
+	}
+
+	return m_PairedStream == NULL || m_PairedStream->GetCableState() != KSSTATE_RUN;
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::RearmTimer
+(
+	_In_ ULONGLONG Frequency
+)
+/*++
+
+Routine Description:
+
+Called at the end of every tick while the stream runs. A busy stream keeps
+the 1 ms period. An idle one sets a single expiry per tick, just after its
+next packet boundary or CABLE_IDLE_TIMER_MAX_MS away, whichever is first.
+The notifications then go out no later than at the 1 ms period, and the
+ticks never drift off the packet grid.
+
+--*/
+{
+	if (!IsIdle())
+	{
+		if (m_bTimerIdle)
+		{
+			m_bTimerIdle = FALSE;
+			m_ullTimerIntervalQpc = Frequency * CABLE_TIMER_PERIOD_HNS / 10000000;
+			ExSetTimer(m_pNotificationTimer, (-1) * CABLE_TIMER_PERIOD_HNS, CABLE_TIMER_PERIOD_HNS, NULL);
+		}
+		return;
+	}
+
+	// The position moves in whole milliseconds, one period more makes sure it
+	// has passed the boundary when the tick runs.
+	ULONG remaining = m_ulPacketSize - (ULONG)(m_ullLinearPosition % m_ulPacketSize);
+	LONGLONG dueHns = (LONGLONG)((ULONGLONG)remaining * 10000000 / m_ulDmaMovementRate) + CABLE_TIMER_PERIOD_HNS;
+
+	dueHns = min(dueHns, (LONGLONG)CABLE_IDLE_TIMER_MAX_MS * HNSTIME_PER_MILLISECOND);
+
+	m_bTimerIdle = TRUE;
+	m_ullTimerIntervalQpc = Frequency * dueHns / 10000000;
+	ExSetTimer(m_pNotificationTimer, (-1) * dueHns, 0, NULL);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::UpdatePosition
+(
+	_In_ LARGE_INTEGER ilQPC
+)
+{
+	// Convert ticks to 100ns units.
+	LONGLONG  hnsCurrentTime = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ilQPC);
+
+	// Calculate the time elapsed since the last call to GetPosition() or since the
+	// DMA engine started.  Note that the division by 10000 to convert to milliseconds
+	// may cause us to lose some of the time, so we will carry the remainder forward
+	// to the next GetPosition() call.
+	//
+	ULONG TimeElapsedInMS = (ULONG)(hnsCurrentTime - m_ullDmaTimeStamp + m_hnsElapsedTimeCarryForward) / 10000;
+
+	// Carry forward the remainder of this division so we don't fall behind with our position too much.
+	//
+	m_hnsElapsedTimeCarryForward = (hnsCurrentTime - m_ullDmaTimeStamp + m_hnsElapsedTimeCarryForward) % 10000;
+
+	// Calculate how many bytes in the DMA buffer would have been processed in the elapsed
+	// time.  Note that the division by 1000 to convert to milliseconds may cause us to
+	// lose some bytes, so we will carry the remainder forward to the next GetPosition() call.
+	//
+	// need to divide by 1000 because m_ulDmaMovementRate is average bytes per sec.
+
+	ULONG ByteDisplacement = ((m_ulDmaMovementRate * TimeElapsedInMS) + m_byteDisplacementCarryForward) / 1000;
+	m_byteDisplacementCarryForward = ((m_ulDmaMovementRate * TimeElapsedInMS) + m_byteDisplacementCarryForward) % 1000;
+
+	// Only move by whole frames. At rates that are not a multiple of 1000 a
+	// partial frame would shift every channel of the cable, carry it instead.
+	ULONG partialFrame = ByteDisplacement % m_ulBlockAlign;
+	ByteDisplacement -= partialFrame;
+	m_byteDisplacementCarryForward += partialFrame * 1000;
+
+	// Without a buffer there is nothing to move through.
+	if (m_pDmaBuffer == NULL || m_ulDmaBufferSize == 0)
+	{
+		m_ullDmaTimeStamp = hnsCurrentTime;
+		return;
+	}
+
+	// A locked capture stream moves with the cable instead of its own clock.
+	if (m_bCapture && m_bClockLock && m_RingBuffer != NULL)
+	{
+		ByteDisplacement = GetClockLockedDisplacement(hnsCurrentTime, ByteDisplacement);
+	}
+
+	// Increment presentation position even after last buffer is rendered.
+	m_ullPresentationPosition += ByteDisplacement;
+
+	if (m_bCapture)
+	{
+		if (m_pWorker)
+		{
+			QueueWork(ByteDisplacement);
+		}
+		else
+		{
+			WriteBytes(m_ullLinearPosition, ByteDisplacement);
+		}
+	}
+	else
+	{
+		if (m_bEoSReceived)
+		{
+			// since EoS flag is set, we'll need to make sure not to read data beyond EOS position.
+			// If driver's current position is less than EoS position, then make sure not to read data beyond EoS.
+			if (m_ullWritePosition <= m_ulCurrentWritePosition)
+			{
+				ByteDisplacement = min(ByteDisplacement, m_ulCurrentWritePosition - (ULONG)m_ullWritePosition);
+			}
+			// If our current position is ahead of EoS position and we'll wrap around after new position then adjust
+			// new position if it crosses EoS.
+			else if ((m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize < m_ullWritePosition)
+			{
+				if ((m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize > m_ulCurrentWritePosition)
+				{
+					ByteDisplacement = ByteDisplacement - (((ULONG)m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize - m_ulCurrentWritePosition);
+				}
+			}
+		}
+
+		// If the last packet was rendered(read in the sample driver's case), report it.
+		if (m_bEoSReceived && !m_bLastBufferRendered
+			&& (m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize == m_ulCurrentWritePosition)
+		{
+			m_bLastBufferRendered = TRUE;
+			OnLastBufferRendered(m_ullLinearPosition + ByteDisplacement);
+		}
+		// Read from buffer and write to a file, on the worker only up to EoS.
+		if (m_pWorker)
+		{
+			QueueWork(ByteDisplacement);
+		}
+		else
+		{
+			ReadBytes(m_ullLinearPosition, ByteDisplacement);
+		}
+	}
+
+	// Increment the DMA position by the number of bytes displaced since the last
+	// call to UpdatePosition() and ensure we properly wrap at buffer length.
+	//
+	m_ullPlayPosition = m_ullWritePosition =
+		(m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize;
+
+	// m_ullDmaTimeStamp is updated in both GetPostion and GetLinearPosition calls
+	// so m_ullLinearPosition needs to be updated accordingly here
+	//
+	m_ullLinearPosition += ByteDisplacement;
+
+	// In event driven mode a packet is complete once the linear position has
+	// passed its end. No packets complete after EoS.
+	if (m_ulPacketSize > 0 && !m_bEoSReceived)
+	{
+		m_llPacketCounter = (LONGLONG)(m_ullLinearPosition / m_ulPacketSize);
+	}
+
+	// Publish to the register page. The clock is written first so a reader
+	// never pairs a new position with an older time, and it is the time of
+	// this tick, the one the position was computed for.
+	if (m_pRegisterPage)
+	{
+		m_pRegisterPage->ClockRegister = hnsCurrentTime;
+		KeMemoryBarrier();
+		m_pRegisterPage->PositionRegister = (ULONG)m_ullPlayPosition;
+	}
+
+	// Update the DMA time stamp for the next call to GetPosition()
+	//
+	m_ullDmaTimeStamp = hnsCurrentTime;
+}
+
+//=============================================================================
+#pragma code_seg()
+ULONG CableStream::GetClockLockedDisplacement
+(
+	_In_ LONGLONG hnsCurrentTime,
+	_In_ ULONG ByteDisplacement
+)
+/*++
+
+Routine Description:
+
+Position update of a clock locked capture stream. While the render side
+delivers, the stream moves to exactly the offset behind what was put into
+the ring. After the holdover without new bytes it runs on its own clock again,
+and locks back on once the ring holds the offset.
+
+Arguments:
+
+hnsCurrentTime - time of this update.
+
+ByteDisplacement - # of bytes the stream's own clock moved.
+
+Return Value:
+
+# of bytes to move the capture position by.
+
+--*/
+{
+	ULONGLONG written = m_RingBuffer->GetWritePosition();
+	ULONGLONG fill = m_RingBuffer->GetFillBytes();
+
+	if (written != m_ullClockLockSource)
+	{
+		m_ullClockLockSource = written;
+		m_hnsClockLockProgress = hnsCurrentTime;
+		if (!m_bClockLocked && fill >= m_ulClockLockOffset)
+		{
+			m_bClockLocked = TRUE;
+		}
+	}
+	else if (m_bClockLocked &&
+		hnsCurrentTime - m_hnsClockLockProgress > CABLE_CLOCK_LOCK_HOLDOVER_MS * HNSTIME_PER_MILLISECOND)
+	{
+		m_bClockLocked = FALSE;
+		m_Statistics.RecordClockLockFallback();
+	}
+
+	if (!m_bClockLocked)
+	{
+		return ByteDisplacement;
+	}
+
+	ByteDisplacement = fill > m_ulClockLockOffset ? (ULONG)(fill - m_ulClockLockOffset) : 0;
+	return ByteDisplacement - ByteDisplacement % m_ulBlockAlign;
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::QueueWork
+(
+	_In_ ULONG ByteDisplacement
+)
+/*++
+
+Routine Description:
+
+Takes the place of WriteBytes and ReadBytes in worker mode, called with the
+position lock held before the position moves. Takes back the blocks the
+worker did not start in time, queues the next one and wakes the worker.
+
+A capture block reaches a lookahead past the new position and is missed
+once the position moves into it. The DPC then zero fills it, which is all
+it ever copies. A render block is what the position just moved over and is
+missed a lookahead later. The DPC then drops it: a mixer input leaves the
+mix until the worker delivers again, and the capture side zero fills the gap.
+
+Arguments:
+
+ByteDisplacement - # of bytes the position moves.
+
+--*/
+{
+	ULONGLONG newPosition = m_ullLinearPosition + ByteDisplacement;
+	ULONGLONG start;
+	ULONGLONG end;
+	ULONGLONG deadline;
+	PCABLE_WORK_ITEM item;
+	BOOLEAN outstanding = m_pWorker->GetOutstanding(0) != NULL;
+
+	// Deadlines grow in queue order.
+	for (ULONG i = 0; (item = m_pWorker->GetOutstanding(i)) != NULL; ++i)
+	{
+		if (newPosition <= item->Deadline)
+		{
+			break;
+		}
+		if (m_pWorker->Abandon(item))
+		{
+			m_Statistics.RecordWorkerMiss(item->Bytes);
+			if (m_bCapture)
+			{
+				ZeroFillDma(item->LinearPosition, item->Bytes);
+			}
+			else if (m_pMixer)
+			{
+				m_pMixer->StopInput(m_ulMixerInput);
+			}
+		}
+		else if (!item->Late && item->State == CableWorkClaimed)
+		{
+			item->Late = TRUE;
+			m_Statistics.RecordWorkerLate();
+		}
+	}
+	m_pWorker->Retire();
+
+	if (m_bCapture)
+	{
+		// No block was queued for these bytes, the stream just started or
+		// the queue was full. Only the latter is the worker's miss.
+		if (m_ullWorkQueued < newPosition)
+		{
+			if (outstanding)
+			{
+				m_Statistics.RecordWorkerMiss((ULONG)(newPosition - m_ullWorkQueued));
+			}
+			ZeroFillDma(m_ullWorkQueued, (ULONG)(newPosition - m_ullWorkQueued));
+			m_ullWorkQueued = newPosition;
+		}
+		start = m_ullWorkQueued;
+		end = newPosition + m_ulWorkLookahead;
+		deadline = start;
+	}
+	else
+	{
+		start = m_ullLinearPosition;
+		end = newPosition;
+		deadline = end + m_ulWorkLookahead;
+	}
+
+	if (end <= start)
+	{
+		return;
+	}
+
+	if (m_pWorker->Queue(start, (ULONG)(end - start), deadline) != NULL)
+	{
+		m_ullWorkQueued = end;
+		m_pWorker->Signal();
+	}
+	else if (!m_bCapture)
+	{
+		m_Statistics.RecordWorkerMiss((ULONG)(end - start));
+		if (m_pMixer)
+		{
+			m_pMixer->StopInput(m_ulMixerInput);
+		}
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::ZeroFillDma
+(
+	_In_ ULONGLONG LinearPosition,
+	_In_ ULONG Count
+)
+{
+	ULONG bufferOffset = LinearPosition % m_ulDmaBufferSize;
+	ULONG remaining = min(Count, m_ulDmaBufferSize);
+
+	while (remaining > 0)
+	{
+		ULONG runZero = min(remaining, m_ulDmaBufferSize - bufferOffset);
+		RtlZeroMemory(m_pDmaBuffer + bufferOffset, runZero);
+		bufferOffset = (bufferOffset + runZero) % m_ulDmaBufferSize;
+		remaining -= runZero;
+	}
+	m_Statistics.RecordZeroFill(Count, FALSE);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::RunWork
+(
+	_In_ PVOID Context,
+	_In_ PCABLE_WORK_ITEM Item
+)
+/*++
+
+Routine Description:
+
+Processes one block on the worker thread, exactly what the DPC does inline
+outside of worker mode.
+
+--*/
+{
+	CableStream* _this = (CableStream*)Context;
+
+	if (_this->m_bCapture)
+	{
+		_this->WriteBytes(Item->LinearPosition, Item->Bytes);
+	}
+	else
+	{
+		_this->ReadBytes(Item->LinearPosition, Item->Bytes);
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::WriteBytes
+(
+	_In_ ULONGLONG LinearPosition,
+	_In_ ULONG ByteDisplacement
+)
+/*++
+
+Routine Description:
+
+Fills the capture DMA buffer from the cable ring, or from the render buffer
+for a loopback stream, and adds the injected audio on top.
+
+Arguments:
+
+LinearPosition - linear position of the first byte.
+
+ByteDisplacement - # of bytes to process.
+
+--*/
+{
+	ULONG bufferOffset = LinearPosition % m_ulDmaBufferSize;
+	ULONG zeroFilledBytes = 0;
+	ULONGLONG ringReadBefore = 0;
+	ULONGLONG runPosition = LinearPosition;
+	BOOLEAN findSound = (m_ulPacketSize > 0 && m_pWorker == NULL);
+
+	if (ByteDisplacement == 0)
+	{
+		return;
+	}
+
+	if (m_RingBuffer)
+	{
+		ringReadBefore = m_RingBuffer->GetReadPosition();
+	}
+
+	// Join the injection ring once a writer has created it.
+	if (!m_bLoopback && m_pInjector == NULL)
+	{
+		CableInjector* pInjector = GetCableInjector();
+
+		if (pInjector != NULL && pInjector->IsFormatSupported(&m_pWfExt->Format) &&
+			NT_SUCCESS(pInjector->AddReader(&m_ulInjectReader)))
+		{
+			m_pInjector = pInjector;
+		}
+	}
+
+	// Normally this will loop no more than once for a single wrap, but if
+	// many bytes have been displaced then this may loops many times.
+	while (ByteDisplacement > 0)
+	{
+		ULONG runWrite = min(ByteDisplacement, m_ulDmaBufferSize - bufferOffset);
+		SIZE_T actuallyWritten = 0;
+
+		if (m_bLoopback)
+		{
+			actuallyWritten = ReadLoopback(m_pDmaBuffer + bufferOffset, runWrite);
+		}
+		else if (m_RingBuffer)
+		{
+			m_RingBuffer->Take(m_pDmaBuffer + bufferOffset, runWrite, &actuallyWritten, m_pEndpointGain);
+		}
+		if (actuallyWritten < runWrite)
+		{
+			RtlZeroMemory(m_pDmaBuffer + bufferOffset + actuallyWritten, runWrite - actuallyWritten);
+			zeroFilledBytes += runWrite - (ULONG)actuallyWritten;
+		}
+		if (m_pInjector)
+		{
+			m_pInjector->Add(m_ulInjectReader, m_pDmaBuffer + bufferOffset, runWrite, m_pEndpointGain);
+		}
+		if (!m_bFirstAudioSeen)
+		{
+			FindFirstAudio(runPosition, m_pDmaBuffer + bufferOffset, runWrite);
+		}
+		// Sound keeps the stream off the idle rate, once per call is enough.
+		if (findSound && CableFindSound(m_pDmaBuffer + bufferOffset, runWrite) < runWrite)
+		{
+			m_ullLastAudioPosition = runPosition + runWrite;
+			findSound = FALSE;
+		}
+
+		bufferOffset = (bufferOffset + runWrite) % m_ulDmaBufferSize;
+		runPosition += runWrite;
+		ByteDisplacement -= runWrite;
+	}
+
+	// Only the transition from delivering audio to zero filling counts as an
+	// underrun, the initial fill of the ring does not.
+	if (zeroFilledBytes > 0)
+	{
+		m_Statistics.RecordZeroFill(zeroFilledBytes, !m_bCaptureStarved);
+	}
+	m_bCaptureStarved = (zeroFilledBytes > 0);
+
+	if (m_RingBuffer == NULL)
+	{
+		return;
+	}
+
+	m_Statistics.RecordRingFill((ULONG)m_RingBuffer->GetFillBytes());
+
+	if (m_LatencyProbe.IsEnabled())
+	{
+		m_LatencyProbe.MarkDelivered(ringReadBefore, m_RingBuffer->GetReadPosition(), KeQueryPerformanceCounter(NULL).QuadPart);
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::DetachInjector()
+/*++
+
+Routine Description:
+
+Stops consuming the injection ring. The stream joins again from WriteBytes.
+
+--*/
+{
+	if (m_pInjector)
+	{
+		m_pInjector->RemoveReader(m_ulInjectReader);
+		m_pInjector = NULL;
+		m_ulInjectReader = CABLE_INJECTOR_NO_READER;
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::ReadBytes
+(
+	_In_ ULONGLONG LinearPosition,
+	_In_ ULONG ByteDisplacement
+)
+/*++
+
+Routine Description:
+
+Passes the bytes the render position moved over on to the cable. Runs once
+per tick, the SIMD bracket around the mix covers every wrap of it.
+
+Arguments:
+
+LinearPosition - linear position of the first byte.
+
+ByteDisplacement - # of bytes to process.
+
+--*/
+{
+	ULONG bufferOffset = LinearPosition % m_ulDmaBufferSize;
+	CABLE_SIMD_CONTEXT simd = {};
+
+	if (m_pMixer)
+	{
+		CableSimdEnter(&simd);
+	}
+
+	// Normally this will loop no more than once for a single wrap, but if
+	// many bytes have been displaced then this may loops many times.
+	while (ByteDisplacement > 0)
+	{
+		ULONG runWrite = min(ByteDisplacement, m_ulDmaBufferSize - bufferOffset);
+		if (m_pMixer) m_pMixer->Mix(m_ulMixerInput, m_pDmaBuffer + bufferOffset, runWrite, m_bRawPath ? NULL : &m_VolumeRamp, m_bRawPath ? NULL : m_pbMuted, simd.Kernels);
+		else if (m_PairedStream) m_PairedStream->WriteAudioPacket(m_pDmaBuffer + bufferOffset, runWrite, false);
+		bufferOffset = (bufferOffset + runWrite) % m_ulDmaBufferSize;
+		ByteDisplacement -= runWrite;
+	}
+
+	if (m_pMixer)
+	{
+		CableSimdLeave(&simd);
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+ULONG CableStream::ReadLoopback
+(
+	_Out_writes_bytes_(Count) BYTE* Target,
+	_In_ ULONG Count
+)
+/*++
+
+Routine Description:
+
+Copies the next bytes of the loopback stream out of the render buffer.
+Called with the position lock held, which keeps the source alive.
+
+Arguments:
+
+Target - where the bytes go in this stream's DMA buffer.
+
+Count - # of bytes wanted.
+
+Return Value:
+
+# of bytes copied, the caller zero fills the rest.
+
+--*/
+{
+	ULONG skippedBytes = 0;
+	ULONG copied = 0;
+
+	if (m_pLoopbackSource == NULL)
+	{
+		return 0;
+	}
+
+	copied = m_pLoopbackSource->ReadLoopbackHistory(&m_ullLoopbackCursor, Target, Count, &skippedBytes);
+	if (skippedBytes > 0)
+	{
+		m_Statistics.RecordOverrun(skippedBytes);
+	}
+
+	return copied;
+}
+
+//=============================================================================
+#pragma code_seg()
+ULONG CableStream::ReadLoopbackHistory
+(
+	_Inout_ PULONGLONG Cursor,
+	_Out_writes_bytes_(Count) BYTE* Target,
+	_In_ ULONG Count,
+	_Out_ PULONG SkippedBytes
+)
+/*++
+
+Routine Description:
+
+Serves a loopback read from the bytes this render stream has already played.
+The history that is still intact ends at the linear position and reaches
+back to where the OS writes next, so nothing is staged in a second ring.
+
+Arguments:
+
+Cursor - render linear position the reader continues from. Moved forward by
+	the bytes copied, resynced when it is unset or outside the history.
+
+Target - destination buffer.
+
+Count - # of bytes wanted.
+
+SkippedBytes - receives the bytes the reader lost because the OS overwrote
+	them before they were read.
+
+Return Value:
+
+# of bytes copied.
+
+--*/
+{
+	KIRQL oldIrql;
+	ULONG copied = 0;
+
+	*SkippedBytes = 0;
+
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+
+	if (m_pDmaBuffer != NULL && m_ulDmaBufferSize > 0 && m_KsState == KSSTATE_RUN)
+	{
+		ULONGLONG historyEnd = m_ullLinearPosition;
+		ULONG playOffset = (ULONG)m_ullWritePosition;
+		ULONG nextWriteOffset = m_ulCurrentWritePosition;
+		ULONG history;
+
+		// In event mode the write position is the start of the packet the OS
+		// completed last, the next one it fills follows it.
+		if (m_ulPacketSize > 0)
+		{
+			nextWriteOffset = (nextWriteOffset + m_ulPacketSize) % m_ulDmaBufferSize;
+		}
+		history = (playOffset + m_ulDmaBufferSize - nextWriteOffset) % m_ulDmaBufferSize;
+		if (history == 0 && m_ulPacketSize == 0)
+		{
+			history = m_ulDmaBufferSize;
+		}
+		history = (ULONG)min((ULONGLONG)history, historyEnd);
+
+		if (*Cursor == LOOPBACK_CURSOR_UNSYNCED || *Cursor > historyEnd)
+		{
+			ULONG lag = m_ulDmaMovementRate * LOOPBACK_START_LAG_MS / 1000;
+			lag -= lag % m_pWfExt->Format.nBlockAlign;
+			*Cursor = historyEnd - min(lag, history);
+		}
+		else if (*Cursor < historyEnd - history)
+		{
+			*SkippedBytes = (ULONG)min(historyEnd - history - *Cursor, (ULONGLONG)MAXULONG);
+			*Cursor = historyEnd - history;
+		}
+
+		ULONG available = (ULONG)(historyEnd - *Cursor);
+		ULONG bufferOffset = *Cursor % m_ulDmaBufferSize;
+		ULONG toCopy = min(Count, available);
+
+		while (toCopy > 0)
+		{
+			ULONG runCopy = min(toCopy, m_ulDmaBufferSize - bufferOffset);
+			RtlCopyMemory(Target + copied, m_pDmaBuffer + bufferOffset, runCopy);
+			bufferOffset = (bufferOffset + runCopy) % m_ulDmaBufferSize;
+			copied += runCopy;
+			toCopy -= runCopy;
+		}
+
+		*Cursor += copied;
+	}
+
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+	return copied;
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::SetLoopbackSource
+(
+	_In_opt_ CableStream* Source
+)
+/*++
+
+Routine Description:
+
+Attaches this loopback stream to a render stream or detaches it. Taking the
+position lock waits out a read that is still using the old source.
+
+--*/
+{
+	KIRQL oldIrql;
+
+	if (Source != NULL &&
+		(Source->m_pWfExt->Format.nBlockAlign != m_pWfExt->Format.nBlockAlign ||
+		 Source->m_ulDmaMovementRate != m_ulDmaMovementRate))
+	{
+		DPF(D_TERSE, ("SetLoopbackSource: render format does not match the loopback format"));
+		Source = NULL;
+	}
+
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+	if (m_pLoopbackSource != NULL)
+	{
+		InterlockedDecrement(&m_pLoopbackSource->m_lLoopbackReaders);
+	}
+	if (Source != NULL)
+	{
+		InterlockedIncrement(&Source->m_lLoopbackReaders);
+	}
+	m_pLoopbackSource = Source;
+	m_ullLoopbackCursor = LOOPBACK_CURSOR_UNSYNCED;
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::OnTimerTick(_In_ const CABLE_STREAM_TICK* Tick)
+{
+	UNREFERENCED_PARAMETER(Tick);
+}
+
+#pragma code_seg()
+VOID CableStream::OnWritePositionChanged(_In_ ULONG NewWritePosition)
+{
+	UNREFERENCED_PARAMETER(NewWritePosition);
+}
+
+#pragma code_seg()
+VOID CableStream::OnLastBufferRendered(_In_ ULONGLONG LinearPosition)
+{
+	UNREFERENCED_PARAMETER(LinearPosition);
+}
+
+#pragma code_seg()
+CableInjector* CableStream::GetCableInjector()
+{
+	return NULL;
+}
+
+//=============================================================================
+#pragma code_seg()
+void
+TimerNotifyRT
+(
+	_In_      PEX_TIMER    Timer,
+	_In_opt_  PVOID        DeferredContext
+)
+{
+	UNREFERENCED_PARAMETER(Timer);
+
+	_IRQL_limited_to_(DISPATCH_LEVEL);
+
+	CableStream* _this = (CableStream*)DeferredContext;
+
+	if (NULL == _this)
+	{
+		return;
+	}
+
+	// Both streams of a cable tick on its home processor, the scheduler
+	// moves the tick there when the timer fired anywhere else.
+	if (_this->m_pScheduler)
+	{
+		_this->m_pScheduler->Dispatch(&_this->m_SchedulerEntry);
+	}
+	else
+	{
+		_this->RunTimerTick();
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CableStream::ScheduledTimerTick(_In_ PVOID Context)
+{
+	((CableStream*)Context)->RunTimerTick();
+}
+
+#pragma code_seg()
+VOID CableStream::RunTimerTick()
+{
+	LARGE_INTEGER qpc;
+	LARGE_INTEGER qpcFrequency;
+	LARGE_INTEGER qpcEntry;
+	BOOL bufferCompleted = FALSE;
+	CABLE_STREAM_TICK tick = {};
+
+	qpcEntry = KeQueryPerformanceCounter(&qpcFrequency);
+
+	KIRQL oldIrql;
+	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+
+	qpc = KeQueryPerformanceCounter(&qpcFrequency);
+
+	// Advance the position on every tick, packet completion follows from it.
+	UpdatePosition(qpc);
+
+	// Positions may also have been advanced by GetPosition or GetPacketCount
+	// since the last tick, so compare against what was already signalled.
+	if (m_llPacketCounter > m_llNotifiedPacketCounter)
+	{
+		tick.CompletedPackets = (ULONG)(m_llPacketCounter - m_llNotifiedPacketCounter);
+		m_llNotifiedPacketCounter = m_llPacketCounter;
+		bufferCompleted = TRUE;
+	}
+
+	if (m_KsState == KSSTATE_RUN)
+	{
+		// Simple buffer underrun detection, the OS has to write once per packet.
+		tick.ReportUnderrun = bufferCompleted && !IsCurrentWaveRTWritePositionUpdated() && !m_bEoSReceived;
+
+		// Send buffer completion event if either of the following is true
+		// 1. Driver consumed a complete buffer for this stream
+		// 2. Driver consumed a partial buffer containing EoS for this stream
+		tick.SignalEvents = bufferCompleted || m_bLastBufferRendered;
+
+		tick.LinearPosition = m_ullLinearPosition;
+		tick.WritePosition = GetCurrentWaveRTWritePosition();
+
+		if (m_bLastBufferRendered)
+		{
+			ExCancelTimer(m_pNotificationTimer, NULL);
+			m_bTimerRunning = FALSE;
+		}
+	}
+
+	// Timer lateness is measured against when the timer was due, one period
+	// or the idle interval after the last tick.
+	ULONG latenessUs = 0;
+	BOOLEAN idleTick = m_bTimerIdle;
+	if (m_ullLastTimerQpc != 0)
+	{
+		ULONGLONG expectedQpc = m_ullLastTimerQpc + m_ullTimerIntervalQpc;
+		if ((ULONGLONG)qpcEntry.QuadPart > expectedQpc)
+		{
+			latenessUs = (ULONG)(((ULONGLONG)qpcEntry.QuadPart - expectedQpc) * 1000000 / qpcFrequency.QuadPart);
+		}
+	}
+	m_ullLastTimerQpc = qpcEntry.QuadPart;
+
+	if (m_bTimerRunning)
+	{
+		RearmTimer(qpcFrequency.QuadPart);
+	}
+
+	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+	// Everything below only needs the values captured above, keep it out of
+	// the position lock.
+	OnTimerTick(&tick);
+
+	LARGE_INTEGER qpcExit = KeQueryPerformanceCounter(NULL);
+	m_Statistics.RecordTimerTick(
+		(ULONG)((qpcExit.QuadPart - qpcEntry.QuadPart) * 1000000 / qpcFrequency.QuadPart),
+		latenessUs,
+		idleTick);
+}
+//=============================================================================
@@ -0,0 +1,512 @@
+#pragma once
+#include "Globals.h"
+#include "RingBuffer.h"
+#include "StreamStatistics.h"
+#include "LatencyProbe.h"
+#include "VolumeRamp.h"
+#include "CableMixer.h"
+#include "CableInjector.h"
+#include "CableScheduler.h"
+#include "CableWorker.h"
+
+#define MINWAVERTSTREAM_POOLTAG     'SRWM'
+#define HNSTIME_PER_MILLISECOND     10000
+
+//
+// Emulated hardware registers handed out by GetPositionRegister and
+// GetClockRegister. PortCls maps the whole page into the audio engine, so the
+// page is allocated on its own and holds nothing else.
+//
+typedef struct _STREAM_REGISTER_PAGE
+{
+	volatile ULONG      PositionRegister;   // DMA position as byte offset into the WaveRT buffer.
+	ULONG               Reserved;
+	volatile ULONGLONG  ClockRegister;      // Time of that position in 100ns units.
+} STREAM_REGISTER_PAGE, *PSTREAM_REGISTER_PAGE;
+
+#define STREAM_CLOCK_REGISTER_FREQUENCY     10000000
+
+//
+// A loopback stream reads the render stream's DMA buffer behind the render
+// play position. Its cursor is a render linear position, it starts this far
+// behind the render position so the 1 ms timer jitter between the two
+// streams does not starve it.
+//
+#define LOOPBACK_CURSOR_UNSYNCED            MAXULONGLONG
+#define LOOPBACK_START_LAG_MS               2
+
+//
+// Size of the cable ring of a capture stream in DMA buffers. The ring starts
+// delivering once it is half full, so this sets the latency the cable adds.
+// RAW and communications streams trade underrun headroom for latency.
+//
+#define CABLE_RING_BUFFERS_DEFAULT          4
+#define CABLE_RING_BUFFERS_LOW_LATENCY      2
+
+//
+// Clock locked capture streams. Their position follows the bytes the render
+// side put into the cable ring, this far behind them, so the ring fill stays
+// constant however the render and capture timers drift apart. The ring then
+// only has to absorb render bursts and can be much smaller. When nothing
+// arrives for the holdover time the stream falls back to its own clock until
+// the render side delivers again.
+//
+#define CABLE_RING_BUFFERS_CLOCK_LOCKED     2
+#define CABLE_CLOCK_LOCK_OFFSET_MS          2
+#define CABLE_CLOCK_LOCK_HOLDOVER_MS        10
+
+//
+// Pre-roll of capture streams. The ring of a stopped capture stream keeps
+// taking what the render side delivers, so on RUN the stream can start with
+// the newest of it. The history only reaches back to the last gap this long
+// between two puts, older audio is stale.
+//
+#define CABLE_PREROLL_GAP_MS                20
+
+//
+// Timer of a running stream. It fires every millisecond while the stream
+// has work, an idle event driven stream only wakes up for its packet
+// boundaries, and every CABLE_IDLE_TIMER_MAX_MS in between, so new audio
+// is picked up within a packet and the pre-roll history has no gaps. A
+// render stream is idle while nobody takes its audio, a capture stream
+// once it has only delivered silence for CABLE_IDLE_SILENCE_MS.
+//
+#define CABLE_TIMER_PERIOD_HNS              HNSTIME_PER_MILLISECOND
+#define CABLE_IDLE_TIMER_MAX_MS             10
+#define CABLE_IDLE_SILENCE_MS               250
+
+C_ASSERT(CABLE_IDLE_TIMER_MAX_MS < CABLE_PREROLL_GAP_MS);
+
+//
+// Streams in worker mode. A capture block is queued this far ahead of the
+// position, a render block has to reach the cable this long after the
+// position moved over it, before the OS writes the next packet over it.
+//
+#define CABLE_WORKER_LOOKAHEAD_MS           2
+
+EXT_CALLBACK   TimerNotifyRT;
+
+//
+// How a stream attaches to the cable, decided by the miniport from the pin
+// and the signal processing mode.
+//
+typedef struct _CABLE_STREAM_CONFIG
+{
+	BOOLEAN         Capture;
+	BOOLEAN         Loopback;           // Capture stream reading a render stream's DMA buffer.
+	BOOLEAN         RawPath;            // Render stream that skips the stream volume.
+	BOOLEAN         MeasureLatency;
+	BOOLEAN         ClockLocked;        // Capture stream whose position follows the render side.
+	ULONG           RingBufferCount;    // CABLE_RING_BUFFERS_*
+	BOOLEAN         MirroredRing;       // Keep the cable ring in double mapped storage, see MirroredBuffer.
+	RING_OVERRUN_POLICY OverrunPolicy;  // What the cable ring of a capture stream discards when it is full.
+	ULONG           PrerollMs;          // Render history a capture stream starts with, 0 for none.
+	EndpointGain*   Gain;               // Applied by capture streams, may be NULL.
+	CableMixer*     Mixer;              // Render streams feed the cable through it, may be NULL.
+	CableScheduler* Scheduler;          // Runs the ticks on the cable's home processor, may be NULL.
+	ULONG           HomeProcessor;      // From CableScheduler::AddCable.
+	BOOLEAN         WorkerThread;       // Process the blocks on a worker thread, not for loopback or clock locked streams.
+} CABLE_STREAM_CONFIG, *PCABLE_STREAM_CONFIG;
+
+//
+// What one timer tick did, handed to OnTimerTick outside the position lock.
+//
+typedef struct _CABLE_STREAM_TICK
+{
+	ULONG       CompletedPackets;   // Packets completed since the previous notification.
+	BOOL        SignalEvents;       // The notification events are due.
+	BOOL        ReportUnderrun;     // The OS did not write the last packet in time.
+	ULONGLONG   LinearPosition;
+	ULONG       WritePosition;      // Last WaveRT buffer write position of the OS.
+} CABLE_STREAM_TICK, *PCABLE_STREAM_TICK;
+
+/*
+	One end of the cable: the emulated DMA engine of a WaveRT stream.
+
+	Owns the DMA position, the timer that advances it, the cable ring of a
+	capture stream and the packet bookkeeping of event driven mode. It only
+	uses the kernel API the host build provides (see Host/HostKernel.h), so
+	the whole streaming path runs and is tested in user mode.
+
+	MiniportWaveRTStream derives from it and adds everything PortCls talks
+	to. The virtual hooks are called outside the position lock.
+*/
+class CableStream
+{
+public:
+	CableStream();
+	virtual ~CableStream();
+
+	/*
+		Copies the format, allocates the timer, the per channel state and
+		the register page, and joins the mixer of a render stream.
+	*/
+	NTSTATUS InitCable
+	(
+		_In_ PWAVEFORMATEX Format,
+		_In_ const CABLE_STREAM_CONFIG* Config
+	);
+
+	/*
+		Stops the timer and leaves the mixer, the injection ring and the
+		paired stream. Safe to call more than once, the destructor calls it
+		as well.
+	*/
+	VOID ShutdownCable();
+
+	/*
+		Aligns the requested size to whole packets and allocates the cable
+		ring for a buffer of that size.
+	*/
+	NTSTATUS PrepareBuffer
+	(
+		_In_ ULONG NotificationCount,
+		_Inout_ PULONG RequestedSize,
+		_Out_ PULONG PacketSize
+	);
+
+	VOID AttachDmaBuffer
+	(
+		_In_ BYTE* Buffer,
+		_In_ ULONG Size,
+		_In_ ULONG NotificationCount,
+		_In_ ULONG PacketSize
+	);
+
+	/*
+		Takes the DMA buffer away under the position lock, so no loopback
+		reader is still copying out of it, and returns it for unmapping.
+	*/
+	BYTE* DetachDmaBuffer();
+
+	/*
+		Runs, pauses and stops the emulated DMA.
+	*/
+	NTSTATUS SetCableState
+	(
+		_In_ KSSTATE State
+	);
+
+	KSSTATE GetCableState()
+	{
+		return m_KsState;
+	}
+
+	BOOLEAN IsCapture()
+	{
+		return m_bCapture;
+	}
+
+	/*
+		Switches a capture stream between its own clock and following the
+		render side. Takes effect on the next position update.
+	*/
+	VOID SetClockLock
+	(
+		_In_ BOOLEAN Enable
+	);
+
+	// The position currently follows the render side.
+	BOOLEAN IsClockLocked()
+	{
+		return m_bClockLocked;
+	}
+
+	VOID GetDmaPosition
+	(
+		_Out_ PULONGLONG PlayOffset,
+		_Out_ PULONGLONG WriteOffset
+	);
+
+	NTSTATUS GetPositions
+	(
+		_Out_opt_  ULONGLONG *      _pullLinearBufferPosition,
+		_Out_opt_  ULONGLONG *      _pullPresentationPosition,
+		_Out_opt_  LARGE_INTEGER *  _pliQPCTime
+	);
+
+	/*
+		Packet interface of event driven mode, see
+		IMiniportWaveRTInputStream::GetReadPacket and
+		IMiniportWaveRTOutputStream::SetWritePacket.
+	*/
+	NTSTATUS GetNextReadPacket
+	(
+		_Out_ ULONG     *PacketNumber,
+		_Out_ ULONG64   *PerformanceCounterValue,
+		_Out_ BOOL      *MoreData
+	);
+
+	NTSTATUS SubmitWritePacket
+	(
+		_In_ ULONG      PacketNumber,
+		_In_ BOOL       EndOfStream,
+		_In_ ULONG      EosPacketLength
+	);
+
+	NTSTATUS GetCompletedPacketCount
+	(
+		_Out_ ULONG *pPacketCount
+	);
+
+	/*
+		Sets the write position of the last, possibly partial buffer. No
+		packets complete after it.
+	*/
+	NTSTATUS SetLastBufferWritePosition
+	(
+		_In_ ULONG WritePosition
+	);
+
+	/*
+		Puts a block of the cable into the ring of a capture stream. Called
+		by the paired render stream or the speaker's mixer at DISPATCH_LEVEL.
+	*/
+	NTSTATUS WriteAudioPacket(BYTE * buffer, ULONG packetSize, BOOL eos);
+
+	void SetPairedStream(CableStream* stream);
+
+	/*
+		Pairs a render and a capture stream both ways. A NULL stream unpairs
+		the other one.
+	*/
+	static VOID PairStreams
+	(
+		_In_opt_ CableStream* Render,
+		_In_opt_ CableStream* Capture
+	);
+
+	VOID SetLoopbackSource
+	(
+		_In_opt_ CableStream* Source
+	);
+
+	ULONG ReadLoopbackHistory
+	(
+		_Inout_ PULONGLONG Cursor,
+		_Out_writes_bytes_(Count) BYTE* Target,
+		_In_ ULONG Count,
+		_Out_ PULONG SkippedBytes
+	);
+
+	StreamStatistics* GetStreamStatistics()
+	{
+		return &m_Statistics;
+	}
+
+	// The timer DPC only moves the position, a worker thread processes the blocks.
+	BOOLEAN IsWorkerMode()
+	{
+		return m_pWorker != NULL;
+	}
+
+	// The timer runs at the idle rate.
+	BOOLEAN IsTimerIdle()
+	{
+		return m_bTimerIdle;
+	}
+
+	// CABLE_SCHEDULER_NO_PROCESSOR when the ticks run where the timer fires.
+	ULONG GetHomeProcessor()
+	{
+		return m_pScheduler ? m_SchedulerEntry.Processor : CABLE_SCHEDULER_NO_PROCESSOR;
+	}
+
+	ULONG GetCurrentWaveRTWritePosition()
+	{
+		return m_ulCurrentWritePosition;
+	};
+
+	// To support simple underrun validation.
+	BOOL IsCurrentWaveRTWritePositionUpdated()
+	{
+		return InterlockedExchange(&m_IsCurrentWritePositionUpdated, 0) ? TRUE : FALSE;
+	};
+
+	// Friends
+	friend EXT_CALLBACK         TimerNotifyRT;
+protected:
+	//
+	// Hot: everything a timer tick reads or writes, starting on its own cache
+	// line and roughly in the order UpdatePosition and RunTimerTick use it,
+	// four lines on 64 bit.
+	//
+	DECLSPEC_CACHEALIGN
+	KSPIN_LOCK                  m_PositionSpinLock;
+	LARGE_INTEGER               m_ullPerformanceCounterFrequency;
+	ULONGLONG                   m_ullDmaTimeStamp;
+	ULONGLONG                   m_hnsElapsedTimeCarryForward;
+	ULONGLONG                   m_ullPresentationPosition;
+	ULONGLONG                   m_ullPlayPosition;
+	ULONGLONG                   m_ullWritePosition;
+	ULONGLONG                   m_ullLinearPosition;
+	LONGLONG                    m_llPacketCounter;
+	LONGLONG                    m_llNotifiedPacketCounter;
+	ULONGLONG                   m_ullLastTimerQpc;
+	ULONGLONG                   m_ullTimerIntervalQpc;  // Until the tick after the last one is due.
+	ULONGLONG                   m_ullLastAudioPosition; // Linear position a capture stream last delivered sound at.
+	BYTE*                       m_pDmaBuffer;
+	RingBuffer*                 m_RingBuffer;       // m_Ring once it is set up, NULL before.
+	PSTREAM_REGISTER_PAGE       m_pRegisterPage;
+	PEX_TIMER                   m_pNotificationTimer;
+	CableWorker*                m_pWorker;
+	CableMixer*                 m_pMixer;
+	LONG                        m_byteDisplacementCarryForward;
+	ULONG                       m_ulDmaMovementRate;
+	ULONG                       m_ulBlockAlign;
+	ULONG                       m_ulDmaBufferSize;
+	ULONG                       m_ulPacketSize;
+	ULONG                       m_ulCurrentWritePosition;
+	LONG                        m_IsCurrentWritePositionUpdated;
+	KSSTATE                     m_KsState;
+	ULONG                       m_ulMixerInput;
+	BOOLEAN                     m_bCapture;
+	BOOLEAN                     m_bClockLock;
+	BOOLEAN                     m_bEoSReceived;
+	BOOLEAN                     m_bLastBufferRendered;
+	BOOLEAN                     m_bLoopback;
+	BOOLEAN                     m_bRawPath;
+	BOOLEAN                     m_bTimerRunning;    // Ticks may rearm the timer.
+	BOOLEAN                     m_bTimerIdle;
+
+	//
+	// The cable ring of a capture stream, in the object instead of its own
+	// allocation. The render side moves its write cursor, so it starts a
+	// line of its own rather than sharing one with the positions above.
+	//
+	DECLSPEC_CACHEALIGN
+	RingBuffer                  m_Ring;
+
+	//
+	// Cold: set up once or only touched by property requests and the rarer
+	// paths of a tick.
+	//
+	DECLSPEC_CACHEALIGN
+	ULONG                       m_ulNotificationsPerBuffer;
+	ULONG                       m_ulLastOsReadPacket;
+	ULONG                       m_ulLastOsWritePacket;
+	PWAVEFORMATEXTENSIBLE       m_pWfExt;           // Followed by the per-channel controls, one allocation.
+	PLONG                       m_plVolumeLevel;
+	PLONG                       m_plPeakMeter;
+	PBOOL                       m_pbMuted;
+	VolumeRamp                  m_VolumeRamp;
+
+	CableStream*                m_PairedStream;
+
+	StreamStatistics            m_Statistics;
+	BOOL                        m_bCaptureStarved;
+	LatencyProbe                m_LatencyProbe;
+	BOOLEAN                     m_bRegistersMapped;
+	CableStream*                m_pLoopbackSource;
+	volatile LONG               m_lLoopbackReaders; // Loopback streams reading this render stream.
+	ULONGLONG                   m_ullLoopbackCursor;
+	ULONG                       m_ulRingBufferCount;
+	BOOLEAN                     m_bMirroredRing;
+	EndpointGain*               m_pEndpointGain;
+	CableInjector*              m_pInjector;
+	ULONG                       m_ulInjectReader;
+	BOOLEAN                     m_bClockLocked;
+	ULONG                       m_ulClockLockOffset;
+	ULONGLONG                   m_ullClockLockSource;
+	LONGLONG                    m_hnsClockLockProgress;
+	CableScheduler*             m_pScheduler;
+	CABLE_SCHEDULER_ENTRY       m_SchedulerEntry;
+	ULONGLONG                   m_ullWorkQueued;    // Linear position the queued blocks reach.
+	ULONG                       m_ulWorkLookahead;
+	RING_OVERRUN_POLICY         m_OverrunPolicy;    // Applied while running, a stopped ring drops the oldest.
+	ULONG                       m_ulPrerollBytes;
+	ULONGLONG                   m_ullHistoryStart;  // Ring write position the render history starts at.
+	ULONGLONG                   m_ullHistoryQpc;    // Last put while stopped.
+	ULONGLONG                   m_ullRunPosition;   // Linear position at the last KSSTATE_RUN.
+	BOOLEAN                     m_bFirstAudioSeen;
+
+	VOID DetachInjector();
+	ULONG GetPrerollBytes(_In_ ULONGLONG Qpc);
+	VOID FindFirstAudio(_In_ ULONGLONG LinearPosition, _In_reads_bytes_(Count) const BYTE* Bytes, _In_ ULONG Count);
+
+	/*
+		Must be called with the position lock held.
+	*/
+	BOOLEAN IsIdle();
+	VOID RearmTimer(_In_ ULONGLONG Frequency);
+
+	/*
+		Must be called with the position lock held.
+	*/
+	NTSTATUS SetCurrentWritePositionInternal
+	(
+		_In_  ULONG ulCurrentWritePosition
+	);
+
+	//
+	// Hooks for the miniport stream, the defaults do nothing.
+	//
+
+	// Called after every timer tick.
+	virtual VOID OnTimerTick(_In_ const CABLE_STREAM_TICK* Tick);
+
+	// Called with the position lock held when the OS moves the write
+	// position, before it is stored.
+	virtual VOID OnWritePositionChanged(_In_ ULONG NewWritePosition);
+
+	// Called with the position lock held once the last byte before EoS was read.
+	virtual VOID OnLastBufferRendered(_In_ ULONGLONG LinearPosition);
+
+	// Returns the injection ring a capture stream adds to the cable, if any.
+	virtual CableInjector* GetCableInjector();
+
+private:
+	BOOLEAN                     m_bCableShutDown;
+
+	/*
+		One tick of the emulated DMA, run by the timer callback directly or
+		on the home processor through the scheduler.
+	*/
+	VOID RunTimerTick();
+
+	static CABLE_SCHEDULER_ROUTINE ScheduledTimerTick;
+	static CABLE_WORK_ROUTINE RunWork;
+
+	VOID UpdatePosition
+	(
+		_In_ LARGE_INTEGER ilQPC
+	);
+
+	VOID ApplyClockLock();
+
+	ULONG GetClockLockedDisplacement
+	(
+		_In_ LONGLONG hnsCurrentTime,
+		_In_ ULONG ByteDisplacement
+	);
+
+	VOID QueueWork
+	(
+		_In_ ULONG ByteDisplacement
+	);
+
+	VOID ZeroFillDma
+	(
+		_In_ ULONGLONG LinearPosition,
+		_In_ ULONG Count
+	);
+
+	VOID WriteBytes
+	(
+		_In_ ULONGLONG LinearPosition,
+		_In_ ULONG ByteDisplacement
+	);
+
+	VOID ReadBytes
+	(
+		_In_ ULONGLONG LinearPosition,
+		_In_ ULONG ByteDisplacement
+	);
+
+	ULONG ReadLoopback
+	(
+		_Out_writes_bytes_(Count) BYTE* Target,
+		_In_ ULONG Count
+	);
+};
+typedef CableStream *PCableStream;
@@ -0,0 +1,89 @@
+#include "CableTap.h"
+
+C_ASSERT(AUDIOMIRROR_TAP_HEADER_SIZE == PAGE_SIZE);
+C_ASSERT(sizeof(AUDIOMIRROR_TAP_HEADER) <= AUDIOMIRROR_TAP_HEADER_SIZE);
+C_ASSERT(FIELD_OFFSET(AUDIOMIRROR_TAP_HEADER, WritePosition) == 64);
+
+#pragma code_seg("PAGE")
+CableTap::CableTap()
+	: m_pHeader(NULL), m_pData(NULL), m_ulDataSize(0), m_ullWritePosition(0), m_ullPacketCount(0)
+{
+	PAGED_CODE();
+}
+
+#pragma code_seg("PAGE")
+NTSTATUS CableTap::Init(PWAVEFORMATEX format)
+{
+	LARGE_INTEGER       qpcFrequency;
+	ULONG               dataBytes;
+	NTSTATUS            ntStatus;
+
+	PAGED_CODE();
+
+	if (format->nBlockAlign == 0 || format->nAvgBytesPerSec == 0)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	dataBytes = ROUND_TO_PAGES(format->nAvgBytesPerSec);
+	m_ulDataSize = dataBytes - (dataBytes % format->nBlockAlign);
+
+	ntStatus = m_Section.Init(AUDIOMIRROR_TAP_HEADER_SIZE + dataBytes);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	m_pHeader = (PAUDIOMIRROR_TAP_HEADER)m_Section.GetSystemAddress();
+	m_pData = (BYTE*)m_pHeader + AUDIOMIRROR_TAP_HEADER_SIZE;
+
+	KeQueryPerformanceCounter(&qpcFrequency);
+	m_pHeader->Magic = AUDIOMIRROR_TAP_MAGIC;
+	m_pHeader->Version = AUDIOMIRROR_TAP_VERSION;
+	m_pHeader->HeaderSize = AUDIOMIRROR_TAP_HEADER_SIZE;
+	m_pHeader->DataSize = m_ulDataSize;
+	m_pHeader->SamplesPerSec = format->nSamplesPerSec;
+	m_pHeader->Channels = format->nChannels;
+	m_pHeader->BitsPerSample = format->wBitsPerSample;
+	m_pHeader->BlockAlign = format->nBlockAlign;
+	m_pHeader->QpcFrequency = qpcFrequency.QuadPart;
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+VOID CableTap::Write(const BYTE* pBytes, ULONG count)
+{
+	ULONGLONG end = m_ullWritePosition + count;
+
+	if (count == 0)
+	{
+		return;
+	}
+
+	// Only the newest ring full of a block can survive.
+	if (count > m_ulDataSize)
+	{
+		pBytes += count - m_ulDataSize;
+		count = m_ulDataSize;
+	}
+
+	InterlockedExchange64((volatile LONG64*)&m_pHeader->WriteLimit, (LONG64)end);
+
+	ULONG offset = (ULONG)((end - count) % m_ulDataSize);
+	while (count > 0)
+	{
+		ULONG run = min(count, m_ulDataSize - offset);
+		RtlCopyMemory(m_pData + offset, pBytes, run);
+		pBytes += run;
+		count -= run;
+		offset = 0;
+	}
+
+	m_ullWritePosition = end;
+	m_pHeader->PacketCount = ++m_ullPacketCount;
+	m_pHeader->LastWriteQpc = KeQueryPerformanceCounter(NULL).QuadPart;
+	InterlockedExchange64((volatile LONG64*)&m_pHeader->WritePosition, (LONG64)end);
+
+	m_Section.SignalEvents();
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "Globals.h"
+#include "AudioMirrorProperties.h"
+#include "AudioMirrorTap.h"
+#include "SharedSection.h"
+
+/*
+	Copy of the cable in a shared section that user mode readers map
+	read-only, so a recorder can follow the cable with plain memory loads
+	instead of opening the microphone through the audio engine.
+
+	The driver writes from the mixer's DPC and keeps its own cursor. It never
+	reads anything back from the shared view, so a reader scribbling on its
+	view cannot affect the driver.
+*/
+class CableTap
+{
+private:
+	SharedSection           m_Section;
+	PAUDIOMIRROR_TAP_HEADER m_pHeader;
+	BYTE*                   m_pData;
+	ULONG                   m_ulDataSize;
+	ULONGLONG               m_ullWritePosition;
+	ULONGLONG               m_ullPacketCount;
+public:
+	CableTap();
+
+	/*
+		Creates the section for about a second of audio in the given format.
+	*/
+	NTSTATUS Init(_In_ PWAVEFORMATEX format);
+
+	/*
+		Maps a read-only view into the current process.
+	*/
+	NTSTATUS MapIntoCurrentProcess(_Out_ PAUDIOMIRROR_TAP_MAPPING mapping)
+	{
+		return m_Section.MapIntoCurrentProcess(PAGE_READONLY, AUDIOMIRROR_TAP_VERSION, mapping);
+	}
+
+	/*
+		Registers or removes an event handle of the current process.
+	*/
+	NTSTATUS RegisterEvent(_In_ HANDLE eventHandle, _In_ BOOL registerEvent)
+	{
+		return m_Section.RegisterEvent(eventHandle, registerEvent);
+	}
+
+	/*
+		Appends a block of the cable and sets the registered events. Called at
+		DISPATCH_LEVEL.
+	*/
+	VOID Write(_In_reads_bytes_(count) const BYTE* pBytes, _In_ ULONG count);
+};
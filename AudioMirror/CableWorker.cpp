@@ -0,0 +1,275 @@
+#include "CableWorker.h"
+
+// How long Flush waits for the idle event before it looks at the queue again.
+#define CABLE_WORKER_FLUSH_POLL_MS  1
+
+#pragma code_seg("PAGE")
+CableWorker::CableWorker()
+	: m_lQueued(0), m_ulRetired(0), m_lStarted(0), m_lBusy(0), m_pThread(NULL), m_lExit(0),
+	m_Routine(NULL), m_Context(NULL), m_ulProcessor(AUDIOMIRROR_NO_PROCESSOR), m_pStatistics(NULL),
+	m_llQpcFrequency(0)
+{
+	PAGED_CODE();
+
+	RtlZeroMemory(m_Items, sizeof(m_Items));
+	KeInitializeEvent(&m_WorkEvent, SynchronizationEvent, FALSE);
+	KeInitializeEvent(&m_IdleEvent, SynchronizationEvent, FALSE);
+}
+
+#pragma code_seg("PAGE")
+CableWorker::~CableWorker()
+{
+	PAGED_CODE();
+
+	Stop();
+}
+
+#pragma code_seg("PAGE")
+NTSTATUS CableWorker::Init
+(
+	PCABLE_WORK_ROUTINE Routine,
+	PVOID Context,
+	ULONG Processor,
+	StreamStatistics* Statistics
+)
+{
+	LARGE_INTEGER qpcFrequency;
+	HANDLE hThread = NULL;
+	NTSTATUS ntStatus;
+
+	PAGED_CODE();
+
+	KeQueryPerformanceCounter(&qpcFrequency);
+	m_llQpcFrequency = qpcFrequency.QuadPart;
+	m_Routine = Routine;
+	m_Context = Context;
+	m_ulProcessor = Processor;
+	m_pStatistics = Statistics;
+
+	ntStatus = PsCreateSystemThread(&hThread, THREAD_ALL_ACCESS, NULL, NULL, NULL, WorkerThread, this);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	ntStatus = ObReferenceObjectByHandle(hThread, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID*)&m_pThread, NULL);
+	ZwClose(hThread);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		// The thread runs but cannot be waited for, tell it to go and
+		// leave it to finish on its own.
+		m_pThread = NULL;
+		InterlockedExchange(&m_lExit, 1);
+		KeSetEvent(&m_WorkEvent, IO_NO_INCREMENT, FALSE);
+	}
+
+	return ntStatus;
+}
+
+#pragma code_seg("PAGE")
+VOID CableWorker::Stop()
+{
+	PAGED_CODE();
+
+	if (m_pThread == NULL)
+	{
+		return;
+	}
+
+	InterlockedExchange(&m_lExit, 1);
+	KeSetEvent(&m_WorkEvent, IO_NO_INCREMENT, FALSE);
+	KeWaitForSingleObject(m_pThread, Executive, KernelMode, FALSE, NULL);
+	ObDereferenceObject(m_pThread);
+	m_pThread = NULL;
+}
+
+//=============================================================================
+#pragma code_seg()
+PCABLE_WORK_ITEM CableWorker::Queue
+(
+	ULONGLONG LinearPosition,
+	ULONG Bytes,
+	ULONGLONG Deadline
+)
+{
+	ULONG queued = (ULONG)m_lQueued;
+	PCABLE_WORK_ITEM item;
+
+	// The slot is free once the DPC took it back and the worker looked at it.
+	if (queued - m_ulRetired >= CABLE_WORKER_QUEUE_DEPTH ||
+		queued - (ULONG)m_lStarted >= CABLE_WORKER_QUEUE_DEPTH)
+	{
+		return NULL;
+	}
+
+	item = &m_Items[queued % CABLE_WORKER_QUEUE_DEPTH];
+	item->LinearPosition = LinearPosition;
+	item->Bytes = Bytes;
+	item->Deadline = Deadline;
+	item->Late = FALSE;
+	item->QueuedQpc = KeQueryPerformanceCounter(NULL).QuadPart;
+	InterlockedExchange(&item->State, CableWorkPending);
+
+	// Publishes the item, the exchange orders the writes above before it.
+	InterlockedExchange(&m_lQueued, (LONG)(queued + 1));
+
+	return item;
+}
+
+#pragma code_seg()
+VOID CableWorker::Signal()
+{
+	KeSetEvent(&m_WorkEvent, IO_NO_INCREMENT, FALSE);
+}
+
+#pragma code_seg()
+PCABLE_WORK_ITEM CableWorker::GetOutstanding(ULONG Index)
+{
+	if (Index >= (ULONG)m_lQueued - m_ulRetired)
+	{
+		return NULL;
+	}
+	return &m_Items[(m_ulRetired + Index) % CABLE_WORKER_QUEUE_DEPTH];
+}
+
+#pragma code_seg()
+BOOLEAN CableWorker::Abandon(PCABLE_WORK_ITEM Item)
+{
+	return InterlockedCompareExchange(&Item->State, CableWorkAbandoned, CableWorkPending) == CableWorkPending;
+}
+
+#pragma code_seg()
+VOID CableWorker::Retire()
+{
+	while (m_ulRetired != (ULONG)m_lQueued)
+	{
+		PCABLE_WORK_ITEM item = &m_Items[m_ulRetired % CABLE_WORKER_QUEUE_DEPTH];
+		LONG state = item->State;
+
+		if (state != CableWorkDone && state != CableWorkAbandoned)
+		{
+			break;
+		}
+		InterlockedExchange(&item->State, CableWorkFree);
+		m_ulRetired++;
+	}
+}
+
+#pragma code_seg()
+VOID CableWorker::Reset()
+{
+	while (m_ulRetired != (ULONG)m_lQueued)
+	{
+		InterlockedExchange(&m_Items[m_ulRetired % CABLE_WORKER_QUEUE_DEPTH].State, CableWorkFree);
+		m_ulRetired++;
+	}
+}
+
+//=============================================================================
+#pragma code_seg()
+PCABLE_WORK_ITEM CableWorker::Claim()
+/*++
+
+Routine Description:
+
+  Returns the next pending item, switched to claimed, and steps over the
+  ones the DPC abandoned. NULL once the worker caught up with the queue.
+
+--*/
+{
+	while (m_lStarted != m_lQueued)
+	{
+		PCABLE_WORK_ITEM item = &m_Items[(ULONG)m_lStarted % CABLE_WORKER_QUEUE_DEPTH];
+		LONG state = InterlockedCompareExchange(&item->State, CableWorkClaimed, CableWorkPending);
+
+		InterlockedIncrement(&m_lStarted);
+		if (state == CableWorkPending)
+		{
+			return item;
+		}
+	}
+
+	return NULL;
+}
+
+#pragma code_seg()
+VOID CableWorker::Run()
+{
+	for (;;)
+	{
+		PCABLE_WORK_ITEM item;
+
+		KeWaitForSingleObject(&m_WorkEvent, Executive, KernelMode, FALSE, NULL);
+		if (m_lExit)
+		{
+			break;
+		}
+
+		// Busy is raised before the started index moves, so Flush never sees
+		// the queue empty while a block is still being processed.
+		InterlockedExchange(&m_lBusy, 1);
+		while ((item = Claim()) != NULL)
+		{
+			LARGE_INTEGER qpcStart = KeQueryPerformanceCounter(NULL);
+
+			m_Routine(m_Context, item);
+
+			LARGE_INTEGER qpcEnd = KeQueryPerformanceCounter(NULL);
+			m_pStatistics->RecordWorkerBlock(
+				(ULONG)(((ULONGLONG)qpcStart.QuadPart - item->QueuedQpc) * 1000000 / m_llQpcFrequency),
+				(ULONG)((qpcEnd.QuadPart - qpcStart.QuadPart) * 1000000 / m_llQpcFrequency));
+
+			InterlockedExchange(&item->State, CableWorkDone);
+		}
+		InterlockedExchange(&m_lBusy, 0);
+
+		KeSetEvent(&m_IdleEvent, IO_NO_INCREMENT, FALSE);
+	}
+}
+
+#pragma code_seg()
+VOID CableWorker::WorkerThread(_In_ PVOID StartContext)
+{
+	CableWorker* worker = (CableWorker*)StartContext;
+	GROUP_AFFINITY affinity;
+	GROUP_AFFINITY previousAffinity;
+	PROCESSOR_NUMBER number;
+	BOOLEAN affinitized = FALSE;
+
+	KeSetPriorityThread(KeGetCurrentThread(), CABLE_WORKER_PRIORITY);
+
+	// Next to the timer DPC of the cable, so the blocks are still in its caches.
+	if (worker->m_ulProcessor != AUDIOMIRROR_NO_PROCESSOR &&
+		NT_SUCCESS(KeGetProcessorNumberFromIndex(worker->m_ulProcessor, &number)))
+	{
+		RtlZeroMemory(&affinity, sizeof(affinity));
+		affinity.Group = number.Group;
+		affinity.Mask = (KAFFINITY)1 << number.Number;
+		KeSetSystemGroupAffinityThread(&affinity, &previousAffinity);
+		affinitized = TRUE;
+	}
+
+	worker->Run();
+
+	if (affinitized)
+	{
+		KeRevertToUserGroupAffinityThread(&previousAffinity);
+	}
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID CableWorker::Flush()
+{
+	LARGE_INTEGER timeout;
+
+	PAGED_CODE();
+
+	timeout.QuadPart = -(LONGLONG)CABLE_WORKER_FLUSH_POLL_MS * 10000;
+	while (m_pThread != NULL && (m_lStarted != m_lQueued || m_lBusy))
+	{
+		KeSetEvent(&m_WorkEvent, IO_NO_INCREMENT, FALSE);
+		KeWaitForSingleObject(&m_IdleEvent, Executive, KernelMode, FALSE, &timeout);
+	}
+}
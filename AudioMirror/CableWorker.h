@@ -0,0 +1,157 @@
+#pragma once
+#include "Globals.h"
+#include "StreamStatistics.h"
+
+#define CABLE_WORKER_POOLTAG        'kwCA'
+
+//
+// Blocks a stream can have queued to its worker at once. A tick queues one,
+// position queries in between may queue a few more.
+//
+#define CABLE_WORKER_QUEUE_DEPTH    32
+
+//
+// Above the real-time threads of the audio engine's clients, below the
+// engine itself.
+//
+#define CABLE_WORKER_PRIORITY       (LOW_REALTIME_PRIORITY + 8)
+
+typedef enum _CABLE_WORK_STATE
+{
+	CableWorkFree = 0,
+	CableWorkPending,       // Queued by the DPC, the worker has not started it.
+	CableWorkClaimed,       // The worker is processing it.
+	CableWorkDone,
+	CableWorkAbandoned      // The deadline passed before the worker started it.
+} CABLE_WORK_STATE;
+
+//
+// One block of DMA buffer for the worker. The DPC fills it in, the state is
+// the only field both sides change and only with interlocked operations.
+//
+typedef struct _CABLE_WORK_ITEM
+{
+	volatile LONG   State;          // CABLE_WORK_STATE
+	BOOLEAN         Late;           // DPC side: the deadline passed while the worker had it.
+	ULONG           Bytes;
+	ULONGLONG       LinearPosition; // First byte of the block.
+	ULONGLONG       Deadline;       // The block is missed once the position moves past this.
+	ULONGLONG       QueuedQpc;
+} CABLE_WORK_ITEM, *PCABLE_WORK_ITEM;
+
+typedef VOID CABLE_WORK_ROUTINE(_In_ PVOID Context, _In_ PCABLE_WORK_ITEM Item);
+typedef CABLE_WORK_ROUTINE* PCABLE_WORK_ROUTINE;
+
+/*
+	Real-time worker thread of one stream.
+
+	The timer DPC of a stream in worker mode only advances the position,
+	queues the block it moved over or towards and wakes the worker, which
+	does the copying, mixing and gain. The queue is a fixed ring of items
+	with a single producer, the stream's position update, and a single
+	consumer, the worker. Neither side takes a lock: the DPC publishes an
+	item by moving the queued index past it, the worker claims it by
+	switching its state from pending to claimed, and hands it back by
+	setting it to done. The DPC takes back every item in order once it is
+	done or abandoned, so a slot is only reused after both sides are past it.
+
+	A DPC that finds an item still pending after its deadline switches it
+	to abandoned instead and runs the stream's fallback for it. Whichever
+	switch succeeds first owns the block, so a block is never processed
+	twice.
+*/
+class CableWorker
+{
+private:
+	CABLE_WORK_ITEM         m_Items[CABLE_WORKER_QUEUE_DEPTH];
+	// DPC side.
+	volatile LONG           m_lQueued;      // Next slot to fill, published after the item.
+	ULONG                   m_ulRetired;    // Oldest slot not taken back yet.
+	// Worker side.
+	volatile LONG           m_lStarted;     // Next slot the worker looks at.
+	volatile LONG           m_lBusy;
+
+	KEVENT                  m_WorkEvent;
+	KEVENT                  m_IdleEvent;
+	PKTHREAD                m_pThread;
+	volatile LONG           m_lExit;
+	PCABLE_WORK_ROUTINE     m_Routine;
+	PVOID                   m_Context;
+	ULONG                   m_ulProcessor;
+	StreamStatistics*       m_pStatistics;
+	LONGLONG                m_llQpcFrequency;
+
+	PCABLE_WORK_ITEM Claim();
+	VOID Run();
+
+	static KSTART_ROUTINE WorkerThread;
+public:
+	CableWorker();
+	~CableWorker();
+
+	/*
+		Starts the thread. It runs at CABLE_WORKER_PRIORITY, on the given
+		processor unless that is AUDIOMIRROR_NO_PROCESSOR. Block times and
+		queueing delays are recorded in the statistics.
+	*/
+	NTSTATUS Init
+	(
+		_In_ PCABLE_WORK_ROUTINE Routine,
+		_In_ PVOID Context,
+		_In_ ULONG Processor,
+		_In_ StreamStatistics* Statistics
+	);
+
+	//
+	// DPC side, called with the stream's position lock held.
+	//
+
+	/*
+		Queues a block, the worker sees it on the next Signal. Returns NULL
+		when the queue is full.
+	*/
+	PCABLE_WORK_ITEM Queue
+	(
+		_In_ ULONGLONG LinearPosition,
+		_In_ ULONG Bytes,
+		_In_ ULONGLONG Deadline
+	);
+
+	VOID Signal();
+
+	/*
+		Items not taken back yet, oldest first. Returns NULL past the newest.
+	*/
+	PCABLE_WORK_ITEM GetOutstanding(_In_ ULONG Index);
+
+	/*
+		Takes a pending item away from the worker. FALSE when the worker
+		already started or finished it.
+	*/
+	BOOLEAN Abandon(_Inout_ PCABLE_WORK_ITEM Item);
+
+	/*
+		Frees the oldest items that are done or abandoned.
+	*/
+	VOID Retire();
+
+	/*
+		Drops every item, for a stream that starts running again. Only valid
+		once Flush returned and before the position moves.
+	*/
+	VOID Reset();
+
+	//
+	// PASSIVE_LEVEL.
+	//
+
+	/*
+		Waits until the worker has finished every block queued so far.
+	*/
+	VOID Flush();
+
+	/*
+		Ends the thread, the destructor calls it as well.
+	*/
+	VOID Stop();
+};
@@ -2,6 +2,7 @@
 
 #include "IAdapterCommon.h"
 #include "AdapterCommon.h"
+#include "CableSimd.h"
 
 #define MAX_ADAPTERS				10 * 2
 
@@ -52,6 +53,9 @@ extern "C" NTSTATUS DriverEntry(
 	//print hello world
 	KdPrintEx((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "AudioMirror: DriverEntry\n"));
 
+	// Pick the mixing kernels before any stream can run.
+	CableSimdInitialize();
+
 	// Initialize the driver configuration object to register the
 	// entry point for the EvtDeviceAdd callback, KmdfHelloWorldEvtDeviceAdd
 	WDF_DRIVER_CONFIG_INIT(&config, WDF_NO_EVENT_CALLBACK);
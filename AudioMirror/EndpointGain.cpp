@@ -0,0 +1,178 @@
+#include "EndpointGain.h"
+
+// Gain table in 0.5 dB steps from 0 dB down to -96 dB, Q16.
+#define ENDPOINT_GAIN_STEP      0x8000
+
+static const LONG g_VolumeGainTable[] =
+{
+	 65536,  61870,  58409,  55142,  52057,  49145,  46396,  43801,
+	 41350,  39037,  36854,  34792,  32846,  31008,  29274,  27636,
+	 26090,  24631,  23253,  21952,  20724,  19565,  18471,  17437,
+	 16462,  15541,  14672,  13851,  13076,  12345,  11654,  11002,
+	 10387,   9806,   9257,   8739,   8250,   7789,   7353,   6942,
+	  6554,   6187,   5841,   5514,   5206,   4915,   4640,   4380,
+	  4135,   3904,   3685,   3479,   3285,   3101,   2927,   2764,
+	  2609,   2463,   2325,   2195,   2072,   1957,   1847,   1744,
+	  1646,   1554,   1467,   1385,   1308,   1234,   1165,   1100,
+	  1039,    981,    926,    874,    825,    779,    735,    694,
+	   655,    619,    584,    551,    521,    491,    464,    438,
+	   414,    390,    369,    348,    328,    310,    293,    276,
+	   261,    246,    233,    220,    207,    196,    185,    174,
+	   165,    155,    147,    139,    131,    123,    117,    110,
+	   104,     98,     93,     87,     83,     78,     74,     69,
+	    66,     62,     58,     55,     52,     49,     46,     44,
+	    41,     39,     37,     35,     33,     31,     29,     28,
+	    26,     25,     23,     22,     21,     20,     18,     17,
+	    16,     16,     15,     14,     13,     12,     12,     11,
+	    10,     10,      9,      9,      8,      8,      7,      7,
+	     7,      6,      6,      6,      5,      5,      5,      4,
+	     4,      4,      4,      3,      3,      3,      3,      3,
+	     3,      2,      2,      2,      2,      2,      2,      2,
+	     2,      2,      1,      1,      1,      1,      1,      1,
+	     1,
+};
+
+#pragma code_seg()
+EndpointGain::EndpointGain(ULONG channels)
+	: m_ulChannels(max(1, min(channels, (ULONG)ENDPOINT_GAIN_MAX_CHANNELS)))
+{
+	for (ULONG i = 0; i < ENDPOINT_GAIN_MAX_CHANNELS; ++i)
+	{
+		m_VolumeLevel[i] = VOLUME_SIGNED_MAXIMUM;
+		m_Mute[i] = FALSE;
+		m_Gain[i] = ENDPOINT_GAIN_UNITY;
+		m_PeakSample[i] = 0;
+	}
+}
+
+#pragma code_seg()
+VOID EndpointGain::UpdateGain(ULONG channel)
+{
+	LONG gain = m_Mute[channel] ? 0 : GainFromVolumeLevel(m_VolumeLevel[channel]);
+
+	InterlockedExchange(&m_Gain[channel], gain);
+}
+
+#pragma code_seg()
+LONG EndpointGain::GetVolumeLevel(ULONG channel)
+{
+	return (channel < m_ulChannels) ? m_VolumeLevel[channel] : VOLUME_SIGNED_MAXIMUM;
+}
+
+#pragma code_seg()
+VOID EndpointGain::SetVolumeLevel(ULONG channel, LONG level)
+{
+	if (channel < m_ulChannels)
+	{
+		InterlockedExchange(&m_VolumeLevel[channel], level);
+		UpdateGain(channel);
+	}
+}
+
+#pragma code_seg()
+BOOL EndpointGain::GetMute(ULONG channel)
+{
+	return (channel < m_ulChannels) ? (BOOL)m_Mute[channel] : FALSE;
+}
+
+#pragma code_seg()
+VOID EndpointGain::SetMute(ULONG channel, BOOL mute)
+{
+	if (channel < m_ulChannels)
+	{
+		InterlockedExchange(&m_Mute[channel], mute ? TRUE : FALSE);
+		UpdateGain(channel);
+	}
+}
+
+#pragma code_seg()
+VOID EndpointGain::TrackPeaks(const SHORT* pSamples, ULONG frames, ULONG channels, PCCABLE_SIMD_KERNELS kernels)
+{
+	LONG peaks[ENDPOINT_GAIN_MAX_CHANNELS] = { 0 };
+	ULONG tracked = min(channels, m_ulChannels);
+
+	if (channels > ENDPOINT_GAIN_MAX_CHANNELS)
+	{
+		return;
+	}
+
+	kernels->TrackPeaks(pSamples, frames, channels, peaks);
+
+	for (ULONG c = 0; c < tracked; ++c)
+	{
+		if (peaks[c] > m_PeakSample[c])
+		{
+			m_PeakSample[c] = peaks[c];
+		}
+	}
+}
+
+#pragma code_seg()
+LONG EndpointGain::GetPeakMeter(ULONG channel)
+{
+	LONG peak;
+
+	if (channel >= m_ulChannels)
+	{
+		return 0;
+	}
+
+	// -32768 reads as 32768, clamp so the scaled value stays below LONG_MAX.
+	// Not inside min, the macro would exchange a second time and read 0.
+	peak = InterlockedExchange(&m_PeakSample[channel], 0);
+	peak = min(peak, (LONG)SHRT_MAX);
+	return peak << 16;
+}
+
+#pragma code_seg()
+ULONG EndpointGain::CopyScaled(SHORT* pTarget, const SHORT* pSource, ULONG samples, ULONG firstChannel)
+{
+	LONG gains[ENDPOINT_GAIN_MAX_CHANNELS];
+	LONG peaks[ENDPOINT_GAIN_MAX_CHANNELS] = { 0 };
+	ULONG channel = firstChannel % m_ulChannels;
+
+	for (ULONG c = 0; c < m_ulChannels; ++c)
+	{
+		gains[c] = m_Gain[c];
+	}
+
+	for (ULONG i = 0; i < samples; ++i)
+	{
+		LONG sample = ((LONG)pSource[i] * gains[channel]) >> 16;
+		LONG magnitude = (sample < 0) ? -sample : sample;
+
+		pTarget[i] = (SHORT)sample;
+		if (magnitude > peaks[channel]) peaks[channel] = magnitude;
+		channel = (channel + 1 == m_ulChannels) ? 0 : channel + 1;
+	}
+
+	for (ULONG c = 0; c < m_ulChannels; ++c)
+	{
+		if (peaks[c] > m_PeakSample[c])
+		{
+			m_PeakSample[c] = peaks[c];
+		}
+	}
+
+	return channel;
+}
+
+#pragma code_seg()
+LONG EndpointGain::GainFromVolumeLevel(LONG level)
+{
+	ULONG step;
+
+	if (level >= 0)
+	{
+		return ENDPOINT_GAIN_UNITY;
+	}
+
+	// Round to the nearest table step.
+	step = (ULONG)((-(LONGLONG)level + ENDPOINT_GAIN_STEP / 2) / ENDPOINT_GAIN_STEP);
+	if (step >= ARRAYSIZE(g_VolumeGainTable))
+	{
+		return 0;
+	}
+
+	return g_VolumeGainTable[step];
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "Globals.h"
+#include "CableSimd.h"
+
+// Default volume settings.
+#define VOLUME_STEPPING_DELTA       0x8000
+#define VOLUME_SIGNED_MAXIMUM       0x00000000
+#define VOLUME_SIGNED_MINIMUM       (-96 * 0x10000)
+
+// Default peak meter settings
+#define PEAKMETER_STEPPING_DELTA    0x1000
+#define PEAKMETER_SIGNED_MAXIMUM    LONG_MAX
+#define PEAKMETER_SIGNED_MINIMUM    LONG_MIN
+
+#define ENDPOINT_GAIN_MAX_CHANNELS  8
+
+// Unity gain of the Q16 fixed point gains applied to the samples.
+#define ENDPOINT_GAIN_UNITY         0x10000
+
+/*
+	Endpoint volume, mute and peak meter of one wave/topology pair.
+
+	The topology filter's volume and mute nodes write the settings, the wave
+	streams apply them while they copy samples through the cable. Every
+	setting is a single LONG per channel and the effective Q16 gain is
+	recomputed on every change, so the copy reads it without taking a lock.
+*/
+class EndpointGain
+{
+private:
+	ULONG           m_ulChannels;
+	volatile LONG   m_VolumeLevel[ENDPOINT_GAIN_MAX_CHANNELS];
+	volatile LONG   m_Mute[ENDPOINT_GAIN_MAX_CHANNELS];
+	volatile LONG   m_Gain[ENDPOINT_GAIN_MAX_CHANNELS];
+	volatile LONG   m_PeakSample[ENDPOINT_GAIN_MAX_CHANNELS];
+
+	VOID UpdateGain(_In_ ULONG channel);
+public:
+	EndpointGain(_In_ ULONG channels);
+
+	ULONG GetChannels()
+	{
+		return m_ulChannels;
+	}
+
+	LONG GetVolumeLevel(_In_ ULONG channel);
+	VOID SetVolumeLevel(_In_ ULONG channel, _In_ LONG level);
+	BOOL GetMute(_In_ ULONG channel);
+	VOID SetMute(_In_ ULONG channel, _In_ BOOL mute);
+
+	/*
+		Returns the Q16 gain of a channel, zero while muted.
+	*/
+	LONG GetGain(_In_ ULONG channel)
+	{
+		return (channel < m_ulChannels) ? m_Gain[channel] : ENDPOINT_GAIN_UNITY;
+	}
+
+	/*
+		Records the peaks of a block of interleaved samples with the peak
+		kernel of the caller's CableSimdEnter bracket.
+	*/
+	VOID TrackPeaks(_In_reads_(frames * channels) const SHORT* pSamples, _In_ ULONG frames, _In_ ULONG channels, _In_ PCCABLE_SIMD_KERNELS kernels);
+
+	/*
+		Returns the peak on a channel since the last call, scaled to the
+		KSPROPERTY_AUDIO_PEAKMETER2 range.
+	*/
+	LONG GetPeakMeter(_In_ ULONG channel);
+
+	/*
+		Copies 16 bit samples with the endpoint gain applied and records their
+		peaks in the same pass. firstChannel is the channel of the first
+		sample, the channel of the sample after the last one is returned.
+	*/
+	ULONG CopyScaled
+	(
+		_Out_writes_(samples) SHORT* pTarget,
+		_In_reads_(samples) const SHORT* pSource,
+		_In_ ULONG samples,
+		_In_ ULONG firstChannel
+	);
+
+	/*
+		Converts a KS volume level (1/65536 dB) into a Q16 gain.
+	*/
+	static LONG GainFromVolumeLevel(_In_ LONG level);
+};
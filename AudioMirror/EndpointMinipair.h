@@ -8,6 +8,7 @@
 // forward declaration.
 typedef struct _ENDPOINT_MINIPAIR *PENDPOINT_MINIPAIR;
 struct AUDIOMODULE_DESCRIPTOR;
+class EndpointGain;
 
 // both wave & topology miniport create function prototypes have this form:
 typedef HRESULT(*PFNCREATEMINIPORT)(
@@ -199,4 +200,8 @@ typedef struct _ENDPOINT_MINIPAIR
 	AUDIOMODULE_DESCRIPTOR *        ModuleList;
 	ULONG                           ModuleListCount;
 	const GUID *                    ModuleNotificationDeviceId;
+
+	// Endpoint volume shared by the topology nodes and the wave streams,
+	// allocated per endpoint by MinipairDescriptorFactory.
+	EndpointGain*                   Gain;
 } ENDPOINT_MINIPAIR;
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "FormatHelper.h"
+
+#pragma code_seg()
+NTSTATUS FormatHelper::FindSupportedFormat
+(
+	_In_ PKSDATAFORMAT DataFormat,
+	_In_reads_(FormatCount) const KSDATAFORMAT_WAVEFORMATEXTENSIBLE* Formats,
+	_In_ ULONG FormatCount
+)
+{
+	for (ULONG iFormat = 0; iFormat < FormatCount; iFormat++)
+	{
+		const KSDATAFORMAT_WAVEFORMATEXTENSIBLE* pFormat = &Formats[iFormat];
+		// KSDATAFORMAT VALIDATION
+		if (!IsEqualGUIDAligned(pFormat->DataFormat.MajorFormat, DataFormat->MajorFormat)) { continue; }
+		if (!IsEqualGUIDAligned(pFormat->DataFormat.SubFormat, DataFormat->SubFormat)) { continue; }
+		if (!IsEqualGUIDAligned(pFormat->DataFormat.Specifier, DataFormat->Specifier)) { continue; }
+		if (pFormat->DataFormat.FormatSize < sizeof(KSDATAFORMAT_WAVEFORMATEX)) { continue; }
+
+		// WAVEFORMATEX VALIDATION
+		PWAVEFORMATEX pWaveFormat = reinterpret_cast<PWAVEFORMATEX>(DataFormat + 1);
+
+		if (pWaveFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE)
+		{
+			if (pWaveFormat->wFormatTag != EXTRACT_WAVEFORMATEX_ID(&(pFormat->WaveFormatExt.SubFormat))) { continue; }
+		}
+		if (pWaveFormat->nChannels != pFormat->WaveFormatExt.Format.nChannels) { continue; }
+		if (pWaveFormat->nSamplesPerSec != pFormat->WaveFormatExt.Format.nSamplesPerSec) { continue; }
+		if (pWaveFormat->nBlockAlign != pFormat->WaveFormatExt.Format.nBlockAlign) { continue; }
+		if (pWaveFormat->wBitsPerSample != pFormat->WaveFormatExt.Format.wBitsPerSample) { continue; }
+
+		if (pWaveFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE)
+		{
+			return STATUS_SUCCESS;
+		}
+
+		// WAVEFORMATEXTENSIBLE VALIDATION
+		if (pWaveFormat->cbSize < sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) { continue; }
+
+		PWAVEFORMATEXTENSIBLE pWaveFormatExt = reinterpret_cast<PWAVEFORMATEXTENSIBLE>(pWaveFormat);
+		if (pWaveFormatExt->Samples.wValidBitsPerSample != pFormat->WaveFormatExt.Samples.wValidBitsPerSample) { continue; }
+		if (pWaveFormatExt->dwChannelMask != pFormat->WaveFormatExt.dwChannelMask) { continue; }
+		if (!IsEqualGUIDAligned(pWaveFormatExt->SubFormat, pFormat->WaveFormatExt.SubFormat)) { continue; }
+
+		return STATUS_SUCCESS;
+	}
+
+	return STATUS_NO_MATCH;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "Globals.h"
+
+class FormatHelper
+{
+private:
+	FormatHelper();
+	~FormatHelper();
+public:
+	/*
+		Looks for a format in the supported device formats of a pin. Returns
+		STATUS_NO_MATCH if none of them matches.
+	*/
+	static NTSTATUS FindSupportedFormat
+	(
+		_In_ PKSDATAFORMAT DataFormat,
+		_In_reads_(FormatCount) const KSDATAFORMAT_WAVEFORMATEXTENSIBLE* Formats,
+		_In_ ULONG FormatCount
+	);
+};
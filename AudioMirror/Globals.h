@@ -1,5 +1,12 @@
 #pragma once
 
+#ifdef AUDIOMIRROR_HOST
+
+// User mode build of the cable core, see Host/HostKernel.h.
+#include "Host/HostKernel.h"
+
+#else
+
 #include <initguid.h>
 
 #include <portcls.h>
@@ -14,6 +21,8 @@
 #include "Macros.h"
 #include "NewDelete.h"
 
+#endif
+
 #define MINIADAPTER_POOLTAG         'aMmA'
 #define DRIVER_POOLTAG				'pDmA'
 #define WAVERT_STREAM_POOLTAG		'sWtR'
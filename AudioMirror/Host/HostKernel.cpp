@@ -0,0 +1,982 @@
+/*++
+
+Module Name:
+
+	HostKernel.cpp
+
+Abstract:
+
+	User mode implementation of the kernel API stand-in, see HostKernel.h.
+
+--*/
+
+#include "HostKernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+//=============================================================================
+// Pool
+//=============================================================================
+
+#define HOST_POOL_MAGIC     0x6c6f6f50  // 'Pool'
+#define HOST_POOL_MAGIC_CACHE_ALIGNED   0x6e67696c  // 'lign'
+#define HOST_POOL_MAX_TAGS  64
+
+// Precedes every allocation, keeps the returned pointer 16 byte aligned like
+// the kernel pool does on 64 bit. Cache aligned allocations start a cache
+// line further in, the header sits at the end of that line.
+typedef struct _HOST_POOL_HEADER
+{
+	SIZE_T  Size;
+	ULONG   Tag;
+	ULONG   Magic;
+} HOST_POOL_HEADER;
+
+C_ASSERT(sizeof(HOST_POOL_HEADER) == 16);
+
+typedef struct _HOST_POOL_TAG
+{
+	std::atomic<ULONG>      Tag;
+	std::atomic<LONG64>     Bytes;
+	std::atomic<LONG64>     Allocations;
+} HOST_POOL_TAG;
+
+// Constant initialized, so allocations before main are counted as well.
+static HOST_POOL_TAG        g_PoolTags[HOST_POOL_MAX_TAGS];
+static std::atomic<LONG64>  g_PoolBytes;
+static std::atomic<LONG64>  g_PoolAllocations;
+
+static HOST_POOL_TAG* FindPoolTag(ULONG tag, bool create)
+{
+	for (ULONG i = 0; i < HOST_POOL_MAX_TAGS; ++i)
+	{
+		ULONG current = g_PoolTags[i].Tag.load(std::memory_order_acquire);
+		if (current == tag)
+		{
+			return &g_PoolTags[i];
+		}
+		if (current == 0)
+		{
+			if (!create)
+			{
+				return nullptr;
+			}
+			if (g_PoolTags[i].Tag.compare_exchange_strong(current, tag) || current == tag)
+			{
+				return &g_PoolTags[i];
+			}
+		}
+	}
+	return nullptr;
+}
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE poolType, SIZE_T size, ULONG tag)
+{
+	HOST_POOL_HEADER* header;
+
+	if (poolType == NonPagedPoolNxCacheAligned)
+	{
+		BYTE* line = (BYTE*)aligned_alloc(SYSTEM_CACHE_ALIGNMENT_SIZE,
+			SYSTEM_CACHE_ALIGNMENT_SIZE + ALIGN_UP_BY(size, SYSTEM_CACHE_ALIGNMENT_SIZE));
+		if (line == nullptr)
+		{
+			return nullptr;
+		}
+		header = (HOST_POOL_HEADER*)(line + SYSTEM_CACHE_ALIGNMENT_SIZE) - 1;
+		header->Magic = HOST_POOL_MAGIC_CACHE_ALIGNED;
+	}
+	else
+	{
+		header = (HOST_POOL_HEADER*)malloc(sizeof(HOST_POOL_HEADER) + size);
+		if (header == nullptr)
+		{
+			return nullptr;
+		}
+		header->Magic = HOST_POOL_MAGIC;
+	}
+	header->Size = size;
+	header->Tag = tag;
+
+	g_PoolBytes += (LONG64)size;
+	g_PoolAllocations++;
+	if (tag != 0)
+	{
+		HOST_POOL_TAG* entry = FindPoolTag(tag, true);
+		if (entry != nullptr)
+		{
+			entry->Bytes += (LONG64)size;
+			entry->Allocations++;
+		}
+	}
+
+	return header + 1;
+}
+
+VOID ExFreePoolWithTag(PVOID p, ULONG tag)
+{
+	UNREFERENCED_PARAMETER(tag);
+
+	if (p == nullptr)
+	{
+		return;
+	}
+
+	HOST_POOL_HEADER* header = (HOST_POOL_HEADER*)p - 1;
+	ULONG magic = header->Magic;
+	if (magic != HOST_POOL_MAGIC && magic != HOST_POOL_MAGIC_CACHE_ALIGNED)
+	{
+		fprintf(stderr, "ExFreePoolWithTag: %p is not a pool allocation\n", p);
+		abort();
+	}
+	header->Magic = 0;
+
+	g_PoolBytes -= (LONG64)header->Size;
+	g_PoolAllocations--;
+	if (header->Tag != 0)
+	{
+		HOST_POOL_TAG* entry = FindPoolTag(header->Tag, false);
+		if (entry != nullptr)
+		{
+			entry->Bytes -= (LONG64)header->Size;
+			entry->Allocations--;
+		}
+	}
+
+	if (magic == HOST_POOL_MAGIC_CACHE_ALIGNED)
+	{
+		free((BYTE*)p - SYSTEM_CACHE_ALIGNMENT_SIZE);
+	}
+	else
+	{
+		free(header);
+	}
+}
+
+SIZE_T HostGetPoolBytes(ULONG tag)
+{
+	if (tag == 0)
+	{
+		return (SIZE_T)g_PoolBytes.load();
+	}
+	HOST_POOL_TAG* entry = FindPoolTag(tag, false);
+	return entry ? (SIZE_T)entry->Bytes.load() : 0;
+}
+
+SIZE_T HostGetPoolAllocations(ULONG tag)
+{
+	if (tag == 0)
+	{
+		return (SIZE_T)g_PoolAllocations.load();
+	}
+	HOST_POOL_TAG* entry = FindPoolTag(tag, false);
+	return entry ? (SIZE_T)entry->Allocations.load() : 0;
+}
+
+//
+// Every new goes through the pool, so memory freed with delete or with
+// ExFreePoolWithTag is always released by the allocator that handed it out.
+//
+PVOID operator new(size_t size, POOL_TYPE poolType, ULONG tag)
+{
+	PVOID result = ExAllocatePoolWithTag(poolType, size, tag);
+	if (result)
+	{
+		RtlZeroMemory(result, size);
+	}
+	return result;
+}
+
+PVOID operator new(size_t size, POOL_TYPE poolType)
+{
+	return operator new(size, poolType, (ULONG)'pDmA');
+}
+
+void operator delete(PVOID p, POOL_TYPE, ULONG tag)
+{
+	ExFreePoolWithTag(p, tag);
+}
+
+void operator delete(PVOID p, POOL_TYPE)
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+void* operator new(size_t size)
+{
+	PVOID result = ExAllocatePoolWithTag(NonPagedPoolNx, size, 0);
+	if (result == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return result;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return ExAllocatePoolWithTag(NonPagedPoolNx, size, 0);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return ExAllocatePoolWithTag(NonPagedPoolNx, size, 0);
+}
+
+void operator delete(void* p) noexcept
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+void operator delete[](void* p) noexcept
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+// Over-aligned types, e.g. CableStream with its cache aligned hot block. The
+// cache aligned pool covers every alignment the code asks for.
+static PVOID AllocateAligned(size_t size, std::align_val_t alignment)
+{
+	if ((size_t)alignment > SYSTEM_CACHE_ALIGNMENT_SIZE)
+	{
+		fprintf(stderr, "operator new: alignment %zu is not supported\n", (size_t)alignment);
+		abort();
+	}
+	return ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned, size, 0);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	PVOID result = AllocateAligned(size, alignment);
+	if (result == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return result;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return AllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return AllocateAligned(size, alignment);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+	ExFreePoolWithTag(p, 0);
+}
+
+//=============================================================================
+// Spin locks
+//=============================================================================
+
+VOID KeInitializeSpinLock(PKSPIN_LOCK lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+VOID KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE) != 0)
+	{
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED) != 0)
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+VOID KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+VOID KeAcquireSpinLock(PKSPIN_LOCK lock, PKIRQL oldIrql)
+{
+	*oldIrql = PASSIVE_LEVEL;
+	KeAcquireSpinLockAtDpcLevel(lock);
+}
+
+VOID KeReleaseSpinLock(PKSPIN_LOCK lock, KIRQL newIrql)
+{
+	UNREFERENCED_PARAMETER(newIrql);
+	KeReleaseSpinLockFromDpcLevel(lock);
+}
+
+//=============================================================================
+// Events and system threads
+//=============================================================================
+
+#define HOST_OBJECT_EVENT   1
+#define HOST_OBJECT_THREAD  2
+
+struct _KTHREAD
+{
+	UCHAR               ObjectType;
+	std::thread         Thread;
+	std::atomic<LONG>   References;
+	BOOLEAN             Terminated;     // Under g_WaitLock.
+	KPRIORITY           Priority;
+};
+
+// Thrown by PsTerminateSystemThread, caught where the thread started.
+struct HostThreadExit
+{
+};
+
+// One lock and condition for every wait, the host only has a handful of waiters.
+static std::mutex               g_WaitLock;
+static std::condition_variable  g_WaitChanged;
+static thread_local PKTHREAD    t_CurrentThread;
+
+// Only ever dereferenced and passed on, ObReferenceObjectByHandle ignores it.
+static POBJECT_TYPE             g_ThreadType = nullptr;
+POBJECT_TYPE* PsThreadType = &g_ThreadType;
+
+VOID KeInitializeEvent(PKEVENT event, EVENT_TYPE type, BOOLEAN state)
+{
+	event->ObjectType = HOST_OBJECT_EVENT;
+	event->Type = type;
+	event->State = state ? 1 : 0;
+	event->SetCount = 0;
+}
+
+LONG KeSetEvent(PKEVENT event, LONG increment, BOOLEAN wait)
+{
+	LONG previous;
+
+	UNREFERENCED_PARAMETER(increment);
+	UNREFERENCED_PARAMETER(wait);
+
+	{
+		std::lock_guard<std::mutex> guard(g_WaitLock);
+		InterlockedIncrement64(&event->SetCount);
+		previous = InterlockedExchange(&event->State, 1);
+	}
+	g_WaitChanged.notify_all();
+	return previous;
+}
+
+VOID KeClearEvent(PKEVENT event)
+{
+	InterlockedExchange(&event->State, 0);
+}
+
+NTSTATUS KeWaitForSingleObject
+(
+	PVOID object,
+	KWAIT_REASON waitReason,
+	KPROCESSOR_MODE waitMode,
+	BOOLEAN alertable,
+	PLARGE_INTEGER timeout
+)
+{
+	UCHAR objectType = *(UCHAR*)object;
+	std::unique_lock<std::mutex> lock(g_WaitLock);
+
+	UNREFERENCED_PARAMETER(waitReason);
+	UNREFERENCED_PARAMETER(waitMode);
+	UNREFERENCED_PARAMETER(alertable);
+
+	auto signalled = [&]() -> bool
+	{
+		if (objectType == HOST_OBJECT_THREAD)
+		{
+			return ((PKTHREAD)object)->Terminated != FALSE;
+		}
+		return ((PKEVENT)object)->State != 0;
+	};
+
+	if (timeout == nullptr)
+	{
+		g_WaitChanged.wait(lock, signalled);
+	}
+	else if (!g_WaitChanged.wait_for(lock, std::chrono::nanoseconds((std::max)(-timeout->QuadPart, (LONGLONG)0) * 100), signalled))
+	{
+		return STATUS_TIMEOUT;
+	}
+
+	if (objectType == HOST_OBJECT_EVENT && ((PKEVENT)object)->Type == SynchronizationEvent)
+	{
+		((PKEVENT)object)->State = 0;
+	}
+	return STATUS_SUCCESS;
+}
+
+static VOID HostReleaseThread(PKTHREAD thread)
+{
+	if (thread->References.fetch_sub(1) != 1)
+	{
+		return;
+	}
+	if (thread->Thread.get_id() == std::this_thread::get_id())
+	{
+		thread->Thread.detach();
+	}
+	else if (thread->Thread.joinable())
+	{
+		thread->Thread.join();
+	}
+	delete thread;
+}
+
+NTSTATUS PsCreateSystemThread
+(
+	HANDLE* threadHandle,
+	ULONG desiredAccess,
+	PVOID objectAttributes,
+	HANDLE processHandle,
+	PVOID clientId,
+	PKSTART_ROUTINE startRoutine,
+	PVOID startContext
+)
+{
+	UNREFERENCED_PARAMETER(desiredAccess);
+	UNREFERENCED_PARAMETER(objectAttributes);
+	UNREFERENCED_PARAMETER(processHandle);
+	UNREFERENCED_PARAMETER(clientId);
+
+	PKTHREAD thread = new KTHREAD;
+	thread->ObjectType = HOST_OBJECT_THREAD;
+	thread->Terminated = FALSE;
+	thread->Priority = 8;
+	// The handle and the running thread each hold a reference.
+	thread->References = 2;
+
+	thread->Thread = std::thread([thread, startRoutine, startContext]()
+	{
+		t_CurrentThread = thread;
+		try
+		{
+			startRoutine(startContext);
+		}
+		catch (const HostThreadExit&)
+		{
+		}
+		{
+			std::lock_guard<std::mutex> guard(g_WaitLock);
+			thread->Terminated = TRUE;
+		}
+		g_WaitChanged.notify_all();
+		HostReleaseThread(thread);
+	});
+
+	*threadHandle = thread;
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS PsTerminateSystemThread(NTSTATUS exitStatus)
+{
+	UNREFERENCED_PARAMETER(exitStatus);
+	throw HostThreadExit();
+}
+
+NTSTATUS ObReferenceObjectByHandle
+(
+	HANDLE handle,
+	ACCESS_MASK desiredAccess,
+	POBJECT_TYPE objectType,
+	KPROCESSOR_MODE accessMode,
+	PVOID* object,
+	PVOID handleInformation
+)
+{
+	UNREFERENCED_PARAMETER(desiredAccess);
+	UNREFERENCED_PARAMETER(objectType);
+	UNREFERENCED_PARAMETER(accessMode);
+	UNREFERENCED_PARAMETER(handleInformation);
+
+	((PKTHREAD)handle)->References++;
+	*object = handle;
+	return STATUS_SUCCESS;
+}
+
+VOID ObDereferenceObject(PVOID object)
+{
+	HostReleaseThread((PKTHREAD)object);
+}
+
+NTSTATUS ZwClose(HANDLE handle)
+{
+	HostReleaseThread((PKTHREAD)handle);
+	return STATUS_SUCCESS;
+}
+
+PKTHREAD KeGetCurrentThread()
+{
+	return t_CurrentThread;
+}
+
+KPRIORITY KeSetPriorityThread(PKTHREAD thread, KPRIORITY priority)
+{
+	KPRIORITY previous = thread->Priority;
+	thread->Priority = priority;
+	return previous;
+}
+
+//=============================================================================
+// Clock and timers
+//=============================================================================
+
+struct _EX_TIMER
+{
+	PEXT_CALLBACK   Callback;
+	PVOID           Context;
+	BOOLEAN         Set;
+	ULONGLONG       DueQpc;
+	LONGLONG        PeriodHns;
+	ULONGLONG       Sequence;   // Orders timers due at the same time by when they were set.
+};
+
+static std::atomic<ULONGLONG>   g_Qpc;
+static std::recursive_mutex     g_TimerLock;
+static std::vector<PEX_TIMER>   g_Timers;
+static HOST_TIMER_LATENESS      g_TimerLateness;
+static HOST_TIMER_OBSERVER      g_TimerObserver;
+static HOST_TIMER_PROCESSOR     g_TimerProcessor;
+static ULONGLONG                g_TimerSequence;
+static std::vector<PKDPC>       g_DpcQueue;
+static std::atomic<ULONG>       g_ProcessorCount(1);
+static thread_local ULONG       g_CurrentProcessor = 0;
+
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER frequency)
+{
+	LARGE_INTEGER now;
+
+	if (frequency != nullptr)
+	{
+		frequency->QuadPart = HOST_QPC_FREQUENCY;
+	}
+	now.QuadPart = (LONGLONG)g_Qpc.load(std::memory_order_acquire);
+	return now;
+}
+
+VOID HostSetTime(ULONGLONG qpc)
+{
+	g_Qpc.store(qpc, std::memory_order_release);
+}
+
+VOID HostAdvanceTime(ULONGLONG qpcTicks)
+{
+	g_Qpc.fetch_add(qpcTicks, std::memory_order_acq_rel);
+}
+
+ULONGLONG HostGetTime()
+{
+	return g_Qpc.load(std::memory_order_acquire);
+}
+
+static ULONGLONG HnsToQpc(LONGLONG hns)
+{
+	return (ULONGLONG)hns * HOST_QPC_FREQUENCY / 10000000;
+}
+
+PEX_TIMER ExAllocateTimer(PEXT_CALLBACK callback, PVOID context, ULONG attributes)
+{
+	UNREFERENCED_PARAMETER(attributes);
+
+	PEX_TIMER timer = new(NonPagedPoolNx, (ULONG)'rmTH') EX_TIMER;
+	if (timer == nullptr)
+	{
+		return nullptr;
+	}
+	timer->Callback = callback;
+	timer->Context = context;
+
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	g_Timers.push_back(timer);
+
+	return timer;
+}
+
+BOOLEAN ExSetTimer(PEX_TIMER timer, LONGLONG dueTime, LONGLONG period, PVOID parameters)
+{
+	UNREFERENCED_PARAMETER(parameters);
+
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	BOOLEAN wasSet = timer->Set;
+
+	// Negative due times are relative, positive ones absolute in 100ns.
+	timer->DueQpc = (dueTime < 0) ? HostGetTime() + HnsToQpc(-dueTime) : HnsToQpc(dueTime);
+	timer->PeriodHns = period;
+	timer->Sequence = g_TimerSequence++;
+	timer->Set = TRUE;
+
+	return wasSet;
+}
+
+BOOLEAN ExCancelTimer(PEX_TIMER timer, PVOID parameters)
+{
+	UNREFERENCED_PARAMETER(parameters);
+
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	BOOLEAN wasSet = timer->Set;
+	timer->Set = FALSE;
+
+	return wasSet;
+}
+
+BOOLEAN ExDeleteTimer(PEX_TIMER timer, BOOLEAN cancel, BOOLEAN wait, PVOID parameters)
+{
+	UNREFERENCED_PARAMETER(cancel);
+	UNREFERENCED_PARAMETER(wait);
+	UNREFERENCED_PARAMETER(parameters);
+
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	BOOLEAN wasSet = timer->Set;
+
+	g_Timers.erase(std::remove(g_Timers.begin(), g_Timers.end(), timer), g_Timers.end());
+	delete timer;
+
+	return wasSet;
+}
+
+VOID KeFlushQueuedDpcs()
+{
+	HostRunDpcs();
+}
+
+VOID HostSetTimerLateness(HOST_TIMER_LATENESS lateness)
+{
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	g_TimerLateness = lateness;
+}
+
+VOID HostSetTimerObserver(HOST_TIMER_OBSERVER observer)
+{
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	g_TimerObserver = observer;
+}
+
+VOID HostSetTimerProcessor(HOST_TIMER_PROCESSOR processor)
+{
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	g_TimerProcessor = processor;
+}
+
+LONGLONG HostGetTimerPeriod(PEX_TIMER timer)
+{
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	return timer->Set ? timer->PeriodHns : 0;
+}
+
+ULONGLONG HostGetNextTimerDue()
+{
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	ULONGLONG dueQpc = MAXULONGLONG;
+
+	for (PEX_TIMER timer : g_Timers)
+	{
+		if (timer->Set && timer->DueQpc < dueQpc)
+		{
+			dueQpc = timer->DueQpc;
+		}
+	}
+	return dueQpc;
+}
+
+ULONGLONG HostGetTimerDue(PEX_TIMER timer)
+{
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+	return timer->DueQpc;
+}
+
+ULONGLONG HostRunTimers(ULONGLONG untilQpc)
+{
+	ULONGLONG fired = 0;
+
+	for (;;)
+	{
+		PEX_TIMER next = nullptr;
+		ULONGLONG dueQpc = 0;
+		ULONGLONG scheduledQpc = 0;
+		HOST_TIMER_OBSERVER observer;
+
+		{
+			std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+			for (PEX_TIMER timer : g_Timers)
+			{
+				if (timer->Set && timer->DueQpc <= untilQpc &&
+					(next == nullptr || timer->DueQpc < next->DueQpc ||
+					 (timer->DueQpc == next->DueQpc && timer->Sequence < next->Sequence)))
+				{
+					next = timer;
+				}
+			}
+			if (next == nullptr)
+			{
+				break;
+			}
+
+			dueQpc = next->DueQpc;
+			scheduledQpc = dueQpc;
+			observer = g_TimerObserver;
+			g_CurrentProcessor = g_TimerProcessor ? g_TimerProcessor(next, next->Context) % g_ProcessorCount : 0;
+			if (g_TimerLateness)
+			{
+				dueQpc += HnsToQpc((std::max<LONGLONG>)(0, g_TimerLateness(next, next->Context)));
+			}
+			if (next->PeriodHns > 0)
+			{
+				// Periodic expiries stay on their grid, lateness does not accumulate.
+				next->DueQpc += HnsToQpc(next->PeriodHns);
+				next->Sequence = g_TimerSequence++;
+			}
+			else
+			{
+				next->Set = FALSE;
+			}
+		}
+
+		// A late expiry never moves the clock backwards. The DPCs the
+		// callback queued count towards its cost.
+		HostSetTime((std::max)(dueQpc, HostGetTime()));
+		if (observer)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			next->Callback(next, next->Context);
+			HostRunDpcs();
+			observer(next, scheduledQpc,
+				(ULONGLONG)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+		else
+		{
+			next->Callback(next, next->Context);
+			HostRunDpcs();
+		}
+		g_CurrentProcessor = 0;
+		fired++;
+	}
+
+	HostSetTime((std::max)(untilQpc, HostGetTime()));
+
+	return fired;
+}
+
+//=============================================================================
+// Processors and DPCs
+//=============================================================================
+
+VOID KeInitializeDpc(PRKDPC dpc, PKDEFERRED_ROUTINE routine, PVOID context)
+{
+	dpc->DeferredRoutine = routine;
+	dpc->DeferredContext = context;
+	dpc->SystemArgument1 = nullptr;
+	dpc->SystemArgument2 = nullptr;
+	dpc->TargetProcessor = MAXULONG;
+	dpc->Queued = FALSE;
+}
+
+NTSTATUS KeSetTargetProcessorDpcEx(PKDPC dpc, PPROCESSOR_NUMBER procNumber)
+{
+	ULONG index = (ULONG)procNumber->Group * HOST_MAX_PROCESSORS + procNumber->Number;
+
+	if (index >= g_ProcessorCount)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+	dpc->TargetProcessor = index;
+	return STATUS_SUCCESS;
+}
+
+VOID KeSetImportanceDpc(PRKDPC dpc, KDPC_IMPORTANCE importance)
+{
+	// Queued DPCs always run right after the current callback.
+	UNREFERENCED_PARAMETER(dpc);
+	UNREFERENCED_PARAMETER(importance);
+}
+
+BOOLEAN KeInsertQueueDpc(PRKDPC dpc, PVOID systemArgument1, PVOID systemArgument2)
+{
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+
+	if (dpc->Queued)
+	{
+		return FALSE;
+	}
+	dpc->SystemArgument1 = systemArgument1;
+	dpc->SystemArgument2 = systemArgument2;
+	dpc->Queued = TRUE;
+	g_DpcQueue.push_back(dpc);
+	return TRUE;
+}
+
+BOOLEAN KeRemoveQueueDpc(PRKDPC dpc)
+{
+	std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+
+	if (!dpc->Queued)
+	{
+		return FALSE;
+	}
+	dpc->Queued = FALSE;
+	g_DpcQueue.erase(std::remove(g_DpcQueue.begin(), g_DpcQueue.end(), dpc), g_DpcQueue.end());
+	return TRUE;
+}
+
+ULONG KeQueryActiveProcessorCountEx(USHORT groupNumber)
+{
+	UNREFERENCED_PARAMETER(groupNumber);
+	return g_ProcessorCount;
+}
+
+ULONG KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER procNumber)
+{
+	ULONG index = g_CurrentProcessor;
+
+	if (procNumber != nullptr)
+	{
+		KeGetProcessorNumberFromIndex(index, procNumber);
+	}
+	return index;
+}
+
+NTSTATUS KeGetProcessorNumberFromIndex(ULONG procIndex, PPROCESSOR_NUMBER procNumber)
+{
+	if (procIndex >= g_ProcessorCount)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+	procNumber->Group = (USHORT)(procIndex / HOST_MAX_PROCESSORS);
+	procNumber->Number = (UCHAR)(procIndex % HOST_MAX_PROCESSORS);
+	procNumber->Reserved = 0;
+	return STATUS_SUCCESS;
+}
+
+VOID KeSetSystemGroupAffinityThread(PGROUP_AFFINITY affinity, PGROUP_AFFINITY previousAffinity)
+{
+	if (previousAffinity != nullptr)
+	{
+		RtlZeroMemory(previousAffinity, sizeof(*previousAffinity));
+		previousAffinity->Group = (USHORT)(g_CurrentProcessor / HOST_MAX_PROCESSORS);
+		previousAffinity->Mask = (KAFFINITY)1 << (g_CurrentProcessor % HOST_MAX_PROCESSORS);
+	}
+	if (affinity->Mask != 0)
+	{
+		g_CurrentProcessor = (ULONG)affinity->Group * HOST_MAX_PROCESSORS + (ULONG)__builtin_ctzll(affinity->Mask);
+	}
+}
+
+VOID KeRevertToUserGroupAffinityThread(PGROUP_AFFINITY previousAffinity)
+{
+	KeSetSystemGroupAffinityThread(previousAffinity, nullptr);
+}
+
+VOID HostSetProcessorCount(ULONG count)
+{
+	g_ProcessorCount = (std::max)(count, (ULONG)1);
+}
+
+ULONGLONG HostRunDpcs()
+{
+	ULONGLONG ran = 0;
+	ULONG processor = g_CurrentProcessor;
+
+	for (;;)
+	{
+		PKDPC dpc = nullptr;
+
+		{
+			std::lock_guard<std::recursive_mutex> guard(g_TimerLock);
+			if (g_DpcQueue.empty())
+			{
+				break;
+			}
+			dpc = g_DpcQueue.front();
+			g_DpcQueue.erase(g_DpcQueue.begin());
+			dpc->Queued = FALSE;
+		}
+
+		if (dpc->TargetProcessor != MAXULONG)
+		{
+			g_CurrentProcessor = dpc->TargetProcessor;
+		}
+		dpc->DeferredRoutine(dpc, dpc->DeferredContext, dpc->SystemArgument1, dpc->SystemArgument2);
+		g_CurrentProcessor = processor;
+		ran++;
+	}
+
+	return ran;
+}
+
+//=============================================================================
+// Extended processor state
+//=============================================================================
+
+static thread_local ULONGLONG g_ExtendedStateSaves = 0;
+
+ULONG64 RtlGetEnabledExtendedFeatures(ULONG64 featureMask)
+{
+	ULONG64 enabled = XSTATE_MASK_LEGACY;
+
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+
+	// XGETBV faults unless the OS turned on XSAVE.
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE))
+	{
+		unsigned int low, high;
+
+		__asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		enabled = ((ULONG64)high << 32) | low;
+	}
+#endif
+
+	return enabled & featureMask;
+}
+
+NTSTATUS KeSaveExtendedProcessorState(ULONG64 mask, PXSTATE_SAVE xStateSave)
+{
+	xStateSave->Mask = mask;
+	g_ExtendedStateSaves++;
+	return STATUS_SUCCESS;
+}
+
+VOID KeRestoreExtendedProcessorState(PXSTATE_SAVE xStateSave)
+{
+	xStateSave->Mask = 0;
+}
+
+ULONGLONG HostGetExtendedStateSaves()
+{
+	return g_ExtendedStateSaves;
+}
@@ -0,0 +1,767 @@
+#pragma once
+
+/*++
+
+Module Name:
+
+	HostKernel.h
+
+Abstract:
+
+	User mode stand-in for the part of the kernel API the portable cable
+	core uses, so the core builds and runs on a Linux host. Globals.h
+	includes it instead of the WDK headers when AUDIOMIRROR_HOST is defined.
+
+	Spin locks are real spin locks and the interlocked functions are real
+	atomics, so the core can be run under ThreadSanitizer. The performance
+	counter is a virtual clock that only moves when the host moves it, and
+	EX_TIMERs fire from HostRunTimers in due time order on that clock. That
+	makes every run deterministic: a test or the simulator decides when time
+	passes and when timer callbacks are late.
+
+	Pool allocations keep a header with their size and tag, so a test can
+	ask how much pool a component holds.
+
+--*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <condition_variable>
+#include <cwchar>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define AUDIOMIRROR_HOST    1
+
+//
+// Basic types.
+//
+typedef void                VOID;
+typedef void*               PVOID;
+typedef char                CHAR;
+typedef unsigned char       UCHAR;
+typedef unsigned char       BYTE;
+typedef BYTE*               PBYTE;
+typedef unsigned char       BOOLEAN;
+typedef BOOLEAN*            PBOOLEAN;
+typedef int                 BOOL;
+typedef BOOL*               PBOOL;
+typedef int16_t             SHORT;
+typedef SHORT*              PSHORT;
+typedef uint16_t            USHORT;
+typedef uint16_t            WORD;
+typedef int32_t             LONG;
+typedef LONG*               PLONG;
+typedef uint32_t            ULONG;
+typedef ULONG*              PULONG;
+typedef uint32_t            DWORD;
+typedef uint32_t            UINT32;
+typedef uint64_t            UINT64;
+typedef int64_t             LONGLONG;
+typedef LONGLONG*           PLONGLONG;
+typedef int64_t             LONG64;
+typedef uint64_t            ULONGLONG;
+typedef ULONGLONG*          PULONGLONG;
+typedef uint64_t            ULONG64;
+typedef size_t              SIZE_T;
+typedef SIZE_T*             PSIZE_T;
+typedef uintptr_t           ULONG_PTR;
+typedef LONG                NTSTATUS;
+typedef UCHAR               KIRQL;
+typedef KIRQL*              PKIRQL;
+typedef void*               HANDLE;
+typedef wchar_t             WCHAR;
+typedef WCHAR*              PWSTR;
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		ULONG   LowPart;
+		LONG    HighPart;
+	};
+	LONGLONG    QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID
+{
+	ULONG   Data1;
+	USHORT  Data2;
+	USHORT  Data3;
+	UCHAR   Data4[8];
+} GUID;
+
+// Variadic, so the GUID may come from a STATIC_ macro like in the WDK.
+#define DEFINE_GUID(name, ...) \
+	[[maybe_unused]] static const GUID name = { __VA_ARGS__ }
+
+inline bool IsEqualGUID(const GUID& a, const GUID& b)
+{
+	return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+#define TRUE                1
+#define FALSE               0
+#define MAXULONG            0xffffffffUL
+#define MAXLONG             0x7fffffffL
+#define MAXULONGLONG        (~(ULONGLONG)0)
+#define MAXLONGLONG         ((LONGLONG)0x7fffffffffffffffLL)
+
+// LONG and ULONG are 32 bit like on Windows, so are their limits.
+#undef LONG_MAX
+#undef LONG_MIN
+#undef ULONG_MAX
+#define LONG_MAX            0x7fffffff
+#define LONG_MIN            (-LONG_MAX - 1)
+#define ULONG_MAX           0xffffffffU
+
+#ifndef min
+#define min(a, b)           (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)           (((a) > (b)) ? (a) : (b))
+#endif
+
+#define C_ASSERT(e)                     static_assert(e, #e)
+#define FIELD_OFFSET(type, field)       ((LONG)offsetof(type, field))
+#define ARRAYSIZE(a)                    (sizeof(a) / sizeof((a)[0]))
+#define SIZEOF_ARRAY(a)                 ARRAYSIZE(a)
+#define UNREFERENCED_PARAMETER(p)       ((void)(p))
+#define LODWORD(l)                      ((ULONG)((ULONGLONG)(l) & 0xffffffff))
+#define HIDWORD(l)                      ((ULONG)(((ULONGLONG)(l) >> 32) & 0xffffffff))
+
+#define PAGE_SIZE                       0x1000
+#define SYSTEM_CACHE_ALIGNMENT_SIZE     64
+#define DECLSPEC_CACHEALIGN             alignas(SYSTEM_CACHE_ALIGNMENT_SIZE)
+#define ALIGN_UP_BY(length, alignment) (((ULONG_PTR)(length) + (alignment) - 1) & ~(ULONG_PTR)((alignment) - 1))
+#define ROUND_TO_PAGES(size)            (((ULONG_PTR)(size) + PAGE_SIZE - 1) & ~(ULONG_PTR)(PAGE_SIZE - 1))
+#define PAGE_READONLY                   0x02
+#define PAGE_READWRITE                  0x04
+
+#define PASSIVE_LEVEL                   0
+#define DISPATCH_LEVEL                  2
+
+//
+// Annotations and code placement compile to nothing.
+//
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _Outptr_opt_
+#define _In_reads_(n)
+#define _In_reads_bytes_(n)
+#define _Out_writes_(n)
+#define _Out_writes_bytes_(n)
+#define _Inout_updates_(n)
+#define _Inout_updates_bytes_(n)
+#define _IRQL_limited_to_(l)
+#define __stdcall
+#define __cdecl
+
+#define PAGED_CODE()
+#define ASSERT(e)                       ((void)0)
+
+#define DPF(level, args)                ((void)0)
+#define DPF_ENTER(args)                 ((void)0)
+#define D_FUNC                          4
+#define D_BLAB                          3
+#define D_VERBOSE                       2
+#define D_TERSE                         1
+#define D_ERROR                         1
+
+//
+// Status codes.
+//
+#define NT_SUCCESS(status)                  (((NTSTATUS)(status)) >= 0)
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                      ((NTSTATUS)0x00000102L)
+#define STATUS_BUFFER_OVERFLOW              ((NTSTATUS)0x80000005L)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED              ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST       ((NTSTATUS)0xC0000010L)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_NOT_SUPPORTED                ((NTSTATUS)0xC00000BBL)
+#define STATUS_DEVICE_NOT_READY             ((NTSTATUS)0xC00000A3L)
+#define STATUS_INVALID_DEVICE_STATE         ((NTSTATUS)0xC0000184L)
+#define STATUS_NOT_FOUND                    ((NTSTATUS)0xC0000225L)
+#define STATUS_OBJECT_NAME_NOT_FOUND        ((NTSTATUS)0xC0000034L)
+#define STATUS_NO_MATCH                     ((NTSTATUS)0xC0000272L)
+#define STATUS_DATA_LATE_ERROR              ((NTSTATUS)0xC000009EL)
+#define STATUS_DATA_OVERRUN                 ((NTSTATUS)0xC000003CL)
+
+//
+// Memory.
+//
+#define RtlCopyMemory(d, s, n)          memcpy((d), (s), (n))
+#define RtlMoveMemory(d, s, n)          memmove((d), (s), (n))
+#define RtlZeroMemory(d, n)             memset((d), 0, (n))
+#define RtlFillMemory(d, n, v)          memset((d), (v), (n))
+
+typedef enum _POOL_TYPE
+{
+	NonPagedPool = 0,
+	PagedPool = 1,
+	NonPagedPoolNx = 512,
+	NonPagedPoolNxCacheAligned = NonPagedPoolNx + 4,
+} POOL_TYPE;
+
+PVOID ExAllocatePoolWithTag(_In_ POOL_TYPE poolType, _In_ SIZE_T size, _In_ ULONG tag);
+VOID ExFreePoolWithTag(_In_ PVOID p, _In_ ULONG tag);
+
+// Counterparts of NewDelete.cpp. Object allocations are zeroed like in the driver.
+PVOID operator new(size_t size, POOL_TYPE poolType, ULONG tag);
+PVOID operator new(size_t size, POOL_TYPE poolType);
+void operator delete(PVOID p, POOL_TYPE poolType, ULONG tag);
+void operator delete(PVOID p, POOL_TYPE poolType);
+
+/*
+	Pool currently held, all tags or the given one.
+*/
+SIZE_T HostGetPoolBytes(_In_ ULONG tag = 0);
+SIZE_T HostGetPoolAllocations(_In_ ULONG tag = 0);
+
+//
+// Interlocked operations and barriers.
+//
+inline LONG InterlockedExchange(volatile LONG* target, LONG value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG64 InterlockedExchange64(volatile LONG64* target, LONG64 value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedCompareExchange(volatile LONG* target, LONG exchange, LONG comparand)
+{
+	__atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+
+inline LONG64 InterlockedCompareExchange64(volatile LONG64* target, LONG64 exchange, LONG64 comparand)
+{
+	__atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+
+inline LONG InterlockedIncrement(volatile LONG* target)
+{
+	return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG* target)
+{
+	return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedAdd(volatile LONG* target, LONG value)
+{
+	return __atomic_add_fetch(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG64 InterlockedIncrement64(volatile LONG64* target)
+{
+	return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG64 InterlockedAdd64(volatile LONG64* target, LONG64 value)
+{
+	return __atomic_add_fetch(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline PVOID InterlockedExchangePointer(PVOID volatile* target, PVOID value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile* target, PVOID exchange, PVOID comparand)
+{
+	__atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+
+inline PVOID ReadPointerAcquire(PVOID const volatile* source)
+{
+	return __atomic_load_n(source, __ATOMIC_ACQUIRE);
+}
+
+#define KeMemoryBarrier()               __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+inline BOOLEAN _BitScanReverse(PULONG index, ULONG mask)
+{
+	if (mask == 0)
+	{
+		return FALSE;
+	}
+	*index = 31 - (ULONG)__builtin_clz(mask);
+	return TRUE;
+}
+
+//
+// Spin locks. IRQL is not modelled, a lock only excludes other threads.
+//
+typedef ULONG_PTR       KSPIN_LOCK;
+typedef KSPIN_LOCK*     PKSPIN_LOCK;
+
+VOID KeInitializeSpinLock(_Out_ PKSPIN_LOCK lock);
+VOID KeAcquireSpinLock(_Inout_ PKSPIN_LOCK lock, _Out_ PKIRQL oldIrql);
+VOID KeReleaseSpinLock(_Inout_ PKSPIN_LOCK lock, _In_ KIRQL newIrql);
+VOID KeAcquireSpinLockAtDpcLevel(_Inout_ PKSPIN_LOCK lock);
+VOID KeReleaseSpinLockFromDpcLevel(_Inout_ PKSPIN_LOCK lock);
+
+//
+// Events and system threads. Unlike the timers these are real: a system
+// thread is a std::thread, and waiting blocks it until the object is
+// signalled or the timeout, in real time, expired. Every set is counted, so
+// a test can also just check that the driver signalled an event.
+//
+typedef enum _EVENT_TYPE
+{
+	NotificationEvent,
+	SynchronizationEvent
+} EVENT_TYPE;
+
+typedef enum _KWAIT_REASON
+{
+	Executive
+} KWAIT_REASON;
+
+typedef enum _MODE
+{
+	KernelMode,
+	UserMode
+} KPROCESSOR_MODE;
+
+typedef struct _KEVENT
+{
+	UCHAR           ObjectType;     // Tells KeWaitForSingleObject an event from a thread.
+	EVENT_TYPE      Type;
+	volatile LONG   State;
+	volatile LONG64 SetCount;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef struct _MDL* PMDL;
+
+VOID KeInitializeEvent(_Out_ PKEVENT event, _In_ EVENT_TYPE type, _In_ BOOLEAN state);
+LONG KeSetEvent(_Inout_ PKEVENT event, _In_ LONG increment, _In_ BOOLEAN wait);
+VOID KeClearEvent(_Inout_ PKEVENT event);
+
+/*
+	Waits for an event or for a thread to end. The timeout is relative and
+	negative in 100ns units like in the kernel, NULL waits forever.
+*/
+NTSTATUS KeWaitForSingleObject
+(
+	_In_ PVOID object,
+	_In_ KWAIT_REASON waitReason,
+	_In_ KPROCESSOR_MODE waitMode,
+	_In_ BOOLEAN alertable,
+	_In_opt_ PLARGE_INTEGER timeout
+);
+
+typedef struct _KTHREAD KTHREAD, *PKTHREAD, *PRKTHREAD;
+typedef VOID KSTART_ROUTINE(_In_ PVOID StartContext);
+typedef KSTART_ROUTINE* PKSTART_ROUTINE;
+typedef LONG KPRIORITY;
+typedef ULONG ACCESS_MASK;
+typedef ULONG_PTR KAFFINITY;
+typedef PVOID POBJECT_TYPE;
+
+#define IO_NO_INCREMENT                 0
+#define LOW_REALTIME_PRIORITY           16
+#define HIGH_PRIORITY                   31
+#define THREAD_ALL_ACCESS               0x001FFFFF
+
+typedef struct _GROUP_AFFINITY
+{
+	KAFFINITY   Mask;
+	USHORT      Group;
+	USHORT      Reserved[3];
+} GROUP_AFFINITY, *PGROUP_AFFINITY;
+
+extern POBJECT_TYPE* PsThreadType;
+
+/*
+	Starts the routine on a new std::thread. The handle is the thread
+	object, ZwClose and ObDereferenceObject drop references to it and the
+	last one joins the thread.
+*/
+NTSTATUS PsCreateSystemThread
+(
+	_Out_ HANDLE* threadHandle,
+	_In_ ULONG desiredAccess,
+	_In_opt_ PVOID objectAttributes,
+	_In_opt_ HANDLE processHandle,
+	_Out_opt_ PVOID clientId,
+	_In_ PKSTART_ROUTINE startRoutine,
+	_In_opt_ PVOID startContext
+);
+[[noreturn]] NTSTATUS PsTerminateSystemThread(_In_ NTSTATUS exitStatus);
+NTSTATUS ObReferenceObjectByHandle
+(
+	_In_ HANDLE handle,
+	_In_ ACCESS_MASK desiredAccess,
+	_In_opt_ POBJECT_TYPE objectType,
+	_In_ KPROCESSOR_MODE accessMode,
+	_Out_ PVOID* object,
+	_Out_opt_ PVOID handleInformation
+);
+VOID ObDereferenceObject(_In_ PVOID object);
+NTSTATUS ZwClose(_In_ HANDLE handle);
+
+PKTHREAD KeGetCurrentThread();
+
+// Priorities are only remembered, the host threads all run at the default.
+KPRIORITY KeSetPriorityThread(_Inout_ PKTHREAD thread, _In_ KPRIORITY priority);
+
+// Moves the calling thread to the lowest processor of the mask, that is all
+// KeGetCurrentProcessorIndex sees of it.
+VOID KeSetSystemGroupAffinityThread(_In_ PGROUP_AFFINITY affinity, _Out_opt_ PGROUP_AFFINITY previousAffinity);
+VOID KeRevertToUserGroupAffinityThread(_In_ PGROUP_AFFINITY previousAffinity);
+
+//
+// Performance counter. Virtual, HostSetTime and HostAdvanceTime move it.
+//
+#define HOST_QPC_FREQUENCY              10000000LL
+
+LARGE_INTEGER KeQueryPerformanceCounter(_Out_opt_ PLARGE_INTEGER frequency);
+
+VOID HostSetTime(_In_ ULONGLONG qpc);
+VOID HostAdvanceTime(_In_ ULONGLONG qpcTicks);
+ULONGLONG HostGetTime();
+
+// From ks.h, 100ns units of a performance counter value.
+#define NANOSECONDS 10000000
+#define KSCONVERT_PERFORMANCE_TIME(Frequency, PerformanceTime) \
+	((((ULONGLONG)(ULONG)(PerformanceTime).HighPart * NANOSECONDS / (Frequency)) << 32) + \
+	((((((ULONGLONG)(ULONG)(PerformanceTime).HighPart * NANOSECONDS) % (Frequency)) << 32) + \
+	((ULONGLONG)(PerformanceTime).LowPart * NANOSECONDS)) / (Frequency)))
+
+//
+// EX_TIMER. A set timer is due on the virtual clock, HostRunTimers fires
+// every due timer in order and moves the clock to each expiry.
+//
+typedef struct _EX_TIMER EX_TIMER, *PEX_TIMER;
+typedef VOID EXT_CALLBACK(_In_ PEX_TIMER Timer, _In_opt_ PVOID Context);
+typedef EXT_CALLBACK* PEXT_CALLBACK;
+
+#define EX_TIMER_HIGH_RESOLUTION        0x4
+
+PEX_TIMER ExAllocateTimer(_In_ PEXT_CALLBACK callback, _In_opt_ PVOID context, _In_ ULONG attributes);
+BOOLEAN ExSetTimer(_In_ PEX_TIMER timer, _In_ LONGLONG dueTime, _In_ LONGLONG period, _In_opt_ PVOID parameters);
+BOOLEAN ExCancelTimer(_Inout_ PEX_TIMER timer, _In_opt_ PVOID parameters);
+BOOLEAN ExDeleteTimer(_In_ PEX_TIMER timer, _In_ BOOLEAN cancel, _In_ BOOLEAN wait, _In_opt_ PVOID parameters);
+VOID KeFlushQueuedDpcs();
+
+/*
+	Lateness in 100ns units added to a timer expiry before its callback
+	runs, called once per expiry. Models DPC latency and timer coalescing.
+	HostGetTimerDue tells the expiry being delayed.
+*/
+typedef std::function<LONGLONG(PEX_TIMER timer, PVOID context)> HOST_TIMER_LATENESS;
+VOID HostSetTimerLateness(_In_ HOST_TIMER_LATENESS lateness);
+
+/*
+	Called after every timer callback with the real time it took in
+	nanoseconds and the virtual time it was due at. The virtual clock does
+	not move while a callback runs, this is what the callback costs the CPU.
+*/
+typedef std::function<VOID(PEX_TIMER timer, ULONGLONG dueQpc, ULONGLONG callbackNs)> HOST_TIMER_OBSERVER;
+VOID HostSetTimerObserver(_In_ HOST_TIMER_OBSERVER observer);
+
+/*
+	Fires every timer due up to and including the given time, in expiry
+	order, and leaves the clock at that time. Returns the number of
+	callbacks run.
+*/
+ULONGLONG HostRunTimers(_In_ ULONGLONG untilQpc);
+
+/*
+	Processor a timer expiry runs on, called once per expiry. Without one
+	every timer fires on processor 0.
+*/
+typedef std::function<ULONG(PEX_TIMER timer, PVOID context)> HOST_TIMER_PROCESSOR;
+VOID HostSetTimerProcessor(_In_ HOST_TIMER_PROCESSOR processor);
+
+/*
+	Time the next set timer is due, before any lateness. MAXULONGLONG when
+	no timer is set. Lets a simulation interleave its own events with the
+	timers exactly.
+*/
+ULONGLONG HostGetNextTimerDue();
+
+/*
+	Time a timer is due, before any lateness. Within a lateness callback
+	this is the expiry the callback is asked about.
+*/
+ULONGLONG HostGetTimerDue(_In_ PEX_TIMER timer);
+
+/*
+	Period of a set timer in 100ns units, 0 when it is not set.
+*/
+LONGLONG HostGetTimerPeriod(_In_ PEX_TIMER timer);
+
+//
+// Processors and DPCs. Timers and DPCs all run on the thread that calls
+// HostRunTimers, but the host models HostSetProcessorCount processors: a
+// timer callback runs on the processor HostSetTimerProcessor picks, and
+// DPCs it queues run on their target processor right after it returns, in
+// queue order. The current processor is per thread.
+//
+#define ALL_PROCESSOR_GROUPS            0xffff
+#define HOST_MAX_PROCESSORS             64
+
+typedef struct _PROCESSOR_NUMBER
+{
+	USHORT  Group;
+	UCHAR   Number;
+	UCHAR   Reserved;
+} PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+typedef struct _KDPC KDPC, *PKDPC, *PRKDPC;
+typedef VOID KDEFERRED_ROUTINE(_In_ PKDPC Dpc, _In_opt_ PVOID DeferredContext, _In_opt_ PVOID SystemArgument1, _In_opt_ PVOID SystemArgument2);
+typedef KDEFERRED_ROUTINE* PKDEFERRED_ROUTINE;
+
+struct _KDPC
+{
+	PKDEFERRED_ROUTINE  DeferredRoutine;
+	PVOID               DeferredContext;
+	PVOID               SystemArgument1;
+	PVOID               SystemArgument2;
+	ULONG               TargetProcessor;    // MAXULONG runs it where it was queued.
+	BOOLEAN             Queued;
+};
+
+typedef enum _KDPC_IMPORTANCE
+{
+	LowImportance,
+	MediumImportance,
+	HighImportance,
+	MediumHighImportance
+} KDPC_IMPORTANCE;
+
+VOID KeInitializeDpc(_Out_ PRKDPC dpc, _In_ PKDEFERRED_ROUTINE routine, _In_opt_ PVOID context);
+NTSTATUS KeSetTargetProcessorDpcEx(_Inout_ PKDPC dpc, _In_ PPROCESSOR_NUMBER procNumber);
+VOID KeSetImportanceDpc(_Inout_ PRKDPC dpc, _In_ KDPC_IMPORTANCE importance);
+BOOLEAN KeInsertQueueDpc(_Inout_ PRKDPC dpc, _In_opt_ PVOID systemArgument1, _In_opt_ PVOID systemArgument2);
+BOOLEAN KeRemoveQueueDpc(_Inout_ PRKDPC dpc);
+
+ULONG KeQueryActiveProcessorCountEx(_In_ USHORT groupNumber);
+ULONG KeGetCurrentProcessorNumberEx(_Out_opt_ PPROCESSOR_NUMBER procNumber);
+NTSTATUS KeGetProcessorNumberFromIndex(_In_ ULONG procIndex, _Out_ PPROCESSOR_NUMBER procNumber);
+#define KeGetCurrentProcessorIndex()    KeGetCurrentProcessorNumberEx(NULL)
+
+VOID HostSetProcessorCount(_In_ ULONG count);
+
+/*
+	Runs every queued DPC, including the ones they queue, and returns how
+	many ran. KeFlushQueuedDpcs and HostRunTimers call it.
+*/
+ULONGLONG HostRunDpcs();
+
+//
+// Extended processor state. User mode threads get their vector registers
+// saved by the OS, so the save and restore only count how often a thread
+// brackets vector work. The enabled features are what XGETBV reports.
+//
+#define XSTATE_MASK_LEGACY_FLOATING_POINT   0x0000000000000001ULL
+#define XSTATE_MASK_LEGACY_SSE              0x0000000000000002ULL
+#define XSTATE_MASK_LEGACY                  (XSTATE_MASK_LEGACY_FLOATING_POINT | XSTATE_MASK_LEGACY_SSE)
+#define XSTATE_MASK_AVX                     0x0000000000000004ULL
+#define XSTATE_MASK_AVX512                  0x00000000000000e0ULL
+
+typedef struct _XSTATE_SAVE
+{
+	ULONG64 Mask;
+} XSTATE_SAVE, *PXSTATE_SAVE;
+
+ULONG64 RtlGetEnabledExtendedFeatures(_In_ ULONG64 featureMask);
+NTSTATUS KeSaveExtendedProcessorState(_In_ ULONG64 mask, _Out_ PXSTATE_SAVE xStateSave);
+VOID KeRestoreExtendedProcessorState(_In_ PXSTATE_SAVE xStateSave);
+
+// Saves of the calling thread since it started.
+ULONGLONG HostGetExtendedStateSaves();
+
+//
+// Kernel streaming types the core uses.
+//
+typedef enum
+{
+	KSSTATE_STOP,
+	KSSTATE_ACQUIRE,
+	KSSTATE_PAUSE,
+	KSSTATE_RUN
+} KSSTATE, *PKSSTATE;
+
+typedef enum
+{
+	AUDIO_CURVE_TYPE_NONE = 0,
+	AUDIO_CURVE_TYPE_WINDOWS_FADE = 1
+} AUDIO_CURVE_TYPE;
+
+typedef struct
+{
+	ULONG   Size;
+	ULONG   Count;
+} KSMULTIPLE_ITEM, *PKSMULTIPLE_ITEM;
+
+#define WAVE_FORMAT_PCM                 1
+#define WAVE_FORMAT_EXTENSIBLE          0xFFFE
+
+#pragma pack(push, 1)
+typedef struct tWAVEFORMATEX
+{
+	WORD    wFormatTag;
+	WORD    nChannels;
+	DWORD   nSamplesPerSec;
+	DWORD   nAvgBytesPerSec;
+	WORD    nBlockAlign;
+	WORD    wBitsPerSample;
+	WORD    cbSize;
+} WAVEFORMATEX, *PWAVEFORMATEX;
+
+typedef struct
+{
+	WAVEFORMATEX    Format;
+	union
+	{
+		WORD    wValidBitsPerSample;
+		WORD    wSamplesPerBlock;
+		WORD    wReserved;
+	} Samples;
+	DWORD           dwChannelMask;
+	GUID            SubFormat;
+} WAVEFORMATEXTENSIBLE, *PWAVEFORMATEXTENSIBLE;
+#pragma pack(pop)
+
+#define KSAUDIO_SPEAKER_MONO            0x00000004
+#define KSAUDIO_SPEAKER_STEREO          0x00000003
+
+typedef struct
+{
+	ULONG   FormatSize;
+	ULONG   Flags;
+	ULONG   SampleSize;
+	ULONG   Reserved;
+	GUID    MajorFormat;
+	GUID    SubFormat;
+	GUID    Specifier;
+} KSDATAFORMAT, *PKSDATAFORMAT;
+
+typedef struct
+{
+	KSDATAFORMAT    DataFormat;
+	WAVEFORMATEX    WaveFormatEx;
+} KSDATAFORMAT_WAVEFORMATEX, *PKSDATAFORMAT_WAVEFORMATEX;
+
+typedef struct
+{
+	KSDATAFORMAT            DataFormat;
+	WAVEFORMATEXTENSIBLE    WaveFormatExt;
+} KSDATAFORMAT_WAVEFORMATEXTENSIBLE, *PKSDATAFORMAT_WAVEFORMATEXTENSIBLE;
+
+DEFINE_GUID(KSDATAFORMAT_TYPE_AUDIO, 0x73647561, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 });
+DEFINE_GUID(KSDATAFORMAT_SUBTYPE_PCM, 0x00000001, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 });
+DEFINE_GUID(KSDATAFORMAT_SPECIFIER_WAVEFORMATEX, 0x05589f81, 0xc356, 0x11ce, { 0xbf, 0x01, 0x00, 0xaa, 0x00, 0x55, 0x59, 0x5a });
+
+#define IsEqualGUIDAligned(a, b)        IsEqualGUID((a), (b))
+#define EXTRACT_WAVEFORMATEX_ID(guid)   ((USHORT)((guid)->Data1))
+
+//
+// Doubly linked lists.
+//
+typedef struct _LIST_ENTRY
+{
+	struct _LIST_ENTRY* Flink;
+	struct _LIST_ENTRY* Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+#define CONTAINING_RECORD(address, type, field) \
+	((type*)((char*)(address) - offsetof(type, field)))
+
+inline VOID InitializeListHead(_Out_ PLIST_ENTRY head)
+{
+	head->Flink = head->Blink = head;
+}
+
+inline BOOLEAN IsListEmpty(_In_ const LIST_ENTRY* head)
+{
+	return head->Flink == head;
+}
+
+inline VOID InsertTailList(_Inout_ PLIST_ENTRY head, _Out_ PLIST_ENTRY entry)
+{
+	entry->Flink = head;
+	entry->Blink = head->Blink;
+	head->Blink->Flink = entry;
+	head->Blink = entry;
+}
+
+inline BOOLEAN RemoveEntryList(_In_ PLIST_ENTRY entry)
+{
+	entry->Blink->Flink = entry->Flink;
+	entry->Flink->Blink = entry->Blink;
+	return entry->Flink == entry->Blink;
+}
+
+inline PLIST_ENTRY RemoveHeadList(_Inout_ PLIST_ENTRY head)
+{
+	PLIST_ENTRY entry = head->Flink;
+	RemoveEntryList(entry);
+	return entry;
+}
+
+//
+// COM style reference counting as PortCls uses it.
+//
+struct IUnknown
+{
+	virtual NTSTATUS QueryInterface(_In_ const GUID& iid, _Out_ PVOID* object) = 0;
+	virtual ULONG AddRef() = 0;
+	virtual ULONG Release() = 0;
+};
+typedef IUnknown* PUNKNOWN;
+
+#define SAFE_RELEASE(p) {if (p) { (p)->Release(); (p) = nullptr; } }
+
+//
+// Strings.
+//
+#define MAX_PATH                        260
+
+inline NTSTATUS RtlStringCchCopyW(_Out_writes_(cch) PWSTR dest, _In_ SIZE_T cch, _In_ const WCHAR* source)
+{
+	SIZE_T length = wcslen(source);
+
+	if (cch == 0)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+	if (length >= cch)
+	{
+		wmemcpy(dest, source, cch - 1);
+		dest[cch - 1] = L'\0';
+		return STATUS_BUFFER_OVERFLOW;
+	}
+	wmemcpy(dest, source, length + 1);
+	return STATUS_SUCCESS;
+}
@@ -0,0 +1,86 @@
+/*++
+
+Module Name:
+
+	HostMirroredBuffer.cpp
+
+Abstract:
+
+	MirroredBuffer for the host build. The storage is a memfd mapped twice
+	into an address range reserved for both views, which is what the two
+	PFN runs of the mirror MDL do in the kernel.
+
+--*/
+
+#include "../MirroredBuffer.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+MirroredBuffer::MirroredBuffer()
+	: m_pPages(NULL), m_pMirror(NULL), m_pAddress(NULL), m_Size(0)
+{
+}
+
+MirroredBuffer::~MirroredBuffer()
+{
+	if (m_pAddress != NULL)
+	{
+		munmap(m_pAddress, 2 * m_Size);
+		m_pAddress = NULL;
+	}
+}
+
+NTSTATUS MirroredBuffer::Init(SIZE_T size)
+{
+	SIZE_T pageSize = (SIZE_T)sysconf(_SC_PAGESIZE);
+	BYTE* pReserved;
+	int fd;
+
+	if (m_pAddress != NULL)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	m_Size = (size + pageSize - 1) / pageSize * pageSize;
+	if (m_Size == 0 || m_Size > MAXULONG / 2)
+	{
+		m_Size = 0;
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	fd = memfd_create("AudioMirrorRing", MFD_CLOEXEC);
+	if (fd < 0)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	if (ftruncate(fd, (off_t)m_Size) != 0)
+	{
+		close(fd);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	// Reserve both views first so nothing else can land in between.
+	pReserved = (BYTE*)mmap(NULL, 2 * m_Size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pReserved == MAP_FAILED)
+	{
+		close(fd);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	for (SIZE_T view = 0; view < 2; ++view)
+	{
+		if (mmap(pReserved + view * m_Size, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+		{
+			munmap(pReserved, 2 * m_Size);
+			close(fd);
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	// The mappings keep the memory alive.
+	close(fd);
+	m_pAddress = pReserved;
+
+	return STATUS_SUCCESS;
+}
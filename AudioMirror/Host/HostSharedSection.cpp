@@ -0,0 +1,119 @@
+/*++
+
+Module Name:
+
+	HostSharedSection.cpp
+
+Abstract:
+
+	SharedSection for the host build. The section is plain page aligned
+	memory and "mapping" it into the current process hands out the system
+	view, so a reader in the same process sees exactly what the driver
+	writes. Event handles are the KEVENTs themselves.
+
+--*/
+
+#include "../SharedSection.h"
+
+SharedSection::SharedSection()
+	: m_hSection(NULL), m_pSection(NULL), m_pSystemView(NULL), m_pMdl(NULL), m_ViewSize(0),
+	m_ulEventCount(0)
+{
+	KeInitializeSpinLock(&m_Lock);
+	RtlZeroMemory(m_Events, sizeof(m_Events));
+}
+
+SharedSection::~SharedSection()
+{
+	if (m_pSystemView != NULL)
+	{
+		free(m_pSystemView);
+		m_pSystemView = NULL;
+	}
+}
+
+NTSTATUS SharedSection::Init(SIZE_T size)
+{
+	m_ViewSize = ROUND_TO_PAGES(size);
+
+	m_pSystemView = aligned_alloc(PAGE_SIZE, m_ViewSize);
+	if (m_pSystemView == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(m_pSystemView, m_ViewSize);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS SharedSection::MapIntoCurrentProcess(ULONG protect, ULONG version, PAUDIOMIRROR_TAP_MAPPING mapping)
+{
+	UNREFERENCED_PARAMETER(protect);
+
+	if (m_pSystemView == NULL)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	mapping->Size = sizeof(AUDIOMIRROR_TAP_MAPPING);
+	mapping->Version = version;
+	mapping->ViewAddress = (ULONGLONG)(ULONG_PTR)m_pSystemView;
+	mapping->ViewSize = m_ViewSize;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS SharedSection::RegisterEvent(HANDLE eventHandle, BOOL registerEvent)
+{
+	PKEVENT     pEvent = (PKEVENT)eventHandle;
+	KIRQL       oldIrql;
+	ULONG       index;
+
+	if (pEvent == NULL)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+
+	for (index = 0; index < m_ulEventCount; ++index)
+	{
+		if (m_Events[index] == pEvent)
+		{
+			break;
+		}
+	}
+
+	if (registerEvent)
+	{
+		if (index == m_ulEventCount)
+		{
+			if (m_ulEventCount == AUDIOMIRROR_TAP_MAX_EVENTS)
+			{
+				RtlMoveMemory(&m_Events[0], &m_Events[1], (AUDIOMIRROR_TAP_MAX_EVENTS - 1) * sizeof(PKEVENT));
+				m_ulEventCount--;
+			}
+			m_Events[m_ulEventCount++] = pEvent;
+		}
+	}
+	else if (index < m_ulEventCount)
+	{
+		RtlMoveMemory(&m_Events[index], &m_Events[index + 1], (m_ulEventCount - index - 1) * sizeof(PKEVENT));
+		m_Events[--m_ulEventCount] = NULL;
+	}
+
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+
+	return STATUS_SUCCESS;
+}
+
+VOID SharedSection::SignalEvents()
+{
+	KeAcquireSpinLockAtDpcLevel(&m_Lock);
+	for (ULONG i = 0; i < m_ulEventCount; ++i)
+	{
+		KeSetEvent(m_Events[i], 0, FALSE);
+	}
+	KeReleaseSpinLockFromDpcLevel(&m_Lock);
+}
@@ -1,16 +1,7 @@
 #pragma once
 
 #include "Globals.h"
-
-// Default volume settings.
-#define VOLUME_STEPPING_DELTA       0x8000
-#define VOLUME_SIGNED_MAXIMUM       0x00000000
-#define VOLUME_SIGNED_MINIMUM       (-96 * 0x10000)
-
-// Default peak meter settings
-#define PEAKMETER_STEPPING_DELTA    0x1000
-#define PEAKMETER_SIGNED_MAXIMUM    LONG_MAX
-#define PEAKMETER_SIGNED_MINIMUM    LONG_MIN
+#include "EndpointGain.h"
 
 #define MIN_BUFFER_DURATION_MS 10
 #define MAX_BUFFER_DURATION_MS 20
@@ -22,8 +13,9 @@
 enum class WaveRenderPins
 {
 	SINK_SYSTEM = 0,
-	SOURCE
-	
+	SOURCE,
+	SINK_LOOPBACK,
+	SINK_OFFLOAD
 };
 
 // Wave pins
@@ -48,7 +40,24 @@ enum class TopologyPin
 // Wave Topology nodes - offloading supported.
 enum class WaveSpeakerNodes
 {
-	DAC = 0
+	AUDIO_ENGINE = 0
+};
+
+// Audio engine node pins.
+enum class AudioEngineNodePins
+{
+	SOURCE = 0,
+	HOST,
+	OFFLOAD,
+	LOOPBACK
+};
+
+// Topology nodes, the same chain on the speaker and microphone filters.
+enum class TopologyNodes
+{
+	VOLUME = 0,
+	MUTE,
+	PEAKMETER
 };
 
 static
@@ -562,4 +562,187 @@ Return Value:
 	}
 
 	return ntStatus;
-} // PropertyHandlerBasicSupportVolume
\ No newline at end of file
+} // PropertyHandlerBasicSupportVolume
+
+#pragma code_seg("PAGE")
+NTSTATUS KsHelper::PropertyHandler_Volume
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest,
+	_In_ EndpointGain*           Gain
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIO_VOLUMELEVEL of a node backed by the endpoint
+  gain, the topology volume node and the audio engine node.
+
+--*/
+{
+	NTSTATUS    ntStatus;
+	ULONG       ulChannel;
+	ULONG       cChannels = Gain->GetChannels();
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return PropertyHandler_BasicSupportVolume(PropertyRequest, cChannels);
+	}
+
+	ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(LONG), sizeof(ULONG));
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	ulChannel = *(PULONG)PropertyRequest->Instance;
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+	{
+		if (ulChannel >= cChannels)
+		{
+			return STATUS_INVALID_PARAMETER;
+		}
+		*(PLONG)PropertyRequest->Value = Gain->GetVolumeLevel(ulChannel);
+		PropertyRequest->ValueSize = sizeof(LONG);
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		LONG lVolume = *(PLONG)PropertyRequest->Value;
+		lVolume = max(VOLUME_SIGNED_MINIMUM, min(VOLUME_SIGNED_MAXIMUM, lVolume));
+
+		if (ulChannel == ALL_CHANNELS_ID)
+		{
+			for (ULONG i = 0; i < cChannels; ++i)
+			{
+				Gain->SetVolumeLevel(i, lVolume);
+			}
+		}
+		else if (ulChannel < cChannels)
+		{
+			Gain->SetVolumeLevel(ulChannel, lVolume);
+		}
+		else
+		{
+			ntStatus = STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	return ntStatus;
+} // PropertyHandler_Volume
+
+#pragma code_seg("PAGE")
+NTSTATUS KsHelper::PropertyHandler_Mute
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest,
+	_In_ EndpointGain*           Gain
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIO_MUTE of a node backed by the endpoint gain.
+
+--*/
+{
+	NTSTATUS    ntStatus;
+	ULONG       ulChannel;
+	ULONG       cChannels = Gain->GetChannels();
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return PropertyHandler_BasicSupportMute(PropertyRequest, cChannels);
+	}
+
+	ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(BOOL), sizeof(ULONG));
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	ulChannel = *(PULONG)PropertyRequest->Instance;
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+	{
+		if (ulChannel >= cChannels)
+		{
+			return STATUS_INVALID_PARAMETER;
+		}
+		*(PBOOL)PropertyRequest->Value = Gain->GetMute(ulChannel);
+		PropertyRequest->ValueSize = sizeof(BOOL);
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		BOOL bMute = *(PBOOL)PropertyRequest->Value;
+
+		if (ulChannel == ALL_CHANNELS_ID)
+		{
+			for (ULONG i = 0; i < cChannels; ++i)
+			{
+				Gain->SetMute(i, bMute);
+			}
+		}
+		else if (ulChannel < cChannels)
+		{
+			Gain->SetMute(ulChannel, bMute);
+		}
+		else
+		{
+			ntStatus = STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	return ntStatus;
+} // PropertyHandler_Mute
+
+#pragma code_seg("PAGE")
+NTSTATUS KsHelper::PropertyHandler_PeakMeter2
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest,
+	_In_ EndpointGain*           Gain
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIO_PEAKMETER2 of a node backed by the endpoint gain,
+  the peak of the samples that went through it since the last query.
+
+--*/
+{
+	NTSTATUS    ntStatus;
+	ULONG       ulChannel;
+	ULONG       cChannels = Gain->GetChannels();
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return PropertyHandler_BasicSupportPeakMeter2(PropertyRequest, cChannels);
+	}
+
+	if ((PropertyRequest->Verb & KSPROPERTY_TYPE_GET) == 0)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(LONG), sizeof(ULONG));
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	ulChannel = *(PULONG)PropertyRequest->Instance;
+	if (ulChannel >= cChannels)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	*(PLONG)PropertyRequest->Value = Gain->GetPeakMeter(ulChannel);
+	PropertyRequest->ValueSize = sizeof(LONG);
+
+	return STATUS_SUCCESS;
+} // PropertyHandler_PeakMeter2
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Globals.h"
+#include "EndpointGain.h"
 
 class KsHelper
 {
@@ -36,6 +37,21 @@ public:
 		_Out_ GUID* _pSignalProcessingMode
 	);
 
+	static NTSTATUS PropertyHandler_Volume(
+		_In_ PPCPROPERTY_REQUEST PropertyRequest,
+		_In_ EndpointGain* Gain
+	);
+
+	static NTSTATUS PropertyHandler_Mute(
+		_In_ PPCPROPERTY_REQUEST PropertyRequest,
+		_In_ EndpointGain* Gain
+	);
+
+	static NTSTATUS PropertyHandler_PeakMeter2(
+		_In_ PPCPROPERTY_REQUEST PropertyRequest,
+		_In_ EndpointGain* Gain
+	);
+
 	static NTSTATUS ValidatePropertyParams(
 		_In_ PPCPROPERTY_REQUEST      PropertyRequest,
 		_In_ ULONG                    cbValueSize,
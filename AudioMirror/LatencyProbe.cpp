@@ -0,0 +1,138 @@
+#include "LatencyProbe.h"
+
+#pragma code_seg()
+VOID LatencyProbe::Init()
+{
+	LARGE_INTEGER qpcFrequency;
+
+	KeInitializeSpinLock(&m_Lock);
+	KeQueryPerformanceCounter(&qpcFrequency);
+	m_ullQpcFrequency = qpcFrequency.QuadPart;
+	m_Enabled = 0;
+	ResetLocked();
+}
+
+#pragma code_seg()
+VOID LatencyProbe::ResetLocked()
+{
+	m_ulFirstMarker = 0;
+	m_ulMarkerCount = 0;
+	RtlZeroMemory(m_Buckets, sizeof(m_Buckets));
+	m_ullSampleCount = 0;
+	m_ullLostMarkers = 0;
+	m_ulMinUs = MAXULONG;
+	m_ulMaxUs = 0;
+	m_ullSumUs = 0;
+}
+
+#pragma code_seg()
+VOID LatencyProbe::Enable(BOOL enable)
+{
+	KIRQL oldIrql;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	ResetLocked();
+	InterlockedExchange(&m_Enabled, enable ? 1 : 0);
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+VOID LatencyProbe::ClearMarkers()
+{
+	KIRQL oldIrql;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	m_ulFirstMarker = 0;
+	m_ulMarkerCount = 0;
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+VOID LatencyProbe::MarkWritten(ULONGLONG cablePosition, ULONGLONG qpc)
+{
+	KIRQL oldIrql;
+
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+
+	// A full queue means the capture side is not draining, skip this block
+	// rather than evicting a marker that is still in flight.
+	if (m_ulMarkerCount < LATENCY_PROBE_MAX_MARKERS)
+	{
+		ULONG index = (m_ulFirstMarker + m_ulMarkerCount) % LATENCY_PROBE_MAX_MARKERS;
+		m_Markers[index].Position = cablePosition;
+		m_Markers[index].Qpc = qpc;
+		m_ulMarkerCount++;
+	}
+
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+VOID LatencyProbe::MarkDelivered(ULONGLONG readBefore, ULONGLONG readAfter, ULONGLONG qpc)
+{
+	KIRQL oldIrql;
+
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+
+	while (m_ulMarkerCount > 0)
+	{
+		MARKER* marker = &m_Markers[m_ulFirstMarker];
+
+		if (marker->Position >= readAfter)
+		{
+			break;
+		}
+
+		if (marker->Position < readBefore)
+		{
+			m_ullLostMarkers++;
+		}
+		else
+		{
+			ULONGLONG elapsedQpc = (qpc > marker->Qpc) ? (qpc - marker->Qpc) : 0;
+			ULONG latencyUs = (ULONG)min(elapsedQpc * 1000000 / m_ullQpcFrequency, (ULONGLONG)MAXULONG);
+			ULONG bucket = min(latencyUs / AUDIOMIRROR_LATENCY_BUCKET_WIDTH_US, AUDIOMIRROR_LATENCY_HISTOGRAM_BUCKETS - 1);
+
+			m_Buckets[bucket]++;
+			m_ullSampleCount++;
+			m_ullSumUs += latencyUs;
+			m_ulMinUs = min(m_ulMinUs, latencyUs);
+			m_ulMaxUs = max(m_ulMaxUs, latencyUs);
+		}
+
+		m_ulFirstMarker = (m_ulFirstMarker + 1) % LATENCY_PROBE_MAX_MARKERS;
+		m_ulMarkerCount--;
+	}
+
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+VOID LatencyProbe::Snapshot(PAUDIOMIRROR_LATENCY_HISTOGRAM histogram)
+{
+	KIRQL oldIrql;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+
+	histogram->Enabled = IsEnabled() ? 1 : 0;
+	histogram->BucketWidthUs = AUDIOMIRROR_LATENCY_BUCKET_WIDTH_US;
+	histogram->BucketCount = AUDIOMIRROR_LATENCY_HISTOGRAM_BUCKETS;
+	histogram->SampleCount = m_ullSampleCount;
+	histogram->LostMarkers = m_ullLostMarkers;
+	histogram->MinUs = (m_ullSampleCount > 0) ? m_ulMinUs : 0;
+	histogram->MaxUs = m_ulMaxUs;
+	histogram->SumUs = m_ullSumUs;
+	RtlCopyMemory(histogram->Buckets, m_Buckets, sizeof(m_Buckets));
+
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "Globals.h"
+#include "AudioMirrorProperties.h"
+
+#define LATENCY_PROBE_MAX_MARKERS   64
+
+/*
+	Measures the time audio spends in the cable ring. The render side drops a
+	marker (cable byte position and QPC) whenever a block is put into the ring,
+	the capture side resolves every marker its Take has moved past and records
+	the elapsed time into a fixed bucket histogram.
+
+	Both sides run in the timer DPCs of different streams, so the marker queue
+	and the histogram are protected by their own spin lock. When measurement is
+	disabled neither side takes the lock.
+*/
+class LatencyProbe
+{
+private:
+	typedef struct _MARKER
+	{
+		ULONGLONG   Position;
+		ULONGLONG   Qpc;
+	} MARKER;
+
+	KSPIN_LOCK          m_Lock;
+	volatile LONG       m_Enabled;
+	ULONGLONG           m_ullQpcFrequency;
+
+	MARKER              m_Markers[LATENCY_PROBE_MAX_MARKERS];
+	ULONG               m_ulFirstMarker;
+	ULONG               m_ulMarkerCount;
+
+	ULONG               m_Buckets[AUDIOMIRROR_LATENCY_HISTOGRAM_BUCKETS];
+	ULONGLONG           m_ullSampleCount;
+	ULONGLONG           m_ullLostMarkers;
+	ULONG               m_ulMinUs;
+	ULONG               m_ulMaxUs;
+	ULONGLONG           m_ullSumUs;
+
+	VOID ResetLocked();
+public:
+	VOID Init();
+
+	BOOL IsEnabled()
+	{
+		return m_Enabled != 0;
+	}
+
+	/*
+		Enables or disables the measurement. Both clear the histogram.
+	*/
+	VOID Enable(_In_ BOOL enable);
+
+	/*
+		Drops all pending markers, used whenever the ring positions restart.
+	*/
+	VOID ClearMarkers();
+
+	/*
+		Records that the block starting at the given cable position entered the ring.
+	*/
+	VOID MarkWritten(_In_ ULONGLONG cablePosition, _In_ ULONGLONG qpc);
+
+	/*
+		Resolves the markers a Take moved past. Markers below readBefore were
+		overwritten by an overrun and are counted as lost.
+	*/
+	VOID MarkDelivered(_In_ ULONGLONG readBefore, _In_ ULONGLONG readAfter, _In_ ULONGLONG qpc);
+
+	VOID Snapshot(_Out_ PAUDIOMIRROR_LATENCY_HISTOGRAM histogram);
+};
@@ -66,10 +66,80 @@ static PCPIN_DESCRIPTOR MicInTopoMiniportPins[] =
 	}
 };
 
+static
+PCPROPERTY_ITEM PropertiesMicInTopoVolume[] =
+{
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_VOLUMELEVEL,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportTopology::PropertyHandler_TopologyNode
+	}
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationMicInTopoVolume, PropertiesMicInTopoVolume);
+
+static
+PCPROPERTY_ITEM PropertiesMicInTopoMute[] =
+{
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_MUTE,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportTopology::PropertyHandler_TopologyNode
+	}
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationMicInTopoMute, PropertiesMicInTopoMute);
+
+static
+PCPROPERTY_ITEM PropertiesMicInTopoPeakMeter[] =
+{
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_PEAKMETER2,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportTopology::PropertyHandler_TopologyNode
+	}
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationMicInTopoPeakMeter, PropertiesMicInTopoPeakMeter);
+
+// The volume and mute nodes are applied by the capture stream while it copies
+// out of the cable ring.
+static
+PCNODE_DESCRIPTOR MicInTopologyNodes[] =
+{
+	// TopologyNodes::VOLUME
+	{
+		0,                                  // Flags
+		&AutomationMicInTopoVolume,       // AutomationTable
+		&KSNODETYPE_VOLUME,                 // Type
+		&KSAUDFNAME_MIC_VOLUME              // Name
+	},
+	// TopologyNodes::MUTE
+	{
+		0,                                  // Flags
+		&AutomationMicInTopoMute,         // AutomationTable
+		&KSNODETYPE_MUTE,                   // Type
+		&KSAUDFNAME_MIC_MUTE                // Name
+	},
+	// TopologyNodes::PEAKMETER
+	{
+		0,                                  // Flags
+		&AutomationMicInTopoPeakMeter,    // AutomationTable
+		&KSNODETYPE_PEAKMETER,              // Type
+		&KSAUDFNAME_PEAKMETER               // Name
+	}
+};
+
 static PCCONNECTION_DESCRIPTOR MicInMiniportConnections[] =
 {
-	//  FromNode,			FromPin,						ToNode,				ToPin
-	{   PCFILTER_NODE,		(int)TopologyPin::Microphone,	PCFILTER_NODE,		(int)TopologyPin::Bridge }
+	//  FromNode,						FromPin,						ToNode,							ToPin
+	{   PCFILTER_NODE,					(int)TopologyPin::Microphone,	(int)TopologyNodes::VOLUME,		KSNODEPIN_STANDARD_IN },
+	{   (int)TopologyNodes::VOLUME,		KSNODEPIN_STANDARD_OUT,			(int)TopologyNodes::MUTE,		KSNODEPIN_STANDARD_IN },
+	{   (int)TopologyNodes::MUTE,		KSNODEPIN_STANDARD_OUT,			(int)TopologyNodes::PEAKMETER,	KSNODEPIN_STANDARD_IN },
+	{   (int)TopologyNodes::PEAKMETER,	KSNODEPIN_STANDARD_OUT,			PCFILTER_NODE,					(int)TopologyPin::Bridge }
 };
 
 static PHYSICALCONNECTIONTABLE MicInTopologyPhysicalConnections[] =
@@ -89,8 +159,8 @@ static PCFILTER_DESCRIPTOR MicInTopoMiniportFilterDescriptor =
   SIZEOF_ARRAY(MicInTopoMiniportPins),      // PinCount
   MicInTopoMiniportPins,                    // Pins
   sizeof(PCNODE_DESCRIPTOR),                // NodeSize
-  0,										// NodeCount
-  NULL,										// Nodes
+  SIZEOF_ARRAY(MicInTopologyNodes),         // NodeCount
+  MicInTopologyNodes,                       // Nodes
   SIZEOF_ARRAY(MicInMiniportConnections),   // ConnectionCount
   MicInMiniportConnections,                 // Connections
   0,                                        // CategoryCount
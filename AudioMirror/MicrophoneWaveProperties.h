@@ -18,7 +18,7 @@
 //
 // Max # of pin instances.
 //
-#define MICIN_MAX_INPUT_STREAMS 1
+#define MICIN_MAX_INPUT_STREAMS 4       // One per mode: RAW, DEFAULT, SPEECH, COMMUNICATIONS.
 
 //=============================================================================
 static
@@ -230,6 +230,60 @@ PCPROPERTY_ITEM PropertiesMicInWaveFilter[] =
 		KSPROPERTY_PIN_PROPOSEDATAFORMAT2,
 		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
 		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_STREAM_STATISTICS,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_LATENCY_MEASUREMENT,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_INJECT,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_INJECT_EVENT,
+		KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_CLOCK_LOCK,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_SCHEDULER,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_WORKER_THREADS,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_OVERRUN_POLICY,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_PREROLL,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
 	}
 };
 
@@ -7,6 +7,7 @@
 
 
 #include "MiniportTopology.h"
+#include "EndpointGain.h"
 
 MinipairDescriptorFactory::MinipairDescriptorFactory()
 {
@@ -44,6 +45,7 @@ ENDPOINT_MINIPAIR MinipairDescriptorFactory::m_MicrophoneTemplate =
 	SIZEOF_ARRAY(MicInTopologyPhysicalConnections),
 	ENDPOINT_FLAG_NONE,
 	NULL, 0, NULL,                          // audio module settings.
+	NULL,                                   // endpoint gain
 };
 
 ENDPOINT_MINIPAIR MinipairDescriptorFactory::m_SpeakerTemplate =
@@ -64,8 +66,9 @@ ENDPOINT_MINIPAIR MinipairDescriptorFactory::m_SpeakerTemplate =
 	SIZEOF_ARRAY(SpeakerPinDeviceFormatsAndModes),
 	SpeakerTopologyPhysicalConnections,
 	SIZEOF_ARRAY(SpeakerTopologyPhysicalConnections),
-	ENDPOINT_FLAG_NONE,
+	ENDPOINT_FLAG_OFFLOAD_SUPPORTED | ENDPOINT_FLAG_LOOPBACK_SUPPORTED,
 	NULL, 0, NULL,
+	NULL,                                   // endpoint gain
 };
 
 NTSTATUS MinipairDescriptorFactory::CreateSpeaker(_Outptr_ ENDPOINT_MINIPAIR** pMinipair)
@@ -78,6 +81,14 @@ NTSTATUS MinipairDescriptorFactory::CreateSpeaker(_Outptr_ ENDPOINT_MINIPAIR** p
 	}
 	*pNewMinipair = m_SpeakerTemplate;
 
+	pNewMinipair->Gain = new(NonPagedPoolNx, MINIADAPTER_POOLTAG) EndpointGain(pNewMinipair->DeviceMaxChannels);
+	if (!pNewMinipair->Gain)
+	{
+		delete pNewMinipair;
+		*pMinipair = NULL;
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
 	MinipairDescriptorFactory::SetLastCharacterOfString(pNewMinipair->TopoName, m_CurrentIndex);
 	MinipairDescriptorFactory::SetLastCharacterOfString(pNewMinipair->WaveName, m_CurrentIndex);
 	//TODO: check if correct
@@ -102,6 +113,14 @@ NTSTATUS MinipairDescriptorFactory::CreateMicrophone(_Outptr_ ENDPOINT_MINIPAIR*
 	}
 	*pNewMinipair = m_MicrophoneTemplate;
 
+	pNewMinipair->Gain = new(NonPagedPoolNx, MINIADAPTER_POOLTAG) EndpointGain(pNewMinipair->DeviceMaxChannels);
+	if (!pNewMinipair->Gain)
+	{
+		delete pNewMinipair;
+		*pMinipair = NULL;
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
 	MinipairDescriptorFactory::SetLastCharacterOfString(pNewMinipair->TopoName, m_CurrentIndex);
 	MinipairDescriptorFactory::SetLastCharacterOfString(pNewMinipair->WaveName, m_CurrentIndex);
 	//TODO: check if correct
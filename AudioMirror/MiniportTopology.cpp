@@ -29,7 +29,8 @@ NTSTATUS MiniportTopology::Create(
 		MiniportPair->TopoDescriptor,
 		MiniportPair->DeviceMaxChannels,
 		MiniportPair->DeviceType,
-		DeviceContext
+		DeviceContext,
+		MiniportPair->Gain
 	);
 	if (NULL == obj)
 	{
@@ -48,13 +49,15 @@ MiniportTopology::MiniportTopology
 	_In_        PCFILTER_DESCRIPTOR*	FilterDesc,
 	_In_        USHORT                  DeviceMaxChannels,
 	_In_        DeviceType				DeviceType,
-	_In_opt_    PVOID                   DeviceContext
+	_In_opt_    PVOID                   DeviceContext,
+	_In_        EndpointGain*			Gain
 ) :
 	CUnknown(UnknownOuter),
 	m_FilterDescriptor(FilterDesc),
 	m_DeviceType(DeviceType),
 	m_DeviceContext(DeviceContext),
-	m_DeviceMaxChannels(DeviceMaxChannels)
+	m_DeviceMaxChannels(DeviceMaxChannels),
+	m_pEndpointGain(Gain)
 {
 	
 }
@@ -221,4 +224,64 @@ Return Value:
 	}
 
 	return(STATUS_INVALID_PARAMETER);
-} // NonDelegatingQueryInterface
\ No newline at end of file
+} // NonDelegatingQueryInterface
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportTopology::PropertyHandler_TopologyNode
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles the volume, mute and peak meter nodes of the topology filter. The
+  nodes are backed by the endpoint gain the wave streams apply while they
+  copy through the cable, so the audio engine does not need a software
+  volume pass of its own.
+
+Arguments:
+
+  PropertyRequest -
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+	PAGED_CODE();
+
+	NTSTATUS            ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+	MiniportTopology*   pMiniport = reinterpret_cast<MiniportTopology*>(PropertyRequest->MajorTarget);
+
+	if (pMiniport == NULL || pMiniport->m_pEndpointGain == NULL)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if (!IsEqualGUIDAligned(*PropertyRequest->PropertyItem->Set, KSPROPSETID_Audio))
+	{
+		return ntStatus;
+	}
+
+	switch (PropertyRequest->PropertyItem->Id)
+	{
+	case KSPROPERTY_AUDIO_VOLUMELEVEL:
+		ntStatus = KsHelper::PropertyHandler_Volume(PropertyRequest, pMiniport->m_pEndpointGain);
+		break;
+
+	case KSPROPERTY_AUDIO_MUTE:
+		ntStatus = KsHelper::PropertyHandler_Mute(PropertyRequest, pMiniport->m_pEndpointGain);
+		break;
+
+	case KSPROPERTY_AUDIO_PEAKMETER2:
+		ntStatus = KsHelper::PropertyHandler_PeakMeter2(PropertyRequest, pMiniport->m_pEndpointGain);
+		break;
+
+	default:
+		DPF(D_TERSE, ("[PropertyHandler_TopologyNode: Invalid Device Request]"));
+	}
+
+	return ntStatus;
+} // PropertyHandler_TopologyNode
@@ -3,6 +3,7 @@
 
 #include "IAdapterCommon.h"
 #include "EndpointMinipair.h"
+#include "EndpointGain.h"
 
 class MiniportTopology :
 	public IMiniportTopology,
@@ -14,6 +15,7 @@ private:
 	PVOID                   m_DeviceContext;
 	USHORT                  m_DeviceMaxChannels;
 	IAdapterCommon*			m_Adapter;
+	EndpointGain*			m_pEndpointGain;
 public:
 	DECLARE_STD_UNKNOWN();
 	static NTSTATUS Create(PUNKNOWN * Unknown, REFCLSID, PUNKNOWN UnknownOuter, POOL_TYPE PoolType, PUNKNOWN UnknownAdapter, PVOID DeviceContext, PENDPOINT_MINIPAIR MiniportPair);
@@ -23,10 +25,13 @@ public:
 		_In_        PCFILTER_DESCRIPTOR*	FilterDesc,
 		_In_        USHORT                  DeviceMaxChannels,
 		_In_        DeviceType				DeviceType,
-		_In_opt_    PVOID                   DeviceContext
+		_In_opt_    PVOID                   DeviceContext,
+		_In_        EndpointGain*			Gain
 	);
 	~MiniportTopology();
 
 	IMP_IMiniportTopology;
+
+	static NTSTATUS PropertyHandler_TopologyNode(_In_ PPCPROPERTY_REQUEST PropertyRequest);
 };
 
@@ -2,6 +2,8 @@
 
 #include "KsAudioProcessingAttribute.h"
 #include "KsHelper.h"
+#include "FormatHelper.h"
+#include "AudioMirrorProperties.h"
 
 #define WAVERT_POOLTAG	'tRaW'
 
@@ -22,6 +24,22 @@ MiniportWaveRT::MiniportWaveRT(
 	PAGED_CODE();
 	m_pAdapterCommon = (IAdapterCommon*)UnknownAdapter; // weak ref.
 	ExInitializeFastMutex(&m_DeviceFormatsAndModesLock);
+	ExInitializeFastMutex(&m_SystemStreamsLock);
+	m_bLatencyMeasurement = FALSE;
+	m_bClockLock = FALSE;
+	m_bWorkerThreads = FALSE;
+	m_ulOverrunPolicy = AUDIOMIRROR_OVERRUN_DROP_OLDEST;
+	m_ulPrerollMs = 0;
+	m_ulMaxLoopbackStreams = 0;
+	m_LoopbackStreams = NULL;
+	m_ulMaxOffloadStreams = 0;
+	m_OffloadStreams = NULL;
+	m_pMixer = NULL;
+	m_pInjector = NULL;
+	m_pScheduler = NULL;
+	m_ulHomeProcessor = CABLE_SCHEDULER_NO_PROCESSOR;
+	m_bGfxEnabled = FALSE;
+	m_pDeviceFormat = NULL;
 
 	if (MiniportPair->WaveDescriptor)
 	{
@@ -34,6 +52,14 @@ MiniportWaveRT::MiniportWaveRT(
 		if (IsRenderDevice())
 		{
 			m_ulMaxSystemStreams = m_FilterDesc.Pins[(int)WaveRenderPins::SINK_SYSTEM].MaxFilterInstanceCount;
+			if (m_FilterDesc.PinCount > (int)WaveRenderPins::SINK_LOOPBACK)
+			{
+				m_ulMaxLoopbackStreams = m_FilterDesc.Pins[(int)WaveRenderPins::SINK_LOOPBACK].MaxFilterInstanceCount;
+			}
+			if (m_FilterDesc.PinCount > (int)WaveRenderPins::SINK_OFFLOAD)
+			{
+				m_ulMaxOffloadStreams = m_FilterDesc.Pins[(int)WaveRenderPins::SINK_OFFLOAD].MaxFilterInstanceCount;
+			}
 		}
 		else
 		{
@@ -89,6 +115,8 @@ Return Value:
 	// Init class data members
 	//
 	m_ulSystemAllocated = 0;
+	m_ulLoopbackAllocated = 0;
+	m_ulOffloadAllocated = 0;
 
 	if (m_ulMaxSystemStreams == 0)
 	{
@@ -102,6 +130,61 @@ Return Value:
 		return STATUS_INSUFFICIENT_RESOURCES;
 	}
 	RtlZeroMemory(m_SystemStreams, size);
+
+	// Loopback streams.
+	if (m_ulMaxLoopbackStreams > 0)
+	{
+		size = sizeof(MiniportWaveRTStream*) * m_ulMaxLoopbackStreams;
+		m_LoopbackStreams = (MiniportWaveRTStream**)ExAllocatePoolWithTag(NonPagedPoolNx, size, WAVERT_POOLTAG);
+		if (m_LoopbackStreams == NULL)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+		RtlZeroMemory(m_LoopbackStreams, size);
+	}
+
+	// Offload streams.
+	if (m_ulMaxOffloadStreams > 0)
+	{
+		size = sizeof(MiniportWaveRTStream*) * m_ulMaxOffloadStreams;
+		m_OffloadStreams = (MiniportWaveRTStream**)ExAllocatePoolWithTag(NonPagedPoolNx, size, WAVERT_POOLTAG);
+		if (m_OffloadStreams == NULL)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+		RtlZeroMemory(m_OffloadStreams, size);
+	}
+
+	//
+	// The render side mixes its host and offload streams into the cable at
+	// the audio engine's device format.
+	//
+	if (IsRenderDevice())
+	{
+		KSDATAFORMAT_WAVEFORMATEXTENSIBLE* pFormats = NULL;
+
+		if (m_DeviceFlags & ENDPOINT_FLAG_OFFLOAD_SUPPORTED)
+		{
+			GetAudioEngineSupportedDeviceFormats(&pFormats);
+		}
+		else
+		{
+			GetPinSupportedDeviceFormats(GetSystemPinId(), &pFormats);
+		}
+		m_pDeviceFormat = pFormats;
+
+		m_pMixer = new(NonPagedPoolNx, WAVERT_POOLTAG) CableMixer();
+		if (m_pMixer == NULL)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		ntStatus = m_pMixer->Init(&m_pDeviceFormat->WaveFormatExt.Format, m_pMiniportPair->Gain);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+	}
 	return ntStatus;
 } // Init
 
@@ -278,6 +361,20 @@ ULONG MiniportWaveRT::GetSystemPinId()
 	return (int)WaveRenderPins::SINK_SYSTEM;
 }
 
+ULONG MiniportWaveRT::GetOffloadPinId()
+{
+	PAGED_CODE();
+	ASSERT(IsRenderDevice());
+	return (int)WaveRenderPins::SINK_OFFLOAD;
+}
+
+ULONG MiniportWaveRT::GetLoopbackPinId()
+{
+	PAGED_CODE();
+	ASSERT(IsRenderDevice());
+	return (int)WaveRenderPins::SINK_LOOPBACK;
+}
+
 #pragma code_seg()
 IAdapterCommon* MiniportWaveRT::GetAdapter()
 {
@@ -344,7 +441,7 @@ Return Value:
 	//
 	if (NT_SUCCESS(ntStatus))
 	{
-		ntStatus = ValidateStreamCreate(Pin, Capture);
+		ntStatus = ValidateStreamCreate(Pin, Capture, signalProcessingMode);
 	}
 
 	// Determine if the format is valid.
@@ -355,11 +452,13 @@ Return Value:
 	}
 
 	// Instantiate a stream. Stream must be in
-	// NonPagedPool(Nx) because of file saving.
+	// NonPagedPool(Nx) because of file saving. Cache aligned, so the hot
+	// block of CableStream really starts on a line of its own.
 	//
 	if (NT_SUCCESS(ntStatus))
 	{
-		stream = new(NonPagedPoolNx, WAVERT_POOLTAG) MiniportWaveRTStream(NULL);
+#pragma warning(suppress: 4316) // The pool type provides the alignment.
+		stream = new(NonPagedPoolNxCacheAligned, WAVERT_POOLTAG) MiniportWaveRTStream(NULL);
 
 		if (stream)
 		{
@@ -429,6 +528,13 @@ NTSTATUS MiniportWaveRT::StreamCreated
 			_Stream->SetPairedStream(m_pPairedMiniport->m_SystemStreams[0]);
 			m_pPairedMiniport->m_SystemStreams[0]->SetPairedStream(_Stream);
 		}
+
+		// The speaker's mixer writes into the cable ring of every capture
+		// stream, whatever its mode.
+		if (m_pPairedMiniport && m_pPairedMiniport->m_pMixer)
+		{
+			m_pPairedMiniport->m_pMixer->AddSink(_Stream);
+		}
 	}
 	else if (IsSystemRenderPin(_Pin))
 	{
@@ -444,6 +550,44 @@ NTSTATUS MiniportWaveRT::StreamCreated
 
 		if (IsRenderDevice()) { DPF(D_TERSE, ("SPEAKER: Created %u th system render stream.", m_ulSystemAllocated)); }
 		else { DPF(D_TERSE, ("MIC: Created %u th system render stream.", m_ulSystemAllocated)); }
+
+		// Point every open loopback stream at the new render buffer.
+		ExAcquireFastMutex(&m_SystemStreamsLock);
+		for (ULONG i = 0; i < m_ulMaxLoopbackStreams; ++i)
+		{
+			if (m_LoopbackStreams[i] != NULL)
+			{
+				m_LoopbackStreams[i]->SetLoopbackSource(_Stream);
+			}
+		}
+		ExReleaseFastMutex(&m_SystemStreamsLock);
+	}
+	else if (IsLoopbackPin(_Pin))
+	{
+		m_ulLoopbackAllocated++;
+		streams = m_LoopbackStreams;
+		count = m_ulMaxLoopbackStreams;
+
+		ExAcquireFastMutex(&m_SystemStreamsLock);
+		for (ULONG i = 0; i < m_ulMaxSystemStreams; ++i)
+		{
+			if (m_SystemStreams[i] != NULL)
+			{
+				_Stream->SetLoopbackSource(m_SystemStreams[i]);
+				break;
+			}
+		}
+		ExReleaseFastMutex(&m_SystemStreamsLock);
+
+		DPF(D_TERSE, ("SPEAKER: Created %u th loopback stream.", m_ulLoopbackAllocated));
+	}
+	else if (IsOffloadPin(_Pin))
+	{
+		m_ulOffloadAllocated++;
+		streams = m_OffloadStreams;
+		count = m_ulMaxOffloadStreams;
+
+		DPF(D_TERSE, ("SPEAKER: Created %u th offload stream.", m_ulOffloadAllocated));
 	}
 	else 
 	{
@@ -456,6 +600,7 @@ NTSTATUS MiniportWaveRT::StreamCreated
 	//
 	if (streams != NULL)
 	{
+		ExAcquireFastMutex(&m_SystemStreamsLock);
 		ULONG i = 0;
 		for (; i < count; ++i)
 		{
@@ -465,6 +610,7 @@ NTSTATUS MiniportWaveRT::StreamCreated
 				break;
 			}
 		}
+		ExReleaseFastMutex(&m_SystemStreamsLock);
 		ASSERT(i != count);
 	}
 
@@ -493,25 +639,48 @@ MiniportWaveRT::StreamClosed
 		streams = m_SystemStreams;
 		count = m_ulMaxSystemStreams;
 
-		if (m_pPairedMiniport && m_pPairedMiniport->m_ulSystemAllocated > 1)
+		// The stream destructor breaks its pair, with one stream per mode the
+		// remaining streams may not be paired at all.
+		if (IsSystemCapturePin(_Pin) && m_pPairedMiniport && m_pPairedMiniport->m_pMixer)
+		{
+			m_pPairedMiniport->m_pMixer->RemoveSink(_Stream);
+		}
+
+		if (IsSystemRenderPin(_Pin))
 		{
-			ULONG i = 0;
-			for (; i < m_pPairedMiniport->m_ulMaxSystemStreams; ++i)
+			// The loopback streams read straight out of this stream's buffer,
+			// detach them before it goes away.
+			ExAcquireFastMutex(&m_SystemStreamsLock);
+			for (ULONG i = 0; i < m_ulMaxLoopbackStreams; ++i)
 			{
-				if (m_pPairedMiniport->m_SystemStreams[i] != NULL)
+				if (m_LoopbackStreams[i] != NULL)
 				{
-					streams[i]->SetPairedStream(NULL);
-					break;
+					m_LoopbackStreams[i]->SetLoopbackSource(NULL);
 				}
 			}
+			ExReleaseFastMutex(&m_SystemStreamsLock);
 		}
 	}
+	else if (IsLoopbackPin(_Pin))
+	{
+		m_ulLoopbackAllocated--;
+		streams = m_LoopbackStreams;
+		count = m_ulMaxLoopbackStreams;
+		_Stream->SetLoopbackSource(NULL);
+	}
+	else if (IsOffloadPin(_Pin))
+	{
+		m_ulOffloadAllocated--;
+		streams = m_OffloadStreams;
+		count = m_ulMaxOffloadStreams;
+	}
 
 	//
 	// Cleanup.
 	//
 	if (streams != NULL)
 	{
+		ExAcquireFastMutex(&m_SystemStreamsLock);
 		ULONG i = 0;
 		for (; i < count; ++i)
 		{
@@ -521,6 +690,7 @@ MiniportWaveRT::StreamClosed
 				break;
 			}
 		}
+		ExReleaseFastMutex(&m_SystemStreamsLock);
 		ASSERT(i != count);
 	}
 
@@ -647,6 +817,18 @@ void MiniportWaveRT::SetPairedMiniport(MiniportWaveRT* miniport)
 	}
 }
 
+/*
+	Sets the processor the ticks of this filter's streams run on. Both
+	filters of a cable get the same one, streams opened afterwards use it.
+*/
+void MiniportWaveRT::SetCableScheduler(CableScheduler* scheduler, ULONG homeProcessor)
+{
+	PAGED_CODE();
+
+	m_pScheduler = scheduler;
+	m_ulHomeProcessor = homeProcessor;
+}
+
 /*
   Return mode information for a given pin.
 
@@ -754,6 +936,30 @@ MiniportWaveRT::~MiniportWaveRT()
 		ExFreePoolWithTag(m_SystemStreams, WAVERT_POOLTAG);
 		m_SystemStreams = NULL;
 	}
+
+	if (m_LoopbackStreams)
+	{
+		ExFreePoolWithTag(m_LoopbackStreams, WAVERT_POOLTAG);
+		m_LoopbackStreams = NULL;
+	}
+
+	if (m_OffloadStreams)
+	{
+		ExFreePoolWithTag(m_OffloadStreams, WAVERT_POOLTAG);
+		m_OffloadStreams = NULL;
+	}
+
+	if (m_pMixer)
+	{
+		delete m_pMixer;
+		m_pMixer = NULL;
+	}
+
+	if (m_pInjector)
+	{
+		delete m_pInjector;
+		m_pInjector = NULL;
+	}
 }
 
 NTSTATUS MiniportWaveRT::PropertyHandler_WaveFilter(PPCPROPERTY_REQUEST PropertyRequest)
@@ -788,7 +994,93 @@ NTSTATUS MiniportWaveRT::PropertyHandler_WaveFilter(PPCPROPERTY_REQUEST Property
 	}
 	else if (IsEqualGUIDAligned(*PropertyRequest->PropertyItem->Set, KSPROPSETID_Audio))
 	{
-		DPF(D_TERSE, ("[PropertyHandler_WaveFilter: Invalid Device Request]"));
+		// Only the audio engine node of the render filter exposes these.
+		if (pWaveHelper->m_pMixer == NULL)
+		{
+			DPF(D_TERSE, ("[PropertyHandler_WaveFilter: Invalid Device Request]"));
+		}
+		else
+		{
+			// The device volume is the endpoint volume the topology filter
+			// exposes as well, both end up in the same gain stage.
+			EndpointGain* pGain = pWaveHelper->m_pMiniportPair->Gain;
+
+			switch (PropertyRequest->PropertyItem->Id)
+			{
+			case KSPROPERTY_AUDIO_VOLUMELEVEL:
+				ntStatus = KsHelper::PropertyHandler_Volume(PropertyRequest, pGain);
+				break;
+
+			case KSPROPERTY_AUDIO_MUTE:
+				ntStatus = KsHelper::PropertyHandler_Mute(PropertyRequest, pGain);
+				break;
+
+			case KSPROPERTY_AUDIO_PEAKMETER2:
+				ntStatus = KsHelper::PropertyHandler_PeakMeter2(PropertyRequest, pGain);
+				break;
+
+			default:
+				DPF(D_TERSE, ("[PropertyHandler_WaveFilter: Invalid Device Request]"));
+			}
+		}
+	}
+	else if (IsEqualGUIDAligned(*PropertyRequest->PropertyItem->Set, KSPROPSETID_AudioEngine))
+	{
+		switch (PropertyRequest->PropertyItem->Id)
+		{
+		case KSPROPERTY_AUDIOENGINE_BUFFER_SIZE_RANGE:
+			ntStatus = pWaveHelper->PropertyHandlerBufferSizeRange(PropertyRequest);
+			break;
+
+		default:
+			ntStatus = pWaveHelper->PropertyHandlerAudioEngine(PropertyRequest);
+		}
+	}
+	else if (IsEqualGUIDAligned(*PropertyRequest->PropertyItem->Set, KSPROPSETID_AudioMirror))
+	{
+		switch (PropertyRequest->PropertyItem->Id)
+		{
+		case KSPROPERTY_AUDIOMIRROR_STREAM_STATISTICS:
+			ntStatus = pWaveHelper->PropertyHandlerStreamStatistics(PropertyRequest);
+			break;
+
+		case KSPROPERTY_AUDIOMIRROR_LATENCY_MEASUREMENT:
+			ntStatus = pWaveHelper->PropertyHandlerLatencyMeasurement(PropertyRequest);
+			break;
+
+		case KSPROPERTY_AUDIOMIRROR_CLOCK_LOCK:
+			ntStatus = pWaveHelper->PropertyHandlerClockLock(PropertyRequest);
+			break;
+
+		case KSPROPERTY_AUDIOMIRROR_SCHEDULER:
+			ntStatus = pWaveHelper->PropertyHandlerScheduler(PropertyRequest);
+			break;
+
+		case KSPROPERTY_AUDIOMIRROR_WORKER_THREADS:
+			ntStatus = pWaveHelper->PropertyHandlerWorkerThreads(PropertyRequest);
+			break;
+
+		case KSPROPERTY_AUDIOMIRROR_OVERRUN_POLICY:
+			ntStatus = pWaveHelper->PropertyHandlerOverrunPolicy(PropertyRequest);
+			break;
+
+		case KSPROPERTY_AUDIOMIRROR_PREROLL:
+			ntStatus = pWaveHelper->PropertyHandlerPreroll(PropertyRequest);
+			break;
+
+		case KSPROPERTY_AUDIOMIRROR_TAP:
+		case KSPROPERTY_AUDIOMIRROR_TAP_EVENT:
+			ntStatus = pWaveHelper->PropertyHandlerCableTap(PropertyRequest);
+			break;
+
+		case KSPROPERTY_AUDIOMIRROR_INJECT:
+		case KSPROPERTY_AUDIOMIRROR_INJECT_EVENT:
+			ntStatus = pWaveHelper->PropertyHandlerInjection(PropertyRequest);
+			break;
+
+		default:
+			DPF(D_TERSE, ("[PropertyHandler_WaveFilter: Invalid Device Request]"));
+		}
 	}
 
 	pWaveHelper->Release();
@@ -891,105 +1183,973 @@ NTSTATUS MiniportWaveRT::PropertyHandlerProposedFormat
 } // PropertyHandlerProposedFormat
 
 #pragma code_seg("PAGE")
-NTSTATUS MiniportWaveRT::PropertyHandlerProposedFormat2
+NTSTATUS MiniportWaveRT::PropertyHandlerStreamStatistics
 (
 	_In_ PPCPROPERTY_REQUEST      PropertyRequest
 )
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_STREAM_STATISTICS. Returns a KSMULTIPLE_ITEM
+  header followed by one AUDIOMIRROR_STREAM_STATISTICS per open system,
+  loopback and offload stream of this filter.
+
+--*/
 {
-	PKSP_PIN                kspPin = NULL;
-	ULONG                   cbMinSize = 0;
 	NTSTATUS                ntStatus = STATUS_INVALID_PARAMETER;
-	ULONG                   numModes = 0;
-	MODE_AND_DEFAULT_FORMAT *modeInfo = NULL;
-	MODE_AND_DEFAULT_FORMAT *modeTemp = NULL;
-	PKSMULTIPLE_ITEM        pKsItemsHeader = NULL;
-	PKSMULTIPLE_ITEM        pKsItemsHeaderOut = NULL;
-	size_t                  cbItemsList = 0;
-	GUID                    signalProcessingMode = { 0 };
-	BOOLEAN                 bFound = FALSE;
-	ULONG                   i;
+	ULONG                   cbMinSize = 0;
 
 	PAGED_CODE();
 
-	//DPF_ENTER(("[CMiniportWaveRT::PropertyHandlerProposedFormat2]"));
-
-	// All properties handled by this handler require at least a KSP_PIN descriptor.
-
-	// Verify instance data stores at least KSP_PIN fields beyond KSPPROPERTY.
-	if (PropertyRequest->InstanceSize < (sizeof(KSP_PIN) - RTL_SIZEOF_THROUGH_FIELD(KSP_PIN, Property)))
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
 	{
-		return STATUS_INVALID_PARAMETER;
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
 	}
 
-	// Extract property descriptor from property request instance data
-	kspPin = CONTAINING_RECORD(PropertyRequest->Instance, KSP_PIN, PinId);
-
-	if (kspPin->PinId >= m_pMiniportPair->WaveDescriptor->PinCount)
+	// Only GET is supported for this property
+	if ((PropertyRequest->Verb & KSPROPERTY_TYPE_GET) == 0)
 	{
-		return STATUS_INVALID_PARAMETER;
+		return STATUS_INVALID_DEVICE_REQUEST;
 	}
 
-	//
-	// This property is supported only on some streaming pins.
-	//
-	numModes = GetPinSupportedDeviceModes(kspPin->PinId, &modeInfo);
-
-	ASSERT((modeInfo != NULL && numModes > 0) || (modeInfo == NULL && numModes == 0));
-
-	if (modeInfo == NULL)
+	if (m_SystemStreams == NULL)
 	{
-		return STATUS_NOT_SUPPORTED;
+		return STATUS_INVALID_DEVICE_STATE;
 	}
 
-	//
-	// Even for pins that support modes, the pin might not support proposed formats
-	//
-	bFound = FALSE;
-	for (i = 0, modeTemp = modeInfo; i < numModes; ++i, ++modeTemp)
+	// Holding the lock keeps the streams alive, a closing stream removes
+	// itself from the list before it frees anything.
+	ExAcquireFastMutex(&m_SystemStreamsLock);
+
+	cbMinSize = sizeof(KSMULTIPLE_ITEM) + (m_ulSystemAllocated + m_ulLoopbackAllocated + m_ulOffloadAllocated) * sizeof(AUDIOMIRROR_STREAM_STATISTICS);
+	ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, cbMinSize);
+	if (NT_SUCCESS(ntStatus))
 	{
-		if (modeTemp->DefaultFormat != NULL)
+		PKSMULTIPLE_ITEM                pKsItemsHeader = (PKSMULTIPLE_ITEM)PropertyRequest->Value;
+		PAUDIOMIRROR_STREAM_STATISTICS  pStatistics = (PAUDIOMIRROR_STREAM_STATISTICS)(pKsItemsHeader + 1);
+		ULONG                           cStatistics = 0;
+
+		for (ULONG i = 0; i < m_ulMaxSystemStreams && cStatistics < m_ulSystemAllocated; ++i)
 		{
-			bFound = TRUE;
-			break;
+			if (m_SystemStreams[i] != NULL)
+			{
+				m_SystemStreams[i]->GetStatistics(&pStatistics[cStatistics++]);
+			}
 		}
-	}
 
-	if (!bFound)
-	{
-		return STATUS_NOT_SUPPORTED;
+		for (ULONG i = 0; i < m_ulMaxLoopbackStreams && cStatistics < m_ulSystemAllocated + m_ulLoopbackAllocated; ++i)
+		{
+			if (m_LoopbackStreams[i] != NULL)
+			{
+				m_LoopbackStreams[i]->GetStatistics(&pStatistics[cStatistics++]);
+			}
+		}
+
+		for (ULONG i = 0; i < m_ulMaxOffloadStreams && cStatistics < m_ulSystemAllocated + m_ulLoopbackAllocated + m_ulOffloadAllocated; ++i)
+		{
+			if (m_OffloadStreams[i] != NULL)
+			{
+				m_OffloadStreams[i]->GetStatistics(&pStatistics[cStatistics++]);
+			}
+		}
+
+		pKsItemsHeader->Count = cStatistics;
+		pKsItemsHeader->Size = sizeof(KSMULTIPLE_ITEM) + cStatistics * sizeof(AUDIOMIRROR_STREAM_STATISTICS);
+		PropertyRequest->ValueSize = pKsItemsHeader->Size;
 	}
 
-	//
-	// The property is generally supported on this pin. Handle basic support request.
-	//
+	ExReleaseFastMutex(&m_SystemStreamsLock);
+
+	return ntStatus;
+} // PropertyHandlerStreamStatistics
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerLatencyMeasurement
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_LATENCY_MEASUREMENT. SET takes a ULONG that
+  enables or disables the measurement on all current and future capture
+  streams of this filter. GET returns a KSMULTIPLE_ITEM header followed by one
+  AUDIOMIRROR_LATENCY_HISTOGRAM per open capture stream.
+
+--*/
+{
+	NTSTATUS                ntStatus = STATUS_INVALID_PARAMETER;
+	ULONG                   cbMinSize = 0;
+
+	PAGED_CODE();
+
 	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
 	{
 		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
 	}
 
-	//
-	// Get the mode if specified.
-	//
-	pKsItemsHeader = (PKSMULTIPLE_ITEM)(kspPin + 1);
-	cbItemsList = (((PBYTE)PropertyRequest->Instance) + PropertyRequest->InstanceSize) - (PBYTE)pKsItemsHeader;
-
-	ntStatus = KsHelper::GetAttributesFromAttributeList(pKsItemsHeader, cbItemsList, &signalProcessingMode);
-	if (!NT_SUCCESS(ntStatus))
+	// The cable ring and with it the measurement live in the capture streams.
+	if (IsRenderDevice())
 	{
-		return ntStatus;
+		return STATUS_NOT_SUPPORTED;
 	}
 
-	//
-	// Get the info associated with this mode.
-	//
-	bFound = FALSE;
-	for (i = 0; i < numModes; ++i, ++modeInfo)
+	if (m_SystemStreams == NULL)
 	{
-		if (modeInfo->Mode == signalProcessingMode)
-		{
-			bFound = TRUE;
-			break;
-		}
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	ExAcquireFastMutex(&m_SystemStreamsLock);
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(ULONG));
+		if (NT_SUCCESS(ntStatus))
+		{
+			m_bLatencyMeasurement = (*(PULONG)PropertyRequest->Value != 0);
+
+			for (ULONG i = 0; i < m_ulMaxSystemStreams; ++i)
+			{
+				if (m_SystemStreams[i] != NULL)
+				{
+					m_SystemStreams[i]->EnableLatencyMeasurement(m_bLatencyMeasurement);
+				}
+			}
+		}
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+	{
+		cbMinSize = sizeof(KSMULTIPLE_ITEM) + m_ulSystemAllocated * sizeof(AUDIOMIRROR_LATENCY_HISTOGRAM);
+		ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, cbMinSize);
+		if (NT_SUCCESS(ntStatus))
+		{
+			PKSMULTIPLE_ITEM                pKsItemsHeader = (PKSMULTIPLE_ITEM)PropertyRequest->Value;
+			PAUDIOMIRROR_LATENCY_HISTOGRAM  pHistograms = (PAUDIOMIRROR_LATENCY_HISTOGRAM)(pKsItemsHeader + 1);
+			ULONG                           cHistograms = 0;
+
+			for (ULONG i = 0; i < m_ulMaxSystemStreams && cHistograms < m_ulSystemAllocated; ++i)
+			{
+				if (m_SystemStreams[i] != NULL)
+				{
+					m_SystemStreams[i]->GetLatencyHistogram(&pHistograms[cHistograms++]);
+				}
+			}
+
+			pKsItemsHeader->Count = cHistograms;
+			pKsItemsHeader->Size = sizeof(KSMULTIPLE_ITEM) + cHistograms * sizeof(AUDIOMIRROR_LATENCY_HISTOGRAM);
+			PropertyRequest->ValueSize = pKsItemsHeader->Size;
+		}
+	}
+
+	ExReleaseFastMutex(&m_SystemStreamsLock);
+
+	return ntStatus;
+} // PropertyHandlerLatencyMeasurement
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerClockLock
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_CLOCK_LOCK. SET takes a ULONG that locks or
+  unlocks the position of all current and future capture streams of this
+  filter to the render side. GET returns the current setting.
+
+--*/
+{
+	NTSTATUS                ntStatus = STATUS_INVALID_PARAMETER;
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_UI4);
+	}
+
+	// Only the capture streams have a clock to lock.
+	if (IsRenderDevice())
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	if (m_SystemStreams == NULL)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(ULONG));
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	ExAcquireFastMutex(&m_SystemStreamsLock);
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		m_bClockLock = (*(PULONG)PropertyRequest->Value != 0);
+
+		for (ULONG i = 0; i < m_ulMaxSystemStreams; ++i)
+		{
+			if (m_SystemStreams[i] != NULL)
+			{
+				m_SystemStreams[i]->SetClockLock(m_bClockLock ? TRUE : FALSE);
+			}
+		}
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+	{
+		*(PULONG)PropertyRequest->Value = m_bClockLock ? 1 : 0;
+		PropertyRequest->ValueSize = sizeof(ULONG);
+	}
+	else
+	{
+		ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ExReleaseFastMutex(&m_SystemStreamsLock);
+
+	return ntStatus;
+} // PropertyHandlerClockLock
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerScheduler
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_SCHEDULER. Returns a KSMULTIPLE_ITEM header
+  followed by one AUDIOMIRROR_PROCESSOR_STATISTICS per processor the cables
+  are spread across. Both filters share the adapter's scheduler.
+
+--*/
+{
+	NTSTATUS                ntStatus = STATUS_INVALID_PARAMETER;
+	ULONG                   cbMinSize = 0;
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
+	}
+
+	// Only GET is supported for this property
+	if ((PropertyRequest->Verb & KSPROPERTY_TYPE_GET) == 0)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	if (m_pScheduler == NULL)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	cbMinSize = sizeof(KSMULTIPLE_ITEM) + m_pScheduler->GetProcessorCount() * sizeof(AUDIOMIRROR_PROCESSOR_STATISTICS);
+	ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, cbMinSize);
+	if (NT_SUCCESS(ntStatus))
+	{
+		PKSMULTIPLE_ITEM                    pKsItemsHeader = (PKSMULTIPLE_ITEM)PropertyRequest->Value;
+		PAUDIOMIRROR_PROCESSOR_STATISTICS   pStatistics = (PAUDIOMIRROR_PROCESSOR_STATISTICS)(pKsItemsHeader + 1);
+
+		for (ULONG i = 0; i < m_pScheduler->GetProcessorCount(); ++i)
+		{
+			m_pScheduler->GetProcessorStatistics(i, &pStatistics[i]);
+		}
+
+		pKsItemsHeader->Count = m_pScheduler->GetProcessorCount();
+		pKsItemsHeader->Size = cbMinSize;
+		PropertyRequest->ValueSize = cbMinSize;
+	}
+
+	return ntStatus;
+} // PropertyHandlerScheduler
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerWorkerThreads
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_WORKER_THREADS. SET takes a ULONG that
+  decides whether streams opened on this filter from then on process their
+  blocks on a worker thread. Running streams keep their mode. GET returns
+  the current setting.
+
+--*/
+{
+	NTSTATUS                ntStatus = STATUS_INVALID_PARAMETER;
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_UI4);
+	}
+
+	ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(ULONG));
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	ExAcquireFastMutex(&m_SystemStreamsLock);
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		m_bWorkerThreads = (*(PULONG)PropertyRequest->Value != 0);
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+	{
+		*(PULONG)PropertyRequest->Value = m_bWorkerThreads ? 1 : 0;
+		PropertyRequest->ValueSize = sizeof(ULONG);
+	}
+	else
+	{
+		ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ExReleaseFastMutex(&m_SystemStreamsLock);
+
+	return ntStatus;
+} // PropertyHandlerWorkerThreads
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerOverrunPolicy
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_OVERRUN_POLICY. SET takes one of the
+  AUDIOMIRROR_OVERRUN_* values for the capture streams opened on this
+  filter from then on. GET returns the current setting.
+
+--*/
+{
+	NTSTATUS                ntStatus = STATUS_INVALID_PARAMETER;
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_UI4);
+	}
+
+	// Only the capture streams own a cable ring.
+	if (IsRenderDevice())
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(ULONG));
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	ExAcquireFastMutex(&m_SystemStreamsLock);
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		if (*(PULONG)PropertyRequest->Value > AUDIOMIRROR_OVERRUN_SKIP_TO_LATENCY)
+		{
+			ntStatus = STATUS_INVALID_PARAMETER;
+		}
+		else
+		{
+			m_ulOverrunPolicy = *(PULONG)PropertyRequest->Value;
+		}
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+	{
+		*(PULONG)PropertyRequest->Value = m_ulOverrunPolicy;
+		PropertyRequest->ValueSize = sizeof(ULONG);
+	}
+	else
+	{
+		ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ExReleaseFastMutex(&m_SystemStreamsLock);
+
+	return ntStatus;
+} // PropertyHandlerOverrunPolicy
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerPreroll
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_PREROLL. SET takes the milliseconds of
+  render history the capture streams opened on this filter from then on
+  start with. GET returns the current setting.
+
+--*/
+{
+	NTSTATUS                ntStatus = STATUS_INVALID_PARAMETER;
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_UI4);
+	}
+
+	// Only the capture streams own a cable ring.
+	if (IsRenderDevice())
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(ULONG));
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	ExAcquireFastMutex(&m_SystemStreamsLock);
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		if (*(PULONG)PropertyRequest->Value > AUDIOMIRROR_PREROLL_MAX_MS)
+		{
+			ntStatus = STATUS_INVALID_PARAMETER;
+		}
+		else
+		{
+			m_ulPrerollMs = *(PULONG)PropertyRequest->Value;
+		}
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+	{
+		*(PULONG)PropertyRequest->Value = m_ulPrerollMs;
+		PropertyRequest->ValueSize = sizeof(ULONG);
+	}
+	else
+	{
+		ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ExReleaseFastMutex(&m_SystemStreamsLock);
+
+	return ntStatus;
+} // PropertyHandlerPreroll
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerCableTap
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_TAP and KSPROPERTY_AUDIOMIRROR_TAP_EVENT.
+  The tap is created on the first request. Both properties act on the
+  calling process, so they are only served synchronously in the context of
+  the user mode process that sent the request.
+
+--*/
+{
+	NTSTATUS    ntStatus = STATUS_INVALID_PARAMETER;
+	CableTap*   pTap = NULL;
+	PIRP        pIrp = PropertyRequest->Irp;
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
+	}
+
+	if (!IsRenderDevice() || m_pMixer == NULL)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	if (pIrp == NULL || pIrp->RequestorMode != UserMode || IoGetRequestorProcess(pIrp) != PsGetCurrentProcess())
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ExAcquireFastMutex(&m_SystemStreamsLock);
+
+	pTap = m_pMixer->GetTap();
+	if (pTap == NULL)
+	{
+		pTap = new(NonPagedPoolNx, WAVERT_POOLTAG) CableTap();
+		if (pTap == NULL)
+		{
+			ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+		}
+		else
+		{
+			ntStatus = pTap->Init(&m_pDeviceFormat->WaveFormatExt.Format);
+			if (NT_SUCCESS(ntStatus))
+			{
+				m_pMixer->AttachTap(pTap);
+			}
+			else
+			{
+				delete pTap;
+				pTap = NULL;
+			}
+		}
+	}
+
+	ExReleaseFastMutex(&m_SystemStreamsLock);
+
+	if (pTap == NULL)
+	{
+		return ntStatus;
+	}
+
+	if (PropertyRequest->PropertyItem->Id == KSPROPERTY_AUDIOMIRROR_TAP)
+	{
+		if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+		{
+			ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(AUDIOMIRROR_TAP_MAPPING));
+			if (NT_SUCCESS(ntStatus))
+			{
+				ntStatus = pTap->MapIntoCurrentProcess((PAUDIOMIRROR_TAP_MAPPING)PropertyRequest->Value);
+				if (NT_SUCCESS(ntStatus))
+				{
+					PropertyRequest->ValueSize = sizeof(AUDIOMIRROR_TAP_MAPPING);
+				}
+			}
+		}
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(AUDIOMIRROR_TAP_EVENT));
+		if (NT_SUCCESS(ntStatus))
+		{
+			PAUDIOMIRROR_TAP_EVENT pTapEvent = (PAUDIOMIRROR_TAP_EVENT)PropertyRequest->Value;
+
+			ntStatus = pTap->RegisterEvent((HANDLE)(ULONG_PTR)pTapEvent->EventHandle, pTapEvent->Register != 0);
+		}
+	}
+
+	return ntStatus;
+} // PropertyHandlerCableTap
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerInjection
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOMIRROR_INJECT and KSPROPERTY_AUDIOMIRROR_INJECT_EVENT.
+  The injection ring is created on the first request in the first device
+  format of the capture pin. Like the tap, both properties act on the calling
+  process.
+
+--*/
+{
+	NTSTATUS                            ntStatus = STATUS_INVALID_PARAMETER;
+	CableInjector*                      pInjector = NULL;
+	KSDATAFORMAT_WAVEFORMATEXTENSIBLE*  pFormats = NULL;
+	PIRP                                pIrp = PropertyRequest->Irp;
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
+	}
+
+	if (IsRenderDevice())
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	if (pIrp == NULL || pIrp->RequestorMode != UserMode || IoGetRequestorProcess(pIrp) != PsGetCurrentProcess())
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ExAcquireFastMutex(&m_SystemStreamsLock);
+
+	pInjector = m_pInjector;
+	if (pInjector == NULL && GetPinSupportedDeviceFormats(GetSystemPinId(), &pFormats) > 0)
+	{
+		pInjector = new(NonPagedPoolNx, WAVERT_POOLTAG) CableInjector();
+		if (pInjector == NULL)
+		{
+			ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+		}
+		else
+		{
+			ntStatus = pInjector->Init(&pFormats[0].WaveFormatExt.Format);
+			if (NT_SUCCESS(ntStatus))
+			{
+				// Streams pick the injector up from their timer DPC.
+				InterlockedExchangePointer((PVOID volatile*)&m_pInjector, pInjector);
+			}
+			else
+			{
+				delete pInjector;
+				pInjector = NULL;
+			}
+		}
+	}
+
+	ExReleaseFastMutex(&m_SystemStreamsLock);
+
+	if (pInjector == NULL)
+	{
+		return ntStatus;
+	}
+
+	if (PropertyRequest->PropertyItem->Id == KSPROPERTY_AUDIOMIRROR_INJECT)
+	{
+		if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+		{
+			ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(AUDIOMIRROR_TAP_MAPPING));
+			if (NT_SUCCESS(ntStatus))
+			{
+				ntStatus = pInjector->MapIntoCurrentProcess((PAUDIOMIRROR_TAP_MAPPING)PropertyRequest->Value);
+				if (NT_SUCCESS(ntStatus))
+				{
+					PropertyRequest->ValueSize = sizeof(AUDIOMIRROR_TAP_MAPPING);
+				}
+			}
+		}
+	}
+	else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+	{
+		ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(AUDIOMIRROR_TAP_EVENT));
+		if (NT_SUCCESS(ntStatus))
+		{
+			PAUDIOMIRROR_TAP_EVENT pInjectEvent = (PAUDIOMIRROR_TAP_EVENT)PropertyRequest->Value;
+
+			ntStatus = pInjector->RegisterEvent((HANDLE)(ULONG_PTR)pInjectEvent->EventHandle, pInjectEvent->Register != 0);
+		}
+	}
+
+	return ntStatus;
+} // PropertyHandlerInjection
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerAudioEngine
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles the filter level KSPROPSETID_AudioEngine properties of the audio
+  engine node. The engine is the cable mixer, it runs at the device format.
+
+--*/
+{
+	NTSTATUS    ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+	ULONG       ulPropertyId = PropertyRequest->PropertyItem->Id;
+
+	PAGED_CODE();
+
+	if (!IsRenderDevice() || m_pMixer == NULL)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	switch (ulPropertyId)
+	{
+	case KSPROPERTY_AUDIOENGINE_GFXENABLE:
+		if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+		{
+			return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_BOOL);
+		}
+
+		ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(BOOL));
+		if (NT_SUCCESS(ntStatus))
+		{
+			if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+			{
+				*(PBOOL)PropertyRequest->Value = m_bGfxEnabled;
+				PropertyRequest->ValueSize = sizeof(BOOL);
+			}
+			else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+			{
+				m_bGfxEnabled = *(PBOOL)PropertyRequest->Value;
+			}
+		}
+		break;
+
+	case KSPROPERTY_AUDIOENGINE_MIXFORMAT:
+	case KSPROPERTY_AUDIOENGINE_DEVICEFORMAT:
+		if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+		{
+			return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
+		}
+
+		ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE));
+		if (NT_SUCCESS(ntStatus))
+		{
+			if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+			{
+				// The mixer sums at the device format, so both are the same.
+				RtlCopyMemory(PropertyRequest->Value, m_pDeviceFormat, sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE));
+				PropertyRequest->ValueSize = sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE);
+			}
+			else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET && ulPropertyId == KSPROPERTY_AUDIOENGINE_DEVICEFORMAT)
+			{
+				KSDATAFORMAT_WAVEFORMATEXTENSIBLE* pFormats = NULL;
+				ULONG cFormats = GetAudioEngineSupportedDeviceFormats(&pFormats);
+				PWAVEFORMATEX pRequested = KsHelper::GetWaveFormatEx((PKSDATAFORMAT)PropertyRequest->Value);
+
+				ntStatus = STATUS_NOT_SUPPORTED;
+				for (ULONG i = 0; pRequested != NULL && i < cFormats; ++i)
+				{
+					PWAVEFORMATEX pFormat = &pFormats[i].WaveFormatExt.Format;
+					if (pRequested->nChannels == pFormat->nChannels &&
+						pRequested->nSamplesPerSec == pFormat->nSamplesPerSec &&
+						pRequested->wBitsPerSample == pFormat->wBitsPerSample &&
+						pRequested->nBlockAlign == pFormat->nBlockAlign)
+					{
+						m_pDeviceFormat = &pFormats[i];
+						ntStatus = STATUS_SUCCESS;
+						break;
+					}
+				}
+			}
+			else
+			{
+				ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+			}
+		}
+		break;
+
+	case KSPROPERTY_AUDIOENGINE_SUPPORTEDDEVICEFORMATS:
+		if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+		{
+			return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
+		}
+
+		if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+		{
+			KSDATAFORMAT_WAVEFORMATEXTENSIBLE* pFormats = NULL;
+			ULONG cFormats = GetAudioEngineSupportedDeviceFormats(&pFormats);
+			ULONG cbSize = sizeof(KSMULTIPLE_ITEM) + cFormats * sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE);
+
+			ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, cbSize);
+			if (NT_SUCCESS(ntStatus))
+			{
+				PKSMULTIPLE_ITEM pKsItemsHeader = (PKSMULTIPLE_ITEM)PropertyRequest->Value;
+
+				pKsItemsHeader->Count = cFormats;
+				pKsItemsHeader->Size = cbSize;
+				RtlCopyMemory(pKsItemsHeader + 1, pFormats, cFormats * sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE));
+				PropertyRequest->ValueSize = cbSize;
+			}
+		}
+		break;
+
+	case KSPROPERTY_AUDIOENGINE_DESCRIPTOR:
+		if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+		{
+			return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
+		}
+
+		if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+		{
+			ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(KSAUDIOENGINE_DESCRIPTOR));
+			if (NT_SUCCESS(ntStatus))
+			{
+				PKSAUDIOENGINE_DESCRIPTOR pDescriptor = (PKSAUDIOENGINE_DESCRIPTOR)PropertyRequest->Value;
+
+				pDescriptor->nHostPinId = GetSystemPinId();
+				pDescriptor->nOffloadPinId = GetOffloadPinId();
+				pDescriptor->nLoopbackPinId = GetLoopbackPinId();
+				PropertyRequest->ValueSize = sizeof(KSAUDIOENGINE_DESCRIPTOR);
+			}
+		}
+		break;
+
+	default:
+		// LFX, stream volume and loopback protection are per stream, PortCls
+		// serves them through IMiniportStreamAudioEngineNode.
+		DPF(D_TERSE, ("[PropertyHandlerAudioEngine: Invalid Device Request]"));
+		break;
+	}
+
+	return ntStatus;
+} // PropertyHandlerAudioEngine
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerBufferSizeRange
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Handles KSPROPERTY_AUDIOENGINE_BUFFER_SIZE_RANGE. The format the caller
+  asks about follows the property.
+
+--*/
+{
+	NTSTATUS                            ntStatus;
+	PKSDATAFORMAT_WAVEFORMATEX          pKsFormat;
+	PKSAUDIOENGINE_BUFFER_SIZE_RANGE    pBufferSizeRange;
+
+	PAGED_CODE();
+
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
+	}
+
+	if ((PropertyRequest->Verb & KSPROPERTY_TYPE_GET) == 0)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ntStatus = KsHelper::ValidatePropertyParams(PropertyRequest, sizeof(KSAUDIOENGINE_BUFFER_SIZE_RANGE), sizeof(KSDATAFORMAT_WAVEFORMATEX));
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	pKsFormat = (PKSDATAFORMAT_WAVEFORMATEX)PropertyRequest->Instance;
+	ntStatus = IsFormatSupported(GetOffloadPinId(), FALSE, &pKsFormat->DataFormat);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	pBufferSizeRange = (PKSAUDIOENGINE_BUFFER_SIZE_RANGE)PropertyRequest->Value;
+	pBufferSizeRange->MinBufferBytes = MIN_BUFFER_DURATION_MS * pKsFormat->WaveFormatEx.nAvgBytesPerSec / MS_PER_SEC;
+	pBufferSizeRange->MaxBufferBytes = MAX_BUFFER_DURATION_MS * pKsFormat->WaveFormatEx.nAvgBytesPerSec / MS_PER_SEC;
+	PropertyRequest->ValueSize = sizeof(KSAUDIOENGINE_BUFFER_SIZE_RANGE);
+
+	return STATUS_SUCCESS;
+} // PropertyHandlerBufferSizeRange
+
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::PropertyHandlerProposedFormat2
+(
+	_In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+{
+	PKSP_PIN                kspPin = NULL;
+	ULONG                   cbMinSize = 0;
+	NTSTATUS                ntStatus = STATUS_INVALID_PARAMETER;
+	ULONG                   numModes = 0;
+	MODE_AND_DEFAULT_FORMAT *modeInfo = NULL;
+	MODE_AND_DEFAULT_FORMAT *modeTemp = NULL;
+	PKSMULTIPLE_ITEM        pKsItemsHeader = NULL;
+	PKSMULTIPLE_ITEM        pKsItemsHeaderOut = NULL;
+	size_t                  cbItemsList = 0;
+	GUID                    signalProcessingMode = { 0 };
+	BOOLEAN                 bFound = FALSE;
+	ULONG                   i;
+
+	PAGED_CODE();
+
+	//DPF_ENTER(("[CMiniportWaveRT::PropertyHandlerProposedFormat2]"));
+
+	// All properties handled by this handler require at least a KSP_PIN descriptor.
+
+	// Verify instance data stores at least KSP_PIN fields beyond KSPPROPERTY.
+	if (PropertyRequest->InstanceSize < (sizeof(KSP_PIN) - RTL_SIZEOF_THROUGH_FIELD(KSP_PIN, Property)))
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	// Extract property descriptor from property request instance data
+	kspPin = CONTAINING_RECORD(PropertyRequest->Instance, KSP_PIN, PinId);
+
+	if (kspPin->PinId >= m_pMiniportPair->WaveDescriptor->PinCount)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	//
+	// This property is supported only on some streaming pins.
+	//
+	numModes = GetPinSupportedDeviceModes(kspPin->PinId, &modeInfo);
+
+	ASSERT((modeInfo != NULL && numModes > 0) || (modeInfo == NULL && numModes == 0));
+
+	if (modeInfo == NULL)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	//
+	// Even for pins that support modes, the pin might not support proposed formats
+	//
+	bFound = FALSE;
+	for (i = 0, modeTemp = modeInfo; i < numModes; ++i, ++modeTemp)
+	{
+		if (modeTemp->DefaultFormat != NULL)
+		{
+			bFound = TRUE;
+			break;
+		}
+	}
+
+	if (!bFound)
+	{
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	//
+	// The property is generally supported on this pin. Handle basic support request.
+	//
+	if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		return KsHelper::PropertyHandler_BasicSupport(PropertyRequest, PropertyRequest->PropertyItem->Flags, VT_ILLEGAL);
+	}
+
+	//
+	// Get the mode if specified.
+	//
+	pKsItemsHeader = (PKSMULTIPLE_ITEM)(kspPin + 1);
+	cbItemsList = (((PBYTE)PropertyRequest->Instance) + PropertyRequest->InstanceSize) - (PBYTE)pKsItemsHeader;
+
+	ntStatus = KsHelper::GetAttributesFromAttributeList(pKsItemsHeader, cbItemsList, &signalProcessingMode);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	//
+	// Get the info associated with this mode.
+	//
+	bFound = FALSE;
+	for (i = 0; i < numModes; ++i, ++modeInfo)
+	{
+		if (modeInfo->Mode == signalProcessingMode)
+		{
+			bFound = TRUE;
+			break;
+		}
 	}
 
 	// Either the mode isn't supported, or the driver doesn't support a
@@ -1066,7 +2226,6 @@ NTSTATUS MiniportWaveRT::IsFormatSupported
 
 	//DPF_ENTER(("[CMiniportWaveRT::IsFormatSupported]"));
 
-	NTSTATUS                            ntStatus = STATUS_NO_MATCH;
 	PKSDATAFORMAT_WAVEFORMATEXTENSIBLE  pPinFormats = NULL;
 	ULONG                               cPinFormats = 0;
 
@@ -1079,46 +2238,7 @@ NTSTATUS MiniportWaveRT::IsFormatSupported
 
 	cPinFormats = GetPinSupportedDeviceFormats(_ulPin, &pPinFormats);
 
-	for (UINT iFormat = 0; iFormat < cPinFormats; iFormat++)
-	{
-		PKSDATAFORMAT_WAVEFORMATEXTENSIBLE pFormat = &pPinFormats[iFormat];
-		// KSDATAFORMAT VALIDATION
-		if (!IsEqualGUIDAligned(pFormat->DataFormat.MajorFormat, _pDataFormat->MajorFormat)) { continue; }
-		if (!IsEqualGUIDAligned(pFormat->DataFormat.SubFormat, _pDataFormat->SubFormat)) { continue; }
-		if (!IsEqualGUIDAligned(pFormat->DataFormat.Specifier, _pDataFormat->Specifier)) { continue; }
-		if (pFormat->DataFormat.FormatSize < sizeof(KSDATAFORMAT_WAVEFORMATEX)) { continue; }
-
-		// WAVEFORMATEX VALIDATION
-		PWAVEFORMATEX pWaveFormat = reinterpret_cast<PWAVEFORMATEX>(_pDataFormat + 1);
-
-		if (pWaveFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE)
-		{
-			if (pWaveFormat->wFormatTag != EXTRACT_WAVEFORMATEX_ID(&(pFormat->WaveFormatExt.SubFormat))) { continue; }
-		}
-		if (pWaveFormat->nChannels != pFormat->WaveFormatExt.Format.nChannels) { continue; }
-		if (pWaveFormat->nSamplesPerSec != pFormat->WaveFormatExt.Format.nSamplesPerSec) { continue; }
-		if (pWaveFormat->nBlockAlign != pFormat->WaveFormatExt.Format.nBlockAlign) { continue; }
-		if (pWaveFormat->wBitsPerSample != pFormat->WaveFormatExt.Format.wBitsPerSample) { continue; }
-
-		if (pWaveFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE)
-		{
-			ntStatus = STATUS_SUCCESS;
-			break;
-		}
-
-		// WAVEFORMATEXTENSIBLE VALIDATION
-		if (pWaveFormat->cbSize < sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) { continue; }
-
-		PWAVEFORMATEXTENSIBLE pWaveFormatExt = reinterpret_cast<PWAVEFORMATEXTENSIBLE>(pWaveFormat);
-		if (pWaveFormatExt->Samples.wValidBitsPerSample != pFormat->WaveFormatExt.Samples.wValidBitsPerSample) { continue; }
-		if (pWaveFormatExt->dwChannelMask != pFormat->WaveFormatExt.dwChannelMask) { continue; }
-		if (!IsEqualGUIDAligned(pWaveFormatExt->SubFormat, pFormat->WaveFormatExt.SubFormat)) { continue; }
-
-		ntStatus = STATUS_SUCCESS;
-		break;
-	}
-
-	return ntStatus;
+	return FormatHelper::FindSupportedFormat(_pDataFormat, pPinFormats, cPinFormats);
 }
 
 _Post_satisfies_(return > 0)
@@ -1148,7 +2268,8 @@ ULONG MiniportWaveRT::GetPinSupportedDeviceFormats(_In_ ULONG PinId, _Outptr_opt
 NTSTATUS MiniportWaveRT::ValidateStreamCreate
 (
 	_In_    ULONG   _Pin,
-	_In_    BOOLEAN _Capture
+	_In_    BOOLEAN _Capture,
+	_In_    GUID    _SignalProcessingMode
 )
 {
 	PAGED_CODE();
@@ -1162,6 +2283,14 @@ NTSTATUS MiniportWaveRT::ValidateStreamCreate
 		if (IsSystemCapturePin(_Pin))
 		{
 			ntStatus = VerifyPinInstanceResourcesAvailable(m_ulSystemAllocated , m_ulMaxSystemStreams);
+			if (NT_SUCCESS(ntStatus))
+			{
+				ntStatus = VerifyModeResourcesAvailable(_Pin, m_SystemStreams, m_ulMaxSystemStreams, _SignalProcessingMode);
+			}
+		}
+		else if (IsLoopbackPin(_Pin))
+		{
+			ntStatus = VerifyPinInstanceResourcesAvailable(m_ulLoopbackAllocated, m_ulMaxLoopbackStreams);
 		}
 	}
 	else
@@ -1169,6 +2298,19 @@ NTSTATUS MiniportWaveRT::ValidateStreamCreate
 		if (IsSystemRenderPin(_Pin))
 		{
 			ntStatus = VerifyPinInstanceResourcesAvailable(m_ulSystemAllocated, m_ulMaxSystemStreams);
+			if (NT_SUCCESS(ntStatus))
+			{
+				ntStatus = VerifyModeResourcesAvailable(_Pin, m_SystemStreams, m_ulMaxSystemStreams, _SignalProcessingMode);
+			}
+		}
+		else if (IsOffloadPin(_Pin))
+		{
+			ntStatus = VerifyPinInstanceResourcesAvailable(m_ulOffloadAllocated, m_ulMaxOffloadStreams);
+			if (NT_SUCCESS(ntStatus) && GetPinSupportedDeviceModes(_Pin, NULL) > 0)
+			{
+				// Offload streams share a mode, only check that it is advertised.
+				ntStatus = VerifyModeResourcesAvailable(_Pin, NULL, 0, _SignalProcessingMode);
+			}
 		}
 	}
 
@@ -1195,6 +2337,63 @@ NTSTATUS MiniportWaveRT::VerifyPinInstanceResourcesAvailable(ULONG allocated, UL
 	return (allocated < max) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
 }
 
+#pragma code_seg("PAGE")
+NTSTATUS MiniportWaveRT::VerifyModeResourcesAvailable
+(
+	_In_ ULONG                  _Pin,
+	_In_opt_ MiniportWaveRTStream** streams,
+	_In_ ULONG                  count,
+	_In_ GUID                   _SignalProcessingMode
+)
+/*++
+
+Routine Description:
+
+  Streams of the system pins are keyed by their signal processing mode. The
+  mode has to be advertised on the pin and only one stream per mode may be
+  open at a time.
+
+--*/
+{
+	NTSTATUS                    ntStatus = STATUS_NOT_SUPPORTED;
+	PMODE_AND_DEFAULT_FORMAT    modes = NULL;
+	ULONG                       numModes;
+
+	PAGED_CODE();
+
+	numModes = GetPinSupportedDeviceModes(_Pin, &modes);
+	for (ULONG i = 0; i < numModes; ++i)
+	{
+		if (modes[i].Mode == _SignalProcessingMode)
+		{
+			ntStatus = STATUS_SUCCESS;
+			break;
+		}
+	}
+
+	if (!NT_SUCCESS(ntStatus))
+	{
+		DPF(D_TERSE, ("[VerifyModeResourcesAvailable: mode not supported on pin %u]", _Pin));
+		return ntStatus;
+	}
+
+	if (streams != NULL)
+	{
+		ExAcquireFastMutex(&m_SystemStreamsLock);
+		for (ULONG i = 0; i < count; ++i)
+		{
+			if (streams[i] != NULL && streams[i]->GetSignalProcessingMode() == _SignalProcessingMode)
+			{
+				ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+				break;
+			}
+		}
+		ExReleaseFastMutex(&m_SystemStreamsLock);
+	}
+
+	return ntStatus;
+}
+
 PinType MiniportWaveRT::GetPinTypeForPinNum(ULONG nPin)
 {
 	ExAcquireFastMutex(&m_DeviceFormatsAndModesLock);
@@ -1219,4 +2418,16 @@ BOOL MiniportWaveRT::IsBridgePin(ULONG nPinId)
 {
 	PAGED_CODE();
 	return (GetPinTypeForPinNum(nPinId) == PinType::BridgePin);
+}
+
+BOOL MiniportWaveRT::IsLoopbackPin(ULONG nPinId)
+{
+	PAGED_CODE();
+	return (GetPinTypeForPinNum(nPinId) == PinType::RenderLoopbackPin);
+}
+
+BOOL MiniportWaveRT::IsOffloadPin(ULONG nPinId)
+{
+	PAGED_CODE();
+	return (GetPinTypeForPinNum(nPinId) == PinType::OffloadRenderPin);
 }
\ No newline at end of file
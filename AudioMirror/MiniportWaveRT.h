@@ -4,6 +4,9 @@
 #include "EndpointMinipair.h"
 #include "IAdapterCommon.h"
 #include "MiniportWaveRTStream.h"
+#include "CableMixer.h"
+#include "CableInjector.h"
+#include "CableScheduler.h"
 
 DEFINE_GUID(IID_MiniportWaveRT,
 	0xebbe60f7, 0xe725, 0x4be9, 0xbc, 0x3e, 0x6e, 0xd5, 0x6e, 0xee, 0x37, 0x2e);
@@ -19,8 +22,26 @@ private:
 
 	ULONG m_ulMaxSystemStreams;
 	ULONG m_ulSystemAllocated;
+	ULONG m_ulMaxLoopbackStreams;
+	ULONG m_ulLoopbackAllocated;
+	ULONG m_ulMaxOffloadStreams;
+	ULONG m_ulOffloadAllocated;
 
 	MiniportWaveRTStream**          m_SystemStreams;
+	MiniportWaveRTStream**          m_LoopbackStreams;
+	MiniportWaveRTStream**          m_OffloadStreams;
+	CableMixer*                     m_pMixer;
+	CableInjector* volatile         m_pInjector;
+	CableScheduler*                 m_pScheduler;       // Owned by the adapter.
+	ULONG                           m_ulHomeProcessor;
+	BOOL                            m_bGfxEnabled;
+	PKSDATAFORMAT_WAVEFORMATEXTENSIBLE m_pDeviceFormat;
+	FAST_MUTEX m_SystemStreamsLock;
+	BOOL m_bLatencyMeasurement;
+	BOOL m_bClockLock;
+	BOOL m_bWorkerThreads;
+	ULONG m_ulOverrunPolicy;
+	ULONG m_ulPrerollMs;
 
 	DeviceType m_DeviceType;
 	PVOID m_DeviceContext;
@@ -35,19 +56,33 @@ private:
 
 	BOOL IsRenderDevice();
 	ULONG GetSystemPinId();
+	ULONG GetOffloadPinId();
+	ULONG GetLoopbackPinId();
 
 	NTSTATUS PropertyHandlerProposedFormat(PPCPROPERTY_REQUEST PropertyRequest);
 	NTSTATUS PropertyHandlerProposedFormat2(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerStreamStatistics(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerLatencyMeasurement(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerClockLock(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerScheduler(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerWorkerThreads(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerOverrunPolicy(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerPreroll(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerCableTap(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerInjection(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerAudioEngine(PPCPROPERTY_REQUEST PropertyRequest);
+	NTSTATUS PropertyHandlerBufferSizeRange(PPCPROPERTY_REQUEST PropertyRequest);
 	NTSTATUS IsFormatSupported(ULONG _ulPin, BOOLEAN _bCapture, PKSDATAFORMAT _pDataFormat);
 	ULONG GetPinSupportedDeviceFormats(ULONG PinId, KSDATAFORMAT_WAVEFORMATEXTENSIBLE** ppFormats);
 	ULONG GetPinSupportedDeviceModes(ULONG PinId, MODE_AND_DEFAULT_FORMAT ** ppModes);
 	ULONG GetAudioEngineSupportedDeviceFormats(KSDATAFORMAT_WAVEFORMATEXTENSIBLE** ppFormats);
-	NTSTATUS ValidateStreamCreate(ULONG   _Pin, BOOLEAN _Capture);
+	NTSTATUS ValidateStreamCreate(ULONG   _Pin, BOOLEAN _Capture, GUID _SignalProcessingMode);
 	const GUID* GetAudioModuleNotificationDeviceId();
 	ULONG GetAudioModuleDescriptorListCount();
 	ULONG GetAudioModuleListCount();
 
 	NTSTATUS VerifyPinInstanceResourcesAvailable(ULONG allocated, ULONG max);
+	NTSTATUS VerifyModeResourcesAvailable(ULONG _Pin, MiniportWaveRTStream** streams, ULONG count, GUID _SignalProcessingMode);
 
 	PinType GetPinTypeForPinNum(ULONG nPin);
 public:
@@ -74,8 +109,21 @@ public:
 	NTSTATUS MiniportWaveRT::StreamClosed(ULONG pin, MiniportWaveRTStream* stream);
 	NTSTATUS MiniportWaveRT::StreamCreated(_In_ ULONG _Pin, _In_ MiniportWaveRTStream* _Stream);
 	void SetPairedMiniport(MiniportWaveRT* miniport);
+	void SetCableScheduler(CableScheduler* scheduler, ULONG homeProcessor);
 	BOOL IsSystemRenderPin(ULONG nPinId);
 	BOOL IsSystemCapturePin(ULONG nPinId);
 	BOOL IsBridgePin(ULONG nPinId);
+	BOOL IsLoopbackPin(ULONG nPinId);
+	BOOL IsOffloadPin(ULONG nPinId);
+	CableMixer* GetMixer() { return m_pMixer; }
+	CableInjector* GetInjector() { return m_pInjector; }
+	EndpointGain* GetEndpointGain() { return m_pMiniportPair->Gain; }
+	BOOL IsLatencyMeasurementEnabled() { return m_bLatencyMeasurement; }
+	BOOL IsClockLockEnabled() { return m_bClockLock; }
+	BOOL IsWorkerThreadEnabled() { return m_bWorkerThreads; }
+	ULONG GetOverrunPolicy() { return m_ulOverrunPolicy; }
+	ULONG GetPrerollMs() { return m_ulPrerollMs; }
+	CableScheduler* GetCableScheduler() { return m_pScheduler; }
+	ULONG GetHomeProcessor() { return m_ulHomeProcessor; }
 };
 
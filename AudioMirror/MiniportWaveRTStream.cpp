@@ -1,8 +1,6 @@
 #include "MiniportWaveRTStream.h"
 #include "MiniportWaveRT.h"
 #include "KsHelper.h"
-#define MINWAVERTSTREAM_POOLTAG 'SRWM'
-#define HNSTIME_PER_MILLISECOND 10000
 #pragma warning (disable : 4127)
 
 //=============================================================================
@@ -39,68 +37,14 @@ Return Value:
 			m_bUnregisterStream = FALSE;
 		}
 
+		// Leave the mixer and the injection ring while the miniport that owns
+		// them is still referenced.
+		ShutdownCable();
+
 		m_pMiniport->Release();
 		m_pMiniport = NULL;
 	}
 
-	if (m_pDpc)
-	{
-		ExFreePoolWithTag(m_pDpc, MINWAVERTSTREAM_POOLTAG);
-		m_pDpc = NULL;
-	}
-
-	if (m_pTimer)
-	{
-		ExFreePoolWithTag(m_pTimer, MINWAVERTSTREAM_POOLTAG);
-		m_pTimer = NULL;
-	}
-
-	if (m_pbMuted)
-	{
-		ExFreePoolWithTag(m_pbMuted, MINWAVERTSTREAM_POOLTAG);
-		m_pbMuted = NULL;
-	}
-
-	if (m_plVolumeLevel)
-	{
-		ExFreePoolWithTag(m_plVolumeLevel, MINWAVERTSTREAM_POOLTAG);
-		m_plVolumeLevel = NULL;
-	}
-
-	if (m_plPeakMeter)
-	{
-		ExFreePoolWithTag(m_plPeakMeter, MINWAVERTSTREAM_POOLTAG);
-		m_plPeakMeter = NULL;
-	}
-
-	if (m_pWfExt)
-	{
-		ExFreePoolWithTag(m_pWfExt, MINWAVERTSTREAM_POOLTAG);
-		m_pWfExt = NULL;
-	}
-	if (m_RingBuffer)
-	{
-		ExFreePoolWithTag(m_RingBuffer, MINWAVERTSTREAM_POOLTAG);
-		m_RingBuffer = NULL;
-	}
-	if (m_pNotificationTimer)
-	{
-		ExDeleteTimer
-		(
-			m_pNotificationTimer,
-			TRUE, // Cancel the timer if it is currently set.
-			TRUE, // Wait for the timer to finish expiring and for any callback to a ExTimerCallback routine to finish.
-			NULL
-		);
-		// Since we just cancelled the notification timer, wait for all queued 
-		// DPCs to complete before we free the notification DPC.
-		//
-		KeFlushQueuedDpcs();
-	}
-	if (m_PairedStream) {
-		m_PairedStream->SetPairedStream(NULL);
-		m_PairedStream = NULL;
-	}
 	DPF_ENTER(("[MiniportWaveRTStream::~MiniportWaveRTStream]"));
 } // ~MiniportWaveRTStream
 
@@ -145,60 +89,21 @@ Return Value:
 	PAGED_CODE();
 
 	PWAVEFORMATEX pWfEx = NULL;
+	CABLE_STREAM_CONFIG cableConfig;
 	NTSTATUS ntStatus = STATUS_SUCCESS;
 
 	m_pMiniport = NULL;
 	m_ulPin = 0;
 	m_bUnregisterStream = FALSE;
-	m_bCapture = FALSE;
-	m_ulDmaBufferSize = 0;
-	m_pDmaBuffer = NULL;
-	m_ulNotificationsPerBuffer = 0;
-	m_KsState = KSSTATE_STOP;
-	m_pTimer = NULL;
-	m_pDpc = NULL;
-	m_llPacketCounter = 0;
-	m_ullPlayPosition = 0;
-	m_ullWritePosition = 0;
-	m_ullDmaTimeStamp = 0;
-	m_hnsElapsedTimeCarryForward = 0;
-	m_ullLastDPCTimeStamp = 0;
-	m_hnsDPCTimeCarryForward = 0;
-	m_ulDmaMovementRate = 0;
-	m_byteDisplacementCarryForward = 0;
 	m_bLfxEnabled = FALSE;
-	m_pbMuted = NULL;
-	m_plVolumeLevel = NULL;
-	m_plPeakMeter = NULL;
-	m_pWfExt = NULL;
-	m_ullLinearPosition = 0;
-	m_ullPresentationPosition = 0;
 	m_ulContentId = 0;
-	m_ulCurrentWritePosition = 0;
-	m_ulLastOsReadPacket = ULONG_MAX;
-	m_ulLastOsWritePacket = ULONG_MAX;
-	m_IsCurrentWritePositionUpdated = 0;
 	m_SignalProcessingMode = SignalProcessingMode;
-	m_bEoSReceived = FALSE;
-	m_bLastBufferRendered = FALSE;
 	m_AudioModuleCount = 0;
 
 	m_pPortStream = PortStream_;
-	InitializeListHead(&m_NotificationList);
-	m_ulNotificationIntervalMs = 0;
-
-	// Initialize the spinlock to synchronize position updates
-	KeInitializeSpinLock(&m_PositionSpinLock);
-
-	m_pNotificationTimer = ExAllocateTimer(
-		TimerNotifyRT,
-		this,
-		EX_TIMER_HIGH_RESOLUTION
-	);
-	if (!m_pNotificationTimer)
-	{
-		return STATUS_INSUFFICIENT_RESOURCES;
-	}
+	RtlZeroMemory(m_NotificationEventSets, sizeof(m_NotificationEventSets));
+	m_pNotificationEvents = &m_NotificationEventSets[0];
+	ExInitializeFastMutex(&m_NotificationEventsLock);
 
 	pWfEx = KsHelper::GetWaveFormatEx(DataFormat_);
 	if (NULL == pWfEx)
@@ -217,42 +122,58 @@ Return Value:
 		return ntStatus;
 	}
 	m_ulPin = Pin_;
-	m_bCapture = Capture_;
-	m_ulDmaMovementRate = pWfEx->nAvgBytesPerSec;
 
-	m_pDpc = (PRKDPC)ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(KDPC), MINWAVERTSTREAM_POOLTAG);
-	if (!m_pDpc)
-	{
-		return STATUS_INSUFFICIENT_RESOURCES;
-	}
+	RtlZeroMemory(&cableConfig, sizeof(cableConfig));
+	cableConfig.Capture = Capture_;
+	cableConfig.Loopback = m_pMiniport->IsLoopbackPin(Pin_);
+	cableConfig.MeasureLatency = m_pMiniport->IsLatencyMeasurementEnabled();
+	cableConfig.RingBufferCount = CABLE_RING_BUFFERS_DEFAULT;
 
-	m_pWfExt = (PWAVEFORMATEXTENSIBLE)ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(WAVEFORMATEX) + pWfEx->cbSize, MINWAVERTSTREAM_POOLTAG);
-	if (m_pWfExt == NULL)
+	// Select the processing path for the mode. RAW render streams skip the
+	// engine node gain so the cable stays bit exact, RAW and communications
+	// capture streams run a shorter cable ring. Their small packets wrap the
+	// ring often, so they also get the mirrored one.
+	cableConfig.RawPath = IsEqualGUID(SignalProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW);
+	if (cableConfig.RawPath || IsEqualGUID(SignalProcessingMode, AUDIO_SIGNALPROCESSINGMODE_COMMUNICATIONS))
 	{
-		return STATUS_INSUFFICIENT_RESOURCES;
+		cableConfig.RingBufferCount = CABLE_RING_BUFFERS_LOW_LATENCY;
+		cableConfig.MirroredRing = TRUE;
 	}
-	RtlCopyMemory(m_pWfExt, pWfEx, sizeof(WAVEFORMATEX) + pWfEx->cbSize);
 
-	m_pbMuted = (PBOOL)ExAllocatePoolWithTag(NonPagedPoolNx, m_pWfExt->Format.nChannels * sizeof(BOOL), MINWAVERTSTREAM_POOLTAG);
-	if (m_pbMuted == NULL)
+	// A capture stream locked to the render side never sees the two timers
+	// drift, so it gets away with a smaller ring.
+	cableConfig.ClockLocked = Capture_ && !cableConfig.Loopback && m_pMiniport->IsClockLockEnabled();
+	if (cableConfig.ClockLocked)
 	{
-		return STATUS_INSUFFICIENT_RESOURCES;
+		cableConfig.RingBufferCount = min(cableConfig.RingBufferCount, CABLE_RING_BUFFERS_CLOCK_LOCKED);
 	}
-	RtlZeroMemory(m_pbMuted, m_pWfExt->Format.nChannels * sizeof(BOOL));
 
-	m_plVolumeLevel = (PLONG)ExAllocatePoolWithTag(NonPagedPoolNx, m_pWfExt->Format.nChannels * sizeof(LONG), MINWAVERTSTREAM_POOLTAG);
-	if (m_plVolumeLevel == NULL)
+	// The microphone's endpoint volume is applied while the capture stream
+	// copies out of the cable ring. The render side applies it in the mixer.
+	if (Capture_ && !cableConfig.Loopback &&
+		pWfEx->wBitsPerSample == 16 &&
+		pWfEx->nChannels == m_pMiniport->GetEndpointGain()->GetChannels())
 	{
-		return STATUS_INSUFFICIENT_RESOURCES;
+		cableConfig.Gain = m_pMiniport->GetEndpointGain();
 	}
-	RtlZeroMemory(m_plVolumeLevel, m_pWfExt->Format.nChannels * sizeof(LONG));
 
-	m_plPeakMeter = (PLONG)ExAllocatePoolWithTag(NonPagedPoolNx, m_pWfExt->Format.nChannels * sizeof(LONG), MINWAVERTSTREAM_POOLTAG);
-	if (m_plPeakMeter == NULL)
+	// The AUDIOMIRROR_OVERRUN_* values are the ring's policies.
+	C_ASSERT(AUDIOMIRROR_OVERRUN_DROP_OLDEST == RingOverrunDropOldest);
+	C_ASSERT(AUDIOMIRROR_OVERRUN_DROP_NEWEST == RingOverrunDropNewest);
+	C_ASSERT(AUDIOMIRROR_OVERRUN_SKIP_TO_LATENCY == RingOverrunSkipToLatency);
+	cableConfig.OverrunPolicy = (RING_OVERRUN_POLICY)m_pMiniport->GetOverrunPolicy();
+	cableConfig.PrerollMs = m_pMiniport->GetPrerollMs();
+
+	cableConfig.Mixer = m_pMiniport->GetMixer();
+	cableConfig.Scheduler = m_pMiniport->GetCableScheduler();
+	cableConfig.HomeProcessor = m_pMiniport->GetHomeProcessor();
+	cableConfig.WorkerThread = m_pMiniport->IsWorkerThreadEnabled() ? TRUE : FALSE;
+
+	ntStatus = InitCable(pWfEx, &cableConfig);
+	if (!NT_SUCCESS(ntStatus))
 	{
-		return STATUS_INSUFFICIENT_RESOURCES;
+		return ntStatus;
 	}
-	RtlZeroMemory(m_plPeakMeter, m_pWfExt->Format.nChannels * sizeof(LONG));
 
 	//
 	// Register this stream.
@@ -308,12 +229,12 @@ Return Value:
 	{
 		*Object = PVOID(PMINIPORTWAVERTSTREAMNOTIFICATION(this));
 	}
-	else if (IsEqualGUIDAligned(Interface, IID_IMiniportWaveRTInputStream) && (this->m_bCapture))
+	else if (IsEqualGUIDAligned(Interface, IID_IMiniportWaveRTInputStream) && IsCapture())
 	{
 		// This interface is supported only on capture streams
 		*Object = PVOID(PMINIPORTWAVERTINPUTSTREAM(this));
 	}
-	else if (IsEqualGUIDAligned(Interface, IID_IMiniportWaveRTOutputStream) && (!this->m_bCapture))
+	else if (IsEqualGUIDAligned(Interface, IID_IMiniportWaveRTOutputStream) && !IsCapture())
 	{
 		// This interface is supported only on host render streams
 		*Object = PVOID(PMINIPORTWAVERTOUTPUTSTREAM(this));
@@ -358,20 +279,15 @@ NTSTATUS MiniportWaveRTStream::AllocateBufferWithNotification
 {
 	PAGED_CODE();
 
-	ULONG ulBufferDurationMs = 0;
-
-	if ((0 == RequestedSize_) || (RequestedSize_ < m_pWfExt->Format.nBlockAlign))
-	{
-		return STATUS_UNSUCCESSFUL;
-	}
+	ULONG ulPacketSize = 0;
+	NTSTATUS ntStatus;
 
-	if ((NotificationCount_ == 0) || (RequestedSize_ % NotificationCount_ != 0))
+	ntStatus = PrepareBuffer(NotificationCount_, &RequestedSize_, &ulPacketSize);
+	if (!NT_SUCCESS(ntStatus))
 	{
-		return STATUS_INVALID_PARAMETER;
+		return ntStatus;
 	}
 
-	RequestedSize_ -= RequestedSize_ % (m_pWfExt->Format.nBlockAlign);
-
 	PHYSICAL_ADDRESS highAddress;
 	highAddress.HighPart = 0;
 	highAddress.LowPart = MAXULONG;
@@ -398,14 +314,7 @@ NTSTATUS MiniportWaveRTStream::AllocateBufferWithNotification
 	//
 	//  A WaveRT miniport driver should not require software access to the audio buffer itself."
 	//   
-	m_pDmaBuffer = (BYTE*)m_pPortStream->MapAllocatedPages(pBufferMdl, MmCached);
-	m_ulNotificationsPerBuffer = NotificationCount_;
-	m_ulDmaBufferSize = RequestedSize_;
-	ulBufferDurationMs = (RequestedSize_ * 1000) / m_ulDmaMovementRate;
-	m_ulNotificationIntervalMs = ulBufferDurationMs / NotificationCount_;
-
-	m_RingBuffer = new(NonPagedPoolNx, MINWAVERTSTREAM_POOLTAG)RingBuffer;
-	m_RingBuffer->Init(m_ulDmaBufferSize * 4, m_pWfExt->Format.nBlockAlign);
+	AttachDmaBuffer((BYTE*)m_pPortStream->MapAllocatedPages(pBufferMdl, MmCached), RequestedSize_, NotificationCount_, ulPacketSize);
 
 	*AudioBufferMdl_ = pBufferMdl;
 	*ActualSize_ = RequestedSize_;
@@ -429,18 +338,17 @@ VOID MiniportWaveRTStream::FreeBufferWithNotification
 
 	if (Mdl_ != NULL)
 	{
-		if (m_pDmaBuffer != NULL)
+		// A loopback stream may be copying out of this buffer, take it away
+		// under the position lock before unmapping it.
+		BYTE* pDmaBuffer = DetachDmaBuffer();
+		if (pDmaBuffer != NULL)
 		{
-			m_pPortStream->UnmapAllocatedPages(m_pDmaBuffer, Mdl_);
-			m_pDmaBuffer = NULL;
+			m_pPortStream->UnmapAllocatedPages(pDmaBuffer, Mdl_);
 		}
 
 		m_pPortStream->FreePagesFromMdl(Mdl_);
 	}
 
-	m_ulDmaBufferSize = 0;
-	m_ulNotificationsPerBuffer = 0;
-
 	return;
 }
 
@@ -451,41 +359,39 @@ NTSTATUS MiniportWaveRTStream::RegisterNotificationEvent
 	_In_ PKEVENT NotificationEvent_
 )
 {
-	UNREFERENCED_PARAMETER(NotificationEvent_);
+	NOTIFICATION_EVENT_SET newSet;
+	NTSTATUS ntStatus = STATUS_SUCCESS;
 
 	PAGED_CODE();
 
-	NotificationListEntry *nleNew = (NotificationListEntry*)ExAllocatePoolWithTag(
-		NonPagedPoolNx,
-		sizeof(NotificationListEntry),
-		MINWAVERTSTREAM_POOLTAG);
-	if (NULL == nleNew)
-	{
-		return STATUS_INSUFFICIENT_RESOURCES;
-	}
+	ExAcquireFastMutex(&m_NotificationEventsLock);
 
-	nleNew->NotificationEvent = NotificationEvent_;
+	newSet = *m_pNotificationEvents;
 
-	// Fail if the notification event already exists in our list.
-	if (!IsListEmpty(&m_NotificationList))
+	// Fail if the notification event already exists in our set.
+	for (ULONG i = 0; i < newSet.Count; i++)
 	{
-		PLIST_ENTRY leCurrent = m_NotificationList.Flink;
-		while (leCurrent != &m_NotificationList)
+		if (newSet.Events[i] == NotificationEvent_)
 		{
-			NotificationListEntry* nleCurrent = CONTAINING_RECORD(leCurrent, NotificationListEntry, ListEntry);
-			if (nleCurrent->NotificationEvent == NotificationEvent_)
-			{
-				ExFreePoolWithTag(nleNew, MINWAVERTSTREAM_POOLTAG);
-				return STATUS_UNSUCCESSFUL;
-			}
-
-			leCurrent = leCurrent->Flink;
+			ntStatus = STATUS_UNSUCCESSFUL;
+			break;
 		}
 	}
 
-	InsertTailList(&m_NotificationList, &(nleNew->ListEntry));
+	if (NT_SUCCESS(ntStatus) && newSet.Count == MAX_NOTIFICATION_EVENTS)
+	{
+		ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+	}
 
-	return STATUS_SUCCESS;
+	if (NT_SUCCESS(ntStatus))
+	{
+		newSet.Events[newSet.Count++] = NotificationEvent_;
+		PublishNotificationEvents(&newSet);
+	}
+
+	ExReleaseFastMutex(&m_NotificationEventsLock);
+
+	return ntStatus;
 }
 
 //=============================================================================
@@ -495,30 +401,66 @@ NTSTATUS MiniportWaveRTStream::UnregisterNotificationEvent
 	_In_ PKEVENT NotificationEvent_
 )
 {
-	UNREFERENCED_PARAMETER(NotificationEvent_);
+	NOTIFICATION_EVENT_SET newSet;
+	NTSTATUS ntStatus = STATUS_NOT_FOUND;
 
 	PAGED_CODE();
 
-	if (!IsListEmpty(&m_NotificationList))
+	ExAcquireFastMutex(&m_NotificationEventsLock);
+
+	newSet = *m_pNotificationEvents;
+
+	for (ULONG i = 0; i < newSet.Count; i++)
 	{
-		PLIST_ENTRY leCurrent = m_NotificationList.Flink;
-		while (leCurrent != &m_NotificationList)
+		if (newSet.Events[i] == NotificationEvent_)
 		{
-			NotificationListEntry* nleCurrent = CONTAINING_RECORD(leCurrent, NotificationListEntry, ListEntry);
-			if (nleCurrent->NotificationEvent == NotificationEvent_)
-			{
-				RemoveEntryList(leCurrent);
-				ExFreePoolWithTag(nleCurrent, MINWAVERTSTREAM_POOLTAG);
-				return STATUS_SUCCESS;
-			}
-
-			leCurrent = leCurrent->Flink;
+			newSet.Events[i] = newSet.Events[--newSet.Count];
+			newSet.Events[newSet.Count] = NULL;
+			ntStatus = STATUS_SUCCESS;
+			break;
 		}
 	}
 
-	return STATUS_NOT_FOUND;
+	// Once this returns the timer DPC no longer references the event, so the
+	// caller is free to delete it.
+	if (NT_SUCCESS(ntStatus))
+	{
+		PublishNotificationEvents(&newSet);
+	}
+
+	ExReleaseFastMutex(&m_NotificationEventsLock);
+
+	return ntStatus;
 }
 
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID MiniportWaveRTStream::PublishNotificationEvents
+(
+	_In_ PNOTIFICATION_EVENT_SET EventSet
+)
+/*++
+
+Routine Description:
+
+  Publishes a new set of notification events to the timer DPC. The set is
+  copied into the slot that is not currently published and the pointer is
+  swapped. Waiting for all queued DPCs afterwards guarantees no DPC still reads
+  the previous slot, so the next update can reuse it. Must be called with
+  m_NotificationEventsLock held.
+
+--*/
+{
+	PAGED_CODE();
+
+	PNOTIFICATION_EVENT_SET nextSet = (m_pNotificationEvents == &m_NotificationEventSets[0]) ?
+		&m_NotificationEventSets[1] : &m_NotificationEventSets[0];
+
+	*nextSet = *EventSet;
+	InterlockedExchangePointer((PVOID volatile*)&m_pNotificationEvents, nextSet);
+
+	KeFlushQueuedDpcs();
+}
 
 //=============================================================================
 #pragma code_seg("PAGE")
@@ -526,12 +468,33 @@ NTSTATUS MiniportWaveRTStream::GetClockRegister
 (
 	_Out_ PKSRTAUDIO_HWREGISTER Register_
 )
-{
-	UNREFERENCED_PARAMETER(Register_);
+/*++
+
+Routine Description:
+
+  Returns the emulated wall clock register. It holds the time at which the
+  position register was last updated, in 100ns units.
 
+--*/
+{
 	PAGED_CODE();
 
-	return STATUS_NOT_IMPLEMENTED;
+	ASSERT(Register_);
+
+	if (m_pRegisterPage == NULL)
+	{
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	m_bRegistersMapped = TRUE;
+
+	Register_->Register = (PVOID)&m_pRegisterPage->ClockRegister;
+	Register_->Width = 64;
+	Register_->Numerator = STREAM_CLOCK_REGISTER_FREQUENCY;
+	Register_->Denominator = 1;
+	Register_->Accuracy = 0;
+
+	return STATUS_SUCCESS;
 }
 
 //=============================================================================
@@ -540,12 +503,35 @@ NTSTATUS MiniportWaveRTStream::GetPositionRegister
 (
 	_Out_ PKSRTAUDIO_HWREGISTER Register_
 )
-{
-	UNREFERENCED_PARAMETER(Register_);
+/*++
+
+Routine Description:
 
+  Returns the emulated DMA position register. The timer DPC refreshes it on
+  every tick while the stream runs, so the audio engine can read the position
+  with a memory load instead of a KSPROPERTY_AUDIO_POSITION request.
+
+--*/
+{
 	PAGED_CODE();
 
-	return STATUS_NOT_IMPLEMENTED;
+	ASSERT(Register_);
+
+	if (m_pRegisterPage == NULL)
+	{
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	m_bRegistersMapped = TRUE;
+
+	Register_->Register = (PVOID)&m_pRegisterPage->PositionRegister;
+	Register_->Width = 32;
+	Register_->Numerator = 0;
+	Register_->Denominator = 0;
+	// The register moves once per timer tick, a millisecond of whole blocks.
+	Register_->Accuracy = (m_ulDmaMovementRate / 1000 + m_ulBlockAlign - 1) / m_ulBlockAlign * m_ulBlockAlign;
+
+	return STATUS_SUCCESS;
 }
 
 //=============================================================================
@@ -578,17 +564,16 @@ VOID MiniportWaveRTStream::FreeAudioBuffer
 
 	if (Mdl_ != NULL)
 	{
-		if (m_pDmaBuffer != NULL)
+		// A loopback stream may be copying out of this buffer, take it away
+		// under the position lock before unmapping it.
+		BYTE* pDmaBuffer = DetachDmaBuffer();
+		if (pDmaBuffer != NULL)
 		{
-			m_pPortStream->UnmapAllocatedPages(m_pDmaBuffer, Mdl_);
-			m_pDmaBuffer = NULL;
+			m_pPortStream->UnmapAllocatedPages(pDmaBuffer, Mdl_);
 		}
 
 		m_pPortStream->FreePagesFromMdl(Mdl_);
 	}
-
-	m_ulDmaBufferSize = 0;
-	m_ulNotificationsPerBuffer = 0;
 }
 
 //=============================================================================
@@ -637,10 +622,7 @@ NTSTATUS MiniportWaveRTStream::AllocateAudioBuffer
 	//
 	//  A WaveRT miniport driver should not require software access to the audio buffer itself."
 	//   
-	m_pDmaBuffer = (BYTE*)m_pPortStream->MapAllocatedPages(pBufferMdl, MmCached);
-
-	m_ulDmaBufferSize = RequestedSize_;
-	m_ulNotificationsPerBuffer = 0;
+	AttachDmaBuffer((BYTE*)m_pPortStream->MapAllocatedPages(pBufferMdl, MmCached), RequestedSize_, 0, 0);
 
 	*AudioBufferMdl_ = pBufferMdl;
 	*ActualSize_ = RequestedSize_;
@@ -657,50 +639,18 @@ NTSTATUS MiniportWaveRTStream::GetPosition
 	_Out_   KSAUDIO_POSITION    *Position_
 )
 {
-	NTSTATUS ntStatus;
+	GetDmaPosition(&Position_->PlayOffset, &Position_->WriteOffset);
 
-	KIRQL oldIrql;
-	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
-
-	if (m_KsState == KSSTATE_RUN)
-	{
-		//
-		// Get the current time and update position.
-		//
-		LARGE_INTEGER ilQPC = KeQueryPerformanceCounter(NULL);
-		UpdatePosition(ilQPC);
-	}
-
-	Position_->PlayOffset = m_ullPlayPosition;
-	Position_->WriteOffset = m_ullWritePosition;
-
-	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
-
-	ntStatus = STATUS_SUCCESS;
-
-#if defined(SYSVAD_BTH_BYPASS)
-	Done:
-#endif // defined(SYSVAD_BTH_BYPASS)
-		return ntStatus;
+	return STATUS_SUCCESS;
 }
 
 //=============================================================================
 // MiniportWaveRTStream::GetReadPacket
 //
-//  Returns information about the next packet for the OS to read.
-//
-// Return value
-//
-//  Returns STATUS_OPERATION_IN_PROGRESS if no new packets are available and
-//  the next packet is in progress.
+//  Returns information about the next packet for the OS to read, see
+//  CableStream::GetNextReadPacket.
 //
 // IRQL - PASSIVE_LEVEL
-//
-// Remarks
-//  Although called at passive level, this routine is non-paged code because
-//  it is called in the streaming path where page faults should be avoided.
-//
-// ISSUE-2014/10/4 Will this work correctly across pause/play?
 #pragma code_seg()
 NTSTATUS MiniportWaveRTStream::GetReadPacket
 (
@@ -710,93 +660,9 @@ NTSTATUS MiniportWaveRTStream::GetReadPacket
 	_Out_ BOOL      *MoreData
 )
 {
-	ULONG availablePacketNumber;
-	ULONG droppedPackets;
-
-	// The call must be from event driven mode
-	if (m_ulNotificationsPerBuffer == 0)
-	{
-		return STATUS_NOT_SUPPORTED;
-	}
-
 	*Flags = 0;
 
-	if (m_KsState < KSSTATE_PAUSE)
-	{
-		return STATUS_INVALID_DEVICE_STATE;
-	}
-
-	KIRQL oldIrql;
-	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
-
-	LONGLONG packetCounter = m_llPacketCounter;
-	ULONGLONG ullLinearPosition = m_ullLinearPosition;
-	ULONGLONG hnsElapsedTimeCarryForward = m_hnsElapsedTimeCarryForward;
-	ULONGLONG ullDmaTimeStamp = m_ullDmaTimeStamp;
-
-	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
-
-	// The 0-based number of the last completed packet
-	// FUTURE-2014/10/27 Update to allow different numbers of packets per WaveRT buffer
-	availablePacketNumber = LODWORD(packetCounter - 1);  // Note this might be ULONG_MAX if called during the first packet
-
-	// If no new packets are available...
-	if (availablePacketNumber == m_ulLastOsReadPacket)
-	{
-		return STATUS_DEVICE_NOT_READY;
-	}
-
-	// If more than one packet has transferred since the last packet read by
-	// the OS, then those were dropped. That is, a glitch occurred.
-	droppedPackets = availablePacketNumber - m_ulLastOsReadPacket - 1;
-	if (droppedPackets > 0)
-	{
-		// Trace a glitch
-	}
-
-	// Return next packet number to be read
-	*PacketNumber = availablePacketNumber;
-
-	// Compute and return timestamp corresponding to start of the available packet. In a real hardware
-	// driver, the timestamp would be computed in a driver and hardware specific manner. In this sample
-	// driver, it is extrapolated from the sample driver's internal simulated position correlation
-	// [m_ullLinearPosition @ m_ullDmaTimeStamp] and the sample's internal 64-bit packet counter, subtracting
-	// 1 from the packet counter to compute the time at the start of that last completed packet.
-	ULONGLONG linearPositionOfAvailablePacket = (packetCounter - 1) * (m_ulDmaBufferSize / m_ulNotificationsPerBuffer);
-	// Need to divide by (1000 * 10000 because m_ulDmaMovementRate is average bytes per sec
-	ULONGLONG carryForwardBytes = (hnsElapsedTimeCarryForward * m_ulDmaMovementRate) / 10000000;
-	ULONGLONG deltaLinearPosition = ullLinearPosition + carryForwardBytes - linearPositionOfAvailablePacket;
-	ULONGLONG deltaTimeInHns = deltaLinearPosition * 10000000 / m_ulDmaMovementRate;
-	ULONGLONG timeOfAvailablePacketInHns = ullDmaTimeStamp - deltaTimeInHns;
-	ULONGLONG timeOfAvailablePacketInQpc = timeOfAvailablePacketInHns * m_ullPerformanceCounterFrequency.QuadPart / 10000000;
-
-	*PerformanceCounterValue = timeOfAvailablePacketInQpc;
-
-	// No flags are defined yet
-	*Flags = 0;
-
-	// This sample does not internally buffer data so there is never more data
-	// than revealed by the results from this routine.
-	*MoreData = FALSE;
-
-	// Update the last packet read by the OS
-	m_ulLastOsReadPacket = availablePacketNumber;
-
-#if 0
-	// For test, embed packet number and timestamp into first two LONGLONGs of the packet
-	LONG packetIndex = availablePacketNumber % m_ulNotificationsPerBuffer;
-	SIZE_T packetSize = m_ulDmaBufferSize / m_ulNotificationsPerBuffer;
-	BYTE *packetDataAsBytes = m_pDmaBuffer + (packetIndex * packetSize);
-	LONGLONG *packetDataAsLonglongs = (LONGLONG*)packetDataAsBytes;
-	for (int i = 0; i < packetSize / sizeof(LONGLONG); i++)
-	{
-		packetDataAsLonglongs[i] = i;
-	}
-	packetDataAsLonglongs[0] = availablePacketNumber;
-	packetDataAsLonglongs[1] = timeOfAvailablePacketInQpc;
-#endif
-
-	return STATUS_SUCCESS;
+	return GetNextReadPacket(PacketNumber, PerformanceCounterValue, MoreData);
 }
 
 #pragma code_seg()
@@ -807,87 +673,7 @@ NTSTATUS MiniportWaveRTStream::SetWritePacket
 	_In_ ULONG      EosPacketLength
 )
 {
-	NTSTATUS ntStatus;
-
-	// The call must be from event driven mode
-	if (m_ulNotificationsPerBuffer == 0)
-	{
-		return STATUS_NOT_SUPPORTED;
-	}
-
-	ULONG oldLastOsWritePacket = m_ulLastOsWritePacket;
-
-	// This function should not be called once EoS has been set.
-	if (m_bEoSReceived)
-	{
-		return STATUS_INVALID_DEVICE_STATE;
-	}
-
-	KIRQL oldIrql;
-	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
-	// 1-based count of completed packets, 0-based packet number of current packet
-	LONGLONG currentPacket = m_llPacketCounter;
-	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
-
-	// If not running, the current packet hasn't actually started transfering so OS should be writing
-	// to the current packet. If running, then the current packing is already transfering to hardware
-	// so the OS should write the packet after the current packet.
-	ULONG expectedPacket = LODWORD(currentPacket);
-	if (m_KsState == KSSTATE_RUN)
-	{
-		expectedPacket++;
-	}
-
-	// Check if OS PacketNumber is behind or too far ahead of current packet
-	LONG deltaFromExpectedPacket = PacketNumber - expectedPacket;   // Modulo arithemetic
-	if (deltaFromExpectedPacket < 0)
-	{
-		return STATUS_DATA_LATE_ERROR;
-	}
-	else if (deltaFromExpectedPacket > 0)
-	{
-		return STATUS_DATA_OVERRUN;
-	}
-
-	ULONG packetSize = (m_ulDmaBufferSize / m_ulNotificationsPerBuffer);
-	ULONG packetIndex = PacketNumber % m_ulNotificationsPerBuffer;
-	ULONG ulCurrentWritePosition = packetIndex * packetSize;
-
-	// Check if EOS flag was passed
-	if (Flags & KSSTREAM_HEADER_OPTIONSF_ENDOFSTREAM)
-	{
-		if (EosPacketLength > packetSize)
-		{
-			return STATUS_INVALID_PARAMETER;
-		}
-		else {
-			// EOS position will be after the total completed packets, plus the packet in progress,
-			// plus this EOS packet length
-			m_ulLastOsWritePacket = PacketNumber;
-			ulCurrentWritePosition += EosPacketLength;
-			ntStatus = SetStreamCurrentWritePositionForLastBuffer(ulCurrentWritePosition);
-		}
-	}
-	else
-	{
-		m_ulLastOsWritePacket = PacketNumber;
-
-		// This function sets the current write position to the specified byte in the DMA buffer.
-		// Will check if the write position is smaller than the DMA buffer size.
-		// Will not return an error when the passed in parameter is 0.
-		// Will also check if this function was called with the same write position(in event mode only)
-		// Underruning will also be checked via timer mechanism
-		KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
-		ntStatus = SetCurrentWritePositionInternal(ulCurrentWritePosition);
-		KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
-	}
-
-	if (!NT_SUCCESS(ntStatus))
-	{
-		m_ulLastOsWritePacket = oldLastOsWritePacket;
-	}
-
-	return ntStatus;
+	return SubmitWritePacket(PacketNumber, (Flags & KSSTREAM_HEADER_OPTIONSF_ENDOFSTREAM) ? TRUE : FALSE, EosPacketLength);
 }
 
 //=============================================================================
@@ -917,26 +703,7 @@ NTSTATUS MiniportWaveRTStream::GetPacketCount
 {
 	ASSERT(pPacketCount);
 
-	// The call must be from event driven mode
-	if (m_ulNotificationsPerBuffer == 0)
-	{
-		return STATUS_NOT_SUPPORTED;
-	}
-
-	KIRQL oldIrql;
-	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
-
-	if (m_KsState == KSSTATE_RUN)
-	{
-		// Get the current time and update simulated position.
-		LARGE_INTEGER ilQPC = KeQueryPerformanceCounter(NULL);
-		UpdatePosition(ilQPC);
-	}
-
-	*pPacketCount = LODWORD(m_llPacketCounter);
-	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
-
-	return STATUS_SUCCESS;
+	return GetCompletedPacketCount(pPacketCount);
 }
 
 //=============================================================================
@@ -946,9 +713,7 @@ NTSTATUS MiniportWaveRTStream::SetState
 	_In_    KSSTATE State_
 )
 {
-	NTSTATUS        ntStatus = STATUS_SUCCESS;
 	IAdapterCommon*  pAdapterComm = m_pMiniport->GetAdapter();
-	KIRQL oldIrql;
 
 	// Spew an event for a pin state change request from portcls
 	//Event type: eMINIPORT_PIN_STATE
@@ -961,140 +726,79 @@ NTSTATUS MiniportWaveRTStream::SetState
 		m_ulCurrentWritePosition, // replace with the previous WaveRtBufferWritePosition that the driver received
 		State_, // replace with the correct "Data length completed"
 		0); // always zero
-	switch (State_)
-	{
-	case KSSTATE_STOP:
-		if (m_KsState == KSSTATE_ACQUIRE)
-		{
-		}
-		KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
-		// Reset DMA
-		m_llPacketCounter = 0;
-		m_ullPlayPosition = 0;
-		m_ullWritePosition = 0;
-		m_ullLinearPosition = 0;
-		m_ullPresentationPosition = 0;
-
-		// Reset OS read/write positions
-		m_ulLastOsReadPacket = ULONG_MAX;
-		m_ulCurrentWritePosition = 0;
-		m_ulLastOsWritePacket = ULONG_MAX;
-		m_bEoSReceived = FALSE;
-		m_bLastBufferRendered = FALSE;
-
-		KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
-		break;
-
-	case KSSTATE_ACQUIRE:
-		if (m_KsState == KSSTATE_STOP)
-		{
-		}
-		break;
 
-	case KSSTATE_PAUSE:
+	return SetCableState(State_);
+}
 
-		if (m_KsState > KSSTATE_PAUSE)
-		{
-			//
-			// Run -> Pause
-			//
-
-			// Pause DMA
-			if (m_ulNotificationIntervalMs > 0)
-			{
-				ExCancelTimer(m_pNotificationTimer, NULL);
-				KeFlushQueuedDpcs();
-
-				// If pin is transitioning from RUN, save the time since last buffer completion event was sent 
-				// so if the pin goes to RUN state again we can send the buffer completion event at correct time.
-				if (m_ullLastDPCTimeStamp > 0)
-				{
-					LARGE_INTEGER qpc;
-					LARGE_INTEGER qpcFrequency;
-					LONGLONG  hnsCurrentTime;
-
-					qpc = KeQueryPerformanceCounter(&qpcFrequency);
-
-					// Convert ticks to 100ns units.
-					hnsCurrentTime = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, qpc);
-					m_hnsDPCTimeCarryForward = hnsCurrentTime - m_ullLastDPCTimeStamp + m_hnsDPCTimeCarryForward;
-				}
-			}
-		}
-		// This call updates the linear buffer and presentation positions.
-		GetPositions(NULL, NULL, NULL);
-		break;
+#pragma code_seg()
+VOID MiniportWaveRTStream::GetStatistics
+(
+	_Out_ PAUDIOMIRROR_STREAM_STATISTICS Statistics
+)
+/*++
 
-	case KSSTATE_RUN:
+Routine Description:
 
-		// Start DMA
-		LARGE_INTEGER ullPerfCounterTemp;
-		
-		ullPerfCounterTemp = KeQueryPerformanceCounter(&m_ullPerformanceCounterFrequency);
-		m_ullLastDPCTimeStamp = m_ullDmaTimeStamp = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ullPerfCounterTemp);
-		m_RingBuffer->Clear();
+  Fills a snapshot of the streaming counters of this stream. The counters are
+  read without the position lock, so individual fields may be from slightly
+  different points in time.
 
-		if (m_ulNotificationIntervalMs > 0)
-		{
-			// Set timer for 1 ms. This will cause DPC to run every 1 ms but driver will send out 
-			// notification events only after notification interval. This timer is used by Sysvad to 
-			// emulate hardware and send out notification event. Real hardware should not use this
-			// timer to fire notification event as it will drain power if the timer is running at 1 msec.
-			ExSetTimer
-			(
-				m_pNotificationTimer,
-				(-1) * HNSTIME_PER_MILLISECOND,
-				HNSTIME_PER_MILLISECOND, // 1 ms 
-				NULL
-			);
+Arguments:
 
-		}
+  Statistics - receives the snapshot.
 
-		break;
-	}
+--*/
+{
+	RtlZeroMemory(Statistics, sizeof(*Statistics));
+	Statistics->Size = sizeof(*Statistics);
+	Statistics->Version = AUDIOMIRROR_STATISTICS_VERSION;
+	Statistics->PinId = m_ulPin;
+	Statistics->LinearPosition = m_ullLinearPosition;
 
-	m_KsState = State_;
+	if (IsCapture()) Statistics->Flags |= AUDIOMIRROR_STREAM_FLAG_CAPTURE;
+	if (m_KsState == KSSTATE_RUN) Statistics->Flags |= AUDIOMIRROR_STREAM_FLAG_RUNNING;
+	if (m_PairedStream) Statistics->Flags |= AUDIOMIRROR_STREAM_FLAG_PAIRED;
+	if (m_bLoopback) Statistics->Flags |= AUDIOMIRROR_STREAM_FLAG_LOOPBACK;
+	if (m_bClockLocked) Statistics->Flags |= AUDIOMIRROR_STREAM_FLAG_CLOCK_LOCKED;
+	if (IsWorkerMode()) Statistics->Flags |= AUDIOMIRROR_STREAM_FLAG_WORKER;
+	if (IsTimerIdle()) Statistics->Flags |= AUDIOMIRROR_STREAM_FLAG_IDLE;
 
-#if defined(SYSVAD_BTH_BYPASS)
-	Done:
-#endif  // defined(SYSVAD_BTH_BYPASS)
-		return ntStatus;
-}
+	m_Statistics.Snapshot(Statistics);
+	Statistics->HomeProcessor = GetHomeProcessor();
 
-#pragma code_seg("PAGE")
-void MiniportWaveRTStream::SetPairedStream(MiniportWaveRTStream* stream)
-{
-	PAGED_CODE();
-	if (m_RingBuffer) m_RingBuffer->Clear();
-	m_PairedStream = stream;
+	// Only the capture side of a pair owns the cable ring.
+	if (IsCapture() && m_RingBuffer)
+	{
+		Statistics->RingSize = (ULONG)m_RingBuffer->GetSize();
+	}
 }
 
 #pragma code_seg()
-NTSTATUS MiniportWaveRTStream::WriteAudioPacket(BYTE* buffer, ULONG packetSize, BOOL eos)
+VOID MiniportWaveRTStream::EnableLatencyMeasurement
+(
+	_In_ BOOL Enable
+)
 {
-	UNREFERENCED_PARAMETER(buffer);
-	UNREFERENCED_PARAMETER(packetSize);
-	UNREFERENCED_PARAMETER(eos);
-
-	//only allowed on capture stream
-	if (!m_bCapture) return STATUS_NOT_IMPLEMENTED;
-	//if we dont have a paired stream this is not allowed
-	if (m_PairedStream == NULL) return STATUS_INVALID_DEVICE_STATE;
-	if (m_RingBuffer == NULL) return STATUS_DEVICE_NOT_READY;
-	if (packetSize > m_RingBuffer->GetSize()) return STATUS_BUFFER_TOO_SMALL;
-
-	NTSTATUS state = m_RingBuffer->Put(buffer, packetSize);
-	switch (state)
+	if (IsCapture())
 	{
-	case STATUS_BUFFER_TOO_SMALL:
-		return state;
-	case STATUS_BUFFER_OVERFLOW:
-	default:
-		return STATUS_SUCCESS;
-		break;
+		m_LatencyProbe.Enable(Enable);
 	}
 }
 
+#pragma code_seg()
+VOID MiniportWaveRTStream::GetLatencyHistogram
+(
+	_Out_ PAUDIOMIRROR_LATENCY_HISTOGRAM Histogram
+)
+{
+	RtlZeroMemory(Histogram, sizeof(*Histogram));
+	Histogram->Size = sizeof(*Histogram);
+	Histogram->Version = AUDIOMIRROR_STATISTICS_VERSION;
+	Histogram->PinId = m_ulPin;
+
+	m_LatencyProbe.Snapshot(Histogram);
+}
+
 //=============================================================================
 #pragma code_seg("PAGE")
 NTSTATUS MiniportWaveRTStream::SetFormat
@@ -1114,291 +818,130 @@ NTSTATUS MiniportWaveRTStream::SetFormat
 	return STATUS_NOT_SUPPORTED;
 }
 
+
 //=============================================================================
 #pragma code_seg()
-VOID MiniportWaveRTStream::UpdatePosition
+VOID MiniportWaveRTStream::OnTimerTick
 (
-	_In_ LARGE_INTEGER ilQPC
+	_In_ const CABLE_STREAM_TICK* Tick
 )
-{
-	// Convert ticks to 100ns units.
-	LONGLONG  hnsCurrentTime = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ilQPC);
-
-	// Calculate the time elapsed since the last call to GetPosition() or since the
-	// DMA engine started.  Note that the division by 10000 to convert to milliseconds
-	// may cause us to lose some of the time, so we will carry the remainder forward 
-	// to the next GetPosition() call.
-	//
-	ULONG TimeElapsedInMS = (ULONG)(hnsCurrentTime - m_ullDmaTimeStamp + m_hnsElapsedTimeCarryForward) / 10000;
-
-	// Carry forward the remainder of this division so we don't fall behind with our position too much.
-	//
-	m_hnsElapsedTimeCarryForward = (hnsCurrentTime - m_ullDmaTimeStamp + m_hnsElapsedTimeCarryForward) % 10000;
+/*++
 
-	// Calculate how many bytes in the DMA buffer would have been processed in the elapsed
-	// time.  Note that the division by 1000 to convert to milliseconds may cause us to 
-	// lose some bytes, so we will carry the remainder forward to the next GetPosition() call.
-	//
-	// need to divide by 1000 because m_ulDmaMovementRate is average bytes per sec.
+Routine Description:
 
-	ULONG ByteDisplacement = ((m_ulDmaMovementRate * TimeElapsedInMS) + m_byteDisplacementCarryForward) / 1000;
-	m_byteDisplacementCarryForward = ((m_ulDmaMovementRate * TimeElapsedInMS) + m_byteDisplacementCarryForward) % 1000;
+  Reports a tick of the emulated DMA to the OS. Called from the timer DPC
+  outside of the position lock. The event set stays valid until this DPC
+  returns, unregistration waits for queued DPCs before reusing it.
 
-	// Increment presentation position even after last buffer is rendered.
-	m_ullPresentationPosition += ByteDisplacement;
+--*/
+{
+	IAdapterCommon*  pAdapterComm = m_pMiniport->GetAdapter();
 
-	if (m_bCapture)
+	if (Tick->ReportUnderrun)
 	{
-		//ULONG fillerBytes = m_pWfExt->Format.nBlockAlign - (ByteDisplacement % m_pWfExt->Format.nBlockAlign);
-		//ULONG subtractBytes = ByteDisplacement - (ByteDisplacement % m_pWfExt->Format.nBlockAlign);
-		//m_byteDisplacementCarryForward -= fillerBytes;
-		//m_ullPresentationPosition += fillerBytes;
-		//ULONG bytesToWrite = ByteDisplacement + fillerBytes;
-		// Write sine wave to buffer.
-		WriteBytes(ByteDisplacement);
+		//Event type: eMINIPORT_GLITCH_REPORT
+		//Parameter 1: Current linear buffer position 
+		//Parameter 2: Previous WaveRtBufferWritePosition that the driver received 
+		//Parameter 3: Major glitch code: 1:WaveRT buffer is underrun
+		//Parameter 4: Minor code for the glitch cause
+		pAdapterComm->WriteEtwEvent(eMINIPORT_GLITCH_REPORT,
+			Tick->LinearPosition,
+			Tick->WritePosition,
+			1,      // WaveRT buffer is underrun
+			0);
 	}
-	else
+
+	if (Tick->SignalEvents)
 	{
-		if (m_bEoSReceived)
+		PNOTIFICATION_EVENT_SET eventSet = (PNOTIFICATION_EVENT_SET)ReadPointerAcquire((PVOID volatile*)&m_pNotificationEvents);
+		ULONG eventCount = eventSet->Count;
+
+		for (ULONG i = 0; i < eventCount; i++)
 		{
-			// since EoS flag is set, we'll need to make sure not to read data beyond EOS position.
-			// If driver's current position is less than EoS position, then make sure not to read data beyond EoS.
-			if (m_ullWritePosition <= m_ulCurrentWritePosition)
-			{
-				ByteDisplacement = min(ByteDisplacement, m_ulCurrentWritePosition - (ULONG)m_ullWritePosition);
-			}
-			// If our current position is ahead of EoS position and we'll wrap around after new position then adjust
-			// new position if it crosses EoS.
-			else if ((m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize < m_ullWritePosition)
-			{
-				if ((m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize > m_ulCurrentWritePosition)
-				{
-					ByteDisplacement = ByteDisplacement - (((ULONG)m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize - m_ulCurrentWritePosition);
-				}
-			}
+			KeSetEvent(eventSet->Events[i], 0, 0);
 		}
 
-		// If the last packet was rendered(read in the sample driver's case), send out an etw event.
-		if (m_bEoSReceived && !m_bLastBufferRendered
-			&& (m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize == m_ulCurrentWritePosition)
+		if (eventCount > 0)
 		{
-			m_bLastBufferRendered = TRUE;
-			IAdapterCommon* pAdapterComm = m_pMiniport->GetAdapter();
-			//Event type : eMINIPORT_LAST_BUFFER_RENDERED
-			//Parameter 1 : Current linear buffer position
-			//Parameter 2 : the very last WaveRtBufferWritePosition that the driver received
-			//Parameter 3 : 0
-			//Parameter 4 : 0
-			pAdapterComm->WriteEtwEvent(eMINIPORT_LAST_BUFFER_RENDERED,
-				m_ullLinearPosition + ByteDisplacement, // Current linear buffer position  
-				m_ulCurrentWritePosition, // The very last WaveRtBufferWritePosition that the driver received
-				0,
-				0);
+			//Event type: eMINIPORT_BUFFER_COMPLETE, one per tick for all signalled events
+			//Parameter 1: Current linear buffer position
+			//Parameter 2: Previous WaveRtBufferWritePosition that the driver received
+			//Parameter 3: Data length completed
+			//Parameter 4: 0
+			pAdapterComm->WriteEtwEvent(eMINIPORT_BUFFER_COMPLETE,
+				Tick->LinearPosition,
+				Tick->WritePosition,
+				Tick->CompletedPackets * m_ulPacketSize, // Data length completed
+				0); // always zero
 		}
-		// Read from buffer and write to a file.
-		ReadBytes(ByteDisplacement);
 	}
-
-	// Increment the DMA position by the number of bytes displaced since the last
-	// call to UpdatePosition() and ensure we properly wrap at buffer length.
-	//
-	m_ullPlayPosition = m_ullWritePosition =
-		(m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize;
-
-	// m_ullDmaTimeStamp is updated in both GetPostion and GetLinearPosition calls
-	// so m_ullLinearPosition needs to be updated accordingly here
-	//
-	m_ullLinearPosition += ByteDisplacement;
-
-	// Update the DMA time stamp for the next call to GetPosition()
-	//
-	m_ullDmaTimeStamp = hnsCurrentTime;
 }
 
 //=============================================================================
 #pragma code_seg()
-VOID MiniportWaveRTStream::WriteBytes
+VOID MiniportWaveRTStream::OnWritePositionChanged
 (
-	_In_ ULONG ByteDisplacement
+	_In_ ULONG NewWritePosition
 )
-/*++
-
-Routine Description:
-
-This function writes the audio buffer using a sine wave generator
-Arguments:
-
-ByteDisplacement - # of bytes to process.
-
---*/
 {
-	ULONG bufferOffset = m_ullLinearPosition % m_ulDmaBufferSize;
+	IAdapterCommon* pAdapterComm = m_pMiniport->GetAdapter();
+
+	//Event type: eMINIPORT_SET_WAVERT_BUFFER_WRITE_POSITION
+	//Parameter 1: Current linear buffer position    
+	//Parameter 2: Previous WaveRtBufferWritePosition that the driver received    
+	//Parameter 3: Target WaveRtBufferWritePosition received from portcls
+	//Parameter 4: 0
+	pAdapterComm->WriteEtwEvent(eMINIPORT_SET_WAVERT_BUFFER_WRITE_POSITION,
+		m_ullLinearPosition, // replace with the correct "Current linear buffer position"    
+		m_ulCurrentWritePosition,
+		NewWritePosition, // this is new write position
+		0); // always zero
 
-	// Normally this will loop no more than once for a single wrap, but if
-	// many bytes have been displaced then this may loops many times.
-	while (ByteDisplacement > 0)
+	//
+	// Check for eMINIPORT_GLITCH_REPORT - Same WaveRT buffer write during event driven mode.
+	//
+	if (m_ulNotificationsPerBuffer > 0)
 	{
-		ULONG runWrite = min(ByteDisplacement, m_ulDmaBufferSize - bufferOffset);
-		SIZE_T actuallyWritten;
-		
-		m_RingBuffer->Take(m_pDmaBuffer + bufferOffset, runWrite, &actuallyWritten);
-		if (actuallyWritten < runWrite)
+		if (m_ulCurrentWritePosition == NewWritePosition)
 		{
-			RtlZeroMemory(m_pDmaBuffer + bufferOffset + actuallyWritten, runWrite - actuallyWritten);
+			//Event type: eMINIPORT_GLITCH_REPORT
+			//Parameter 1: Current linear buffer position 
+			//Parameter 2: Previous WaveRtBufferWritePosition that the driver received 
+			//Parameter 3: Major glitch code: 3: Received same WaveRT buffer twice in a row during event driven mode
+			//Parameter 4: Minor code for the glitch cause
+			pAdapterComm->WriteEtwEvent(eMINIPORT_GLITCH_REPORT,
+				m_ullLinearPosition, // replace with the correct "Current linear buffer position"
+				m_ulCurrentWritePosition,
+				3, // received same WaveRT buffer twice in a row during event driven mode
+				NewWritePosition);
 		}
-		
-		bufferOffset = (bufferOffset + runWrite) % m_ulDmaBufferSize;
-		ByteDisplacement -= runWrite;
 	}
 }
 
 //=============================================================================
 #pragma code_seg()
-VOID MiniportWaveRTStream::ReadBytes
+VOID MiniportWaveRTStream::OnLastBufferRendered
 (
-	_In_ ULONG ByteDisplacement
+	_In_ ULONGLONG LinearPosition
 )
-/*++
-
-Routine Description:
-
-This function reads the audio buffer and saves the data in a file.
-
-Arguments:
-
-ByteDisplacement - # of bytes to process.
-
---*/
 {
-	ULONG bufferOffset = m_ullLinearPosition % m_ulDmaBufferSize;
-
-	// Normally this will loop no more than once for a single wrap, but if
-	// many bytes have been displaced then this may loops many times.
-	while (ByteDisplacement > 0)
-	{
-		ULONG runWrite = min(ByteDisplacement, m_ulDmaBufferSize - bufferOffset);
-		if (m_PairedStream) m_PairedStream->WriteAudioPacket(m_pDmaBuffer + bufferOffset, runWrite, false);
-		bufferOffset = (bufferOffset + runWrite) % m_ulDmaBufferSize;
-		ByteDisplacement -= runWrite;
-	}
+	IAdapterCommon* pAdapterComm = m_pMiniport->GetAdapter();
+
+	//Event type : eMINIPORT_LAST_BUFFER_RENDERED
+	//Parameter 1 : Current linear buffer position
+	//Parameter 2 : the very last WaveRtBufferWritePosition that the driver received
+	//Parameter 3 : 0
+	//Parameter 4 : 0
+	pAdapterComm->WriteEtwEvent(eMINIPORT_LAST_BUFFER_RENDERED,
+		LinearPosition, // Current linear buffer position  
+		m_ulCurrentWritePosition, // The very last WaveRtBufferWritePosition that the driver received
+		0,
+		0);
 }
 
 //=============================================================================
 #pragma code_seg()
-void
-TimerNotifyRT
-(
-	_In_      PEX_TIMER    Timer,
-	_In_opt_  PVOID        DeferredContext
-)
+CableInjector* MiniportWaveRTStream::GetCableInjector()
 {
-	LARGE_INTEGER qpc;
-	LARGE_INTEGER qpcFrequency;
-	BOOL bufferCompleted = FALSE;
-
-	UNREFERENCED_PARAMETER(Timer);
-
-	_IRQL_limited_to_(DISPATCH_LEVEL);
-
-	MiniportWaveRTStream* _this = (MiniportWaveRTStream*)DeferredContext;
-
-	if (NULL == _this)
-	{
-		return;
-	}
-
-	KIRQL oldIrql;
-	KeAcquireSpinLock(&_this->m_PositionSpinLock, &oldIrql);
-
-	qpc = KeQueryPerformanceCounter(&qpcFrequency);
-
-	// Convert ticks to 100ns units.
-	LONGLONG  hnsCurrentTime = KSCONVERT_PERFORMANCE_TIME(_this->m_ullPerformanceCounterFrequency.QuadPart, qpc);
-
-	// Calculate the time elapsed since the last we ran DPC that matched Notification interval. Note that the division by 10000 
-	// to convert to milliseconds may cause us to lose some of the time, so we will carry the remainder forward.
-
-	ULONG TimeElapsedInMS = (ULONG)(hnsCurrentTime - _this->m_ullLastDPCTimeStamp + _this->m_hnsDPCTimeCarryForward) / 10000;
-
-	if (TimeElapsedInMS >= _this->m_ulNotificationIntervalMs)
-	{
-		// Carry forward the time greater than notification interval to adjust time to signal next buffer completion event accordingly.
-		_this->m_hnsDPCTimeCarryForward = hnsCurrentTime - _this->m_ullLastDPCTimeStamp + _this->m_hnsDPCTimeCarryForward - (_this->m_ulNotificationIntervalMs * 10000);
-		// Save the last time DPC ran at notification interval
-		_this->m_ullLastDPCTimeStamp = hnsCurrentTime;
-		bufferCompleted = TRUE;
-	}
-
-	if (!bufferCompleted && !_this->m_bEoSReceived)
-	{
-		goto End;
-	}
-
-	_this->UpdatePosition(qpc);
-
-	if (!_this->m_bEoSReceived)
-	{
-		_this->m_llPacketCounter++;
-	}
-
-	if (_this->m_KsState != KSSTATE_RUN)
-	{
-		goto End;
-	}
-
-	IAdapterCommon*  pAdapterComm = _this->m_pMiniport->GetAdapter();
-
-	// Simple buffer underrun detection.
-	if (!_this->IsCurrentWaveRTWritePositionUpdated() && !_this->m_bEoSReceived)
-	{
-		//Event type: eMINIPORT_GLITCH_REPORT
-		//Parameter 1: Current linear buffer position 
-		//Parameter 2: Previous WaveRtBufferWritePosition that the driver received 
-		//Parameter 3: Major glitch code: 1:WaveRT buffer is underrun
-		//Parameter 4: Minor code for the glitch cause
-		pAdapterComm->WriteEtwEvent(eMINIPORT_GLITCH_REPORT,
-			_this->m_ullLinearPosition,
-			_this->GetCurrentWaveRTWritePosition(),
-			1,      // WaveRT buffer is underrun
-			0);
-	}
-
-	// Send buffer completion event if either of the following is true
-	// 1. Driver consumed a complete buffer for this stream
-	// 2. Driver consumed a partial buffer containing EoS for this stream
-
-	if (!IsListEmpty(&_this->m_NotificationList) &&
-		(bufferCompleted || _this->m_bLastBufferRendered))
-	{
-		PLIST_ENTRY leCurrent = _this->m_NotificationList.Flink;
-		while (leCurrent != &_this->m_NotificationList)
-		{
-			NotificationListEntry* nleCurrent = CONTAINING_RECORD(leCurrent, NotificationListEntry, ListEntry);
-			//Event type: eMINIPORT_BUFFER_COMPLETE
-			//Parameter 1: Current linear buffer position
-			//Parameter 2: Previous WaveRtBufferWritePosition that the driver received
-			//Parameter 3: Data length completed
-			//Parameter 4: 0
-			pAdapterComm->WriteEtwEvent(eMINIPORT_BUFFER_COMPLETE,
-				_this->m_ullLinearPosition,
-				_this->GetCurrentWaveRTWritePosition(),
-				_this->m_ulDmaBufferSize / _this->m_ulNotificationsPerBuffer, // replace with the correct "Data length completed"
-				0); // always zero
-			KeSetEvent(nleCurrent->NotificationEvent, 0, 0);
-
-			leCurrent = leCurrent->Flink;
-		}
-	}
-
-	if (_this->m_bLastBufferRendered)
-	{
-		ExCancelTimer(_this->m_pNotificationTimer, NULL);
-	}
-
-End:
-	KeReleaseSpinLock(&_this->m_PositionSpinLock, oldIrql);
-	return;
+	return m_pMiniport->GetInjector();
 }
-//=============================================================================
-
-
@@ -1,6 +1,6 @@
 #pragma once
 #include "Globals.h"
-#include "RingBuffer.h"
+#include "CableStream.h"
 
 /*++
 
@@ -18,15 +18,17 @@ Abstract:
 
 
 //
-// Structure to store notifications events in a protected list
+// Registered notification events. The timer DPC reads the published set
+// without a lock, registration builds a new set in the other slot and
+// swaps the pointer. PortCls registers one event per stream in practice.
 //
-typedef struct _NotificationListEntry
-{
-	LIST_ENTRY  ListEntry;
-	PKEVENT     NotificationEvent;
-} NotificationListEntry;
+#define MAX_NOTIFICATION_EVENTS     4
 
-EXT_CALLBACK   TimerNotifyRT;
+typedef struct _NOTIFICATION_EVENT_SET
+{
+	ULONG       Count;
+	PKEVENT     Events[MAX_NOTIFICATION_EVENTS];
+} NOTIFICATION_EVENT_SET, *PNOTIFICATION_EVENT_SET;
 
 //=============================================================================
 // Referenced Forward
@@ -46,15 +48,14 @@ class MiniportWaveRTStream :
 	public IMiniportWaveRTOutputStream,
 	public IMiniportStreamAudioEngineNode,
 	public IMiniportStreamAudioEngineNode2,
+	public CableStream,
 	public CUnknown
 {
 protected:
 	PPORTWAVERTSTREAM           m_pPortStream;
-	LIST_ENTRY                  m_NotificationList;
-	PEX_TIMER                   m_pNotificationTimer;
-	ULONG                       m_ulNotificationIntervalMs;
-	ULONG                       m_ulCurrentWritePosition;
-	LONG                        m_IsCurrentWritePositionUpdated;
+	NOTIFICATION_EVENT_SET      m_NotificationEventSets[2];
+	PNOTIFICATION_EVENT_SET     m_pNotificationEvents;
+	FAST_MUTEX                  m_NotificationEventsLock;
 
 public:
 	DECLARE_STD_UNKNOWN();
@@ -77,48 +78,22 @@ public:
 		_In_  PKSDATAFORMAT       DataFormat,
 		_In_  GUID                SignalProcessingMode
 	);
-
-	// Friends
-	friend EXT_CALLBACK         TimerNotifyRT;
 protected:
 	MiniportWaveRT*            m_pMiniport;
 	ULONG                       m_ulPin;
-	BOOLEAN                     m_bCapture;
 	BOOLEAN                     m_bUnregisterStream;
-	ULONG                       m_ulDmaBufferSize;
-	BYTE*                       m_pDmaBuffer;
-	ULONG                       m_ulNotificationsPerBuffer;
-	KSSTATE                     m_KsState;
-	PKTIMER                     m_pTimer;
-	PRKDPC                      m_pDpc;
-	ULONGLONG                   m_ullPlayPosition;
-	ULONGLONG                   m_ullWritePosition;
-	ULONGLONG                   m_ullLinearPosition;
-	ULONGLONG                   m_ullPresentationPosition;
-	ULONG                       m_ulLastOsReadPacket;
-	ULONG                       m_ulLastOsWritePacket;
-	LONGLONG                    m_llPacketCounter;
-	ULONGLONG                   m_ullDmaTimeStamp;
-	LARGE_INTEGER               m_ullPerformanceCounterFrequency;
-	ULONGLONG                   m_hnsElapsedTimeCarryForward;
-	ULONGLONG                   m_ullLastDPCTimeStamp;
-	ULONGLONG                   m_hnsDPCTimeCarryForward;
-	LONG                        m_byteDisplacementCarryForward;
-	ULONG                       m_ulDmaMovementRate;
 	BOOL                        m_bLfxEnabled;
-	PBOOL                       m_pbMuted;
-	PLONG                       m_plVolumeLevel;
-	PLONG                       m_plPeakMeter;
-	PWAVEFORMATEXTENSIBLE       m_pWfExt;
 	ULONG                       m_ulContentId;
 	GUID                        m_SignalProcessingMode;
-	BOOLEAN                     m_bEoSReceived;
-	BOOLEAN                     m_bLastBufferRendered;
-	KSPIN_LOCK                  m_PositionSpinLock;
 	ULONG                       m_AudioModuleCount;
 
-	MiniportWaveRTStream*		m_PairedStream;
-	RingBuffer*					m_RingBuffer;
+	//
+	// CableStream hooks.
+	//
+	VOID OnTimerTick(_In_ const CABLE_STREAM_TICK* Tick) override;
+	VOID OnWritePositionChanged(_In_ ULONG NewWritePosition) override;
+	VOID OnLastBufferRendered(_In_ ULONGLONG LinearPosition) override;
+	CableInjector* GetCableInjector() override;
 public:
 
 	NTSTATUS GetVolumeChannelCount
@@ -201,17 +176,6 @@ public:
 		_In_ CONSTRICTOR_OPTION ulProtectionOption
 	);
 
-	ULONG GetCurrentWaveRTWritePosition()
-	{
-		return m_ulCurrentWritePosition;
-	};
-
-	// To support simple underrun validation.
-	BOOL IsCurrentWaveRTWritePositionUpdated()
-	{
-		return InterlockedExchange(&m_IsCurrentWritePositionUpdated, 0) ? TRUE : FALSE;
-	};
-
 	GUID GetSignalProcessingMode()
 	{
 		return m_SignalProcessingMode;
@@ -227,7 +191,20 @@ public:
 		_In_ PPCPROPERTY_REQUEST PropertyRequest
 	);
 
-	void SetPairedStream(MiniportWaveRTStream* stream);
+	VOID GetStatistics
+	(
+		_Out_ PAUDIOMIRROR_STREAM_STATISTICS Statistics
+	);
+
+	VOID EnableLatencyMeasurement
+	(
+		_In_ BOOL Enable
+	);
+
+	VOID GetLatencyHistogram
+	(
+		_Out_ PAUDIOMIRROR_LATENCY_HISTOGRAM Histogram
+	);
 private:
 
 	//
@@ -241,33 +218,9 @@ private:
 		return m_AudioModuleCount;
 	}
 
-	VOID WriteBytes
-	(
-		_In_ ULONG ByteDisplacement
-	);
-
-	VOID ReadBytes
-	(
-		_In_ ULONG ByteDisplacement
-	);
-
-	NTSTATUS WriteAudioPacket(BYTE * buffer, ULONG packetSize, BOOL eos);
-
-	VOID UpdatePosition
-	(
-		_In_ LARGE_INTEGER ilQPC
-	);
-
-	NTSTATUS SetCurrentWritePositionInternal
-	(
-		_In_  ULONG ulCurrentWritePosition
-	);
-
-	NTSTATUS GetPositions
+	VOID PublishNotificationEvents
 	(
-		_Out_opt_  ULONGLONG *      _pullLinearBufferPosition,
-		_Out_opt_  ULONGLONG *      _pullPresentationPosition,
-		_Out_opt_  LARGE_INTEGER *  _pliQPCTime
+		_In_ PNOTIFICATION_EVENT_SET EventSet
 	);
 
 };
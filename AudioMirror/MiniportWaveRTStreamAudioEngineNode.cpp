@@ -12,19 +12,6 @@ Abstract:
 #include "MiniportWaveRTStream.h"
 #include "MiniportWaveRT.h"
 
-#define MINWAVERTSTREAM_POOLTAG 'SRWM'
-#define HNSTIME_PER_MILLISECOND 10000
-
-// Default volume settings.
-#define VOLUME_STEPPING_DELTA       0x8000
-#define VOLUME_SIGNED_MAXIMUM       0x00000000
-#define VOLUME_SIGNED_MINIMUM       (-96 * 0x10000)
-
-// Default peak meter settings
-#define PEAKMETER_STEPPING_DELTA    0x1000
-#define PEAKMETER_SIGNED_MAXIMUM    LONG_MAX
-#define PEAKMETER_SIGNED_MINIMUM    LONG_MIN
-
 #define VALUE_NORMALIZE_P(v, step) \
     ((((v) + (step)/2) / (step)) * (step))
 
@@ -243,6 +230,10 @@ Called at PASSIVE_LEVEL
 
 Remarks
 
+	The curve is executed by the stream's volume ramp while the mixer sums the
+	stream, so a whole fade costs the audio engine one call. The reported
+	level is the target right away.
+
 -------------------------------------------------------------------------------------------------------------------------*/
 STDMETHODIMP_(NTSTATUS) MiniportWaveRTStream::SetStreamChannelVolume
 (
@@ -252,8 +243,6 @@ STDMETHODIMP_(NTSTATUS) MiniportWaveRTStream::SetStreamChannelVolume
 	_In_ ULONGLONG          CurveDuration
 )
 {
-	UNREFERENCED_PARAMETER(CurveType);
-	UNREFERENCED_PARAMETER(CurveDuration);
 	NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
 
 	PAGED_CODE();
@@ -268,11 +257,13 @@ STDMETHODIMP_(NTSTATUS) MiniportWaveRTStream::SetStreamChannelVolume
 		for (UINT32 i = 0; i < m_pWfExt->Format.nChannels; i++)
 		{
 			ntStatus = SetChannelVolume(i, lVolume);
+			m_VolumeRamp.SetTarget(i, lVolume, CurveType, CurveDuration);
 		}
 	}
 	else
 	{
 		ntStatus = SetChannelVolume(Channel, lVolume);
+		m_VolumeRamp.SetTarget(Channel, lVolume, CurveType, CurveDuration);
 	}
 
 	return ntStatus;
@@ -787,117 +778,6 @@ Done:
 	return ntStatus;
 }
 
-#pragma code_seg()
-NTSTATUS MiniportWaveRTStream::SetCurrentWritePositionInternal(_In_  ULONG _ulCurrentWritePosition)
-{
-
-	ASSERT(m_bEoSReceived == FALSE);
-
-	if (m_bEoSReceived)
-	{
-		return STATUS_INVALID_DEVICE_REQUEST;
-	}
-
-	if (_ulCurrentWritePosition > m_ulDmaBufferSize)
-	{
-		return STATUS_INVALID_DEVICE_REQUEST;
-	}
-
-	IAdapterCommon* pAdapterComm = m_pMiniport->GetAdapter();
-
-	//Event type: eMINIPORT_SET_WAVERT_BUFFER_WRITE_POSITION
-	//Parameter 1: Current linear buffer position    
-	//Parameter 2: Previous WaveRtBufferWritePosition that the driver received    
-	//Parameter 3: Target WaveRtBufferWritePosition received from portcls
-	//Parameter 4: 0
-	pAdapterComm->WriteEtwEvent(eMINIPORT_SET_WAVERT_BUFFER_WRITE_POSITION,
-		m_ullLinearPosition, // replace with the correct "Current linear buffer position"    
-		m_ulCurrentWritePosition,
-		_ulCurrentWritePosition, // this is new write position
-		0); // always zero
-
-//
-// Check for eMINIPORT_GLITCH_REPORT - Same WaveRT buffer write during event driven mode.
-//
-	if (m_ulNotificationIntervalMs > 0)
-	{
-		if (m_ulCurrentWritePosition == _ulCurrentWritePosition)
-		{
-			//Event type: eMINIPORT_GLITCH_REPORT
-			//Parameter 1: Current linear buffer position 
-			//Parameter 2: Previous WaveRtBufferWritePosition that the driver received 
-			//Parameter 3: Major glitch code: 3: Received same WaveRT buffer twice in a row during event driven mode
-			//Parameter 4: Minor code for the glitch cause
-			pAdapterComm->WriteEtwEvent(eMINIPORT_GLITCH_REPORT,
-				m_ullLinearPosition, // replace with the correct "Current linear buffer position"
-				m_ulCurrentWritePosition,
-				3, // received same WaveRT buffer twice in a row during event driven mode
-				_ulCurrentWritePosition);
-		}
-	}
-
-	m_ulCurrentWritePosition = _ulCurrentWritePosition;
-	InterlockedExchange(&m_IsCurrentWritePositionUpdated, 1);
-
-	return STATUS_SUCCESS;
-}
-
-//linear and presentation positions
-#pragma code_seg()
-NTSTATUS MiniportWaveRTStream::GetPositions
-(
-	_Out_opt_  ULONGLONG *      _pullLinearBufferPosition,
-	_Out_opt_  ULONGLONG *      _pullPresentationPosition,
-	_Out_opt_  LARGE_INTEGER *  _pliQPCTime
-)
-{
-
-	NTSTATUS        ntStatus;
-	LARGE_INTEGER   ilQPC;
-	KIRQL           oldIrql;
-#if defined(SYSVAD_BTH_BYPASS)
-	if (m_SidebandStarted)
-	{
-		ntStatus = GetSidebandStreamNtStatus();
-		IF_FAILED_JUMP(ntStatus, Done);
-	}
-#endif // defined(SYSVAD_BTH_BYPASS)
-
-	// Update *_pullLinearBufferPosition with the the number of bytes fetched from waveRT ever since a stream got set into RUN
-	// state.
-	// Once the stream is set to STOP state, any further read on this call would return zero.
-
-	//
-	// Get the current time and update position.
-	//
-	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
-	ilQPC = KeQueryPerformanceCounter(NULL);
-	if (m_KsState == KSSTATE_RUN)
-	{
-		UpdatePosition(ilQPC);
-	}
-	if (_pullLinearBufferPosition)
-	{
-		*_pullLinearBufferPosition = m_ullLinearPosition;
-	}
-	if (_pullPresentationPosition)
-	{
-		*_pullPresentationPosition = m_ullPresentationPosition;
-	}
-	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
-	if (_pliQPCTime)
-	{
-		*_pliQPCTime = ilQPC;
-	}
-
-	ntStatus = STATUS_SUCCESS;
-
-#if defined(SYSVAD_BTH_BYPASS)
-	Done:
-#endif // defined(SYSVAD_BTH_BYPASS)
-		return ntStatus;
-}
-
 #pragma code_seg("PAGE")
 /*-----------------------------------------------------------------------------
 MiniportWaveRTStream::SetLoopbackProtection
@@ -964,22 +844,9 @@ NTSTATUS MiniportWaveRTStream::SetLoopbackProtection(_In_ CONSTRICTOR_OPTION pro
 
 NTSTATUS MiniportWaveRTStream::SetStreamCurrentWritePositionForLastBuffer(_In_ ULONG _ulWritePosition)
 {
-	NTSTATUS        ntStatus;
-	KIRQL           oldIrql;
-
-	KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
-
 	// Miniport driver needs to prepare to signal buffer completion event
 	// when it's done with reading the last valid byte - an _ulWritePosition offset from the beginning WaveRT buffer
 	// Note: _ulWritePosition will be smaller than buffer size in most of the cases 
-	ntStatus = SetCurrentWritePositionInternal(_ulWritePosition);
-	if (NT_SUCCESS(ntStatus))
-	{
-		m_bEoSReceived = TRUE;
-	}
-
-	KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
-
-	return ntStatus;
+	return SetLastBufferWritePosition(_ulWritePosition);
 }
 
@@ -0,0 +1,89 @@
+#include "MirroredBuffer.h"
+
+#pragma code_seg("PAGE")
+MirroredBuffer::MirroredBuffer()
+	: m_pPages(NULL), m_pMirror(NULL), m_pAddress(NULL), m_Size(0)
+{
+	PAGED_CODE();
+}
+
+#pragma code_seg()
+MirroredBuffer::~MirroredBuffer()
+{
+	if (m_pAddress != NULL)
+	{
+		MmUnmapLockedPages(m_pAddress, m_pMirror);
+		m_pAddress = NULL;
+	}
+
+	if (m_pMirror != NULL)
+	{
+		IoFreeMdl(m_pMirror);
+		m_pMirror = NULL;
+	}
+
+	if (m_pPages != NULL)
+	{
+		MmFreePagesFromMdl(m_pPages);
+		ExFreePool(m_pPages);
+		m_pPages = NULL;
+	}
+}
+
+#pragma code_seg("PAGE")
+NTSTATUS MirroredBuffer::Init(SIZE_T size)
+{
+	PHYSICAL_ADDRESS lowAddress;
+	PHYSICAL_ADDRESS highAddress;
+	PHYSICAL_ADDRESS skipBytes;
+	PPFN_NUMBER pSourcePages;
+	PPFN_NUMBER pMirrorPages;
+	SIZE_T pageCount;
+
+	PAGED_CODE();
+
+	if (m_pPages != NULL)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	// Both views are described by one MDL, whose length is a ULONG.
+	m_Size = ROUND_TO_PAGES(size);
+	if (m_Size == 0 || m_Size > MAXULONG / 2)
+	{
+		m_Size = 0;
+		return STATUS_INVALID_PARAMETER;
+	}
+	pageCount = m_Size / PAGE_SIZE;
+
+	lowAddress.QuadPart = 0;
+	highAddress.QuadPart = -1;
+	skipBytes.QuadPart = 0;
+	m_pPages = MmAllocatePagesForMdlEx(lowAddress, highAddress, skipBytes, m_Size, MmCached, MM_ALLOCATE_FULLY_REQUIRED);
+	if (m_pPages == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	m_pMirror = IoAllocateMdl(NULL, (ULONG)(2 * m_Size), FALSE, FALSE, NULL);
+	if (m_pMirror == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	pSourcePages = MmGetMdlPfnArray(m_pPages);
+	pMirrorPages = MmGetMdlPfnArray(m_pMirror);
+	RtlCopyMemory(pMirrorPages, pSourcePages, pageCount * sizeof(PFN_NUMBER));
+	RtlCopyMemory(pMirrorPages + pageCount, pSourcePages, pageCount * sizeof(PFN_NUMBER));
+
+	// The pages are locked for as long as the first MDL owns them.
+	m_pMirror->MdlFlags |= MDL_PAGES_LOCKED;
+
+	m_pAddress = (BYTE*)MmMapLockedPagesSpecifyCache(m_pMirror, KernelMode, MmCached, NULL, FALSE, NormalPagePriority | MdlMappingNoExecute);
+	if (m_pAddress == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	return STATUS_SUCCESS;
+}
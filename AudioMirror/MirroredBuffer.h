@@ -0,0 +1,42 @@
+#pragma once
+#include "Globals.h"
+
+/*
+	Nonpaged storage whose pages are mapped twice, back to back, so the
+	byte after the last one is the first one again. A ring on top of it
+	copies any span up to its size in one piece, wherever the wrap falls.
+
+	The pages come from MmAllocatePagesForMdlEx. A second MDL lists every
+	one of them twice and is mapped into system space, which gives the two
+	adjacent views of the same memory.
+*/
+class MirroredBuffer
+{
+private:
+	PMDL        m_pPages;
+	PMDL        m_pMirror;
+	BYTE*       m_pAddress;
+	SIZE_T      m_Size;
+public:
+	MirroredBuffer();
+	~MirroredBuffer();
+
+	/*
+		Allocates and maps at least size zeroed bytes, rounded up to whole
+		pages. PASSIVE_LEVEL only.
+	*/
+	NTSTATUS Init(_In_ SIZE_T size);
+
+	/*
+		Start of the first view, the second one follows at GetSize().
+	*/
+	BYTE* GetAddress()
+	{
+		return m_pAddress;
+	}
+
+	SIZE_T GetSize()
+	{
+		return m_Size;
+	}
+};
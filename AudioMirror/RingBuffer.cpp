@@ -2,73 +2,106 @@
 
 #define RING_BUFFER_TAG	'uBiR'
 
-RingBuffer::RingBuffer() 
-	: m_Buffer(NULL), m_BufferLength(0), 
-	m_LinearBufferReadPosition(0), m_LinearBufferWritePosition(0), m_IsFilling(TRUE), m_AlignBuffer(NULL), m_nByteAlignBufferCount(0)
+RingBuffer::RingBuffer()
+	: m_SpinLockIrql(0), m_Buffer(NULL), m_AlignBuffer(NULL), m_pMirror(NULL), m_BufferLength(0),
+	m_StorageLength(0), m_nByteAlign(0), m_StartThreshold(0), m_IsFilling(TRUE),
+	m_OverrunPolicy(RingOverrunDropOldest), m_LinearBufferReadPosition(0),
+	m_LinearBufferWritePosition(0), m_nByteAlignBufferCount(0)
 {
+	KeInitializeSpinLock(&m_BufferLock);
 }
 
 
 RingBuffer::~RingBuffer()
 {
+	MirroredBuffer* pMirror = m_pMirror;
+
 	if (m_Buffer != NULL)
 	{
-		KeAcquireSpinLock(m_BufferLock, &m_SpinLockIrql);
-		ExFreePoolWithTag(m_Buffer, RING_BUFFER_TAG);
-		ExFreePoolWithTag(m_AlignBuffer, RING_BUFFER_TAG);
+		KeAcquireSpinLock(&m_BufferLock, &m_SpinLockIrql);
+		if (m_pMirror == NULL)
+		{
+			ExFreePoolWithTag(m_Buffer, RING_BUFFER_TAG);
+		}
+		m_pMirror = NULL;
 		m_Buffer = NULL;
 		m_AlignBuffer = NULL;
 		m_BufferLength = 0;
-		KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
+		KeReleaseSpinLock(&m_BufferLock, m_SpinLockIrql);
 	}
 
-	if (m_BufferLock != NULL) 
+	if (pMirror != NULL)
 	{
-		ExFreePoolWithTag(m_BufferLock, RING_BUFFER_TAG);
-		m_BufferLock = NULL;
+		delete pMirror;
 	}
 }
 
-NTSTATUS RingBuffer::Init(SIZE_T bufferSize, SIZE_T nByteAlign)
+NTSTATUS RingBuffer::Init(SIZE_T bufferSize, SIZE_T nByteAlign, BOOLEAN mirrored)
 {
-	if (m_BufferLock == NULL)
+	MirroredBuffer* pMirror = NULL;
+	MirroredBuffer* pOldMirror;
+
+	// Mapping the mirror cannot happen under the lock.
+	if (mirrored)
 	{
-		m_BufferLock = new(NonPagedPoolNx, sizeof(KSPIN_LOCK)) KSPIN_LOCK;
-		if (m_BufferLock == NULL) return STATUS_INSUFFICIENT_RESOURCES;
-		KeInitializeSpinLock(m_BufferLock);
+		pMirror = new(NonPagedPoolNx, RING_BUFFER_TAG) MirroredBuffer();
+		if (pMirror == NULL)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		NTSTATUS ntStatus = pMirror->Init(bufferSize);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			delete pMirror;
+			return ntStatus;
+		}
 	}
 
-	if (m_Buffer != NULL) 
+	KeAcquireSpinLock(&m_BufferLock, &m_SpinLockIrql);
+	if (m_Buffer != NULL && m_pMirror == NULL)
 	{
-		KeAcquireSpinLock(m_BufferLock, &m_SpinLockIrql);
 		ExFreePoolWithTag(m_Buffer, RING_BUFFER_TAG);
-		ExFreePoolWithTag(m_AlignBuffer, RING_BUFFER_TAG);
-		m_Buffer = NULL;
-		m_AlignBuffer = NULL;
-		KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
 	}
+	m_Buffer = NULL;
+	m_AlignBuffer = NULL;
+	pOldMirror = m_pMirror;
+	m_pMirror = pMirror;
 
-	KeAcquireSpinLock(m_BufferLock, &m_SpinLockIrql);
-	m_Buffer = static_cast<BYTE*>(ExAllocatePoolWithTag(NonPagedPoolNx, bufferSize, RING_BUFFER_TAG));
-	if (m_Buffer == NULL) 
+	if (pMirror != NULL)
 	{
-		KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
-		return STATUS_INSUFFICIENT_RESOURCES;
+		// Offsets wrap at the mapped size, the rounding only adds slack.
+		m_Buffer = pMirror->GetAddress();
+		m_StorageLength = pMirror->GetSize();
 	}
-	m_AlignBuffer = static_cast<BYTE*>(ExAllocatePoolWithTag(NonPagedPoolNx, nByteAlign, RING_BUFFER_TAG));
-	if (m_AlignBuffer == NULL)
+	else
 	{
-		ExFreePoolWithTag(m_Buffer, RING_BUFFER_TAG);
-		m_Buffer = NULL;
-		KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
-		return STATUS_INSUFFICIENT_RESOURCES;
+		// The partial frame carried between puts lives behind the ring.
+		m_Buffer = static_cast<BYTE*>(ExAllocatePoolWithTag(NonPagedPoolNx, bufferSize + nByteAlign, RING_BUFFER_TAG));
+		if (m_Buffer == NULL) 
+		{
+			KeReleaseSpinLock(&m_BufferLock, m_SpinLockIrql);
+			if (pOldMirror != NULL)
+			{
+				delete pOldMirror;
+			}
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+		m_AlignBuffer = m_Buffer + bufferSize;
+		m_StorageLength = bufferSize;
 	}
 	m_BufferLength = bufferSize;
 	m_nByteAlign = nByteAlign;
+	m_StartThreshold = bufferSize / 2;
 	m_LinearBufferWritePosition = 0;
 	m_LinearBufferReadPosition = 0;
 	m_IsFilling = TRUE;
-	KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
+	KeReleaseSpinLock(&m_BufferLock, m_SpinLockIrql);
+
+	if (pOldMirror != NULL)
+	{
+		delete pOldMirror;
+	}
 
 	return STATUS_SUCCESS;
 }
@@ -77,9 +110,10 @@ NTSTATUS RingBuffer::Init(SIZE_T bufferSize, SIZE_T nByteAlign)
 NTSTATUS RingBuffer::PutInternal(BYTE* pBytes, SIZE_T count)
 {
 	if (count > m_BufferLength) return STATUS_BUFFER_TOO_SMALL;
+	if (m_AlignBuffer == NULL) return STATUS_NOT_SUPPORTED;
 	
 	NTSTATUS status = STATUS_SUCCESS;
-	KeAcquireSpinLock(m_BufferLock, &m_SpinLockIrql);
+	KeAcquireSpinLock(&m_BufferLock, &m_SpinLockIrql);
 	
 	SIZE_T actualCount = m_nByteAlignBufferCount + count;
 	if (actualCount >= m_nByteAlign)
@@ -102,62 +136,137 @@ NTSTATUS RingBuffer::PutInternal(BYTE* pBytes, SIZE_T count)
 		m_nByteAlignBufferCount += count;
 	}
 
-	KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
+	KeReleaseSpinLock(&m_BufferLock, m_SpinLockIrql);
 	return status;
 }
 
-NTSTATUS RingBuffer::Put(BYTE* pBytes, SIZE_T count) 
+NTSTATUS RingBuffer::Put(BYTE* pBytes, SIZE_T count, SIZE_T* discardedBytes) 
 {
+	if (discardedBytes != NULL) *discardedBytes = 0;
 	if (count > m_BufferLength) return STATUS_BUFFER_TOO_SMALL;
 	if (count == 0) return STATUS_SUCCESS;
 
 	NTSTATUS status = STATUS_SUCCESS;
-	//buffer overrun
+	KIRQL oldIrql = PASSIVE_LEVEL;
+	BOOLEAN locked = FALSE;
+
+	//buffer overrun, the policies stay out of the common path. They move the
+	//read position Take moves as well, so they run under the lock.
 	if ((m_LinearBufferWritePosition + count) - m_LinearBufferReadPosition > m_BufferLength)
 	{
-		status = STATUS_BUFFER_OVERFLOW;
-		m_LinearBufferReadPosition = (m_LinearBufferWritePosition + count) - m_BufferLength + 1;
+		KeAcquireSpinLock(&m_BufferLock, &oldIrql);
+		locked = TRUE;
+
+		if ((m_LinearBufferWritePosition + count) - m_LinearBufferReadPosition > m_BufferLength)
+		{
+			SIZE_T discarded;
+
+			count = ResolveOverrun(count, &discarded);
+			status = STATUS_BUFFER_OVERFLOW;
+			if (discardedBytes != NULL) *discardedBytes = discarded;
+		}
 	}
 
-	SIZE_T bufferOffset = m_LinearBufferWritePosition % m_BufferLength;
+	SIZE_T bufferOffset = m_LinearBufferWritePosition % m_StorageLength;
 	SIZE_T bytesWritten = 0;
-	while (count > 0)
+	if (m_pMirror != NULL)
+	{
+		// A copy that passes the end runs on into the second view.
+		RtlCopyMemory(m_Buffer + bufferOffset, pBytes, count);
+		bytesWritten = count;
+	}
+	else while (count > 0)
 	{
-		SIZE_T runWrite = min(count, m_BufferLength - bufferOffset);
-		RtlCopyMemory(m_Buffer + bufferOffset, pBytes, runWrite);
-		bufferOffset = (bufferOffset + runWrite) % m_BufferLength;
+		SIZE_T runWrite = min(count, m_StorageLength - bufferOffset);
+		RtlCopyMemory(m_Buffer + bufferOffset, pBytes + bytesWritten, runWrite);
+		bufferOffset = (bufferOffset + runWrite) % m_StorageLength;
 		count -= runWrite;
 		bytesWritten += runWrite;
 	}
 	m_LinearBufferWritePosition += bytesWritten;
 
-	if (m_IsFilling && (m_LinearBufferWritePosition - m_LinearBufferReadPosition) > (m_BufferLength / 2))
+	if (m_IsFilling && (m_LinearBufferWritePosition - m_LinearBufferReadPosition) > m_StartThreshold)
 	{
 		DPF(D_TERSE, ("RingBuffer filled with %u bytes.", (m_LinearBufferWritePosition - m_LinearBufferReadPosition)));
 		m_IsFilling = false;
 	}
+
+	if (locked)
+	{
+		KeReleaseSpinLock(&m_BufferLock, oldIrql);
+	}
 	return status;
 }
 
-NTSTATUS RingBuffer::Take(BYTE* pTarget, SIZE_T count, SIZE_T* readCount)
+SIZE_T RingBuffer::ResolveOverrun(SIZE_T count, SIZE_T* discardedBytes)
+{
+	SIZE_T frame = (m_nByteAlign != 0) ? m_nByteAlign : 1;
+	SIZE_T fill = (SIZE_T)(m_LinearBufferWritePosition - m_LinearBufferReadPosition);
+	SIZE_T drop;
+	SIZE_T space;
+
+	switch (m_OverrunPolicy)
+	{
+	case RingOverrunDropNewest:
+		// Keeps the unread bytes, the cut below drops the rest of the put.
+		drop = 0;
+		break;
+
+	case RingOverrunSkipToLatency:
+		// Back down to the fill the ring started delivering at, at least
+		// the new bytes.
+		drop = fill + count - max(m_StartThreshold, count);
+		break;
+
+	default:
+		drop = fill + count - m_BufferLength;
+		break;
+	}
+
+	drop = min((drop + frame - 1) / frame * frame, fill);
+	m_LinearBufferReadPosition += drop;
+	*discardedBytes = drop;
+
+	// Whatever still does not fit is cut from the put in whole frames, the
+	// writer never runs over unread bytes.
+	space = (m_BufferLength - (fill - drop)) / frame * frame;
+	if (count > space)
+	{
+		*discardedBytes += count - space;
+		count = space;
+	}
+	return count;
+}
+
+NTSTATUS RingBuffer::Take(BYTE* pTarget, SIZE_T count, SIZE_T* readCount, EndpointGain* gain)
 {
-	KeAcquireSpinLock(m_BufferLock, &m_SpinLockIrql);
+	KeAcquireSpinLock(&m_BufferLock, &m_SpinLockIrql);
 
 	if (m_IsFilling)
 	{
 		*readCount = 0;
-		KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
+		KeReleaseSpinLock(&m_BufferLock, m_SpinLockIrql);
 		return STATUS_DEVICE_NOT_READY;
 	}
 
 	count = min(count, m_LinearBufferWritePosition - m_LinearBufferReadPosition);
-	SIZE_T bufferOffset = m_LinearBufferReadPosition % m_BufferLength;
+	SIZE_T bufferOffset = m_LinearBufferReadPosition % m_StorageLength;
 	SIZE_T bytesRead = 0;
+	ULONG channel = gain ? (ULONG)((m_LinearBufferReadPosition / sizeof(SHORT)) % gain->GetChannels()) : 0;
 	while (count > 0)
 	{
-		SIZE_T runWrite = min(count, m_BufferLength - bufferOffset);
-		RtlCopyMemory(pTarget + bytesRead, m_Buffer + bufferOffset, runWrite);
-		bufferOffset = (bufferOffset + runWrite) % m_BufferLength;
+		// Mirrored storage takes the whole count in one run.
+		SIZE_T runWrite = m_pMirror ? count : min(count, m_StorageLength - bufferOffset);
+		if (gain)
+		{
+			// Writers put whole frames, so a run never splits a sample.
+			channel = gain->CopyScaled((SHORT*)(pTarget + bytesRead), (SHORT*)(m_Buffer + bufferOffset), (ULONG)(runWrite / sizeof(SHORT)), channel);
+		}
+		else
+		{
+			RtlCopyMemory(pTarget + bytesRead, m_Buffer + bufferOffset, runWrite);
+		}
+		bufferOffset = (bufferOffset + runWrite) % m_StorageLength;
 		count -= runWrite;
 		bytesRead += runWrite;
 	}
@@ -170,7 +279,7 @@ NTSTATUS RingBuffer::Take(BYTE* pTarget, SIZE_T count, SIZE_T* readCount)
 		//m_nByteAlignBufferCount = 0;
 	}
 
-	KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
+	KeReleaseSpinLock(&m_BufferLock, m_SpinLockIrql);
 	return STATUS_SUCCESS;
 }
 
@@ -181,19 +290,58 @@ SIZE_T RingBuffer::GetSize()
 	return m_BufferLength;
 }
 
+void RingBuffer::SetStartThreshold(SIZE_T threshold)
+{
+	KeAcquireSpinLock(&m_BufferLock, &m_SpinLockIrql);
+	m_StartThreshold = min(threshold, m_BufferLength);
+	KeReleaseSpinLock(&m_BufferLock, m_SpinLockIrql);
+}
+
+void RingBuffer::SetOverrunPolicy(RING_OVERRUN_POLICY policy)
+{
+	m_OverrunPolicy = (policy < RingOverrunPolicyCount) ? policy : RingOverrunDropOldest;
+}
+
 SIZE_T RingBuffer::GetAvailableBytes()
 {
 	return m_IsFilling ? 0 : m_LinearBufferWritePosition - m_LinearBufferReadPosition;
 }
 
+SIZE_T RingBuffer::GetFillBytes()
+{
+	return m_LinearBufferWritePosition - m_LinearBufferReadPosition;
+}
+
+ULONGLONG RingBuffer::GetWritePosition()
+{
+	return m_LinearBufferWritePosition;
+}
+
+ULONGLONG RingBuffer::GetReadPosition()
+{
+	return m_LinearBufferReadPosition;
+}
+
 void RingBuffer::Clear()
 {
-	KeAcquireSpinLock(m_BufferLock, &m_SpinLockIrql);
+	Restart(0);
+}
 
-	RtlZeroMemory(m_Buffer, m_BufferLength);
-	m_IsFilling = true;
-	m_LinearBufferReadPosition = 0;
-	m_LinearBufferWritePosition = 0;
+SIZE_T RingBuffer::Restart(SIZE_T keepBytes)
+{
+	SIZE_T frame = (m_nByteAlign != 0) ? m_nByteAlign : 1;
+	SIZE_T keep;
+
+	KeAcquireSpinLock(&m_BufferLock, &m_SpinLockIrql);
+
+	// Take never reads past the write position, so the bytes behind it can
+	// stay as they are.
+	keep = min(keepBytes, (SIZE_T)(m_LinearBufferWritePosition - m_LinearBufferReadPosition));
+	keep -= keep % frame;
+	m_LinearBufferReadPosition = m_LinearBufferWritePosition - keep;
+	m_IsFilling = (keep == 0);
+
+	KeReleaseSpinLock(&m_BufferLock, m_SpinLockIrql);
 
-	KeReleaseSpinLock(m_BufferLock, m_SpinLockIrql);
+	return keep;
 }
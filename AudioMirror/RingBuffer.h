@@ -1,40 +1,112 @@
 #pragma once
 #include "Globals.h"
+#include "EndpointGain.h"
+#include "MirroredBuffer.h"
+
+/*
+	What Put discards when the bytes do not fit. The oldest bytes go in
+	whole frames of nByteAlign bytes, so the ring never restarts mid frame.
+*/
+typedef enum _RING_OVERRUN_POLICY
+{
+	RingOverrunDropOldest,      // Advances the read position just far enough.
+	RingOverrunDropNewest,      // Keeps the unread bytes, writes the frames that fit.
+	RingOverrunSkipToLatency,   // Advances the read position until the start threshold is left.
+	RingOverrunPolicyCount
+} RING_OVERRUN_POLICY;
 
 class RingBuffer
 {
 private:
-	KSPIN_LOCK* m_BufferLock;
+	KSPIN_LOCK m_BufferLock;
 	KIRQL m_SpinLockIrql;
 	BYTE* m_Buffer;
 	BYTE* m_AlignBuffer;
+	MirroredBuffer* m_pMirror;
 	SIZE_T m_BufferLength;
+	SIZE_T m_StorageLength;
 	SIZE_T m_nByteAlign;
+	SIZE_T m_StartThreshold;
 	BOOL m_IsFilling;
+	RING_OVERRUN_POLICY m_OverrunPolicy;
 
 	ULONGLONG m_LinearBufferReadPosition;
 	ULONGLONG m_LinearBufferWritePosition;
 	SIZE_T m_nByteAlignBufferCount;
 
 	NTSTATUS PutInternal(BYTE * pBytes, SIZE_T count);
+	SIZE_T ResolveOverrun(_In_ SIZE_T count, _Out_ SIZE_T* discardedBytes);
 public:
 	RingBuffer();
 	~RingBuffer();
 
-	NTSTATUS Init(SIZE_T bufferSize, SIZE_T nByteAlign);
 	/*
-		Puts the given bytes into the buffer.
+		Allocates the storage for bufferSize bytes. A mirrored ring keeps
+		them in a MirroredBuffer, rounded up to pages, and copies every Put
+		and Take in one piece instead of splitting it at the wrap. Mirrored
+		storage can only be set up at PASSIVE_LEVEL.
+	*/
+	NTSTATUS Init(_In_ SIZE_T bufferSize, _In_ SIZE_T nByteAlign, _In_ BOOLEAN mirrored = FALSE);
+	/*
+		Puts the given bytes into the buffer. When they do not fit, the
+		overrun policy decides what is discarded, Put returns
+		STATUS_BUFFER_OVERFLOW and discardedBytes tells how much. The
+		overrun runs under the buffer lock since it moves the read position,
+		and unread bytes are never written over.
 	*/
-	NTSTATUS Put(_In_ BYTE* pBytes, _In_ SIZE_T count);
+	NTSTATUS Put(_In_ BYTE* pBytes, _In_ SIZE_T count, _Out_opt_ SIZE_T* discardedBytes = NULL);
 	/*
 		Takes bytes out of the buffer and puts them into the target address.
+		With a gain the buffer holds 16 bit samples and the gain is applied
+		while they are copied.
 	*/
-	NTSTATUS Take(_In_ BYTE* pTarget, _In_ SIZE_T count, _Outptr_opt_ SIZE_T* readCount);
+	NTSTATUS Take(_In_ BYTE* pTarget, _In_ SIZE_T count, _Outptr_opt_ SIZE_T* readCount, _In_opt_ EndpointGain* gain = NULL);
 
 	SIZE_T GetSize();
 
+	BOOLEAN IsMirrored()
+	{
+		return m_pMirror != NULL;
+	}
+
+	/*
+		Fill level above which a filling buffer starts to deliver, half the
+		buffer by default. Init restores the default.
+	*/
+	void SetStartThreshold(_In_ SIZE_T threshold);
+
+	/*
+		RingOverrunDropOldest by default. Init keeps the policy.
+	*/
+	void SetOverrunPolicy(_In_ RING_OVERRUN_POLICY policy);
+
+	RING_OVERRUN_POLICY GetOverrunPolicy()
+	{
+		return m_OverrunPolicy;
+	}
+
 	SIZE_T GetAvailableBytes();
+	/*
+		Returns the number of unread bytes, regardless of whether the buffer is still filling.
+	*/
+	SIZE_T GetFillBytes();
+	/*
+		Linear positions since Init, used to identify bytes across Put and Take.
+	*/
+	ULONGLONG GetWritePosition();
+	ULONGLONG GetReadPosition();
 
+	/*
+		Drops the unread bytes and starts filling again. Only the read
+		position moves, nothing is zeroed.
+	*/
 	void Clear();
+
+	/*
+		Like Clear, but keeps up to keepBytes of the newest bytes readable,
+		in whole frames. Whatever is kept is delivered right away, the start
+		threshold only applies when nothing is. Returns the bytes kept.
+	*/
+	SIZE_T Restart(_In_ SIZE_T keepBytes);
 };
 
@@ -0,0 +1,220 @@
+#include "SharedSection.h"
+
+#pragma code_seg("PAGE")
+SharedSection::SharedSection()
+	: m_hSection(NULL), m_pSection(NULL), m_pSystemView(NULL), m_pMdl(NULL), m_ViewSize(0),
+	m_ulEventCount(0)
+{
+	PAGED_CODE();
+
+	KeInitializeSpinLock(&m_Lock);
+	RtlZeroMemory(m_Events, sizeof(m_Events));
+}
+
+#pragma code_seg("PAGE")
+SharedSection::~SharedSection()
+{
+	PAGED_CODE();
+
+	for (ULONG i = 0; i < m_ulEventCount; ++i)
+	{
+		ObDereferenceObject(m_Events[i]);
+	}
+	m_ulEventCount = 0;
+
+	if (m_pMdl != NULL)
+	{
+		MmUnlockPages(m_pMdl);
+		IoFreeMdl(m_pMdl);
+		m_pMdl = NULL;
+	}
+
+	if (m_pSystemView != NULL)
+	{
+		MmUnmapViewInSystemSpace(m_pSystemView);
+		m_pSystemView = NULL;
+	}
+
+	if (m_pSection != NULL)
+	{
+		ObDereferenceObject(m_pSection);
+		m_pSection = NULL;
+	}
+
+	// Views mapped into processes keep the section alive until they are unmapped.
+	if (m_hSection != NULL)
+	{
+		ZwClose(m_hSection);
+		m_hSection = NULL;
+	}
+}
+
+#pragma code_seg("PAGE")
+NTSTATUS SharedSection::Init(SIZE_T size)
+{
+	OBJECT_ATTRIBUTES   objectAttributes;
+	LARGE_INTEGER       maximumSize;
+	SIZE_T              viewSize;
+	NTSTATUS            ntStatus;
+
+	PAGED_CODE();
+
+	m_ViewSize = ROUND_TO_PAGES(size);
+
+	InitializeObjectAttributes(&objectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+	maximumSize.QuadPart = m_ViewSize;
+
+	ntStatus = ZwCreateSection(&m_hSection, SECTION_ALL_ACCESS, &objectAttributes, &maximumSize, PAGE_READWRITE, SEC_COMMIT, NULL);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		m_hSection = NULL;
+		return ntStatus;
+	}
+
+	ntStatus = ObReferenceObjectByHandle(m_hSection, SECTION_MAP_READ | SECTION_MAP_WRITE, NULL, KernelMode, &m_pSection, NULL);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		m_pSection = NULL;
+		return ntStatus;
+	}
+
+	viewSize = m_ViewSize;
+	ntStatus = MmMapViewInSystemSpace(m_pSection, &m_pSystemView, &viewSize);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		m_pSystemView = NULL;
+		return ntStatus;
+	}
+
+	// The section is pageable, the DPC accesses it only through locked pages.
+	m_pMdl = IoAllocateMdl(m_pSystemView, (ULONG)m_ViewSize, FALSE, FALSE, NULL);
+	if (m_pMdl == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	__try
+	{
+		MmProbeAndLockPages(m_pMdl, KernelMode, IoWriteAccess);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		IoFreeMdl(m_pMdl);
+		m_pMdl = NULL;
+		return GetExceptionCode();
+	}
+
+	RtlZeroMemory(m_pSystemView, m_ViewSize);
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg("PAGE")
+NTSTATUS SharedSection::MapIntoCurrentProcess(ULONG protect, ULONG version, PAUDIOMIRROR_TAP_MAPPING mapping)
+{
+	PVOID       baseAddress = NULL;
+	SIZE_T      viewSize = 0;
+	NTSTATUS    ntStatus;
+
+	PAGED_CODE();
+
+	ntStatus = ZwMapViewOfSection(m_hSection, ZwCurrentProcess(), &baseAddress, 0, 0, NULL, &viewSize, ViewUnmap, 0, protect);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	mapping->Size = sizeof(AUDIOMIRROR_TAP_MAPPING);
+	mapping->Version = version;
+	mapping->ViewAddress = (ULONGLONG)(ULONG_PTR)baseAddress;
+	mapping->ViewSize = viewSize;
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+NTSTATUS SharedSection::RegisterEvent(HANDLE eventHandle, BOOL registerEvent)
+/*++
+
+Routine Description:
+
+  Called at PASSIVE_LEVEL. Not paged, the event list is updated under the
+  spin lock the DPC takes.
+
+--*/
+{
+	PKEVENT     pEvent = NULL;
+	PKEVENT     pReleased[2] = { NULL, NULL };
+	KIRQL       oldIrql;
+	ULONG       index;
+	NTSTATUS    ntStatus;
+
+	ntStatus = ObReferenceObjectByHandle(eventHandle, EVENT_MODIFY_STATE, *ExEventObjectType, UserMode, (PVOID*)&pEvent, NULL);
+	if (!NT_SUCCESS(ntStatus))
+	{
+		return ntStatus;
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+
+	for (index = 0; index < m_ulEventCount; ++index)
+	{
+		if (m_Events[index] == pEvent)
+		{
+			break;
+		}
+	}
+
+	if (registerEvent)
+	{
+		if (index < m_ulEventCount)
+		{
+			// Already registered, keep the reference we hold.
+			pReleased[0] = pEvent;
+		}
+		else
+		{
+			// Processes that exited without removing their event give way to new ones.
+			if (m_ulEventCount == AUDIOMIRROR_TAP_MAX_EVENTS)
+			{
+				pReleased[0] = m_Events[0];
+				RtlMoveMemory(&m_Events[0], &m_Events[1], (AUDIOMIRROR_TAP_MAX_EVENTS - 1) * sizeof(PKEVENT));
+				m_ulEventCount--;
+			}
+			m_Events[m_ulEventCount++] = pEvent;
+		}
+	}
+	else
+	{
+		pReleased[0] = pEvent;
+		if (index < m_ulEventCount)
+		{
+			pReleased[1] = m_Events[index];
+			RtlMoveMemory(&m_Events[index], &m_Events[index + 1], (m_ulEventCount - index - 1) * sizeof(PKEVENT));
+			m_Events[--m_ulEventCount] = NULL;
+		}
+	}
+
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+
+	for (ULONG i = 0; i < ARRAYSIZE(pReleased); ++i)
+	{
+		if (pReleased[i] != NULL)
+		{
+			ObDereferenceObject(pReleased[i]);
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
+VOID SharedSection::SignalEvents()
+{
+	KeAcquireSpinLockAtDpcLevel(&m_Lock);
+	for (ULONG i = 0; i < m_ulEventCount; ++i)
+	{
+		KeSetEvent(m_Events[i], IO_NO_INCREMENT, FALSE);
+	}
+	KeReleaseSpinLockFromDpcLevel(&m_Lock);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "Globals.h"
+#include "AudioMirrorProperties.h"
+
+/*
+	Pagefile backed section the driver shares with user mode processes, plus
+	the events it sets for them.
+
+	The driver accesses the section through a system view whose pages stay
+	locked, so it can be touched from a DPC. Processes get their own views
+	mapped by MapIntoCurrentProcess, which the memory manager tears down with
+	the process. The section lives until the last view is gone.
+*/
+class SharedSection
+{
+private:
+	KSPIN_LOCK      m_Lock;     // Guards the event list.
+	HANDLE          m_hSection;
+	PVOID           m_pSection;
+	PVOID           m_pSystemView;
+	PMDL            m_pMdl;
+	SIZE_T          m_ViewSize;
+	PKEVENT         m_Events[AUDIOMIRROR_TAP_MAX_EVENTS];
+	ULONG           m_ulEventCount;
+public:
+	SharedSection();
+	~SharedSection();
+
+	/*
+		Creates the section and the locked, zeroed system view.
+	*/
+	NTSTATUS Init(_In_ SIZE_T size);
+
+	PVOID GetSystemAddress()
+	{
+		return m_pSystemView;
+	}
+
+	/*
+		Maps a view with the given page protection into the current process.
+		Must be called in the context of the process the view is for.
+	*/
+	NTSTATUS MapIntoCurrentProcess(_In_ ULONG protect, _In_ ULONG version, _Out_ PAUDIOMIRROR_TAP_MAPPING mapping);
+
+	/*
+		Registers or removes an event handle of the current process. Beyond
+		AUDIOMIRROR_TAP_MAX_EVENTS the oldest registration is dropped.
+	*/
+	NTSTATUS RegisterEvent(_In_ HANDLE eventHandle, _In_ BOOL registerEvent);
+
+	/*
+		Sets all registered events. Called at DISPATCH_LEVEL.
+	*/
+	VOID SignalEvents();
+};
@@ -2,6 +2,7 @@
 
 #include "Globals.h"
 #include "MiniportTopology.h"
+#include "KsAudioProcessingAttribute.h"
 
 enum class TopologyRenderPins
 {
@@ -9,11 +10,81 @@ enum class TopologyRenderPins
 	LINEOUT_DEST,
 };
 
+static
+PCPROPERTY_ITEM PropertiesSpeakerTopoVolume[] =
+{
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_VOLUMELEVEL,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportTopology::PropertyHandler_TopologyNode
+	}
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpeakerTopoVolume, PropertiesSpeakerTopoVolume);
+
+static
+PCPROPERTY_ITEM PropertiesSpeakerTopoMute[] =
+{
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_MUTE,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportTopology::PropertyHandler_TopologyNode
+	}
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpeakerTopoMute, PropertiesSpeakerTopoMute);
+
+static
+PCPROPERTY_ITEM PropertiesSpeakerTopoPeakMeter[] =
+{
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_PEAKMETER2,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportTopology::PropertyHandler_TopologyNode
+	}
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpeakerTopoPeakMeter, PropertiesSpeakerTopoPeakMeter);
+
+// The engine applies no volume of its own, the volume and mute nodes are
+// applied by the mixer while it writes into the cable.
+static
+PCNODE_DESCRIPTOR SpeakerTopologyNodes[] =
+{
+	// TopologyNodes::VOLUME
+	{
+		0,                                  // Flags
+		&AutomationSpeakerTopoVolume,       // AutomationTable
+		&KSNODETYPE_VOLUME,                 // Type
+		&KSAUDFNAME_MASTER_VOLUME           // Name
+	},
+	// TopologyNodes::MUTE
+	{
+		0,                                  // Flags
+		&AutomationSpeakerTopoMute,         // AutomationTable
+		&KSNODETYPE_MUTE,                   // Type
+		&KSAUDFNAME_MASTER_MUTE             // Name
+	},
+	// TopologyNodes::PEAKMETER
+	{
+		0,                                  // Flags
+		&AutomationSpeakerTopoPeakMeter,    // AutomationTable
+		&KSNODETYPE_PEAKMETER,              // Type
+		&KSAUDFNAME_PEAKMETER               // Name
+	}
+};
+
 static
 PCCONNECTION_DESCRIPTOR SpeakerTopoMiniportConnections[] =
 {
-	//  FromNode,       FromPin,									ToNode,         ToPin
-	{   PCFILTER_NODE,	(int)TopologyRenderPins::WAVEOUT_SINK,    PCFILTER_NODE,  (int)TopologyRenderPins::LINEOUT_DEST}
+	//  FromNode,							FromPin,								ToNode,								ToPin
+	{   PCFILTER_NODE,						(int)TopologyRenderPins::WAVEOUT_SINK,	(int)TopologyNodes::VOLUME,			KSNODEPIN_STANDARD_IN },
+	{   (int)TopologyNodes::VOLUME,			KSNODEPIN_STANDARD_OUT,					(int)TopologyNodes::MUTE,			KSNODEPIN_STANDARD_IN },
+	{   (int)TopologyNodes::MUTE,			KSNODEPIN_STANDARD_OUT,					(int)TopologyNodes::PEAKMETER,		KSNODEPIN_STANDARD_IN },
+	{   (int)TopologyNodes::PEAKMETER,		KSNODEPIN_STANDARD_OUT,					PCFILTER_NODE,						(int)TopologyRenderPins::LINEOUT_DEST }
 };
 
 static
@@ -98,8 +169,8 @@ static PCFILTER_DESCRIPTOR SpeakerTopoMiniportFilterDescriptor =
   SIZEOF_ARRAY(SpeakerTopoMiniportPins),        // PinCount
   SpeakerTopoMiniportPins,                      // Pins
   sizeof(PCNODE_DESCRIPTOR),                    // NodeSize
-  0,                                            // NodeCount
-  NULL,                                         // Nodes
+  SIZEOF_ARRAY(SpeakerTopologyNodes),           // NodeCount
+  SpeakerTopologyNodes,                         // Nodes
   SIZEOF_ARRAY(SpeakerTopoMiniportConnections), // ConnectionCount
   SpeakerTopoMiniportConnections,               // Connections
   0,                                            // CategoryCount
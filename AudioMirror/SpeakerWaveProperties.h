@@ -4,8 +4,8 @@
 
 #define SPEAKER_DEVICE_MAX_CHANNELS               2       // Max Channels.
 
-#define SPEAKER_MAX_INPUT_SYSTEM_STREAMS            1
-#define SPEAKER_MAX_INPUT_OFFLOAD_STREAMS           0
+#define SPEAKER_MAX_INPUT_SYSTEM_STREAMS            3       // One per mode: RAW, DEFAULT, COMMUNICATIONS.
+#define SPEAKER_MAX_INPUT_OFFLOAD_STREAMS           3
 #define SPEAKER_MAX_OUTPUT_LOOPBACK_STREAMS         MAX_OUTPUT_LOOPBACK_STREAMS
 
 #define SPEAKER_HOST_MAX_CHANNELS                   2       // Max Channels.
@@ -52,13 +52,65 @@ KSDATAFORMAT_WAVEFORMATEXTENSIBLE SpeakerHostPinSupportedDeviceFormats[] =
 
 static
 MODE_AND_DEFAULT_FORMAT SpeakerHostPinSupportedDeviceModes[] =
+{
+	{
+		STATIC_AUDIO_SIGNALPROCESSINGMODE_RAW,
+		&SpeakerHostPinSupportedDeviceFormats[0].DataFormat
+	},
+	{
+		STATIC_AUDIO_SIGNALPROCESSINGMODE_DEFAULT,
+		&SpeakerHostPinSupportedDeviceFormats[0].DataFormat
+	},
+	{
+		STATIC_AUDIO_SIGNALPROCESSINGMODE_COMMUNICATIONS,
+		&SpeakerHostPinSupportedDeviceFormats[0].DataFormat
+	},
+};
+
+static
+KSDATAFORMAT_WAVEFORMATEXTENSIBLE SpeakerOffloadPinSupportedDeviceFormats[] =
+{
+	{
+		{
+			sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE),
+			0,
+			0,
+			0,
+			STATICGUIDOF(KSDATAFORMAT_TYPE_AUDIO),
+			STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM),
+			STATICGUIDOF(KSDATAFORMAT_SPECIFIER_WAVEFORMATEX)
+		},
+		{
+			{
+				WAVE_FORMAT_EXTENSIBLE,
+				2,
+				44100,
+				176400,
+				4,
+				16,
+				sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)
+			},
+			16,
+			KSAUDIO_SPEAKER_STEREO,
+			STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM)
+		}
+	},
+};
+
+static
+MODE_AND_DEFAULT_FORMAT SpeakerOffloadPinSupportedDeviceModes[] =
 {
 	{
 		STATIC_AUDIO_SIGNALPROCESSINGMODE_DEFAULT,
-		&SpeakerHostPinSupportedDeviceFormats[0].DataFormat // 48KHz
+		&SpeakerOffloadPinSupportedDeviceFormats[0].DataFormat
 	},
 };
 
+//
+// The entries here must follow the same order as the filter's pin
+// descriptor array. The last entry holds the device formats of the audio
+// engine node, which the offload mixer runs at.
+//
 static PIN_DEVICE_FORMATS_AND_MODES SpeakerPinDeviceFormatsAndModes[] =
 {
 	{
@@ -75,6 +127,27 @@ static PIN_DEVICE_FORMATS_AND_MODES SpeakerPinDeviceFormatsAndModes[] =
 		NULL,
 		0
 	},
+	{
+		PinType::RenderLoopbackPin,
+		SpeakerHostPinSupportedDeviceFormats,
+		SIZEOF_ARRAY(SpeakerHostPinSupportedDeviceFormats),
+		NULL,
+		0
+	},
+	{
+		PinType::OffloadRenderPin,
+		SpeakerOffloadPinSupportedDeviceFormats,
+		SIZEOF_ARRAY(SpeakerOffloadPinSupportedDeviceFormats),
+		SpeakerOffloadPinSupportedDeviceModes,
+		SIZEOF_ARRAY(SpeakerOffloadPinSupportedDeviceModes)
+	},
+	{
+		PinType::NoPin,
+		SpeakerHostPinSupportedDeviceFormats,
+		SIZEOF_ARRAY(SpeakerHostPinSupportedDeviceFormats),
+		NULL,
+		0
+	},
 };
 
 static KSDATARANGE_AUDIO SpeakerPinDataRangesStream[] =
@@ -104,6 +177,59 @@ PKSDATARANGE SpeakerPinDataRangePointersStream[] =
 	PKSDATARANGE(&PinDataRangeAttributeList),
 };
 
+static KSDATARANGE_AUDIO SpeakerPinDataRangesOffloadStream[] =
+{
+	{
+		{
+			sizeof(KSDATARANGE_AUDIO),
+			KSDATARANGE_ATTRIBUTES,         // An attributes list follows this data range
+			0,
+			0,
+			STATICGUIDOF(KSDATAFORMAT_TYPE_AUDIO),
+			STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM),
+			STATICGUIDOF(KSDATAFORMAT_SPECIFIER_WAVEFORMATEX)
+		},
+		SPEAKER_OFFLOAD_MAX_CHANNELS,
+		SPEAKER_OFFLOAD_MIN_BITS_PER_SAMPLE,
+		SPEAKER_OFFLOAD_MAX_BITS_PER_SAMPLE,
+		SPEAKER_OFFLOAD_MIN_SAMPLE_RATE,
+		SPEAKER_OFFLOAD_MAX_SAMPLE_RATE
+	},
+};
+
+static
+PKSDATARANGE SpeakerPinDataRangePointersOffloadStream[] =
+{
+	PKSDATARANGE(&SpeakerPinDataRangesOffloadStream[0]),
+	PKSDATARANGE(&PinDataRangeAttributeList),
+};
+
+static KSDATARANGE_AUDIO SpeakerPinDataRangesLoopbackStream[] =
+{
+	{
+		{
+			sizeof(KSDATARANGE_AUDIO),
+			0,
+			0,
+			0,
+			STATICGUIDOF(KSDATAFORMAT_TYPE_AUDIO),
+			STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM),
+			STATICGUIDOF(KSDATAFORMAT_SPECIFIER_WAVEFORMATEX)
+		},
+		SPEAKER_HOST_MAX_CHANNELS,
+		SPEAKER_HOST_MIN_BITS_PER_SAMPLE,
+		SPEAKER_HOST_MAX_BITS_PER_SAMPLE,
+		SPEAKER_HOST_MIN_SAMPLE_RATE,
+		SPEAKER_HOST_MAX_SAMPLE_RATE
+	},
+};
+
+static
+PKSDATARANGE SpeakerPinDataRangePointersLoopbackStream[] =
+{
+	PKSDATARANGE(&SpeakerPinDataRangesLoopbackStream[0]),
+};
+
 static
 KSDATARANGE SpeakerPinDataRangesBridge[] =
 {
@@ -166,6 +292,139 @@ static PCPIN_DESCRIPTOR SpeakerWaveMiniportPins[] =
 			0
 		}
 	},
+	// Wave Out Loopback Pin KSPIN_WAVE_RENDER_SINK_LOOPBACK
+	{
+		SPEAKER_MAX_OUTPUT_LOOPBACK_STREAMS,
+		SPEAKER_MAX_OUTPUT_LOOPBACK_STREAMS,
+		0,
+		NULL,
+		{
+			0,
+			NULL,
+			0,
+			NULL,
+			SIZEOF_ARRAY(SpeakerPinDataRangePointersLoopbackStream),
+			SpeakerPinDataRangePointersLoopbackStream,
+			KSPIN_DATAFLOW_OUT,
+			KSPIN_COMMUNICATION_SINK,
+			&KSNODETYPE_AUDIO_LOOPBACK,
+			NULL,
+			0
+		}
+	},
+	// Wave Out Offload Pin (Renderer) KSPIN_WAVE_RENDER_SINK_OFFLOAD
+	{
+		SPEAKER_MAX_INPUT_OFFLOAD_STREAMS,
+		SPEAKER_MAX_INPUT_OFFLOAD_STREAMS,
+		0,
+		NULL,
+		{
+			0,
+			NULL,
+			0,
+			NULL,
+			SIZEOF_ARRAY(SpeakerPinDataRangePointersOffloadStream),
+			SpeakerPinDataRangePointersOffloadStream,
+			KSPIN_DATAFLOW_IN,
+			KSPIN_COMMUNICATION_SINK,
+			&KSNODETYPE_SPEAKER,
+			NULL,
+			0
+		}
+	},
+};
+
+//
+// Properties of the audio engine node. The stream level ones (LFX, stream
+// volume, loopback protection) are routed by PortCls to the stream's
+// IMiniportStreamAudioEngineNode, the rest land in the filter handler.
+//
+static PCPROPERTY_ITEM PropertiesSpeakerAudioEngine[] =
+{
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_LFXENABLE,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_GFXENABLE,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_MIXFORMAT,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_DEVICEFORMAT,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_SUPPORTEDDEVICEFORMATS,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_DESCRIPTOR,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_BUFFER_SIZE_RANGE,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_LOOPBACK_PROTECTION,
+		KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioEngine,
+		KSPROPERTY_AUDIOENGINE_VOLUMELEVEL,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_VOLUMELEVEL,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_MUTE,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_Audio,
+		KSPROPERTY_AUDIO_PEAKMETER2,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+};
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpeakerAudioEngine, PropertiesSpeakerAudioEngine);
+
+static PCNODE_DESCRIPTOR SpeakerWaveMiniportNodes[] =
+{
+	// KSNODE_WAVE_AUDIO_ENGINE
+	{
+		0,                              // Flags
+		&AutomationSpeakerAudioEngine,  // AutomationTable
+		&KSNODETYPE_AUDIO_ENGINE,       // Type
+		NULL                            // Name
+	}
 };
 
 static PCPROPERTY_ITEM PropertiesSpeakerWaveFilter[] =
@@ -182,21 +441,55 @@ static PCPROPERTY_ITEM PropertiesSpeakerWaveFilter[] =
 		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
 		MiniportWaveRT::PropertyHandler_WaveFilter
 	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_STREAM_STATISTICS,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_TAP,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_TAP_EVENT,
+		KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_SCHEDULER,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
+	{
+		&KSPROPSETID_AudioMirror,
+		KSPROPERTY_AUDIOMIRROR_WORKER_THREADS,
+		KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
+		MiniportWaveRT::PropertyHandler_WaveFilter
+	},
 };
 DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpeakerWaveFilter, PropertiesSpeakerWaveFilter);
 
 //=============================================================================
 //
 //                   ----------------------------      
-//                   |                          |      
-//  System Pin   0-->|                          |
-//                   |      				    |      
-//  |											|--> 1 KSPIN_WAVE_RENDER_SOURCE
+//                   |      Audio Engine        |      
+//  System Pin   0-->|1                         |
+//                   |                         0|--> 1 KSPIN_WAVE_RENDER_SOURCE
+//  Offload Pin  3-->|2                         |      
+//                   |                         3|--> 2 KSPIN_WAVE_RENDER_SINK_LOOPBACK
 //                   |                          |      
 //                   ----------------------------       
 static PCCONNECTION_DESCRIPTOR SpeakerWaveMiniportConnections[] =
 {
-	{ PCFILTER_NODE,						(int)WaveRenderPins::SINK_SYSTEM,   PCFILTER_NODE,						(int)WaveRenderPins::SOURCE },
+	{ PCFILTER_NODE,							(int)WaveRenderPins::SINK_SYSTEM,			(int)WaveSpeakerNodes::AUDIO_ENGINE,	(int)AudioEngineNodePins::HOST },
+	{ PCFILTER_NODE,							(int)WaveRenderPins::SINK_OFFLOAD,			(int)WaveSpeakerNodes::AUDIO_ENGINE,	(int)AudioEngineNodePins::OFFLOAD },
+	{ (int)WaveSpeakerNodes::AUDIO_ENGINE,		(int)AudioEngineNodePins::LOOPBACK,			PCFILTER_NODE,							(int)WaveRenderPins::SINK_LOOPBACK },
+	{ (int)WaveSpeakerNodes::AUDIO_ENGINE,		(int)AudioEngineNodePins::SOURCE,			PCFILTER_NODE,							(int)WaveRenderPins::SOURCE },
 };
 
 static PCFILTER_DESCRIPTOR SpeakerWaveMiniportFilterDescriptor =
@@ -207,8 +500,8 @@ static PCFILTER_DESCRIPTOR SpeakerWaveMiniportFilterDescriptor =
 	SIZEOF_ARRAY(SpeakerWaveMiniportPins),          // PinCount
 	SpeakerWaveMiniportPins,                        // Pins
 	sizeof(PCNODE_DESCRIPTOR),                      // NodeSize
-	0,												// NodeCount
-	NULL,											// Nodes
+	SIZEOF_ARRAY(SpeakerWaveMiniportNodes),         // NodeCount
+	SpeakerWaveMiniportNodes,                       // Nodes
 	SIZEOF_ARRAY(SpeakerWaveMiniportConnections),   // ConnectionCount
 	SpeakerWaveMiniportConnections,                 // Connections
 	0,                                              // CategoryCount
@@ -0,0 +1,263 @@
+#include "StreamStatistics.h"
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+#pragma code_seg()
+static void InterlockedStoreMin(volatile LONG* target, LONG value)
+{
+	LONG current = *target;
+	while (value < current)
+	{
+		LONG previous = InterlockedCompareExchange(target, value, current);
+		if (previous == current)
+		{
+			break;
+		}
+		current = previous;
+	}
+}
+
+#pragma code_seg()
+static void InterlockedStoreMax(volatile LONG* target, LONG value)
+{
+	LONG current = *target;
+	while (value > current)
+	{
+		LONG previous = InterlockedCompareExchange(target, value, current);
+		if (previous == current)
+		{
+			break;
+		}
+		current = previous;
+	}
+}
+
+//=============================================================================
+// TimingHistogram
+//=============================================================================
+
+#pragma code_seg()
+void TimingHistogram::Reset()
+{
+	for (ULONG i = 0; i < AUDIOMIRROR_TIMING_HISTOGRAM_BUCKETS; i++)
+	{
+		InterlockedExchange64(&m_Buckets[i], 0);
+	}
+	InterlockedExchange(&m_MaxUs, 0);
+}
+
+#pragma code_seg()
+void TimingHistogram::Record(ULONG us)
+{
+	ULONG bucket = 0;
+	ULONG highestBit;
+
+	if (_BitScanReverse(&highestBit, us))
+	{
+		bucket = min(highestBit + 1, AUDIOMIRROR_TIMING_HISTOGRAM_BUCKETS - 1);
+	}
+
+	InterlockedIncrement64(&m_Buckets[bucket]);
+	InterlockedStoreMax(&m_MaxUs, (LONG)min(us, (ULONG)MAXLONG));
+}
+
+#pragma code_seg()
+ULONG TimingHistogram::GetPercentileUs(ULONGLONG total, ULONG percent)
+{
+	// Smallest sample count that covers the requested percentile.
+	ULONGLONG target = (total * percent + 99) / 100;
+	ULONGLONG cumulative = 0;
+
+	for (ULONG i = 0; i < AUDIOMIRROR_TIMING_HISTOGRAM_BUCKETS; i++)
+	{
+		cumulative += m_Buckets[i];
+		if (cumulative >= target)
+		{
+			return 1UL << i;
+		}
+	}
+
+	return 1UL << (AUDIOMIRROR_TIMING_HISTOGRAM_BUCKETS - 1);
+}
+
+#pragma code_seg()
+void TimingHistogram::Summarize(PAUDIOMIRROR_TIMING_SUMMARY summary)
+{
+	ULONGLONG total = 0;
+
+	for (ULONG i = 0; i < AUDIOMIRROR_TIMING_HISTOGRAM_BUCKETS; i++)
+	{
+		total += m_Buckets[i];
+	}
+
+	RtlZeroMemory(summary, sizeof(*summary));
+	summary->SampleCount = total;
+	summary->MaxUs = (ULONG)m_MaxUs;
+	if (total == 0)
+	{
+		return;
+	}
+
+	summary->P50Us = GetPercentileUs(total, 50);
+	summary->P90Us = GetPercentileUs(total, 90);
+	summary->P99Us = GetPercentileUs(total, 99);
+}
+
+//=============================================================================
+// StreamStatistics
+//=============================================================================
+
+#pragma code_seg()
+void StreamStatistics::Reset()
+{
+	ResetRingFill();
+	InterlockedExchange64(&m_Overruns, 0);
+	InterlockedExchange64(&m_OverrunBytes, 0);
+	InterlockedExchange64(&m_Underruns, 0);
+	InterlockedExchange64(&m_ZeroFilledBytes, 0);
+	InterlockedExchange64(&m_DroppedPackets, 0);
+	InterlockedExchange64(&m_TimerTicks, 0);
+	InterlockedExchange64(&m_IdleTimerTicks, 0);
+	InterlockedExchange64(&m_PositionQueries, 0);
+	InterlockedExchange64(&m_PositionQueryTimeNs, 0);
+	InterlockedExchange64(&m_ClockLockFallbacks, 0);
+	InterlockedExchange64(&m_WorkerBlocks, 0);
+	InterlockedExchange64(&m_WorkerMisses, 0);
+	InterlockedExchange64(&m_WorkerLateBlocks, 0);
+	InterlockedExchange64(&m_WorkerFallbackBytes, 0);
+	StartRun(0);
+	m_DpcTime.Reset();
+	m_TimerLateness.Reset();
+	m_WorkerTime.Reset();
+	m_WorkerDelay.Reset();
+}
+
+#pragma code_seg()
+void StreamStatistics::ResetRingFill()
+{
+	LONG current = m_RingFillCurrent;
+	InterlockedExchange(&m_RingFillMin, current);
+	InterlockedExchange(&m_RingFillMax, current);
+}
+
+#pragma code_seg()
+void StreamStatistics::StartRun(ULONG prerollBytes)
+{
+	InterlockedExchange(&m_FirstAudioUs, (LONG)AUDIOMIRROR_NO_FIRST_AUDIO);
+	InterlockedExchange(&m_PrerollBytes, (LONG)prerollBytes);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordRingFill(ULONG fillBytes)
+{
+	LONG fill = (LONG)min(fillBytes, (ULONG)MAXLONG);
+
+	InterlockedExchange(&m_RingFillCurrent, fill);
+	InterlockedStoreMin(&m_RingFillMin, fill);
+	InterlockedStoreMax(&m_RingFillMax, fill);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordOverrun(ULONG lostBytes)
+{
+	InterlockedIncrement64(&m_Overruns);
+	InterlockedAdd64(&m_OverrunBytes, lostBytes);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordZeroFill(ULONG zeroFilledBytes, BOOL startOfUnderrun)
+{
+	if (startOfUnderrun)
+	{
+		InterlockedIncrement64(&m_Underruns);
+	}
+	InterlockedAdd64(&m_ZeroFilledBytes, zeroFilledBytes);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordDroppedPackets(ULONG count)
+{
+	InterlockedAdd64(&m_DroppedPackets, count);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordTimerTick(ULONG dpcTimeUs, ULONG latenessUs, BOOLEAN idle)
+{
+	InterlockedIncrement64(&m_TimerTicks);
+	if (idle)
+	{
+		InterlockedIncrement64(&m_IdleTimerTicks);
+	}
+	m_DpcTime.Record(dpcTimeUs);
+	m_TimerLateness.Record(latenessUs);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordPositionQuery(ULONG timeNs)
+{
+	InterlockedIncrement64(&m_PositionQueries);
+	InterlockedAdd64(&m_PositionQueryTimeNs, timeNs);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordClockLockFallback()
+{
+	InterlockedIncrement64(&m_ClockLockFallbacks);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordWorkerBlock(ULONG delayUs, ULONG timeUs)
+{
+	InterlockedIncrement64(&m_WorkerBlocks);
+	m_WorkerDelay.Record(delayUs);
+	m_WorkerTime.Record(timeUs);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordWorkerMiss(ULONG fallbackBytes)
+{
+	InterlockedIncrement64(&m_WorkerMisses);
+	InterlockedAdd64(&m_WorkerFallbackBytes, fallbackBytes);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordWorkerLate()
+{
+	InterlockedIncrement64(&m_WorkerLateBlocks);
+}
+
+#pragma code_seg()
+void StreamStatistics::RecordFirstAudio(ULONG us)
+{
+	InterlockedExchange(&m_FirstAudioUs, (LONG)min(us, AUDIOMIRROR_NO_FIRST_AUDIO - 1));
+}
+
+#pragma code_seg()
+void StreamStatistics::Snapshot(PAUDIOMIRROR_STREAM_STATISTICS statistics)
+{
+	statistics->RingFillCurrent = (ULONG)m_RingFillCurrent;
+	statistics->RingFillMin = (ULONG)m_RingFillMin;
+	statistics->RingFillMax = (ULONG)m_RingFillMax;
+	statistics->Overruns = (ULONGLONG)m_Overruns;
+	statistics->OverrunBytes = (ULONGLONG)m_OverrunBytes;
+	statistics->Underruns = (ULONGLONG)m_Underruns;
+	statistics->ZeroFilledBytes = (ULONGLONG)m_ZeroFilledBytes;
+	statistics->DroppedPackets = (ULONGLONG)m_DroppedPackets;
+	statistics->TimerTicks = (ULONGLONG)m_TimerTicks;
+	statistics->IdleTimerTicks = (ULONGLONG)m_IdleTimerTicks;
+	m_DpcTime.Summarize(&statistics->DpcTime);
+	m_TimerLateness.Summarize(&statistics->TimerLateness);
+	statistics->PositionQueries = (ULONGLONG)m_PositionQueries;
+	statistics->PositionQueryTimeNs = (ULONGLONG)m_PositionQueryTimeNs;
+	statistics->ClockLockFallbacks = (ULONGLONG)m_ClockLockFallbacks;
+	statistics->WorkerBlocks = (ULONGLONG)m_WorkerBlocks;
+	statistics->WorkerMisses = (ULONGLONG)m_WorkerMisses;
+	statistics->WorkerLateBlocks = (ULONGLONG)m_WorkerLateBlocks;
+	statistics->WorkerFallbackBytes = (ULONGLONG)m_WorkerFallbackBytes;
+	m_WorkerTime.Summarize(&statistics->WorkerTime);
+	m_WorkerDelay.Summarize(&statistics->WorkerDelay);
+	statistics->FirstAudioUs = (ULONG)m_FirstAudioUs;
+	statistics->PrerollBytes = (ULONG)m_PrerollBytes;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "Globals.h"
+#include "AudioMirrorProperties.h"
+
+/*
+	Power of two histogram of a timing value in microseconds. Recording is a
+	single interlocked increment so it can be used from any DPC without a lock.
+*/
+class TimingHistogram
+{
+private:
+	volatile LONG64 m_Buckets[AUDIOMIRROR_TIMING_HISTOGRAM_BUCKETS];
+	volatile LONG m_MaxUs;
+
+	ULONG GetPercentileUs(ULONGLONG total, ULONG percent);
+public:
+	void Reset();
+	void Record(ULONG us);
+	void Summarize(_Out_ PAUDIOMIRROR_TIMING_SUMMARY summary);
+};
+
+/*
+	Streaming counters of a single wave stream. All Record* functions may be
+	called at DISPATCH_LEVEL from the timer callbacks of either stream of a
+	pair, so every counter is updated with interlocked operations.
+*/
+class StreamStatistics
+{
+private:
+	volatile LONG m_RingFillCurrent;
+	volatile LONG m_RingFillMin;
+	volatile LONG m_RingFillMax;
+
+	volatile LONG64 m_Overruns;
+	volatile LONG64 m_OverrunBytes;
+	volatile LONG64 m_Underruns;
+	volatile LONG64 m_ZeroFilledBytes;
+	volatile LONG64 m_DroppedPackets;
+	volatile LONG64 m_TimerTicks;
+	volatile LONG64 m_IdleTimerTicks;
+	volatile LONG64 m_PositionQueries;
+	volatile LONG64 m_PositionQueryTimeNs;
+	volatile LONG64 m_ClockLockFallbacks;
+	volatile LONG64 m_WorkerBlocks;
+	volatile LONG64 m_WorkerMisses;
+	volatile LONG64 m_WorkerLateBlocks;
+	volatile LONG64 m_WorkerFallbackBytes;
+	volatile LONG m_FirstAudioUs;
+	volatile LONG m_PrerollBytes;
+
+	TimingHistogram m_DpcTime;
+	TimingHistogram m_TimerLateness;
+	TimingHistogram m_WorkerTime;
+	TimingHistogram m_WorkerDelay;
+public:
+	void Reset();
+	void ResetRingFill();
+	void StartRun(_In_ ULONG prerollBytes);
+
+	void RecordRingFill(_In_ ULONG fillBytes);
+	void RecordOverrun(_In_ ULONG lostBytes);
+	void RecordZeroFill(_In_ ULONG zeroFilledBytes, _In_ BOOL startOfUnderrun);
+	void RecordDroppedPackets(_In_ ULONG count);
+	void RecordTimerTick(_In_ ULONG dpcTimeUs, _In_ ULONG latenessUs, _In_ BOOLEAN idle);
+	void RecordPositionQuery(_In_ ULONG timeNs);
+	void RecordClockLockFallback();
+	void RecordWorkerBlock(_In_ ULONG delayUs, _In_ ULONG timeUs);
+	void RecordWorkerMiss(_In_ ULONG fallbackBytes);
+	void RecordWorkerLate();
+	void RecordFirstAudio(_In_ ULONG us);
+
+	void Snapshot(_Out_ PAUDIOMIRROR_STREAM_STATISTICS statistics);
+};
@@ -0,0 +1,89 @@
+#include "VolumeRamp.h"
+
+#define HNS_PER_SECOND      10000000ULL
+
+#pragma code_seg()
+VOID VolumeRamp::Init(ULONG channels, ULONG samplesPerSec)
+{
+	KeInitializeSpinLock(&m_Lock);
+	m_ulChannels = min(channels, (ULONG)VOLUME_RAMP_MAX_CHANNELS);
+	m_ulSamplesPerSec = samplesPerSec;
+
+	for (ULONG c = 0; c < VOLUME_RAMP_MAX_CHANNELS; ++c)
+	{
+		m_Current[c] = VOLUME_RAMP_UNITY;
+		m_Target[c] = VOLUME_RAMP_UNITY;
+		m_Step[c] = 0;
+		m_Remaining[c] = 0;
+	}
+}
+
+#pragma code_seg()
+VOID VolumeRamp::SetTarget(ULONG channel, LONG level, AUDIO_CURVE_TYPE curveType, ULONGLONG duration)
+{
+	KIRQL oldIrql;
+	LONG target = EndpointGain::GainFromVolumeLevel(level) << VOLUME_RAMP_SHIFT;
+	ULONGLONG frames = 0;
+
+	if (channel >= m_ulChannels)
+	{
+		return;
+	}
+
+	if (curveType == AUDIO_CURVE_TYPE_WINDOWS_FADE)
+	{
+		frames = min(duration * m_ulSamplesPerSec / HNS_PER_SECOND, (ULONGLONG)MAXULONG);
+	}
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+	m_Target[channel] = target;
+	if (frames == 0)
+	{
+		m_Current[channel] = target;
+		m_Step[channel] = 0;
+		m_Remaining[channel] = 0;
+	}
+	else
+	{
+		// m_Current is where a running fade has got to, the new one starts there.
+		m_Step[channel] = (LONG)(((LONGLONG)target - m_Current[channel]) / (LONGLONG)frames);
+		m_Remaining[channel] = (ULONG)frames;
+	}
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+}
+
+#pragma code_seg()
+ULONG VolumeRamp::Next(ULONG frames, LONG* gains, LONG* steps)
+{
+	KIRQL oldIrql;
+	ULONG run = frames;
+
+	KeAcquireSpinLock(&m_Lock, &oldIrql);
+
+	// The segment ends where the first channel reaches its target, so the
+	// step stays constant for every channel within it.
+	for (ULONG c = 0; c < m_ulChannels; ++c)
+	{
+		if (m_Remaining[c] > 0)
+		{
+			run = min(run, m_Remaining[c]);
+		}
+	}
+
+	for (ULONG c = 0; c < VOLUME_RAMP_MAX_CHANNELS; ++c)
+	{
+		gains[c] = m_Current[c];
+		steps[c] = (m_Remaining[c] > 0) ? m_Step[c] : 0;
+
+		if (m_Remaining[c] > 0)
+		{
+			m_Remaining[c] -= run;
+			// Land exactly on the target, the truncated step would fall short.
+			m_Current[c] = (m_Remaining[c] > 0) ? (LONG)(m_Current[c] + (LONGLONG)m_Step[c] * run) : m_Target[c];
+		}
+	}
+
+	KeReleaseSpinLock(&m_Lock, oldIrql);
+
+	return run;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "Globals.h"
+#include "EndpointGain.h"
+
+#define VOLUME_RAMP_MAX_CHANNELS    ENDPOINT_GAIN_MAX_CHANNELS
+
+// Unity of the Q30 gains a ramp hands out. The extra fraction bits over the
+// Q16 endpoint gains keep long fades sample accurate.
+#define VOLUME_RAMP_UNITY           (1 << 30)
+#define VOLUME_RAMP_SHIFT           14
+
+/*
+	Stream volume of a render stream, faded over the curve the audio engine
+	requests in SetStreamChannelVolume.
+
+	A new target starts from the gain the ramp has reached, so a fade that
+	arrives mid curve continues from where the previous one was instead of
+	jumping. The ramp only moves when the mixer consumes frames, which keeps
+	it sample accurate on the stream's own timeline. Settings arrive at
+	PASSIVE_LEVEL while the timer DPC consumes them, so the state is guarded
+	by a spin lock.
+*/
+class VolumeRamp
+{
+private:
+	KSPIN_LOCK      m_Lock;
+	ULONG           m_ulChannels;
+	ULONG           m_ulSamplesPerSec;
+	LONG            m_Current[VOLUME_RAMP_MAX_CHANNELS];    // Gain of the next frame.
+	LONG            m_Target[VOLUME_RAMP_MAX_CHANNELS];
+	LONG            m_Step[VOLUME_RAMP_MAX_CHANNELS];       // Added per frame.
+	ULONG           m_Remaining[VOLUME_RAMP_MAX_CHANNELS];  // Frames left in the curve.
+public:
+	VOID Init(_In_ ULONG channels, _In_ ULONG samplesPerSec);
+
+	/*
+		Moves a channel to a KS volume level (1/65536 dB). AUDIO_CURVE_TYPE_NONE
+		applies it at the next frame, AUDIO_CURVE_TYPE_WINDOWS_FADE fades the
+		linear gain over duration (hns).
+	*/
+	VOID SetTarget(_In_ ULONG channel, _In_ LONG level, _In_ AUDIO_CURVE_TYPE curveType, _In_ ULONGLONG duration);
+
+	/*
+		Hands out the next segment of at most frames frames over which every
+		channel's gain changes by a constant step. gains receive the Q30 gain of
+		the first frame, steps the per frame increment. Returns the segment
+		length and moves the ramp past it.
+	*/
+	ULONG Next
+	(
+		_In_ ULONG frames,
+		_Out_writes_(VOLUME_RAMP_MAX_CHANNELS) LONG* gains,
+		_Out_writes_(VOLUME_RAMP_MAX_CHANNELS) LONG* steps
+	);
+};
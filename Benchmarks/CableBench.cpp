@@ -0,0 +1,785 @@
+/*
+	Microbenchmarks for the hot paths of the cable core.
+
+	Every benchmark reports the best nanoseconds per operation out of a few
+	runs. The results are printed as JSON and can be compared against a stored
+	baseline; a benchmark that got slower than the baseline by more than the
+	tolerance fails the run. To keep a baseline usable on other machines all
+	timings are also divided by a fixed calibration workload and the comparison
+	uses those normalised values.
+
+	CableBench [--filter text] [--runs n] [--min-ms n]
+	           [--baseline file [--tolerance x] [--update-baseline]]
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "CableStream.h"
+#include "SubdeviceCache.h"
+#include "FormatHelper.h"
+#include "CableSimd.h"
+
+struct BenchResult
+{
+	std::string Name;
+	double      NsPerOp;
+	double      Normalised;
+};
+
+struct BenchOptions
+{
+	std::string Filter;
+	ULONG       Runs = 7;
+	ULONG       MinMs = 20;
+	std::string Baseline;
+	double      Tolerance = 0.25;
+	bool        UpdateBaseline = false;
+};
+
+static BenchOptions          g_Options;
+static std::vector<BenchResult> g_Results;
+static double                g_CalibrationNs = 0;
+static volatile ULONGLONG    g_Sink;
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double ElapsedNs(BenchClock::time_point start, BenchClock::time_point end)
+{
+	return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+static bool Selected(const std::string& name)
+{
+	return g_Options.Filter.empty() || name.find(g_Options.Filter) != std::string::npos;
+}
+
+static void Report(const std::string& name, double nsPerOp)
+{
+	BenchResult result;
+
+	result.Name = name;
+	result.NsPerOp = nsPerOp;
+	result.Normalised = 0;
+	g_Results.push_back(result);
+	fprintf(stderr, "%-48s %12.1f ns/op\n", name.c_str(), nsPerOp);
+}
+
+/*
+	Runs op in batches sized so one batch takes at least --min-ms and returns
+	the best time per operation over --runs batches.
+*/
+template<typename Op>
+static double Measure(Op op)
+{
+	ULONGLONG batch = 1;
+	double best = 0;
+
+	for (;;)
+	{
+		BenchClock::time_point start = BenchClock::now();
+		for (ULONGLONG i = 0; i < batch; ++i)
+		{
+			op();
+		}
+		double elapsed = ElapsedNs(start, BenchClock::now());
+		if (elapsed >= g_Options.MinMs * 1e6 || batch >= (1ULL << 32))
+		{
+			break;
+		}
+		batch *= 2;
+	}
+
+	for (ULONG run = 0; run < g_Options.Runs; ++run)
+	{
+		BenchClock::time_point start = BenchClock::now();
+		for (ULONGLONG i = 0; i < batch; ++i)
+		{
+			op();
+		}
+		double perOp = ElapsedNs(start, BenchClock::now()) / (double)batch;
+		if (run == 0 || perOp < best)
+		{
+			best = perOp;
+		}
+	}
+	return best;
+}
+
+template<typename Op>
+static void Bench(const std::string& name, Op op)
+{
+	if (Selected(name))
+	{
+		Report(name, Measure(op));
+	}
+}
+
+//=============================================================================
+// Calibration
+//=============================================================================
+
+/*
+	A fixed mix of copying and integer work the other results are divided by.
+	It runs before and after the benchmarks and the faster of the two is kept,
+	so a clock ramping up at the start does not skew every ratio.
+*/
+static double MeasureCalibration()
+{
+	static BYTE source[4096];
+	static BYTE target[4096];
+	ULONG seed = 1;
+
+	for (BYTE& b : source)
+	{
+		seed = seed * 1103515245 + 12345;
+		b = (BYTE)(seed >> 16);
+	}
+	return Measure([&]()
+	{
+		ULONGLONG sum = 0;
+		memcpy(target, source, sizeof(target));
+		for (ULONG i = 0; i < sizeof(target); i += 8)
+		{
+			sum = sum * 31 + target[i];
+		}
+		g_Sink = sum;
+	});
+}
+
+static void NormaliseResults()
+{
+	double calibrationNs = MeasureCalibration();
+
+	if (g_CalibrationNs == 0 || calibrationNs < g_CalibrationNs)
+	{
+		g_CalibrationNs = calibrationNs;
+	}
+	fprintf(stderr, "%-48s %12.1f ns/op\n", "Calibration", g_CalibrationNs);
+	for (BenchResult& result : g_Results)
+	{
+		result.Normalised = result.NsPerOp / g_CalibrationNs;
+	}
+}
+
+//=============================================================================
+// RingBuffer
+//=============================================================================
+
+/*
+	Put followed by Take of the same chunk on a ring that is kept half full,
+	so every operation moves data in and out. With a ring that is a whole
+	number of chunks a run never splits at the end, the straddling variant
+	adds one frame to the ring so the wrap falls inside a chunk. The mirrored
+	variants run the same ring on double mapped storage, where no run splits
+	but the wrap lands on the page size rather than the ring size.
+*/
+static void BenchRingBuffer(SIZE_T chunk, BOOLEAN straddle, BOOLEAN mirrored)
+{
+	const SIZE_T frame = 4;
+	const SIZE_T ringSize = 4 * (std::max)(chunk, (SIZE_T)1764) + (straddle ? frame : 0);
+	std::string name = "RingBuffer.PutTake/" + std::to_string(chunk) + (straddle ? "/straddle" : "/aligned") + (mirrored ? "/mirrored" : "");
+
+	if (!Selected(name))
+	{
+		return;
+	}
+
+	RingBuffer ring;
+	std::vector<BYTE> source(chunk, 0x5A);
+	std::vector<BYTE> target(chunk);
+	std::vector<BYTE> preroll(ringSize / 2 + frame, 0);
+	SIZE_T read = 0;
+
+	ring.Init(ringSize, frame, mirrored);
+	ring.Put(preroll.data(), preroll.size());
+
+	Report(name, Measure([&]()
+	{
+		ring.Put(source.data(), chunk);
+		ring.Take(target.data(), chunk, &read);
+	}));
+}
+
+static void BenchRingGain()
+{
+	const SIZE_T chunk = 1764;
+	std::string name = "RingBuffer.TakeWithGain/1764";
+
+	if (!Selected(name))
+	{
+		return;
+	}
+
+	RingBuffer ring;
+	EndpointGain gain(2);
+	std::vector<BYTE> source(chunk, 0x5A);
+	std::vector<BYTE> target(chunk);
+	std::vector<BYTE> preroll(2 * chunk + 4, 0);
+	SIZE_T read = 0;
+
+	ring.Init(4 * chunk, 4);
+	ring.Put(preroll.data(), preroll.size());
+
+	Report(name, Measure([&]()
+	{
+		ring.Put(source.data(), chunk);
+		ring.Take(target.data(), chunk, &read, &gain);
+	}));
+}
+
+//=============================================================================
+// CableSimd
+//=============================================================================
+
+/*
+	Every kernel of every table the processor supports on one 10 ms block at
+	48 kHz, stereo and 5.1. The table name is part of the benchmark name, so
+	a baseline from a machine with other instruction sets only compares the
+	ones both have.
+*/
+static void BenchSimdKernels()
+{
+	const ULONG frames = 480;
+
+	for (LONG isa = CableSimdScalar; isa < CableSimdIsaCount; ++isa)
+	{
+		PCCABLE_SIMD_KERNELS kernels = CableSimdGetKernels((CABLE_SIMD_ISA)isa);
+
+		if (kernels == NULL)
+		{
+			continue;
+		}
+
+		for (ULONG channels : { 2, 6 })
+		{
+			std::string suffix = std::string("/") + kernels->Name + "/10ms_48k_" + std::to_string(channels) + "ch";
+			std::vector<SHORT> samples(frames * channels);
+			std::vector<SHORT> target(frames * channels);
+			std::vector<LONG> accumulator(frames * channels, 0);
+			LONG gains[CABLE_SIMD_MAX_CHANNELS];
+			LONG peaks[CABLE_SIMD_MAX_CHANNELS] = { 0 };
+
+			for (SIZE_T i = 0; i < samples.size(); ++i)
+			{
+				samples[i] = (SHORT)(i * 7919);
+			}
+			for (ULONG c = 0; c < CABLE_SIMD_MAX_CHANNELS; ++c)
+			{
+				gains[c] = 0x6000 + (LONG)c * 0x1800;
+			}
+
+			Bench("CableSimd.AccumulateScaled" + suffix, [&]()
+			{
+				kernels->AccumulateScaled(accumulator.data(), samples.data(), frames, channels, gains);
+			});
+			Bench("CableSimd.ClampToShort" + suffix, [&]()
+			{
+				kernels->ClampToShort(target.data(), accumulator.data(), frames * channels);
+			});
+			Bench("CableSimd.TrackPeaks" + suffix, [&]()
+			{
+				kernels->TrackPeaks(samples.data(), frames, channels, peaks);
+			});
+			g_Sink = (ULONGLONG)target[frames] + (ULONGLONG)peaks[0];
+		}
+	}
+}
+
+//=============================================================================
+// CableStream
+//=============================================================================
+
+/*
+	A stream with its own DMA buffer in the running state. Nothing runs the
+	notification timer, the benchmarks move the virtual clock themselves and
+	drive the position updates through GetPositions.
+*/
+struct BenchStream
+{
+	CableStream         Stream;
+	std::vector<BYTE>   Buffer;
+
+	bool Init(ULONG sampleRate, BOOLEAN capture, CableMixer* mixer)
+	{
+		WAVEFORMATEX format = {};
+		CABLE_STREAM_CONFIG config = {};
+		ULONG size;
+		ULONG packetSize = 0;
+
+		format.wFormatTag = WAVE_FORMAT_PCM;
+		format.nChannels = 2;
+		format.nSamplesPerSec = sampleRate;
+		format.wBitsPerSample = 16;
+		format.nBlockAlign = 4;
+		format.nAvgBytesPerSec = sampleRate * 4;
+
+		config.Capture = capture;
+		config.RingBufferCount = CABLE_RING_BUFFERS_DEFAULT;
+		config.Mixer = mixer;
+
+		size = format.nAvgBytesPerSec / 100;
+		if (!NT_SUCCESS(Stream.InitCable(&format, &config)) ||
+			!NT_SUCCESS(Stream.PrepareBuffer(2, &size, &packetSize)))
+		{
+			return false;
+		}
+		Buffer.assign(size, 0x11);
+		Stream.AttachDmaBuffer(Buffer.data(), size, 2, packetSize);
+		return true;
+	}
+
+	void Run()
+	{
+		Stream.SetCableState(KSSTATE_ACQUIRE);
+		Stream.SetCableState(KSSTATE_PAUSE);
+		Stream.SetCableState(KSSTATE_RUN);
+	}
+};
+
+static const ULONGLONG QpcPerMs = HOST_QPC_FREQUENCY / 1000;
+
+// The position math alone: an unpaired render stream moved by 1 ms per query.
+static void BenchUpdatePosition()
+{
+	std::string name = "CableStream.UpdatePosition/1ms";
+
+	if (!Selected(name))
+	{
+		return;
+	}
+
+	BenchStream render;
+	ULONGLONG linear = 0;
+
+	HostSetTime(0);
+	if (!render.Init(44100, FALSE, NULL))
+	{
+		fprintf(stderr, "%s: stream setup failed\n", name.c_str());
+		exit(1);
+	}
+	render.Run();
+
+	Report(name, Measure([&]()
+	{
+		HostAdvanceTime(QpcPerMs);
+		render.Stream.GetPositions(&linear, NULL, NULL);
+	}));
+	g_Sink = linear;
+	render.Stream.ShutdownCable();
+}
+
+/*
+	One 10 ms period at 44.1 kHz through a cable: the render query runs
+	ReadBytes into the capture ring, the capture query runs WriteBytes out of
+	it. The two are timed separately inside the same loop.
+*/
+static void BenchCablePeriod(BOOLEAN useMixer)
+{
+	std::string prefix = useMixer ? "CableStream.Mixer" : "CableStream.Paired";
+	std::string readName = prefix + "/ReadBytes/10ms_44k";
+	std::string writeName = prefix + "/WriteBytes/10ms_44k";
+
+	if (!Selected(readName) && !Selected(writeName))
+	{
+		return;
+	}
+
+	WAVEFORMATEX format = {};
+	EndpointGain* gain = NULL;
+	CableMixer* mixer = NULL;
+
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = 2;
+	format.nSamplesPerSec = 44100;
+	format.wBitsPerSample = 16;
+	format.nBlockAlign = 4;
+	format.nAvgBytesPerSec = 44100 * 4;
+
+	if (useMixer)
+	{
+		gain = new(NonPagedPoolNx, 'nGBC') EndpointGain(2);
+		mixer = new(NonPagedPoolNx, 'xMBC') CableMixer;
+		mixer->Init(&format, gain);
+	}
+
+	{
+		BenchStream render;
+		BenchStream capture;
+		ULONGLONG linear = 0;
+
+		HostSetTime(0);
+		if (!render.Init(44100, FALSE, mixer) || !capture.Init(44100, TRUE, NULL))
+		{
+			fprintf(stderr, "%s: stream setup failed\n", prefix.c_str());
+			exit(1);
+		}
+		if (useMixer)
+		{
+			mixer->AddSink(&capture.Stream);
+		}
+		else
+		{
+			CableStream::PairStreams(&render.Stream, &capture.Stream);
+		}
+		capture.Run();
+		render.Run();
+
+		ULONGLONG batch = 0;
+		double bestRead = 0;
+		double bestWrite = 0;
+
+		// Calibrate the batch on the pair of calls, then time them apart.
+		Measure([&]()
+		{
+			HostAdvanceTime(10 * QpcPerMs);
+			render.Stream.GetPositions(&linear, NULL, NULL);
+			capture.Stream.GetPositions(&linear, NULL, NULL);
+			batch++;
+		});
+		batch = (std::max)(batch / (g_Options.Runs + 1), (ULONGLONG)1);
+
+		for (ULONG run = 0; run < g_Options.Runs; ++run)
+		{
+			double readNs = 0;
+			double writeNs = 0;
+			for (ULONGLONG i = 0; i < batch; ++i)
+			{
+				HostAdvanceTime(10 * QpcPerMs);
+				BenchClock::time_point t0 = BenchClock::now();
+				render.Stream.GetPositions(&linear, NULL, NULL);
+				BenchClock::time_point t1 = BenchClock::now();
+				capture.Stream.GetPositions(&linear, NULL, NULL);
+				BenchClock::time_point t2 = BenchClock::now();
+				readNs += ElapsedNs(t0, t1);
+				writeNs += ElapsedNs(t1, t2);
+			}
+			readNs /= (double)batch;
+			writeNs /= (double)batch;
+			if (run == 0 || readNs < bestRead)
+			{
+				bestRead = readNs;
+			}
+			if (run == 0 || writeNs < bestWrite)
+			{
+				bestWrite = writeNs;
+			}
+		}
+		g_Sink = linear;
+
+		if (Selected(readName))
+		{
+			Report(readName, bestRead);
+		}
+		if (Selected(writeName))
+		{
+			Report(writeName, bestWrite);
+		}
+
+		if (useMixer)
+		{
+			mixer->RemoveSink(&capture.Stream);
+		}
+		render.Stream.ShutdownCable();
+		capture.Stream.ShutdownCable();
+	}
+
+	delete mixer;
+	delete gain;
+}
+
+//=============================================================================
+// SubdeviceCache
+//=============================================================================
+
+// Stands in for the port and miniport objects the adapter caches.
+class BenchUnknown : public IUnknown
+{
+public:
+	NTSTATUS QueryInterface(const GUID&, PVOID*) { return STATUS_NOT_IMPLEMENTED; }
+	ULONG AddRef() { return ++m_Refs; }
+	ULONG Release() { return --m_Refs; }
+private:
+	ULONG m_Refs = 1;
+};
+
+static void BenchSubdeviceCache()
+{
+	static const WCHAR* names[] =
+	{
+		L"WaveSpeaker", L"TopologySpeaker", L"WaveMicArray1", L"TopologyMicArray1",
+		L"WaveMicArray2", L"TopologyMicArray2", L"WaveMicIn", L"TopologyMicIn",
+	};
+	const ULONG count = sizeof(names) / sizeof(names[0]);
+	SubdeviceCache cache;
+	BenchUnknown port;
+	BenchUnknown miniport;
+	WCHAR first[MAX_PATH];
+	WCHAR last[MAX_PATH];
+	WCHAR missing[MAX_PATH];
+
+	for (ULONG i = 0; i < count; ++i)
+	{
+		WCHAR name[MAX_PATH];
+		RtlStringCchCopyW(name, MAX_PATH, names[i]);
+		cache.Put(name, &port, &miniport);
+	}
+	RtlStringCchCopyW(first, MAX_PATH, names[0]);
+	RtlStringCchCopyW(last, MAX_PATH, names[count - 1]);
+	RtlStringCchCopyW(missing, MAX_PATH, L"WaveHdmi");
+
+	struct { const char* Suffix; PWSTR Name; } lookups[] =
+	{
+		{ "hit_first", first }, { "hit_last", last }, { "miss", missing },
+	};
+	for (auto& lookup : lookups)
+	{
+		Bench(std::string("SubdeviceCache.Get/") + lookup.Suffix, [&]()
+		{
+			PUNKNOWN unknownPort = NULL;
+			PUNKNOWN unknownMiniport = NULL;
+			if (NT_SUCCESS(cache.Get(lookup.Name, &unknownPort, &unknownMiniport)))
+			{
+				unknownPort->Release();
+				unknownMiniport->Release();
+			}
+		});
+	}
+
+	cache.Clear();
+}
+
+//=============================================================================
+// FormatHelper
+//=============================================================================
+
+static KSDATAFORMAT_WAVEFORMATEXTENSIBLE MakeDeviceFormat(USHORT channels, ULONG sampleRate, USHORT bits)
+{
+	KSDATAFORMAT_WAVEFORMATEXTENSIBLE format = {};
+
+	format.DataFormat.FormatSize = sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE);
+	format.DataFormat.MajorFormat = KSDATAFORMAT_TYPE_AUDIO;
+	format.DataFormat.SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
+	format.DataFormat.Specifier = KSDATAFORMAT_SPECIFIER_WAVEFORMATEX;
+	format.WaveFormatExt.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+	format.WaveFormatExt.Format.nChannels = channels;
+	format.WaveFormatExt.Format.nSamplesPerSec = sampleRate;
+	format.WaveFormatExt.Format.wBitsPerSample = bits;
+	format.WaveFormatExt.Format.nBlockAlign = channels * bits / 8;
+	format.WaveFormatExt.Format.nAvgBytesPerSec = sampleRate * channels * bits / 8;
+	format.WaveFormatExt.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+	format.WaveFormatExt.Samples.wValidBitsPerSample = bits;
+	format.WaveFormatExt.dwChannelMask = channels == 1 ? KSAUDIO_SPEAKER_MONO : KSAUDIO_SPEAKER_STEREO;
+	format.WaveFormatExt.SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
+	return format;
+}
+
+/*
+	The speaker pin supports a single format. The larger table is what a pin
+	offering every common rate at 16 and 24 bits would carry.
+*/
+static void BenchFormatHelper()
+{
+	static const ULONG rates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 192000 };
+	std::vector<KSDATAFORMAT_WAVEFORMATEXTENSIBLE> table;
+	KSDATAFORMAT_WAVEFORMATEXTENSIBLE speaker = MakeDeviceFormat(2, 48000, 16);
+	KSDATAFORMAT_WAVEFORMATEXTENSIBLE requestFirst = MakeDeviceFormat(2, 8000, 16);
+	KSDATAFORMAT_WAVEFORMATEXTENSIBLE requestLast = MakeDeviceFormat(2, 192000, 24);
+	KSDATAFORMAT_WAVEFORMATEXTENSIBLE requestMissing = MakeDeviceFormat(6, 48000, 16);
+
+	for (USHORT bits : { 16, 24 })
+	{
+		for (ULONG rate : rates)
+		{
+			table.push_back(MakeDeviceFormat(2, rate, bits));
+		}
+	}
+
+	Bench("FormatHelper.FindSupportedFormat/speaker", [&]()
+	{
+		g_Sink = FormatHelper::FindSupportedFormat(&speaker.DataFormat, &speaker, 1);
+	});
+	Bench("FormatHelper.FindSupportedFormat/table20_first", [&]()
+	{
+		g_Sink = FormatHelper::FindSupportedFormat(&requestFirst.DataFormat, table.data(), (ULONG)table.size());
+	});
+	Bench("FormatHelper.FindSupportedFormat/table20_last", [&]()
+	{
+		g_Sink = FormatHelper::FindSupportedFormat(&requestLast.DataFormat, table.data(), (ULONG)table.size());
+	});
+	Bench("FormatHelper.FindSupportedFormat/table20_miss", [&]()
+	{
+		g_Sink = FormatHelper::FindSupportedFormat(&requestMissing.DataFormat, table.data(), (ULONG)table.size());
+	});
+}
+
+//=============================================================================
+// Baselines
+//=============================================================================
+
+static void WriteResults(FILE* file)
+{
+	fprintf(file, "{\n  \"calibration_ns\": %.1f,\n  \"benchmarks\": [\n", g_CalibrationNs);
+	for (size_t i = 0; i < g_Results.size(); ++i)
+	{
+		fprintf(file, "    {\"name\": \"%s\", \"ns_per_op\": %.1f, \"normalised\": %.6f}%s\n",
+			g_Results[i].Name.c_str(), g_Results[i].NsPerOp, g_Results[i].Normalised,
+			i + 1 < g_Results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+}
+
+// Reads back what WriteResults produced, one benchmark per line.
+static bool ReadBaseline(const std::string& path, std::map<std::string, double>* normalised)
+{
+	FILE* file = fopen(path.c_str(), "r");
+	char line[512];
+
+	if (!file)
+	{
+		return false;
+	}
+	while (fgets(line, sizeof(line), file))
+	{
+		char name[256];
+		double nsPerOp;
+		double value;
+		if (sscanf(line, " {\"name\": \"%255[^\"]\", \"ns_per_op\": %lf, \"normalised\": %lf}", name, &nsPerOp, &value) == 3)
+		{
+			(*normalised)[name] = value;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+static int CompareWithBaseline()
+{
+	std::map<std::string, double> baseline;
+	int regressions = 0;
+
+	if (!ReadBaseline(g_Options.Baseline, &baseline))
+	{
+		fprintf(stderr, "Cannot read baseline %s\n", g_Options.Baseline.c_str());
+		return 1;
+	}
+
+	fprintf(stderr, "\nAgainst %s (tolerance %.0f%%):\n", g_Options.Baseline.c_str(), g_Options.Tolerance * 100);
+	for (const BenchResult& result : g_Results)
+	{
+		auto it = baseline.find(result.Name);
+		if (it == baseline.end())
+		{
+			fprintf(stderr, "  %-46s not in baseline\n", result.Name.c_str());
+			continue;
+		}
+		double ratio = result.Normalised / it->second;
+		bool regressed = ratio > 1.0 + g_Options.Tolerance;
+		fprintf(stderr, "  %-46s %6.2fx%s\n", result.Name.c_str(), ratio, regressed ? "  REGRESSION" : "");
+		if (regressed)
+		{
+			regressions++;
+		}
+	}
+	return regressions ? 2 : 0;
+}
+
+//=============================================================================
+// main
+//=============================================================================
+
+static void Usage()
+{
+	fprintf(stderr,
+		"CableBench [--filter text] [--runs n] [--min-ms n]\n"
+		"           [--baseline file [--tolerance x] [--update-baseline]]\n");
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (arg == "--update-baseline")
+		{
+			g_Options.UpdateBaseline = true;
+			continue;
+		}
+		if (!value)
+		{
+			Usage();
+		}
+		if (arg == "--filter")
+		{
+			g_Options.Filter = value;
+		}
+		else if (arg == "--runs")
+		{
+			g_Options.Runs = (std::max)(1, atoi(value));
+		}
+		else if (arg == "--min-ms")
+		{
+			g_Options.MinMs = (std::max)(1, atoi(value));
+		}
+		else if (arg == "--baseline")
+		{
+			g_Options.Baseline = value;
+		}
+		else if (arg == "--tolerance")
+		{
+			g_Options.Tolerance = atof(value);
+		}
+		else
+		{
+			Usage();
+		}
+		i++;
+	}
+
+	CableSimdInitialize();
+
+	g_CalibrationNs = MeasureCalibration();
+	for (SIZE_T chunk : { 4, 64, 1764, 3528 })
+	{
+		BenchRingBuffer(chunk, FALSE, FALSE);
+		BenchRingBuffer(chunk, TRUE, FALSE);
+		BenchRingBuffer(chunk, FALSE, TRUE);
+		BenchRingBuffer(chunk, TRUE, TRUE);
+	}
+	BenchRingGain();
+	BenchSimdKernels();
+	BenchUpdatePosition();
+	BenchCablePeriod(FALSE);
+	BenchCablePeriod(TRUE);
+	BenchSubdeviceCache();
+	BenchFormatHelper();
+	NormaliseResults();
+
+	WriteResults(stdout);
+
+	if (g_Options.Baseline.empty())
+	{
+		return 0;
+	}
+	if (g_Options.UpdateBaseline)
+	{
+		FILE* file = fopen(g_Options.Baseline.c_str(), "w");
+		if (!file)
+		{
+			fprintf(stderr, "Cannot write baseline %s\n", g_Options.Baseline.c_str());
+			return 1;
+		}
+		WriteResults(file);
+		fclose(file);
+		return 0;
+	}
+	return CompareWithBaseline();
+}
@@ -0,0 +1,567 @@
+/*
+	Load benchmark: how the timer callback cost grows with the number of
+	cables.
+
+	For every cable count it creates that many cables the way the driver
+	does for one speaker/microphone pair: an endpoint gain and a mixer for
+	the render miniport, then a render and a capture stream set up through
+	InitCable, PrepareBuffer and AttachDmaBuffer like MiniportWaveRTStream::Init
+	and AllocateBufferWithNotification do, with the capture stream as the
+	mixer's sink. All streams run and their 1 ms timers fire on the virtual
+	clock while the real time of every callback is measured.
+
+	Reported per cable count, as JSON:
+	  - pool memory and allocations per cable, and the DMA buffer bytes the
+	    port would allocate on top
+	  - CPU time per 1 ms tick across all cables and the share of one core
+	  - the callback time distribution, and the completion latency: how long
+	    after its tick a callback finishes when all callbacks of the tick run
+	    one after another on one processor
+	  - with --processors, how evenly the cable scheduler spreads the ticks
+	    when every timer fires on a random processor, and the share of ticks
+	    it had to move to their cable's home processor
+	  - L1 data and last level cache misses per 1 ms tick, read from the
+	    hardware counters on Linux, null where there are none (most VMs)
+
+	CableScale [--max-cables n] [--duration-ms n] [--buffer-ms n]
+	           [--sample-rate n] [--channels n] [--processors n] [--stagger]
+*/
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "CableStream.h"
+#include "CableSimd.h"
+
+#define SCALE_POOLTAG   'lcSC'
+
+struct ScaleOptions
+{
+	ULONG       MaxCables = 256;
+	ULONG       DurationMs = 1000;
+	ULONG       WarmupMs = 100;
+	ULONG       BufferMs = 10;
+	ULONG       SampleRate = 48000;
+	USHORT      Channels = 2;
+	ULONG       Processors = 1;
+	bool        Stagger = false;
+};
+
+static ScaleOptions g_Options;
+
+static const ULONGLONG QpcPerMs = HOST_QPC_FREQUENCY / 1000;
+
+/*
+	Hardware cache miss counter of the calling thread, which is where the
+	host runs every timer callback. Unavailable off Linux and without a PMU.
+*/
+class CacheMissCounter
+{
+private:
+	int m_Fd = -1;
+
+public:
+	CacheMissCounter(ULONG type, ULONGLONG config)
+	{
+#ifdef __linux__
+		struct perf_event_attr attr = {};
+		attr.type = type;
+		attr.size = sizeof(attr);
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_Fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+		UNREFERENCED_PARAMETER(type);
+		UNREFERENCED_PARAMETER(config);
+#endif
+	}
+
+	~CacheMissCounter()
+	{
+#ifdef __linux__
+		if (m_Fd >= 0)
+		{
+			close(m_Fd);
+		}
+#endif
+	}
+
+	bool IsAvailable()
+	{
+		return m_Fd >= 0;
+	}
+
+	VOID Start()
+	{
+#ifdef __linux__
+		if (m_Fd >= 0)
+		{
+			ioctl(m_Fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(m_Fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	ULONGLONG Stop()
+	{
+		ULONGLONG count = 0;
+#ifdef __linux__
+		if (m_Fd >= 0)
+		{
+			ioctl(m_Fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(m_Fd, &count, sizeof(count)) != sizeof(count))
+			{
+				count = 0;
+			}
+		}
+#endif
+		return count;
+	}
+};
+
+#ifdef __linux__
+#define CACHE_COUNTER_L1D   PERF_TYPE_HW_CACHE, (PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#define CACHE_COUNTER_LLC   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES
+#else
+#define CACHE_COUNTER_L1D   0, 0
+#define CACHE_COUNTER_LLC   0, 0
+#endif
+
+/*
+	One speaker/microphone pair with one stream on each side. The objects
+	come from the pool like the driver's, so the pool counters see them,
+	and the streams are cache aligned like MiniportWaveRT allocates them.
+*/
+struct ScaleCable
+{
+	EndpointGain*       SpeakerGain = NULL;
+	EndpointGain*       MicGain = NULL;
+	CableMixer*         Mixer = NULL;
+	CableStream*        Render = NULL;
+	CableStream*        Capture = NULL;
+	std::vector<BYTE>   RenderBuffer;
+	std::vector<BYTE>   CaptureBuffer;
+
+	NTSTATUS InitStream(CableStream* stream, PWAVEFORMATEX format, const CABLE_STREAM_CONFIG* config, std::vector<BYTE>* buffer)
+	{
+		ULONG size = g_Options.BufferMs * format->nAvgBytesPerSec / 1000;
+		ULONG packetSize = 0;
+		NTSTATUS ntStatus;
+
+		ntStatus = stream->InitCable(format, config);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		ntStatus = stream->PrepareBuffer(2, &size, &packetSize);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		buffer->assign(size, 0);
+		stream->AttachDmaBuffer(buffer->data(), size, 2, packetSize);
+		return STATUS_SUCCESS;
+	}
+
+	NTSTATUS Init(PWAVEFORMATEX format, CableScheduler* scheduler)
+	{
+		CABLE_STREAM_CONFIG renderConfig = {};
+		CABLE_STREAM_CONFIG captureConfig = {};
+		ULONG homeProcessor = CABLE_SCHEDULER_NO_PROCESSOR;
+		NTSTATUS ntStatus;
+
+		SpeakerGain = new(NonPagedPoolNx, SCALE_POOLTAG) EndpointGain(format->nChannels);
+		MicGain = new(NonPagedPoolNx, SCALE_POOLTAG) EndpointGain(format->nChannels);
+		Mixer = new(NonPagedPoolNx, SCALE_POOLTAG) CableMixer;
+		Render = new(NonPagedPoolNxCacheAligned, SCALE_POOLTAG) CableStream;
+		Capture = new(NonPagedPoolNxCacheAligned, SCALE_POOLTAG) CableStream;
+		if (!SpeakerGain || !MicGain || !Mixer || !Render || !Capture)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		ntStatus = Mixer->Init(format, SpeakerGain);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+
+		if (scheduler != NULL)
+		{
+			ntStatus = scheduler->AddCable(&homeProcessor);
+			if (!NT_SUCCESS(ntStatus))
+			{
+				return ntStatus;
+			}
+		}
+		renderConfig.Scheduler = scheduler;
+		renderConfig.HomeProcessor = homeProcessor;
+		captureConfig.Scheduler = scheduler;
+		captureConfig.HomeProcessor = homeProcessor;
+
+		renderConfig.RingBufferCount = CABLE_RING_BUFFERS_DEFAULT;
+		renderConfig.Mixer = Mixer;
+		ntStatus = InitStream(Render, format, &renderConfig, &RenderBuffer);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+
+		captureConfig.Capture = TRUE;
+		captureConfig.RingBufferCount = CABLE_RING_BUFFERS_DEFAULT;
+		captureConfig.Gain = MicGain;
+		ntStatus = InitStream(Capture, format, &captureConfig, &CaptureBuffer);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+
+		return Mixer->AddSink(Capture);
+	}
+
+	static VOID Run(CableStream* stream)
+	{
+		stream->SetCableState(KSSTATE_ACQUIRE);
+		stream->SetCableState(KSSTATE_PAUSE);
+		stream->SetCableState(KSSTATE_RUN);
+	}
+
+	VOID Shutdown()
+	{
+		if (Mixer && Capture)
+		{
+			Mixer->RemoveSink(Capture);
+		}
+		if (Render)
+		{
+			Render->ShutdownCable();
+		}
+		if (Capture)
+		{
+			Capture->ShutdownCable();
+		}
+		delete Render;
+		delete Capture;
+		delete Mixer;
+		delete SpeakerGain;
+		delete MicGain;
+	}
+};
+
+struct ScaleResult
+{
+	ULONG       Cables;
+	double      SetupUsPerCable;
+	double      PoolBytesPerCable;
+	double      PoolAllocationsPerCable;
+	double      DmaBytesPerCable;
+	ULONGLONG   Callbacks;
+	double      CpuNsPerTick;
+	double      CoreLoad;
+	ULONGLONG   CallbackNs[4];      // p50, p99, p99.9, max
+	ULONGLONG   CompletionNs[4];
+	ULONGLONG   CaptureUnderruns;
+	double      TickImbalance;      // Busiest processor's ticks over the mean.
+	double      ForwardedShare;     // Ticks moved to their home processor.
+	double      L1dMissesPerTick;   // Negative without hardware counters.
+	double      LlcMissesPerTick;
+};
+
+static const double Percentiles[] = { 0.5, 0.99, 0.999, 1.0 };
+
+static VOID Summarise(std::vector<ULONGLONG>* samples, ULONGLONG* out)
+{
+	for (ULONG i = 0; i < 4; ++i)
+	{
+		out[i] = 0;
+		if (samples->empty())
+		{
+			continue;
+		}
+		size_t index = (std::min)((size_t)(Percentiles[i] * (double)samples->size()), samples->size() - 1);
+		std::nth_element(samples->begin(), samples->begin() + index, samples->end());
+		out[i] = (*samples)[index];
+	}
+}
+
+static bool RunScale(ULONG cableCount, ScaleResult* result)
+{
+	WAVEFORMATEX format = {};
+	std::vector<ScaleCable> cables(cableCount);
+	std::vector<ULONGLONG> callbackNs;
+	std::vector<ULONGLONG> completionNs;
+	ULONGLONG tickQpc = MAXULONGLONG;
+	ULONGLONG tickElapsedNs = 0;
+	ULONGLONG totalNs = 0;
+	ULONGLONG timerExpiries = 0;
+	CableScheduler* scheduler = NULL;
+	bool measuring = false;
+	bool ok = true;
+
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = g_Options.Channels;
+	format.nSamplesPerSec = g_Options.SampleRate;
+	format.wBitsPerSample = 16;
+	format.nBlockAlign = format.nChannels * sizeof(SHORT);
+	format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+
+	*result = {};
+	result->Cables = cableCount;
+
+	HostSetTime(0);
+	HostSetProcessorCount(g_Options.Processors);
+	if (g_Options.Processors > 1)
+	{
+		scheduler = new(NonPagedPoolNx, SCALE_POOLTAG) CableScheduler;
+		if (scheduler == NULL || !NT_SUCCESS(scheduler->Init()))
+		{
+			fprintf(stderr, "Scheduler setup failed\n");
+			delete scheduler;
+			return false;
+		}
+		// Expiries land on the processors in a fixed pseudo random order.
+		HostSetTimerProcessor([&](PEX_TIMER, PVOID) -> ULONG
+		{
+			return (ULONG)((++timerExpiries * 2654435761ULL) >> 16);
+		});
+	}
+
+	SIZE_T poolBytes = HostGetPoolBytes();
+	SIZE_T poolAllocations = HostGetPoolAllocations();
+	std::chrono::steady_clock::time_point setupStart = std::chrono::steady_clock::now();
+	for (ScaleCable& cable : cables)
+	{
+		if (!NT_SUCCESS(cable.Init(&format, scheduler)))
+		{
+			fprintf(stderr, "Cable setup failed at %u cables\n", cableCount);
+			ok = false;
+			break;
+		}
+	}
+	result->SetupUsPerCable = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - setupStart).count() / 1000.0 / cableCount;
+	result->PoolBytesPerCable = (double)(HostGetPoolBytes() - poolBytes) / cableCount;
+	result->PoolAllocationsPerCable = (double)(HostGetPoolAllocations() - poolAllocations) / cableCount;
+	result->DmaBytesPerCable = (double)(cables[0].RenderBuffer.size() + cables[0].CaptureBuffer.size());
+
+	// Capture first like an application listening before playback starts.
+	// Staggered cables start spread over one timer period, otherwise every
+	// timer is due on the same tick.
+	for (ULONG i = 0; ok && i < cableCount; ++i)
+	{
+		if (g_Options.Stagger)
+		{
+			HostRunTimers(i * QpcPerMs / cableCount);
+		}
+		ScaleCable::Run(cables[i].Capture);
+		ScaleCable::Run(cables[i].Render);
+	}
+
+	callbackNs.reserve((size_t)cableCount * 2 * g_Options.DurationMs);
+	completionNs.reserve((size_t)cableCount * 2 * g_Options.DurationMs);
+	HostSetTimerObserver([&](PEX_TIMER, ULONGLONG dueQpc, ULONGLONG ns)
+	{
+		if (!measuring)
+		{
+			return;
+		}
+		// Callbacks due at the same time queue behind each other.
+		if (dueQpc != tickQpc)
+		{
+			tickQpc = dueQpc;
+			tickElapsedNs = 0;
+		}
+		tickElapsedNs += ns;
+		totalNs += ns;
+		callbackNs.push_back(ns);
+		completionNs.push_back(tickElapsedNs);
+	});
+
+	if (ok)
+	{
+		CacheMissCounter l1dMisses(CACHE_COUNTER_L1D);
+		CacheMissCounter llcMisses(CACHE_COUNTER_LLC);
+
+		HostRunTimers(HostGetTime() + g_Options.WarmupMs * QpcPerMs);
+		measuring = true;
+		l1dMisses.Start();
+		llcMisses.Start();
+		HostRunTimers(HostGetTime() + g_Options.DurationMs * QpcPerMs);
+		result->L1dMissesPerTick = l1dMisses.IsAvailable() ? (double)l1dMisses.Stop() / g_Options.DurationMs : -1;
+		result->LlcMissesPerTick = llcMisses.IsAvailable() ? (double)llcMisses.Stop() / g_Options.DurationMs : -1;
+		measuring = false;
+	}
+	HostSetTimerObserver(nullptr);
+	HostSetTimerProcessor(nullptr);
+
+	for (ScaleCable& cable : cables)
+	{
+		if (ok)
+		{
+			AUDIOMIRROR_STREAM_STATISTICS statistics;
+			cable.Capture->GetStreamStatistics()->Snapshot(&statistics);
+			result->CaptureUnderruns += statistics.Underruns;
+		}
+		cable.Shutdown();
+	}
+
+	if (scheduler != NULL)
+	{
+		ULONGLONG busiest = 0;
+		ULONGLONG ticks = 0;
+		ULONGLONG forwarded = 0;
+		for (ULONG i = 0; i < scheduler->GetProcessorCount(); ++i)
+		{
+			AUDIOMIRROR_PROCESSOR_STATISTICS statistics;
+			scheduler->GetProcessorStatistics(i, &statistics);
+			busiest = (std::max)(busiest, statistics.LocalTicks + statistics.ForwardedTicks);
+			ticks += statistics.LocalTicks + statistics.ForwardedTicks;
+			forwarded += statistics.ForwardedTicks;
+		}
+		if (ticks > 0)
+		{
+			result->TickImbalance = (double)busiest * scheduler->GetProcessorCount() / ticks;
+			result->ForwardedShare = (double)forwarded / ticks;
+		}
+		delete scheduler;
+	}
+	HostSetProcessorCount(1);
+
+	result->Callbacks = callbackNs.size();
+	result->CpuNsPerTick = (double)totalNs / g_Options.DurationMs;
+	result->CoreLoad = result->CpuNsPerTick / 1e6;
+	Summarise(&callbackNs, result->CallbackNs);
+	Summarise(&completionNs, result->CompletionNs);
+	return ok;
+}
+
+// A count per tick, or null without hardware counters.
+static std::string FormatMisses(double misses)
+{
+	char text[32];
+
+	if (misses < 0)
+	{
+		return "null";
+	}
+	snprintf(text, sizeof(text), "%.1f", misses);
+	return text;
+}
+
+static VOID PrintResult(const ScaleResult& r, bool last)
+{
+	printf("    {\"cables\": %u, \"setup_us_per_cable\": %.1f, \"pool_bytes_per_cable\": %.0f, "
+		"\"pool_allocations_per_cable\": %.1f, \"dma_bytes_per_cable\": %.0f,\n"
+		"     \"callbacks\": %llu, \"cpu_ns_per_tick\": %.0f, \"core_load\": %.4f, \"capture_underruns\": %llu,\n"
+		"     \"tick_imbalance\": %.3f, \"forwarded_share\": %.3f, \"l1d_misses_per_tick\": %s, \"llc_misses_per_tick\": %s,\n"
+		"     \"callback_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu},\n"
+		"     \"completion_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}%s\n",
+		r.Cables, r.SetupUsPerCable, r.PoolBytesPerCable, r.PoolAllocationsPerCable, r.DmaBytesPerCable,
+		(unsigned long long)r.Callbacks, r.CpuNsPerTick, r.CoreLoad, (unsigned long long)r.CaptureUnderruns,
+		r.TickImbalance, r.ForwardedShare, FormatMisses(r.L1dMissesPerTick).c_str(), FormatMisses(r.LlcMissesPerTick).c_str(),
+		(unsigned long long)r.CallbackNs[0], (unsigned long long)r.CallbackNs[1],
+		(unsigned long long)r.CallbackNs[2], (unsigned long long)r.CallbackNs[3],
+		(unsigned long long)r.CompletionNs[0], (unsigned long long)r.CompletionNs[1],
+		(unsigned long long)r.CompletionNs[2], (unsigned long long)r.CompletionNs[3],
+		last ? "" : ",");
+}
+
+static VOID Usage()
+{
+	fprintf(stderr,
+		"CableScale [--max-cables n] [--duration-ms n] [--buffer-ms n]\n"
+		"           [--sample-rate n] [--channels n] [--processors n] [--stagger]\n");
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--stagger")
+		{
+			g_Options.Stagger = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			Usage();
+		}
+		ULONG value = (ULONG)strtoul(argv[++i], NULL, 10);
+		if (arg == "--max-cables")
+		{
+			g_Options.MaxCables = (std::max)(value, 1U);
+		}
+		else if (arg == "--duration-ms")
+		{
+			g_Options.DurationMs = (std::max)(value, 1U);
+		}
+		else if (arg == "--buffer-ms")
+		{
+			g_Options.BufferMs = (std::max)(value, 2U);
+		}
+		else if (arg == "--sample-rate")
+		{
+			g_Options.SampleRate = value;
+		}
+		else if (arg == "--channels")
+		{
+			g_Options.Channels = (USHORT)(std::max)(value, 1U);
+		}
+		else if (arg == "--processors")
+		{
+			g_Options.Processors = (std::min)((std::max)(value, 1U), (ULONG)HOST_MAX_PROCESSORS);
+		}
+		else
+		{
+			Usage();
+		}
+	}
+
+	CableSimdInitialize();
+
+	std::vector<ScaleResult> results;
+	for (ULONG cables = 1; cables <= g_Options.MaxCables; cables *= 2)
+	{
+		ScaleResult result;
+		if (!RunScale(cables, &result))
+		{
+			return 1;
+		}
+		fprintf(stderr, "%4u cables: %8.0f ns/tick  %6.2f%% of a core  callback p99 %6llu ns  completion p99 %8llu ns  %6.0f bytes/cable\n",
+			cables, result.CpuNsPerTick, result.CoreLoad * 100,
+			(unsigned long long)result.CallbackNs[1], (unsigned long long)result.CompletionNs[1], result.PoolBytesPerCable);
+		results.push_back(result);
+	}
+
+	printf("{\n  \"sample_rate\": %u, \"channels\": %u, \"buffer_ms\": %u, \"duration_ms\": %u, \"processors\": %u, \"stagger\": %s,\n  \"scaling\": [\n",
+		g_Options.SampleRate, g_Options.Channels, g_Options.BufferMs, g_Options.DurationMs, g_Options.Processors, g_Options.Stagger ? "true" : "false");
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		PrintResult(results[i], i + 1 == results.size());
+	}
+	printf("  ]\n}\n");
+
+	for (const ScaleResult& result : results)
+	{
+		if (result.CaptureUnderruns != 0)
+		{
+			fprintf(stderr, "%u cables: capture streams ran dry %llu times\n", result.Cables, (unsigned long long)result.CaptureUnderruns);
+			return 2;
+		}
+	}
+	return 0;
+}
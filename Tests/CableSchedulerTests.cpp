@@ -0,0 +1,257 @@
+#include <random>
+#include <vector>
+
+#include "TestHarness.h"
+#include "CableStream.h"
+
+#define TEST_PROCESSORS         4
+#define TEST_SAMPLE_RATE        48000
+#define TEST_CHANNELS           2
+#define TEST_BLOCK_ALIGN        (TEST_CHANNELS * sizeof(SHORT))
+#define TEST_BYTES_PER_MS       (TEST_SAMPLE_RATE / 1000 * TEST_BLOCK_ALIGN)
+#define TEST_BUFFER_MS          10
+#define TEST_NOTIFICATIONS      2
+#define TEST_SAMPLE_VALUE       0x1234
+
+static ULONGLONG MsToQpc(ULONGLONG ms)
+{
+	return ms * HOST_QPC_FREQUENCY / 1000;
+}
+
+/*
+	Stream that remembers on which processors its ticks ran.
+*/
+class ProcessorTrackingStream : public CableStream
+{
+public:
+	ULONG   Ticks = 0;
+	ULONG   TicksAway = 0;      // Ticks that ran off the home processor.
+
+protected:
+	VOID OnTimerTick(_In_ const CABLE_STREAM_TICK* Tick) override
+	{
+		UNREFERENCED_PARAMETER(Tick);
+		Ticks++;
+		if (KeGetCurrentProcessorIndex() != GetHomeProcessor())
+		{
+			TicksAway++;
+		}
+	}
+};
+
+struct TestCable
+{
+	ProcessorTrackingStream Render;
+	ProcessorTrackingStream Capture;
+	std::vector<BYTE>       RenderBuffer;
+	std::vector<BYTE>       CaptureBuffer;
+
+	static NTSTATUS InitStream(CableStream& stream, std::vector<BYTE>& buffer, BOOLEAN capture, CableScheduler* scheduler, ULONG processor)
+	{
+		WAVEFORMATEX format = {};
+		CABLE_STREAM_CONFIG config = {};
+		ULONG size = TEST_BUFFER_MS * TEST_BYTES_PER_MS;
+		ULONG packetSize = 0;
+		NTSTATUS ntStatus;
+
+		format.wFormatTag = WAVE_FORMAT_PCM;
+		format.nChannels = TEST_CHANNELS;
+		format.nSamplesPerSec = TEST_SAMPLE_RATE;
+		format.wBitsPerSample = 16;
+		format.nBlockAlign = TEST_BLOCK_ALIGN;
+		format.nAvgBytesPerSec = TEST_SAMPLE_RATE * TEST_BLOCK_ALIGN;
+
+		config.Capture = capture;
+		config.RingBufferCount = CABLE_RING_BUFFERS_DEFAULT;
+		config.Scheduler = scheduler;
+		config.HomeProcessor = processor;
+
+		ntStatus = stream.InitCable(&format, &config);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		ntStatus = stream.PrepareBuffer(TEST_NOTIFICATIONS, &size, &packetSize);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		buffer.assign(size, 0);
+		stream.AttachDmaBuffer(buffer.data(), size, TEST_NOTIFICATIONS, packetSize);
+		return STATUS_SUCCESS;
+	}
+
+	NTSTATUS Init(CableScheduler* scheduler, ULONG processor)
+	{
+		NTSTATUS ntStatus = InitStream(Render, RenderBuffer, FALSE, scheduler, processor);
+		if (NT_SUCCESS(ntStatus))
+		{
+			ntStatus = InitStream(Capture, CaptureBuffer, TRUE, scheduler, processor);
+		}
+		if (NT_SUCCESS(ntStatus))
+		{
+			CableStream::PairStreams(&Render, &Capture);
+		}
+		return ntStatus;
+	}
+
+	VOID Run()
+	{
+		SHORT* samples = (SHORT*)RenderBuffer.data();
+		for (size_t i = 0; i < RenderBuffer.size() / sizeof(SHORT); ++i)
+		{
+			samples[i] = TEST_SAMPLE_VALUE;
+		}
+
+		for (CableStream* stream : { (CableStream*)&Capture, (CableStream*)&Render })
+		{
+			stream->SetCableState(KSSTATE_ACQUIRE);
+			stream->SetCableState(KSSTATE_PAUSE);
+			stream->SetCableState(KSSTATE_RUN);
+		}
+	}
+};
+
+TEST(CablesSpreadEvenly)
+{
+	CableScheduler scheduler;
+	ULONG perProcessor[TEST_PROCESSORS] = {};
+	ULONG processor;
+
+	HostSetProcessorCount(TEST_PROCESSORS);
+	REQUIRE(NT_SUCCESS(scheduler.Init()));
+	CHECK_EQ(scheduler.GetProcessorCount(), TEST_PROCESSORS);
+
+	for (ULONG i = 0; i < 2 * TEST_PROCESSORS; ++i)
+	{
+		REQUIRE(NT_SUCCESS(scheduler.AddCable(&processor)));
+		REQUIRE(processor < TEST_PROCESSORS);
+		perProcessor[processor]++;
+	}
+	for (ULONG i = 0; i < TEST_PROCESSORS; ++i)
+	{
+		CHECK_EQ(perProcessor[i], 2);
+	}
+
+	// A freed slot is the least loaded one and gets the next cable.
+	scheduler.RemoveCable(1);
+	REQUIRE(NT_SUCCESS(scheduler.AddCable(&processor)));
+	CHECK_EQ(processor, 1);
+
+	AUDIOMIRROR_PROCESSOR_STATISTICS statistics;
+	scheduler.GetProcessorStatistics(1, &statistics);
+	CHECK_EQ(statistics.Size, sizeof(statistics));
+	CHECK_EQ(statistics.Cables, 2);
+
+	HostSetProcessorCount(1);
+}
+
+TEST(TicksRunOnTheHomeProcessor)
+{
+	CableScheduler scheduler;
+	TestCable cables[2 * TEST_PROCESSORS];
+	std::mt19937 random(43);
+
+	HostSetTime(0);
+	HostSetProcessorCount(TEST_PROCESSORS);
+	REQUIRE(NT_SUCCESS(scheduler.Init()));
+
+	for (TestCable& cable : cables)
+	{
+		ULONG processor;
+		REQUIRE(NT_SUCCESS(scheduler.AddCable(&processor)));
+		REQUIRE(NT_SUCCESS(cable.Init(&scheduler, processor)));
+		cable.Run();
+	}
+
+	// The timers expire on any processor.
+	HostSetTimerProcessor([&](PEX_TIMER timer, PVOID context) -> ULONG
+	{
+		UNREFERENCED_PARAMETER(timer);
+		UNREFERENCED_PARAMETER(context);
+		return (ULONG)(random() % TEST_PROCESSORS);
+	});
+	HostRunTimers(MsToQpc(200));
+	HostSetTimerProcessor(nullptr);
+
+	ULONGLONG ticks = 0;
+	for (TestCable& cable : cables)
+	{
+		CHECK_EQ(cable.Render.TicksAway, 0);
+		CHECK_EQ(cable.Capture.TicksAway, 0);
+		CHECK(cable.Capture.Ticks >= 199);
+		ticks += cable.Render.Ticks + cable.Capture.Ticks;
+
+		// The cable still carries the render audio.
+		AUDIOMIRROR_STREAM_STATISTICS statistics;
+		cable.Capture.GetStreamStatistics()->Snapshot(&statistics);
+		CHECK_EQ(statistics.Overruns, 0);
+		CHECK_EQ(statistics.Underruns, 0);
+		CHECK(statistics.RingFillCurrent > 0);
+	}
+
+	// Every tick was counted once, about three in four had to move.
+	ULONGLONG local = 0;
+	ULONGLONG forwarded = 0;
+	for (ULONG i = 0; i < TEST_PROCESSORS; ++i)
+	{
+		AUDIOMIRROR_PROCESSOR_STATISTICS statistics;
+		scheduler.GetProcessorStatistics(i, &statistics);
+		CHECK_EQ(statistics.Cables, 2);
+		CHECK_EQ(statistics.CoalescedTicks, 0);
+		CHECK(statistics.LocalTicks > 0);
+		CHECK(statistics.ForwardedTicks > statistics.LocalTicks);
+		local += statistics.LocalTicks;
+		forwarded += statistics.ForwardedTicks;
+	}
+	CHECK_EQ(local + forwarded, ticks);
+
+	for (TestCable& cable : cables)
+	{
+		cable.Render.ShutdownCable();
+		cable.Capture.ShutdownCable();
+	}
+	HostSetProcessorCount(1);
+}
+
+static VOID CountTick(_In_ PVOID Context)
+{
+	(*(ULONG*)Context)++;
+}
+
+TEST(CancelledTickDoesNotRun)
+{
+	CableScheduler scheduler;
+	CABLE_SCHEDULER_ENTRY entry;
+	ULONG count = 0;
+
+	HostSetProcessorCount(2);
+	REQUIRE(NT_SUCCESS(scheduler.Init()));
+	scheduler.InitEntry(&entry, 1, CountTick, &count);
+
+	// The test runs on processor 0, so the tick is queued on processor 1. A
+	// second one before the queue ran is folded into the first.
+	scheduler.Dispatch(&entry);
+	scheduler.Dispatch(&entry);
+	CHECK_EQ(count, 0);
+	CHECK(entry.Queued);
+	HostRunDpcs();
+	CHECK_EQ(count, 1);
+
+	scheduler.Dispatch(&entry);
+	scheduler.Cancel(&entry);
+	CHECK(!entry.Queued);
+	HostRunDpcs();
+	CHECK_EQ(count, 1);
+
+	AUDIOMIRROR_PROCESSOR_STATISTICS statistics;
+	scheduler.GetProcessorStatistics(1, &statistics);
+	CHECK_EQ(statistics.ForwardedTicks, 1);
+	CHECK_EQ(statistics.CoalescedTicks, 1);
+	CHECK_EQ(statistics.QueueRuns, 2);
+	CHECK_EQ(statistics.QueueDepthMax, 1);
+
+	HostSetProcessorCount(1);
+}
+
+TEST_MAIN()
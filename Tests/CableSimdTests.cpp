@@ -0,0 +1,225 @@
+#include <random>
+#include <vector>
+
+#include "TestHarness.h"
+#include "CableSimd.h"
+
+static const ULONG g_FrameCounts[] = { 0, 1, 3, 31, 97, 480, 1023 };
+
+// Gains around the points where the vector kernels switch how they multiply.
+static const LONG g_EdgeGains[] = { 0, 1, 0x7fff, 0x8000, 0x8001, 0xffff, 0x10000 };
+
+static std::vector<SHORT> RandomSamples(std::mt19937& random, SIZE_T count)
+{
+	std::uniform_int_distribution<int> sample(SHRT_MIN, SHRT_MAX);
+	std::vector<SHORT> samples(count);
+
+	for (SIZE_T i = 0; i < count; ++i)
+	{
+		samples[i] = (SHORT)sample(random);
+	}
+
+	// Make sure the extremes are in there.
+	if (count > 2)
+	{
+		samples[0] = SHRT_MIN;
+		samples[count / 2] = SHRT_MAX;
+	}
+	return samples;
+}
+
+static std::vector<LONG> RandomAccumulator(std::mt19937& random, SIZE_T count)
+{
+	std::uniform_int_distribution<LONG> value(-4 * 32768, 4 * 32768);
+	std::vector<LONG> accumulator(count);
+
+	for (SIZE_T i = 0; i < count; ++i)
+	{
+		accumulator[i] = value(random);
+	}
+	return accumulator;
+}
+
+// Calls check once for every table other than the scalar one the processor can run.
+template<typename Check>
+static VOID ForEachVectorTable(Check check)
+{
+	CableSimdInitialize();
+
+	for (LONG isa = CableSimdScalar + 1; isa < CableSimdIsaCount; ++isa)
+	{
+		PCCABLE_SIMD_KERNELS kernels = CableSimdGetKernels((CABLE_SIMD_ISA)isa);
+		if (kernels != NULL)
+		{
+			check(kernels);
+		}
+	}
+}
+
+TEST(ScalarTableIsAlwaysThere)
+{
+	CableSimdInitialize();
+
+	PCCABLE_SIMD_KERNELS scalar = CableSimdGetKernels(CableSimdScalar);
+	REQUIRE(scalar != NULL);
+	CHECK_EQ(scalar->StateMask, 0);
+	CHECK(CableSimdGetKernels(CableSimdIsaCount) == NULL);
+
+	// The widest supported table is the one selected.
+	CHECK(CableSimdGetSelected() != NULL);
+	for (LONG isa = CableSimdGetSelected()->Isa + 1; isa < CableSimdIsaCount; ++isa)
+	{
+		CHECK(CableSimdGetKernels((CABLE_SIMD_ISA)isa) == NULL);
+	}
+}
+
+TEST(ClampToShortMatchesScalar)
+{
+	PCCABLE_SIMD_KERNELS scalar = CableSimdGetKernels(CableSimdScalar);
+	std::mt19937 random(1);
+
+	ForEachVectorTable([&](PCCABLE_SIMD_KERNELS kernels)
+	{
+		for (ULONG samples : { 0, 1, 7, 8, 15, 16, 33, 64, 1001 })
+		{
+			std::vector<LONG> expectedAccumulator = RandomAccumulator(random, samples);
+			std::vector<LONG> accumulator = expectedAccumulator;
+			std::vector<SHORT> expected(samples + 1, 0x5555);
+			std::vector<SHORT> target(samples + 1, 0x5555);
+
+			scalar->ClampToShort(expected.data(), expectedAccumulator.data(), samples);
+			kernels->ClampToShort(target.data(), accumulator.data(), samples);
+
+			CHECK(target == expected);
+			CHECK(accumulator == expectedAccumulator);
+		}
+	});
+}
+
+TEST(AccumulateScaledMatchesScalar)
+{
+	PCCABLE_SIMD_KERNELS scalar = CableSimdGetKernels(CableSimdScalar);
+	std::mt19937 random(2);
+	std::uniform_int_distribution<LONG> gain(0, 0x10000);
+
+	ForEachVectorTable([&](PCCABLE_SIMD_KERNELS kernels)
+	{
+		for (ULONG channels = 1; channels <= CABLE_SIMD_MAX_CHANNELS; ++channels)
+		{
+			for (ULONG frames : g_FrameCounts)
+			{
+				std::vector<SHORT> samples = RandomSamples(random, frames * channels);
+				std::vector<LONG> expected = RandomAccumulator(random, frames * channels + 1);
+				std::vector<LONG> accumulator = expected;
+				LONG gains[CABLE_SIMD_MAX_CHANNELS];
+
+				for (ULONG c = 0; c < channels; ++c)
+				{
+					gains[c] = (c % 2) ? g_EdgeGains[(frames + c) % ARRAYSIZE(g_EdgeGains)] : gain(random);
+				}
+
+				scalar->AccumulateScaled(expected.data(), samples.data(), frames, channels, gains);
+				kernels->AccumulateScaled(accumulator.data(), samples.data(), frames, channels, gains);
+
+				CHECK(accumulator == expected);
+			}
+		}
+	});
+}
+
+TEST(TrackPeaksMatchesScalar)
+{
+	PCCABLE_SIMD_KERNELS scalar = CableSimdGetKernels(CableSimdScalar);
+	std::mt19937 random(3);
+	std::uniform_int_distribution<LONG> start(0, 1000);
+
+	ForEachVectorTable([&](PCCABLE_SIMD_KERNELS kernels)
+	{
+		for (ULONG channels = 1; channels <= CABLE_SIMD_MAX_CHANNELS; ++channels)
+		{
+			for (ULONG frames : g_FrameCounts)
+			{
+				std::vector<SHORT> samples = RandomSamples(random, frames * channels);
+				LONG expected[CABLE_SIMD_MAX_CHANNELS];
+				LONG peaks[CABLE_SIMD_MAX_CHANNELS];
+
+				// Scale some channels down so not every peak is near full scale.
+				for (SIZE_T i = 0; i < samples.size(); ++i)
+				{
+					samples[i] = (SHORT)(samples[i] >> (i % channels));
+				}
+				for (ULONG c = 0; c < channels; ++c)
+				{
+					expected[c] = peaks[c] = start(random);
+				}
+
+				scalar->TrackPeaks(samples.data(), frames, channels, expected);
+				kernels->TrackPeaks(samples.data(), frames, channels, peaks);
+
+				for (ULONG c = 0; c < channels; ++c)
+				{
+					CHECK_EQ(peaks[c], expected[c]);
+				}
+			}
+		}
+	});
+}
+
+TEST(PeaksSaturateAtShortMax)
+{
+	SHORT samples[64];
+	LONG peaks[2];
+
+	for (SIZE_T i = 0; i < ARRAYSIZE(samples); ++i)
+	{
+		samples[i] = (i % 2) ? 100 : SHRT_MIN;
+	}
+
+	CableSimdInitialize();
+	for (LONG isa = CableSimdScalar; isa < CableSimdIsaCount; ++isa)
+	{
+		PCCABLE_SIMD_KERNELS kernels = CableSimdGetKernels((CABLE_SIMD_ISA)isa);
+		if (kernels == NULL)
+		{
+			continue;
+		}
+
+		peaks[0] = peaks[1] = 0;
+		kernels->TrackPeaks(samples, ARRAYSIZE(samples) / 2, 2, peaks);
+		CHECK_EQ(peaks[0], SHRT_MAX);
+		CHECK_EQ(peaks[1], 100);
+	}
+}
+
+TEST(BracketSavesTheStateOfTheSelectedTable)
+{
+	CABLE_SIMD_CONTEXT simd;
+
+	CableSimdInitialize();
+
+	// Scalar kernels need nothing saved.
+	REQUIRE(NT_SUCCESS(CableSimdSelect(CableSimdScalar)));
+	ULONGLONG saves = HostGetExtendedStateSaves();
+	CableSimdEnter(&simd);
+	CHECK(simd.Kernels == CableSimdGetKernels(CableSimdScalar));
+	CHECK(!simd.Saved);
+	CableSimdLeave(&simd);
+	CHECK_EQ(HostGetExtendedStateSaves(), saves);
+
+	if (CableSimdGetKernels(CableSimdAvx2) != NULL)
+	{
+		REQUIRE(NT_SUCCESS(CableSimdSelect(CableSimdAvx2)));
+		CableSimdEnter(&simd);
+		CHECK(simd.Kernels == CableSimdGetKernels(CableSimdAvx2));
+		CHECK(simd.Saved);
+		CHECK((simd.State.Mask & XSTATE_MASK_AVX) != 0);
+		CableSimdLeave(&simd);
+		CHECK(!simd.Saved);
+		CHECK_EQ(HostGetExtendedStateSaves(), saves + 1);
+	}
+
+	CHECK_EQ(CableSimdSelect(CableSimdIsaCount), STATUS_NOT_SUPPORTED);
+	CableSimdInitialize();
+}
+
+TEST_MAIN()
@@ -0,0 +1,547 @@
+#include "TestHarness.h"
+#include "CableStream.h"
+#include "CableTapReader.h"
+#include "CableSimd.h"
+
+#include <vector>
+
+#define TEST_SAMPLE_RATE        48000
+#define TEST_CHANNELS           2
+#define TEST_BLOCK_ALIGN        (TEST_CHANNELS * sizeof(SHORT))
+#define TEST_BYTES_PER_MS       (TEST_SAMPLE_RATE / 1000 * TEST_BLOCK_ALIGN)
+#define TEST_BUFFER_MS          10
+#define TEST_NOTIFICATIONS      2
+#define TEST_SAMPLE_VALUE       0x1234
+
+static WAVEFORMATEX MakeFormat()
+{
+	WAVEFORMATEX format = {};
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = TEST_CHANNELS;
+	format.nSamplesPerSec = TEST_SAMPLE_RATE;
+	format.wBitsPerSample = 16;
+	format.nBlockAlign = TEST_BLOCK_ALIGN;
+	format.nAvgBytesPerSec = TEST_SAMPLE_RATE * TEST_BLOCK_ALIGN;
+	format.cbSize = 0;
+	return format;
+}
+
+static ULONGLONG MsToQpc(ULONGLONG ms)
+{
+	return ms * HOST_QPC_FREQUENCY / 1000;
+}
+
+/*
+	One stream with a DMA buffer the test owns, set up the way the miniport
+	does it in Init and AllocateBufferWithNotification.
+*/
+struct TestStream
+{
+	CableStream         Stream;
+	std::vector<BYTE>   Buffer;
+	ULONG               PacketSize = 0;
+
+	NTSTATUS Init(BOOLEAN capture, CableMixer* mixer = NULL, BOOLEAN clockLocked = FALSE, BOOLEAN mirroredRing = FALSE, ULONG prerollMs = 0)
+	{
+		WAVEFORMATEX format = MakeFormat();
+		CABLE_STREAM_CONFIG config = {};
+		ULONG size = TEST_BUFFER_MS * TEST_BYTES_PER_MS;
+		NTSTATUS ntStatus;
+
+		config.Capture = capture;
+		config.RingBufferCount = clockLocked ? CABLE_RING_BUFFERS_CLOCK_LOCKED : CABLE_RING_BUFFERS_DEFAULT;
+		config.Mixer = mixer;
+		config.ClockLocked = clockLocked;
+		config.MirroredRing = mirroredRing;
+		config.PrerollMs = prerollMs;
+
+		ntStatus = Stream.InitCable(&format, &config);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		ntStatus = Stream.PrepareBuffer(TEST_NOTIFICATIONS, &size, &PacketSize);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		Buffer.assign(size, 0);
+		Stream.AttachDmaBuffer(Buffer.data(), size, TEST_NOTIFICATIONS, PacketSize);
+		return STATUS_SUCCESS;
+	}
+
+	VOID Run()
+	{
+		Stream.SetCableState(KSSTATE_ACQUIRE);
+		Stream.SetCableState(KSSTATE_PAUSE);
+		Stream.SetCableState(KSSTATE_RUN);
+	}
+
+	VOID Fill(SHORT value)
+	{
+		SHORT* samples = (SHORT*)Buffer.data();
+		for (size_t i = 0; i < Buffer.size() / sizeof(SHORT); ++i)
+		{
+			samples[i] = value;
+		}
+	}
+
+	// Counts the samples of the last ms bytes before the DMA position that hold value.
+	ULONG CountBehindPosition(ULONG ms, SHORT value)
+	{
+		ULONGLONG linear = 0;
+		ULONG count = 0;
+
+		Stream.GetPositions(&linear, NULL, NULL);
+		for (ULONG i = 0; i < ms * TEST_BYTES_PER_MS / sizeof(SHORT); ++i)
+		{
+			ULONGLONG offset = (linear - (i + 1) * sizeof(SHORT)) % Buffer.size();
+			if (*(SHORT*)(Buffer.data() + offset) == value)
+			{
+				count++;
+			}
+		}
+		return count;
+	}
+};
+
+TEST(PacketsCompleteWithTheVirtualClock)
+{
+	TestStream render;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	CHECK_EQ(render.PacketSize, TEST_BUFFER_MS / TEST_NOTIFICATIONS * TEST_BYTES_PER_MS);
+
+	render.Run();
+	HostRunTimers(MsToQpc(12));
+
+	ULONG packets = 0;
+	ULONGLONG linear = 0;
+	CHECK(NT_SUCCESS(render.Stream.GetCompletedPacketCount(&packets)));
+	CHECK_EQ(packets, 2);
+	CHECK(NT_SUCCESS(render.Stream.GetPositions(&linear, NULL, NULL)));
+	CHECK_EQ(linear, 12 * TEST_BYTES_PER_MS);
+
+	render.Stream.SetCableState(KSSTATE_PAUSE);
+	HostRunTimers(MsToQpc(30));
+	CHECK(NT_SUCCESS(render.Stream.GetCompletedPacketCount(&packets)));
+	CHECK_EQ(packets, 2);
+}
+
+TEST(PairedRenderReachesCapture)
+{
+	TestStream render;
+	TestStream capture;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	render.Fill(TEST_SAMPLE_VALUE);
+	capture.Run();
+	render.Run();
+	HostRunTimers(MsToQpc(100));
+
+	// The capture ring delivers once it holds two buffers, after that every
+	// sample is render audio.
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	capture.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.Overruns, 0);
+	CHECK_EQ(statistics.Underruns, 0);
+	CHECK(statistics.ZeroFilledBytes > 0);
+	CHECK_EQ(statistics.PrerollBytes, 0);
+	// The ring delivers from the tick after it got more than half full.
+	CHECK_EQ(statistics.FirstAudioUs, (2 * TEST_BUFFER_MS + 1) * 1000);
+
+	render.Stream.ShutdownCable();
+	capture.Stream.ShutdownCable();
+}
+
+TEST(PairedRenderReachesMirroredCapture)
+{
+	TestStream render;
+	TestStream capture;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE, NULL, FALSE, TRUE)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	render.Fill(TEST_SAMPLE_VALUE);
+	capture.Run();
+	render.Run();
+
+	// Long enough for the cursors to pass the end of the mirror a few times.
+	HostRunTimers(MsToQpc(400));
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	capture.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.Overruns, 0);
+	CHECK_EQ(statistics.Underruns, 0);
+
+	render.Stream.ShutdownCable();
+	capture.Stream.ShutdownCable();
+}
+
+TEST(PrerollStartsWithTheRenderHistory)
+{
+	TestStream render;
+	TestStream capture;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE, NULL, FALSE, FALSE, 15)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	// The render side plays long before anyone captures.
+	render.Fill(TEST_SAMPLE_VALUE);
+	render.Run();
+	HostRunTimers(MsToQpc(200));
+	capture.Run();
+	HostRunTimers(MsToQpc(205));
+
+	// Nothing took the render audio, so it last put 4 ms ago at the idle
+	// rate. Those bytes arrive with its next tick and make up the rest.
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	capture.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.PrerollBytes, 11 * TEST_BYTES_PER_MS);
+	CHECK_EQ(statistics.FirstAudioUs, 0);
+	CHECK_EQ(statistics.ZeroFilledBytes, 0);
+	CHECK_EQ(statistics.Overruns, 0);
+	CHECK_EQ(capture.CountBehindPosition(5, TEST_SAMPLE_VALUE), 5 * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	render.Stream.ShutdownCable();
+	capture.Stream.ShutdownCable();
+}
+
+TEST(PrerollSkipsStaleHistory)
+{
+	TestStream render;
+	TestStream capture;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE, NULL, FALSE, FALSE, 15)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	render.Fill(TEST_SAMPLE_VALUE);
+	render.Run();
+	HostRunTimers(MsToQpc(100));
+	render.Stream.SetCableState(KSSTATE_PAUSE);
+	HostRunTimers(MsToQpc(200));
+	capture.Run();
+	HostRunTimers(MsToQpc(250));
+
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	capture.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.PrerollBytes, 0);
+	CHECK_EQ(statistics.FirstAudioUs, AUDIOMIRROR_NO_FIRST_AUDIO);
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, 0), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	render.Stream.ShutdownCable();
+	capture.Stream.ShutdownCable();
+}
+
+TEST(StoppedRenderStarvesCapture)
+{
+	TestStream render;
+	TestStream capture;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	render.Fill(TEST_SAMPLE_VALUE);
+	capture.Run();
+	render.Run();
+	HostRunTimers(MsToQpc(50));
+	render.Stream.SetCableState(KSSTATE_PAUSE);
+	HostRunTimers(MsToQpc(150));
+
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	capture.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.Underruns, 1);
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, 0), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+}
+
+TEST(MixerFeedsCaptureAndTap)
+{
+	WAVEFORMATEX format = MakeFormat();
+	EndpointGain gain(TEST_CHANNELS);
+	CableMixer* mixer = new(NonPagedPoolNx, 'xiMT') CableMixer;
+	CableTap* tap = new(NonPagedPoolNx, 'paTT') CableTap;
+	AUDIOMIRROR_TAP_MAPPING mapping = {};
+
+	REQUIRE(NT_SUCCESS(mixer->Init(&format, &gain)));
+	REQUIRE(NT_SUCCESS(tap->Init(&format)));
+	REQUIRE(NT_SUCCESS(tap->MapIntoCurrentProcess(&mapping)));
+	mixer->AttachTap(tap);
+
+	{
+		TestStream render;
+		TestStream capture;
+
+		HostSetTime(0);
+		REQUIRE(NT_SUCCESS(render.Init(FALSE, mixer)));
+		REQUIRE(NT_SUCCESS(capture.Init(TRUE)));
+		REQUIRE(NT_SUCCESS(mixer->AddSink(&capture.Stream)));
+
+		TapReader reader;
+		REQUIRE(reader.Attach((const void*)(ULONG_PTR)mapping.ViewAddress, (size_t)mapping.ViewSize));
+
+		render.Fill(TEST_SAMPLE_VALUE);
+		capture.Run();
+		render.Run();
+		HostRunTimers(MsToQpc(100));
+
+		CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+		std::vector<SHORT> tapped(TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+		CHECK_EQ(reader.Available(), 100 * TEST_BYTES_PER_MS);
+		CHECK_EQ(reader.Read(tapped.data(), tapped.size() * sizeof(SHORT)), tapped.size() * sizeof(SHORT));
+		CHECK_EQ(tapped.front(), TEST_SAMPLE_VALUE);
+		CHECK_EQ(tapped.back(), TEST_SAMPLE_VALUE);
+		CHECK_EQ(reader.LostBytes(), 0);
+
+		mixer->RemoveSink(&capture.Stream);
+		render.Stream.ShutdownCable();
+	}
+
+	delete mixer;
+}
+
+TEST(MixerSumsInputsOnceBracketedPerTick)
+{
+	WAVEFORMATEX format = MakeFormat();
+	EndpointGain gain(TEST_CHANNELS);
+	CableMixer* mixer = new(NonPagedPoolNx, 'xiMT') CableMixer;
+
+	REQUIRE(NT_SUCCESS(mixer->Init(&format, &gain)));
+
+	// The widest table, so the vector kernels sum and the bracket saves state.
+	CableSimdInitialize();
+
+	{
+		TestStream first;
+		TestStream second;
+		TestStream capture;
+
+		HostSetTime(0);
+		REQUIRE(NT_SUCCESS(first.Init(FALSE, mixer)));
+		REQUIRE(NT_SUCCESS(second.Init(FALSE, mixer)));
+		REQUIRE(NT_SUCCESS(capture.Init(TRUE)));
+		REQUIRE(NT_SUCCESS(mixer->AddSink(&capture.Stream)));
+
+		first.Fill(TEST_SAMPLE_VALUE);
+		second.Fill(0x0100);
+		capture.Run();
+		first.Run();
+		second.Run();
+		HostRunTimers(MsToQpc(20));
+
+		// Every render tick brackets its whole block once, however many
+		// kernels the mix runs in it.
+		ULONGLONG saves = HostGetExtendedStateSaves();
+		ULONGLONG callbacks = HostRunTimers(MsToQpc(120));
+		if (CableSimdGetSelected()->StateMask != 0)
+		{
+			CHECK_EQ(HostGetExtendedStateSaves() - saves, callbacks * 2 / 3);
+		}
+
+		CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE + 0x0100), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+		CHECK_EQ(gain.GetPeakMeter(0), (LONG)(TEST_SAMPLE_VALUE + 0x0100) << 16);
+
+		mixer->RemoveSink(&capture.Stream);
+		first.Stream.ShutdownCable();
+		second.Stream.ShutdownCable();
+	}
+
+	delete mixer;
+}
+
+TEST(ClockLockedCaptureFollowsRender)
+{
+	TestStream render;
+	TestStream capture;
+	ULONG tick = 0;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE, NULL, TRUE)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	// Only the render timer runs late, up to most of a period.
+	HostSetTimerLateness([&](PEX_TIMER timer, PVOID context) -> LONGLONG
+	{
+		UNREFERENCED_PARAMETER(timer);
+		return context == &render.Stream ? (LONGLONG)(tick++ * 3571 % 9000) : 0;
+	});
+
+	render.Fill(TEST_SAMPLE_VALUE);
+	capture.Run();
+	render.Run();
+	HostRunTimers(MsToQpc(500));
+	HostSetTimerLateness(nullptr);
+
+	CHECK(capture.Stream.IsClockLocked());
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	// The capture position stays exactly the offset behind the render side.
+	ULONGLONG renderLinear = 0;
+	ULONGLONG captureLinear = 0;
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	render.Stream.GetPositions(&renderLinear, NULL, NULL);
+	capture.Stream.GetPositions(&captureLinear, NULL, NULL);
+	capture.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.RingFillCurrent, CABLE_CLOCK_LOCK_OFFSET_MS * TEST_BYTES_PER_MS);
+	CHECK_EQ(statistics.Underruns, 0);
+	CHECK_EQ(statistics.Overruns, 0);
+	CHECK_EQ(statistics.ClockLockFallbacks, 0);
+	CHECK(captureLinear <= renderLinear);
+
+	render.Stream.ShutdownCable();
+	capture.Stream.ShutdownCable();
+}
+
+TEST(ClockLockFallsBackWhileRenderStops)
+{
+	TestStream render;
+	TestStream capture;
+	ULONGLONG before = 0;
+	ULONGLONG after = 0;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE, NULL, TRUE)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	render.Fill(TEST_SAMPLE_VALUE);
+	capture.Run();
+	render.Run();
+	HostRunTimers(MsToQpc(100));
+	CHECK(capture.Stream.IsClockLocked());
+
+	// Without render audio the capture stream keeps time on its own clock.
+	render.Stream.SetCableState(KSSTATE_PAUSE);
+	capture.Stream.GetPositions(&before, NULL, NULL);
+	HostRunTimers(MsToQpc(200));
+	capture.Stream.GetPositions(&after, NULL, NULL);
+	CHECK(!capture.Stream.IsClockLocked());
+	CHECK(after - before >= (100 - CABLE_CLOCK_LOCK_HOLDOVER_MS - 1) * TEST_BYTES_PER_MS);
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, 0), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	render.Run();
+	HostRunTimers(MsToQpc(300));
+	CHECK(capture.Stream.IsClockLocked());
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	capture.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.ClockLockFallbacks, 1);
+
+	render.Stream.ShutdownCable();
+	capture.Stream.ShutdownCable();
+}
+
+TEST(RenderTicksPerPacketWithoutARunningCapture)
+{
+	TestStream render;
+	TestStream capture;
+	const ULONGLONG packetMs = TEST_BUFFER_MS / TEST_NOTIFICATIONS;
+	std::vector<ULONGLONG> expiries;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	render.Fill(TEST_SAMPLE_VALUE);
+	HostSetTimerObserver([&](PEX_TIMER, ULONGLONG dueQpc, ULONGLONG) { expiries.push_back(dueQpc); });
+	render.Run();
+	HostRunTimers(MsToQpc(50));
+	HostSetTimerObserver(nullptr);
+
+	// After the first tick the timer only fires 1 ms past every packet
+	// boundary, as late as a notification at the full rate gets.
+	CHECK(render.Stream.IsTimerIdle());
+	REQUIRE(expiries.size() == 50 / packetMs);
+	CHECK_EQ(expiries[0], MsToQpc(1));
+	for (size_t i = 1; i < expiries.size(); ++i)
+	{
+		CHECK_EQ(expiries[i], MsToQpc(i * packetMs + 1));
+	}
+
+	// A running capture stream wakes it up on its next tick.
+	capture.Run();
+	HostRunTimers(MsToQpc(100));
+	CHECK(!render.Stream.IsTimerIdle());
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	render.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.IdleTimerTicks, expiries.size());
+	CHECK_EQ(statistics.TimerTicks, expiries.size() + 1 + (100 - 51));
+
+	render.Stream.ShutdownCable();
+	capture.Stream.ShutdownCable();
+}
+
+TEST(SilentCaptureTicksPerPacketUntilSoundArrives)
+{
+	TestStream render;
+	TestStream capture;
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE)));
+	CableStream::PairStreams(&render.Stream, &capture.Stream);
+
+	render.Fill(0);
+	capture.Run();
+	render.Run();
+	HostRunTimers(MsToQpc(CABLE_IDLE_SILENCE_MS - 10));
+	CHECK(!capture.Stream.IsTimerIdle());
+	HostRunTimers(MsToQpc(CABLE_IDLE_SILENCE_MS + 10));
+	CHECK(capture.Stream.IsTimerIdle());
+	CHECK(!render.Stream.IsTimerIdle());
+
+	// Back at the full rate within a packet of the first sound it delivers,
+	// which is the ring latency after the render side played it.
+	render.Fill(TEST_SAMPLE_VALUE);
+	HostRunTimers(MsToQpc(CABLE_IDLE_SILENCE_MS + 10 + 2 * TEST_BUFFER_MS + TEST_BUFFER_MS / TEST_NOTIFICATIONS + 2));
+	CHECK(!capture.Stream.IsTimerIdle());
+	CHECK(capture.CountBehindPosition(1, TEST_SAMPLE_VALUE) > 0);
+
+	capture.Stream.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK(statistics.IdleTimerTicks > 0);
+	CHECK_EQ(statistics.Underruns, 0);
+
+	render.Stream.ShutdownCable();
+	capture.Stream.ShutdownCable();
+}
+
+TEST(ShutdownReleasesEverything)
+{
+	SIZE_T before = HostGetPoolAllocations();
+	{
+		TestStream render;
+		TestStream capture;
+
+		REQUIRE(NT_SUCCESS(render.Init(FALSE)));
+		REQUIRE(NT_SUCCESS(capture.Init(TRUE)));
+		CableStream::PairStreams(&render.Stream, &capture.Stream);
+		capture.Run();
+		render.Run();
+		HostRunTimers(HostGetTime() + MsToQpc(20));
+	}
+	CHECK_EQ(HostGetPoolAllocations(), before);
+}
+
+TEST_MAIN()
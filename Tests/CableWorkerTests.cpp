@@ -0,0 +1,299 @@
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "TestHarness.h"
+#include "CableStream.h"
+
+#define TEST_SAMPLE_RATE        48000
+#define TEST_CHANNELS           2
+#define TEST_BLOCK_ALIGN        (TEST_CHANNELS * sizeof(SHORT))
+#define TEST_BYTES_PER_MS       (TEST_SAMPLE_RATE / 1000 * TEST_BLOCK_ALIGN)
+#define TEST_BUFFER_MS          10
+#define TEST_NOTIFICATIONS      2
+#define TEST_SAMPLE_VALUE       0x1234
+
+static ULONGLONG MsToQpc(ULONGLONG ms)
+{
+	return ms * HOST_QPC_FREQUENCY / 1000;
+}
+
+/*
+	Stream in worker mode whose worker can be held up. A capture block asks
+	for the injection ring first, that is where the worker gets stuck.
+*/
+class WorkerStream : public CableStream
+{
+public:
+	std::vector<BYTE>       Buffer;
+	std::mutex              StallLock;
+	std::condition_variable StallChanged;
+	bool                    Stall = false;
+	bool                    Stalled = false;
+
+	NTSTATUS Init(BOOLEAN capture, BOOLEAN workerThread, BOOLEAN clockLocked = FALSE)
+	{
+		WAVEFORMATEX format = {};
+		CABLE_STREAM_CONFIG config = {};
+		ULONG size = TEST_BUFFER_MS * TEST_BYTES_PER_MS;
+		ULONG packetSize = 0;
+		NTSTATUS ntStatus;
+
+		format.wFormatTag = WAVE_FORMAT_PCM;
+		format.nChannels = TEST_CHANNELS;
+		format.nSamplesPerSec = TEST_SAMPLE_RATE;
+		format.wBitsPerSample = 16;
+		format.nBlockAlign = TEST_BLOCK_ALIGN;
+		format.nAvgBytesPerSec = TEST_SAMPLE_RATE * TEST_BLOCK_ALIGN;
+
+		config.Capture = capture;
+		config.RingBufferCount = CABLE_RING_BUFFERS_DEFAULT;
+		config.ClockLocked = clockLocked;
+		config.WorkerThread = workerThread;
+
+		ntStatus = InitCable(&format, &config);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		ntStatus = PrepareBuffer(TEST_NOTIFICATIONS, &size, &packetSize);
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+		Buffer.assign(size, 0);
+		AttachDmaBuffer(Buffer.data(), size, TEST_NOTIFICATIONS, packetSize);
+		return STATUS_SUCCESS;
+	}
+
+	VOID Run()
+	{
+		SetCableState(KSSTATE_ACQUIRE);
+		SetCableState(KSSTATE_PAUSE);
+		SetCableState(KSSTATE_RUN);
+	}
+
+	BOOLEAN LastBufferRendered()
+	{
+		return m_bLastBufferRendered;
+	}
+
+	// The stream was asked to follow the render side.
+	BOOLEAN WantsClockLock()
+	{
+		return m_bClockLock;
+	}
+
+	// Waits until the worker finished what the DPC queued so far.
+	VOID Flush()
+	{
+		if (m_pWorker)
+		{
+			m_pWorker->Flush();
+		}
+	}
+
+	VOID SetStall(bool stall)
+	{
+		{
+			std::lock_guard<std::mutex> guard(StallLock);
+			Stall = stall;
+		}
+		StallChanged.notify_all();
+	}
+
+	// Waits until the worker is stuck in a block.
+	VOID WaitStalled()
+	{
+		std::unique_lock<std::mutex> lock(StallLock);
+		StallChanged.wait(lock, [this]() { return Stalled; });
+	}
+
+	// Counts the samples of the last ms before the DMA position that hold value.
+	ULONG CountBehindPosition(ULONG ms, SHORT value)
+	{
+		ULONGLONG linear = 0;
+		ULONG count = 0;
+
+		GetPositions(&linear, NULL, NULL);
+		for (ULONG i = 0; i < ms * TEST_BYTES_PER_MS / sizeof(SHORT); ++i)
+		{
+			ULONGLONG offset = (linear - (i + 1) * sizeof(SHORT)) % Buffer.size();
+			if (*(SHORT*)(Buffer.data() + offset) == value)
+			{
+				count++;
+			}
+		}
+		return count;
+	}
+
+protected:
+	CableInjector* GetCableInjector() override
+	{
+		std::unique_lock<std::mutex> lock(StallLock);
+		if (Stall)
+		{
+			Stalled = true;
+			StallChanged.notify_all();
+			StallChanged.wait(lock, [this]() { return !Stall; });
+			Stalled = false;
+		}
+		return NULL;
+	}
+};
+
+// Runs the timers in 1 ms steps and lets the workers keep up with every tick.
+static VOID RunInStep(ULONGLONG untilMs, WorkerStream& render, WorkerStream& capture)
+{
+	for (ULONGLONG ms = HostGetTime() * 1000 / HOST_QPC_FREQUENCY + 1; ms <= untilMs; ++ms)
+	{
+		HostRunTimers(MsToQpc(ms));
+		render.Flush();
+		capture.Flush();
+	}
+}
+
+TEST(WorkerCarriesTheCable)
+{
+	WorkerStream render;
+	WorkerStream capture;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE, TRUE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE, TRUE)));
+	REQUIRE(render.IsWorkerMode());
+	REQUIRE(capture.IsWorkerMode());
+	CableStream::PairStreams(&render, &capture);
+
+	SHORT* samples = (SHORT*)render.Buffer.data();
+	for (size_t i = 0; i < render.Buffer.size() / sizeof(SHORT); ++i)
+	{
+		samples[i] = TEST_SAMPLE_VALUE;
+	}
+	capture.Run();
+	render.Run();
+	RunInStep(200, render, capture);
+
+	// Same result as the DPC copying it, every sample is render audio.
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	capture.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.Overruns, 0);
+	CHECK_EQ(statistics.Underruns, 0);
+	CHECK_EQ(statistics.WorkerMisses, 0);
+	CHECK_EQ(statistics.WorkerLateBlocks, 0);
+	CHECK(statistics.WorkerBlocks >= 199);
+	CHECK(statistics.WorkerDelay.SampleCount == statistics.WorkerBlocks);
+
+	render.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.WorkerMisses, 0);
+	CHECK(statistics.WorkerBlocks >= 199);
+
+	render.ShutdownCable();
+	capture.ShutdownCable();
+}
+
+TEST(WorkerRenderStopsAtTheEndOfStream)
+{
+	WorkerStream render;
+	WorkerStream capture;
+	ULONGLONG linear = 0;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE, TRUE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE, TRUE)));
+	CableStream::PairStreams(&render, &capture);
+
+	capture.Run();
+	render.Run();
+	RunInStep(4, render, capture);
+
+	// The last buffer ends 8 ms into the stream, the worker gets nothing past it.
+	REQUIRE(NT_SUCCESS(render.SetLastBufferWritePosition(8 * TEST_BYTES_PER_MS)));
+	RunInStep(30, render, capture);
+
+	CHECK(render.LastBufferRendered());
+	CHECK(NT_SUCCESS(render.GetPositions(&linear, NULL, NULL)));
+	CHECK_EQ(linear, 8 * TEST_BYTES_PER_MS);
+
+	render.ShutdownCable();
+	capture.ShutdownCable();
+}
+
+TEST(StalledWorkerFallsBackToZeroFill)
+{
+	WorkerStream render;
+	WorkerStream capture;
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+
+	HostSetTime(0);
+	REQUIRE(NT_SUCCESS(render.Init(FALSE, TRUE)));
+	REQUIRE(NT_SUCCESS(capture.Init(TRUE, TRUE)));
+	CableStream::PairStreams(&render, &capture);
+
+	SHORT* samples = (SHORT*)render.Buffer.data();
+	for (size_t i = 0; i < render.Buffer.size() / sizeof(SHORT); ++i)
+	{
+		samples[i] = TEST_SAMPLE_VALUE;
+	}
+	capture.Run();
+	render.Run();
+	RunInStep(100, render, capture);
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	// The capture worker gets stuck in its next block for 15 ms, short enough
+	// for the ring to hold what the render side writes meanwhile. The DPC
+	// keeps the position moving and zero fills every block it misses.
+	capture.SetStall(true);
+	HostRunTimers(MsToQpc(101));
+	capture.WaitStalled();
+	for (ULONGLONG ms = 102; ms <= 115; ++ms)
+	{
+		HostRunTimers(MsToQpc(ms));
+		render.Flush();
+	}
+
+	capture.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK(statistics.WorkerMisses >= 10);
+	CHECK(statistics.WorkerFallbackBytes >= 10 * TEST_BYTES_PER_MS);
+	CHECK_EQ(statistics.WorkerLateBlocks, 1);
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, 0), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	// Once the worker is back it delivers again and misses nothing.
+	capture.SetStall(false);
+	capture.Flush();
+	ULONGLONG misses = statistics.WorkerMisses;
+	RunInStep(300, render, capture);
+
+	capture.GetStreamStatistics()->Snapshot(&statistics);
+	CHECK_EQ(statistics.WorkerMisses, misses);
+	CHECK_EQ(statistics.Overruns, 0);
+	CHECK_EQ(capture.CountBehindPosition(TEST_BUFFER_MS, TEST_SAMPLE_VALUE), TEST_BUFFER_MS * TEST_BYTES_PER_MS / sizeof(SHORT));
+
+	render.ShutdownCable();
+	capture.ShutdownCable();
+}
+
+TEST(ClockLockedCaptureStaysInTheDpc)
+{
+	WorkerStream locked;
+	WorkerStream worker;
+
+	// A locked capture stream reads the ring in the DPC, where it follows
+	// the render side.
+	REQUIRE(NT_SUCCESS(locked.Init(TRUE, TRUE, TRUE)));
+	CHECK(!locked.IsWorkerMode());
+	CHECK(locked.WantsClockLock());
+
+	// A stream in worker mode cannot be locked later either.
+	REQUIRE(NT_SUCCESS(worker.Init(TRUE, TRUE)));
+	REQUIRE(worker.IsWorkerMode());
+	worker.SetClockLock(TRUE);
+	CHECK(!worker.WantsClockLock());
+
+	locked.ShutdownCable();
+	worker.ShutdownCable();
+}
+
+TEST_MAIN()
@@ -0,0 +1,37 @@
+#
+# Fails when a derived class declares a field its base class already has.
+# The derived field hides the base one and nothing warns about it, the
+# driver side of the stream is not part of the host build. Run with
+# cmake -DBASE=<header> -DDERIVED=<header> -P CheckHiddenMembers.cmake
+#
+
+cmake_policy(SET CMP0057 NEW)
+
+function(read_members header out)
+	# Fields are declared one per line, one tab deep, in the class body.
+	file(STRINGS ${header} lines REGEX "^\t[A-Za-z_][^(]*[ \t*]m_[A-Za-z0-9_]+(\\[[^]]*\\])?;")
+	set(members)
+	foreach(line IN LISTS lines)
+		string(REGEX MATCH "m_[A-Za-z0-9_]+(\\[[^]]*\\])?;" member "${line}")
+		string(REGEX REPLACE "(\\[.*)?;$" "" member "${member}")
+		list(APPEND members ${member})
+	endforeach()
+	set(${out} ${members} PARENT_SCOPE)
+endfunction()
+
+read_members(${BASE} baseMembers)
+read_members(${DERIVED} derivedMembers)
+if(NOT baseMembers)
+	message(FATAL_ERROR "no fields found in ${BASE}")
+endif()
+
+set(hidden)
+foreach(member IN LISTS derivedMembers)
+	if(member IN_LIST baseMembers)
+		list(APPEND hidden ${member})
+	endif()
+endforeach()
+
+if(hidden)
+	message(FATAL_ERROR "${DERIVED} hides fields of ${BASE}: ${hidden}")
+endif()
@@ -0,0 +1,356 @@
+#include "TestHarness.h"
+#include "RingBuffer.h"
+
+#include <vector>
+
+static std::vector<BYTE> Sequence(SIZE_T count, BYTE first)
+{
+	std::vector<BYTE> bytes(count);
+	for (SIZE_T i = 0; i < count; ++i)
+	{
+		bytes[i] = (BYTE)(first + i);
+	}
+	return bytes;
+}
+
+TEST(TakeWaitsUntilHalfFull)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> block = Sequence(32, 0);
+	std::vector<BYTE> target(64);
+	SIZE_T read = 1;
+
+	CHECK_EQ(ring.Put(block.data(), block.size()), STATUS_SUCCESS);
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_DEVICE_NOT_READY);
+	CHECK_EQ(read, 0);
+	CHECK_EQ(ring.GetAvailableBytes(), 0);
+	CHECK_EQ(ring.GetFillBytes(), 32);
+
+	CHECK_EQ(ring.Put(block.data(), 4), STATUS_SUCCESS);
+	CHECK_EQ(ring.GetAvailableBytes(), 36);
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_SUCCESS);
+	CHECK_EQ(read, 36);
+}
+
+TEST(DataSurvivesWrap)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> target(64);
+	SIZE_T read = 0;
+
+	// Move the cursors close to the end of the ring first.
+	std::vector<BYTE> first = Sequence(48, 100);
+	ring.Put(first.data(), first.size());
+	ring.Take(target.data(), 48, &read);
+	REQUIRE(read == 48);
+
+	std::vector<BYTE> second = Sequence(40, 7);
+	CHECK_EQ(ring.Put(second.data(), second.size()), STATUS_SUCCESS);
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_SUCCESS);
+	REQUIRE(read == 40);
+	for (SIZE_T i = 0; i < 40; ++i)
+	{
+		CHECK_EQ(target[i], second[i]);
+	}
+	CHECK_EQ(ring.GetReadPosition(), 88);
+	CHECK_EQ(ring.GetWritePosition(), 88);
+}
+
+TEST(OverflowDropsOldestAndReportsIt)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> block = Sequence(48, 0);
+	SIZE_T discarded = 1;
+	CHECK_EQ(ring.Put(block.data(), block.size(), &discarded), STATUS_SUCCESS);
+	CHECK_EQ(discarded, 0);
+	CHECK_EQ(ring.Put(block.data(), block.size(), &discarded), STATUS_BUFFER_OVERFLOW);
+	CHECK_EQ(discarded, 32);
+	CHECK_EQ(ring.GetFillBytes(), ring.GetSize());
+	CHECK_EQ(ring.GetWritePosition(), 96);
+}
+
+TEST(DropOldestDiscardsWholeFrames)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> first = Sequence(48, 0);
+	std::vector<BYTE> second = Sequence(18, 48);
+	std::vector<BYTE> target(64);
+	SIZE_T discarded = 0;
+	SIZE_T read = 0;
+
+	// Two bytes too many still cost the whole oldest frame.
+	ring.Put(first.data(), first.size());
+	CHECK_EQ(ring.Put(second.data(), second.size(), &discarded), STATUS_BUFFER_OVERFLOW);
+	CHECK_EQ(discarded, 4);
+	CHECK_EQ(ring.GetReadPosition(), 4);
+
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_SUCCESS);
+	REQUIRE(read == 62);
+	for (SIZE_T i = 0; i < read; ++i)
+	{
+		CHECK_EQ(target[i], (BYTE)(4 + i));
+	}
+}
+
+TEST(DropOldestNeverRunsOverUnreadBytes)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> first = Sequence(62, 0);
+	std::vector<BYTE> second = Sequence(64, 100);
+	std::vector<BYTE> target(64);
+	SIZE_T discarded = 0;
+	SIZE_T read = 0;
+
+	// The rounded drop is capped at the fill, the partial frame goes as well.
+	ring.Put(first.data(), first.size());
+	CHECK_EQ(ring.Put(second.data(), second.size(), &discarded), STATUS_BUFFER_OVERFLOW);
+	CHECK_EQ(discarded, 62);
+	CHECK_EQ(ring.GetFillBytes(), 64);
+
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_SUCCESS);
+	REQUIRE(read == 64);
+	for (SIZE_T i = 0; i < read; ++i)
+	{
+		CHECK_EQ(target[i], second[i]);
+	}
+}
+
+TEST(DropNewestKeepsTheUnreadBytes)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+	ring.SetOverrunPolicy(RingOverrunDropNewest);
+
+	std::vector<BYTE> first = Sequence(48, 0);
+	std::vector<BYTE> second = Sequence(26, 48);
+	std::vector<BYTE> target(64);
+	SIZE_T discarded = 0;
+	SIZE_T read = 0;
+
+	ring.Put(first.data(), first.size());
+	CHECK_EQ(ring.Put(second.data(), second.size(), &discarded), STATUS_BUFFER_OVERFLOW);
+	CHECK_EQ(discarded, 10);
+	CHECK_EQ(ring.GetReadPosition(), 0);
+	CHECK_EQ(ring.GetWritePosition(), 64);
+
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_SUCCESS);
+	REQUIRE(read == 64);
+	for (SIZE_T i = 0; i < read; ++i)
+	{
+		CHECK_EQ(target[i], (BYTE)i);
+	}
+
+	// A full ring takes nothing at all.
+	ring.Put(first.data(), first.size());
+	ring.Put(second.data(), 16);
+	CHECK_EQ(ring.Put(second.data(), 4, &discarded), STATUS_BUFFER_OVERFLOW);
+	CHECK_EQ(discarded, 4);
+	CHECK_EQ(ring.GetWritePosition(), 128);
+}
+
+TEST(SkipToLatencyReturnsToTheStartThreshold)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+	ring.SetOverrunPolicy(RingOverrunSkipToLatency);
+	ring.SetStartThreshold(32);
+
+	std::vector<BYTE> first = Sequence(48, 0);
+	std::vector<BYTE> second = Sequence(24, 48);
+	std::vector<BYTE> target(64);
+	SIZE_T discarded = 0;
+	SIZE_T read = 0;
+
+	ring.Put(first.data(), first.size());
+	CHECK_EQ(ring.Put(second.data(), second.size(), &discarded), STATUS_BUFFER_OVERFLOW);
+	CHECK_EQ(discarded, 40);
+	CHECK_EQ(ring.GetFillBytes(), 32);
+
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_SUCCESS);
+	REQUIRE(read == 32);
+	CHECK_EQ(target[0], 40);
+	CHECK_EQ(target[31], 71);
+
+	// Init keeps the policy.
+	REQUIRE(NT_SUCCESS(ring.Init(128, 4)));
+	CHECK_EQ(ring.GetOverrunPolicy(), RingOverrunSkipToLatency);
+}
+
+TEST(PutLargerThanRingIsRejected)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> block(65);
+	CHECK_EQ(ring.Put(block.data(), block.size()), STATUS_BUFFER_TOO_SMALL);
+	CHECK_EQ(ring.GetWritePosition(), 0);
+}
+
+TEST(ClearRestartsFilling)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> block = Sequence(40, 0);
+	std::vector<BYTE> target(64);
+	SIZE_T read = 0;
+
+	ring.Put(block.data(), block.size());
+	ring.Clear();
+	CHECK_EQ(ring.GetFillBytes(), 0);
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_DEVICE_NOT_READY);
+}
+
+TEST(ClearOnlyMovesTheReadPosition)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> block = Sequence(40, 0);
+	std::vector<BYTE> target(64);
+	SIZE_T read = 0;
+
+	ring.Put(block.data(), block.size());
+	ring.Clear();
+	CHECK_EQ(ring.GetReadPosition(), 40);
+	CHECK_EQ(ring.GetWritePosition(), 40);
+
+	// The ring fills up again from where it was.
+	block = Sequence(36, 50);
+	ring.Put(block.data(), block.size());
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_SUCCESS);
+	REQUIRE(read == 36);
+	CHECK_EQ(target[0], 50);
+	CHECK_EQ(target[35], 85);
+}
+
+TEST(RestartKeepsTheNewestFrames)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+
+	std::vector<BYTE> block = Sequence(48, 0);
+	std::vector<BYTE> target(64);
+	SIZE_T read = 0;
+
+	ring.Put(block.data(), block.size());
+	CHECK_EQ(ring.Restart(38), 36);
+	CHECK_EQ(ring.GetAvailableBytes(), 36);
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_SUCCESS);
+	REQUIRE(read == 36);
+	CHECK_EQ(target[0], 12);
+
+	// Kept bytes below the start threshold are delivered as well.
+	ring.Put(block.data(), block.size());
+	CHECK_EQ(ring.Restart(16), 16);
+	CHECK_EQ(ring.GetAvailableBytes(), 16);
+
+	// Nothing to keep beyond the unread bytes, and keeping nothing fills
+	// up to the threshold again.
+	CHECK_EQ(ring.Restart(64), 16);
+	CHECK_EQ(ring.Restart(0), 0);
+	CHECK_EQ(ring.Take(target.data(), target.size(), &read), STATUS_DEVICE_NOT_READY);
+}
+
+TEST(ReinitFreesThePreviousBuffer)
+{
+	SIZE_T before = HostGetPoolBytes('uBiR');
+	{
+		RingBuffer ring;
+		REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+		REQUIRE(NT_SUCCESS(ring.Init(128, 4)));
+		CHECK_EQ(ring.GetSize(), 128);
+		CHECK_EQ(HostGetPoolBytes('uBiR') - before, 128 + 4);
+	}
+	CHECK_EQ(HostGetPoolBytes('uBiR'), before);
+}
+
+TEST(MirrorViewsAlias)
+{
+	MirroredBuffer mirror;
+	REQUIRE(NT_SUCCESS(mirror.Init(100)));
+	REQUIRE(mirror.GetSize() >= 100);
+	CHECK_EQ(mirror.GetSize() % PAGE_SIZE, 0);
+
+	BYTE* pBytes = mirror.GetAddress();
+	CHECK_EQ(pBytes[0], 0);
+	pBytes[mirror.GetSize() - 1] = 0x11;
+	pBytes[mirror.GetSize()] = 0x22;
+	CHECK_EQ(pBytes[2 * mirror.GetSize() - 1], 0x11);
+	CHECK_EQ(pBytes[0], 0x22);
+}
+
+TEST(MirroredRingDataSurvivesWraps)
+{
+	RingBuffer ring;
+	REQUIRE(NT_SUCCESS(ring.Init(64, 4, TRUE)));
+	CHECK(ring.IsMirrored());
+	CHECK_EQ(ring.GetSize(), 64);
+
+	std::vector<BYTE> target(40);
+	SIZE_T read = 0;
+
+	// 40 byte chunks cross the end of the page mid chunk every few rounds.
+	for (SIZE_T round = 0; round < 1000; ++round)
+	{
+		std::vector<BYTE> chunk = Sequence(40, (BYTE)round);
+		REQUIRE(ring.Put(chunk.data(), chunk.size()) == STATUS_SUCCESS);
+		REQUIRE(ring.Take(target.data(), target.size(), &read) == STATUS_SUCCESS);
+		REQUIRE(read == 40);
+		CHECK(target == chunk);
+	}
+	CHECK_EQ(ring.GetReadPosition(), 40000);
+}
+
+TEST(MirroredRingScalesLikeThePooledOne)
+{
+	RingBuffer pooled;
+	RingBuffer mirrored;
+	EndpointGain gain(2);
+	REQUIRE(NT_SUCCESS(pooled.Init(256, 4)));
+	REQUIRE(NT_SUCCESS(mirrored.Init(256, 4, TRUE)));
+	gain.SetVolumeLevel(1, -6 * 0x10000);
+
+	std::vector<BYTE> expected(132);
+	std::vector<BYTE> target(132);
+	SIZE_T read = 0;
+
+	for (SIZE_T round = 0; round < 200; ++round)
+	{
+		std::vector<BYTE> chunk = Sequence(132, (BYTE)(3 * round));
+		pooled.Put(chunk.data(), chunk.size());
+		mirrored.Put(chunk.data(), chunk.size());
+		CHECK_EQ(pooled.Take(expected.data(), expected.size(), &read, &gain), mirrored.Take(target.data(), target.size(), &read, &gain));
+		CHECK(target == expected);
+	}
+}
+
+TEST(MirroredRingIsNotPoolAllocated)
+{
+	SIZE_T before = HostGetPoolBytes('uBiR');
+	{
+		RingBuffer ring;
+		REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+		REQUIRE(NT_SUCCESS(ring.Init(128, 4, TRUE)));
+		CHECK_EQ(ring.GetSize(), 128);
+		CHECK_EQ(HostGetPoolBytes('uBiR') - before, sizeof(MirroredBuffer));
+
+		// Going back to a pooled ring unmaps the mirror.
+		REQUIRE(NT_SUCCESS(ring.Init(64, 4)));
+		CHECK(!ring.IsMirrored());
+		CHECK_EQ(HostGetPoolBytes('uBiR') - before, 64 + 4);
+	}
+	CHECK_EQ(HostGetPoolBytes('uBiR'), before);
+}
+
+TEST_MAIN()
@@ -0,0 +1,115 @@
+#pragma once
+
+/*++
+
+Module Name:
+
+	TestHarness.h
+
+Abstract:
+
+	Minimal test runner for the host build. A test is a function registered
+	with TEST, CHECK records a failure and carries on, REQUIRE ends the test.
+	Every test binary has one main that runs all tests and returns non zero
+	if any failed, which is what ctest looks at.
+
+--*/
+
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+struct TestCase
+{
+	const char*             Name;
+	std::function<void()>   Body;
+};
+
+inline std::vector<TestCase>& GetTestCases()
+{
+	static std::vector<TestCase> cases;
+	return cases;
+}
+
+inline int& GetTestFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+struct TestRegistrar
+{
+	TestRegistrar(const char* name, std::function<void()> body)
+	{
+		GetTestCases().push_back({ name, body });
+	}
+};
+
+struct TestAbort {};
+
+#define TEST(name) \
+	static void name(); \
+	static TestRegistrar name##_registrar(#name, name); \
+	static void name()
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			GetTestFailures()++; \
+		} \
+	} while (0)
+
+#define REQUIRE(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: REQUIRE(%s) failed\n", __FILE__, __LINE__, #condition); \
+			GetTestFailures()++; \
+			throw TestAbort(); \
+		} \
+	} while (0)
+
+// Both sides compare as long long, so mixed signedness neither warns nor misleads.
+#define CHECK_EQ(a, b) \
+	do { \
+		long long _a = (long long)(a); long long _b = (long long)(b); \
+		if (!(_a == _b)) { \
+			fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, \
+				_a, _b); \
+			GetTestFailures()++; \
+		} \
+	} while (0)
+
+inline int RunAllTests()
+{
+	int failedTests = 0;
+
+	for (const TestCase& test : GetTestCases())
+	{
+		int failuresBefore = GetTestFailures();
+
+		try
+		{
+			test.Body();
+		}
+		catch (const TestAbort&)
+		{
+		}
+
+		if (GetTestFailures() != failuresBefore)
+		{
+			printf("FAIL %s\n", test.Name);
+			failedTests++;
+		}
+		else
+		{
+			printf("ok   %s\n", test.Name);
+		}
+	}
+
+	printf("%d of %zu tests failed\n", failedTests, GetTestCases().size());
+	return failedTests == 0 ? 0 : 1;
+}
+
+#define TEST_MAIN() \
+	int main() { return RunAllTests(); }
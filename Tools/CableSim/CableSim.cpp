@@ -0,0 +1,713 @@
+/*++
+
+Module Name:
+
+	CableSim.cpp
+
+Abstract:
+
+	Discrete event simulation of a render and a capture stream on the cable.
+	Like LatencySim it runs the driver's own CableStream, RingBuffer and
+	CableMixer against the host kernel shim, and it adds the clients: the
+	performance counter is virtual, the 1 ms notification timers fire on it
+	with configurable lateness, and two clients play the part of the audio
+	engine, woken by the packet events or polling.
+
+	The render client writes a frame counter into every frame, the capture
+	client checks what arrives. Reported are underruns, overruns, dropped and
+	late packets, discontinuities and misaligned frames in the captured
+	audio, and the end to end latency from the render DMA reading a frame to
+	the capture DMA position passing it. Hours of stream time take seconds,
+	and a given seed always produces the same run.
+
+--*/
+
+// The standard headers go first, the kernel headers define min and max.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CableStream.h"
+#include "CableSimd.h"
+
+struct SimConfig
+{
+	ULONG       SampleRate = 48000;
+	ULONG       Channels = 2;
+	ULONG       BufferMs = 10;
+	ULONG       Notifications = 2;
+	ULONG       RingBuffers = CABLE_RING_BUFFERS_DEFAULT;
+	ULONGLONG   DurationMs = 60000;
+	ULONGLONG   CaptureStartUs = 500;
+	ULONGLONG   JitterUs = 0;
+	ULONGLONG   StallUs = 0;
+	ULONG       StallsPerSecond = 0;
+	bool        PollClients = false;
+	ULONG       PollMs = 1;
+	ULONGLONG   ClientDelayUs = 50;
+	ULONGLONG   ClientJitterUs = 0;
+	bool        Mixer = true;
+	bool        ClockLock = false;
+	RING_OVERRUN_POLICY OverrunPolicy = RingOverrunDropOldest;
+	ULONG       PrerollMs = 0;
+	ULONG       Seed = 1;
+	bool        FailOnGlitch = false;
+};
+
+enum SimEventKind
+{
+	SimCaptureStart,
+	SimRenderClient,
+	SimCaptureClient
+};
+
+struct SimEvent
+{
+	ULONGLONG       Qpc;
+	ULONGLONG       Sequence;
+	SimEventKind    Kind;
+
+	bool operator>(const SimEvent& other) const
+	{
+		return Qpc != other.Qpc ? Qpc > other.Qpc : Sequence > other.Sequence;
+	}
+};
+
+class Simulation;
+
+/*
+	A stream with a DMA buffer the simulation owns. The packet events go to
+	the simulation, which wakes the matching client after its wake up delay.
+*/
+class SimStream : public CableStream
+{
+public:
+	Simulation*         Sim = nullptr;
+	std::vector<BYTE>   Buffer;
+	ULONG               PacketSize = 0;
+	ULONGLONG           RunQpc = 0;
+	ULONGLONG           LatePackets = 0;
+
+	VOID GetLatencyHistogram(_Out_ PAUDIOMIRROR_LATENCY_HISTOGRAM Histogram)
+	{
+		m_LatencyProbe.Snapshot(Histogram);
+	}
+
+	ULONG GetRingSize()
+	{
+		return m_RingBuffer ? (ULONG)m_RingBuffer->GetSize() : 0;
+	}
+
+protected:
+	VOID OnTimerTick(_In_ const CABLE_STREAM_TICK* Tick) override;
+};
+
+class Simulation
+{
+public:
+	explicit Simulation(const SimConfig& config)
+		: m_Config(config), m_Random(config.Seed)
+	{
+	}
+
+	~Simulation()
+	{
+		HostSetTimerLateness(nullptr);
+		m_Render.ShutdownCable();
+		m_Capture.ShutdownCable();
+		if (m_pMixer)
+		{
+			m_pMixer->RemoveSink(&m_Capture);
+			delete m_pMixer;
+		}
+		delete m_pGain;
+	}
+
+	bool Init();
+	void Run();
+	int Report(double wallSeconds);
+
+	void OnPacketEvent(SimStream* stream);
+
+private:
+	SimConfig                   m_Config;
+	std::mt19937_64             m_Random;
+	WAVEFORMATEX                m_Format = {};
+	ULONG                       m_ulFramesPerPacket = 0;
+	EndpointGain*               m_pGain = nullptr;
+	CableMixer*                 m_pMixer = nullptr;
+	SimStream                   m_Render;
+	SimStream                   m_Capture;
+	ULONGLONG                   m_ullEndQpc = 0;
+	ULONGLONG                   m_ullSequence = 0;
+	std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent>> m_Events;
+
+	// Render client.
+	ULONG                       m_ulLastWrittenPacket = 0;
+	ULONGLONG                   m_ullSkippedPackets = 0;
+	ULONGLONG                   m_ullRejectedPackets = 0;
+
+	// Capture client.
+	ULONGLONG                   m_ullCapturedPackets = 0;
+	bool                        m_bAudioStarted = false;
+	ULONGLONG                   m_ullLastFrame = 0;
+	ULONGLONG                   m_ullDiscontinuities = 0;
+	ULONGLONG                   m_ullMisalignedFrames = 0;
+	ULONGLONG                   m_ullSilentFrames = 0;
+	std::vector<ULONG>          m_LatenciesUs;
+
+	void Schedule(ULONGLONG qpc, SimEventKind kind)
+	{
+		m_Events.push({ qpc, m_ullSequence++, kind });
+	}
+
+	ULONGLONG UsToQpc(ULONGLONG us) const
+	{
+		return us * HOST_QPC_FREQUENCY / 1000000;
+	}
+
+	ULONGLONG RandomUs(ULONGLONG maxUs)
+	{
+		return maxUs ? std::uniform_int_distribution<ULONGLONG>(0, maxUs)(m_Random) : 0;
+	}
+
+	LONGLONG TimerLateness();
+	bool InitStream(SimStream* stream, BOOLEAN capture);
+	void WriteRenderPacket(ULONG packetNumber);
+	void RenderClient();
+	void CaptureClient();
+	void AnalyzePacket(const SHORT* samples, ULONGLONG packetQpc);
+};
+
+//
+// Frame n carries the low 16 bits of n on channel 0 and their complement on
+// channel 1, further channels a fixed pattern on top. No frame is all zero,
+// so silence is told apart from audio, and a frame whose channels do not
+// match is audio that got shifted by part of a frame.
+//
+static SHORT EncodeSample(ULONGLONG frame, ULONG channel)
+{
+	USHORT value = (USHORT)frame;
+
+	switch (channel)
+	{
+	case 0:     return (SHORT)value;
+	case 1:     return (SHORT)(USHORT)~value;
+	default:    return (SHORT)(USHORT)(value ^ (channel * 0x1111));
+	}
+}
+
+static bool IsSilentFrame(const SHORT* frame, ULONG channels)
+{
+	for (ULONG c = 0; c < channels; ++c)
+	{
+		if (frame[c] != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool IsConsistentFrame(const SHORT* frame, ULONG channels)
+{
+	for (ULONG c = 1; c < channels; ++c)
+	{
+		if (frame[c] != EncodeSample((USHORT)frame[0], c))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+VOID SimStream::OnTimerTick(_In_ const CABLE_STREAM_TICK* Tick)
+{
+	if (Tick->ReportUnderrun)
+	{
+		LatePackets++;
+	}
+	if (Tick->SignalEvents)
+	{
+		Sim->OnPacketEvent(this);
+	}
+}
+
+LONGLONG Simulation::TimerLateness()
+{
+	ULONGLONG latenessUs = RandomUs(m_Config.JitterUs);
+
+	// On average StallsPerSecond of the 1000 expiries per second per timer
+	// are held up by a long stall, a DPC or ISR hogging the processor.
+	if (m_Config.StallsPerSecond > 0 &&
+		std::uniform_int_distribution<ULONG>(0, 999)(m_Random) < m_Config.StallsPerSecond)
+	{
+		latenessUs += m_Config.StallUs;
+	}
+	return (LONGLONG)latenessUs * 10;
+}
+
+bool Simulation::InitStream(SimStream* stream, BOOLEAN capture)
+{
+	CABLE_STREAM_CONFIG config = {};
+	ULONG size = m_Format.nAvgBytesPerSec / 1000 * m_Config.BufferMs;
+
+	config.Capture = capture;
+	config.MeasureLatency = capture;
+	config.ClockLocked = capture && m_Config.ClockLock;
+	config.RingBufferCount = m_Config.RingBuffers;
+	config.OverrunPolicy = m_Config.OverrunPolicy;
+	config.PrerollMs = capture ? m_Config.PrerollMs : 0;
+	config.Mixer = capture ? NULL : m_pMixer;
+
+	stream->Sim = this;
+	if (!NT_SUCCESS(stream->InitCable(&m_Format, &config)) ||
+		!NT_SUCCESS(stream->PrepareBuffer(m_Config.Notifications, &size, &stream->PacketSize)))
+	{
+		return false;
+	}
+	stream->Buffer.assign(size, 0);
+	stream->AttachDmaBuffer(stream->Buffer.data(), size, m_Config.Notifications, stream->PacketSize);
+	return true;
+}
+
+bool Simulation::Init()
+{
+	m_Format.wFormatTag = WAVE_FORMAT_PCM;
+	m_Format.nChannels = (WORD)m_Config.Channels;
+	m_Format.nSamplesPerSec = m_Config.SampleRate;
+	m_Format.wBitsPerSample = 16;
+	m_Format.nBlockAlign = (WORD)(m_Config.Channels * sizeof(SHORT));
+	m_Format.nAvgBytesPerSec = m_Config.SampleRate * m_Format.nBlockAlign;
+
+	HostSetTime(0);
+	HostSetTimerLateness([this](PEX_TIMER, PVOID) { return TimerLateness(); });
+
+	if (m_Config.Mixer)
+	{
+		m_pGain = new EndpointGain(m_Config.Channels);
+		m_pMixer = new(NonPagedPoolNx, 'miSC') CableMixer;
+		if (!NT_SUCCESS(m_pMixer->Init(&m_Format, m_pGain)))
+		{
+			fprintf(stderr, "mixer does not support the format\n");
+			return false;
+		}
+	}
+
+	if (!InitStream(&m_Render, FALSE) || !InitStream(&m_Capture, TRUE))
+	{
+		fprintf(stderr, "invalid buffer configuration\n");
+		return false;
+	}
+	m_ulFramesPerPacket = m_Render.PacketSize / m_Format.nBlockAlign;
+
+	if (m_pMixer)
+	{
+		m_pMixer->AddSink(&m_Capture);
+	}
+	else
+	{
+		CableStream::PairStreams(&m_Render, &m_Capture);
+	}
+
+	m_ullEndQpc = UsToQpc(m_Config.DurationMs * 1000);
+	return true;
+}
+
+void Simulation::WriteRenderPacket(ULONG packetNumber)
+{
+	ULONG slot = packetNumber % m_Config.Notifications;
+	SHORT* samples = (SHORT*)(m_Render.Buffer.data() + slot * m_Render.PacketSize);
+	ULONGLONG frame = (ULONGLONG)packetNumber * m_ulFramesPerPacket;
+
+	for (ULONG f = 0; f < m_ulFramesPerPacket; ++f, ++frame)
+	{
+		for (ULONG c = 0; c < m_Config.Channels; ++c)
+		{
+			*samples++ = EncodeSample(frame, c);
+		}
+	}
+
+	if (!NT_SUCCESS(m_Render.SubmitWritePacket(packetNumber, FALSE, 0)))
+	{
+		m_ullRejectedPackets++;
+	}
+	m_ulLastWrittenPacket = packetNumber;
+}
+
+void Simulation::RenderClient()
+{
+	ULONG completed;
+
+	if (!NT_SUCCESS(m_Render.GetCompletedPacketCount(&completed)))
+	{
+		return;
+	}
+
+	// Packet completed is playing, the client fills the one after it. Every
+	// packet it did not get to plays whatever the buffer held before.
+	ULONG next = completed + 1;
+	if (next != m_ulLastWrittenPacket && (LONG)(next - m_ulLastWrittenPacket) > 0)
+	{
+		m_ullSkippedPackets += next - m_ulLastWrittenPacket - 1;
+		WriteRenderPacket(next);
+	}
+}
+
+void Simulation::CaptureClient()
+{
+	ULONG packetNumber;
+	ULONG64 packetQpc;
+	BOOL moreData;
+
+	while (NT_SUCCESS(m_Capture.GetNextReadPacket(&packetNumber, &packetQpc, &moreData)))
+	{
+		ULONG slot = packetNumber % m_Config.Notifications;
+		AnalyzePacket((const SHORT*)(m_Capture.Buffer.data() + slot * m_Capture.PacketSize), packetQpc);
+		m_ullCapturedPackets++;
+	}
+}
+
+void Simulation::AnalyzePacket(const SHORT* samples, ULONGLONG packetQpc)
+{
+	bool latencySampled = false;
+
+	for (ULONG f = 0; f < m_ulFramesPerPacket; ++f, samples += m_Config.Channels)
+	{
+		if (IsSilentFrame(samples, m_Config.Channels))
+		{
+			if (m_bAudioStarted)
+			{
+				m_ullSilentFrames++;
+			}
+			continue;
+		}
+		if (!IsConsistentFrame(samples, m_Config.Channels))
+		{
+			m_ullMisalignedFrames++;
+			continue;
+		}
+
+		// Unwrap the 16 bit counter to the frame closest to the expected one.
+		USHORT value = (USHORT)samples[0];
+		ULONGLONG frame = value;
+		if (m_bAudioStarted)
+		{
+			ULONGLONG expected = m_ullLastFrame + 1;
+			frame = expected + (SHORT)(USHORT)(value - (USHORT)expected);
+			if (frame != expected)
+			{
+				m_ullDiscontinuities++;
+			}
+		}
+		m_bAudioStarted = true;
+		m_ullLastFrame = frame;
+
+		if (!latencySampled)
+		{
+			ULONGLONG captureQpc = packetQpc + (ULONGLONG)f * HOST_QPC_FREQUENCY / m_Config.SampleRate;
+			ULONGLONG renderQpc = m_Render.RunQpc + frame * HOST_QPC_FREQUENCY / m_Config.SampleRate;
+			if (captureQpc >= renderQpc)
+			{
+				m_LatenciesUs.push_back((ULONG)((captureQpc - renderQpc) * 1000000 / HOST_QPC_FREQUENCY));
+			}
+			latencySampled = true;
+		}
+	}
+}
+
+void Simulation::OnPacketEvent(SimStream* stream)
+{
+	if (m_Config.PollClients)
+	{
+		return;
+	}
+	Schedule(HostGetTime() + UsToQpc(m_Config.ClientDelayUs + RandomUs(m_Config.ClientJitterUs)),
+		stream == &m_Render ? SimRenderClient : SimCaptureClient);
+}
+
+void Simulation::Run()
+{
+	// The audio engine writes the first packet before the stream runs and
+	// the second right after.
+	m_Render.SetCableState(KSSTATE_ACQUIRE);
+	m_Render.SetCableState(KSSTATE_PAUSE);
+	WriteRenderPacket(0);
+	m_Render.RunQpc = HostGetTime();
+	m_Render.SetCableState(KSSTATE_RUN);
+	WriteRenderPacket(1);
+
+	Schedule(UsToQpc(m_Config.CaptureStartUs), SimCaptureStart);
+	if (m_Config.PollClients)
+	{
+		Schedule(UsToQpc(m_Config.PollMs * 1000), SimRenderClient);
+		Schedule(UsToQpc(m_Config.PollMs * 1000), SimCaptureClient);
+	}
+
+	for (;;)
+	{
+		ULONGLONG nextQpc = (std::min)(HostGetNextTimerDue(), m_ullEndQpc);
+		if (!m_Events.empty())
+		{
+			nextQpc = (std::min)(nextQpc, m_Events.top().Qpc);
+		}
+
+		// A late timer may carry the clock past client events, they run
+		// late then, just as a thread does behind a long DPC.
+		HostRunTimers(nextQpc);
+		if (HostGetTime() >= m_ullEndQpc)
+		{
+			break;
+		}
+
+		while (!m_Events.empty() && m_Events.top().Qpc <= HostGetTime())
+		{
+			SimEvent event = m_Events.top();
+			m_Events.pop();
+
+			switch (event.Kind)
+			{
+			case SimCaptureStart:
+				m_Capture.SetCableState(KSSTATE_ACQUIRE);
+				m_Capture.SetCableState(KSSTATE_PAUSE);
+				m_Capture.RunQpc = HostGetTime();
+				m_Capture.SetCableState(KSSTATE_RUN);
+				break;
+			case SimRenderClient:
+				RenderClient();
+				break;
+			case SimCaptureClient:
+				CaptureClient();
+				break;
+			}
+
+			if (m_Config.PollClients && event.Kind != SimCaptureStart)
+			{
+				Schedule(event.Qpc + UsToQpc(m_Config.PollMs * 1000), event.Kind);
+			}
+		}
+	}
+}
+
+static ULONG Percentile(const std::vector<ULONG>& sorted, double percentile)
+{
+	size_t rank = (size_t)(percentile / 100.0 * sorted.size() + 0.999999);
+	rank = (std::max<size_t>)(rank, 1);
+	return sorted[(std::min)(rank, sorted.size()) - 1];
+}
+
+int Simulation::Report(double wallSeconds)
+{
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+	AUDIOMIRROR_STREAM_STATISTICS renderStatistics;
+	AUDIOMIRROR_LATENCY_HISTOGRAM ringLatency;
+
+	m_Capture.GetStreamStatistics()->Snapshot(&statistics);
+	m_Render.GetStreamStatistics()->Snapshot(&renderStatistics);
+	m_Capture.GetLatencyHistogram(&ringLatency);
+
+	printf("stream time        %.3f s, simulated in %.2f s\n", m_Config.DurationMs / 1000.0, wallSeconds);
+	printf("path               %s\n", m_pMixer ? "mixer" : "paired");
+	printf("buffer             %u ms, %u packets of %u bytes\n", m_Config.BufferMs, m_Config.Notifications, m_Render.PacketSize);
+	printf("ring               %u bytes\n", m_Capture.GetRingSize());
+	printf("ring fill          min %u, max %u bytes\n", statistics.RingFillMin, statistics.RingFillMax);
+	if (m_Config.ClockLock)
+	{
+		printf("clock lock         %s, %llu fallbacks\n", m_Capture.IsClockLocked() ? "locked" : "unlocked",
+			(unsigned long long)statistics.ClockLockFallbacks);
+	}
+	printf("captured packets   %llu\n", (unsigned long long)m_ullCapturedPackets);
+	printf("dropped packets    %llu\n", (unsigned long long)statistics.DroppedPackets);
+	printf("late packets       %llu\n", (unsigned long long)m_Render.LatePackets);
+	printf("skipped packets    %llu\n", (unsigned long long)m_ullSkippedPackets);
+	printf("rejected packets   %llu\n", (unsigned long long)m_ullRejectedPackets);
+	printf("underruns          %llu, %llu bytes zero filled\n",
+		(unsigned long long)statistics.Underruns, (unsigned long long)statistics.ZeroFilledBytes);
+	printf("overruns           %llu, %llu bytes lost\n",
+		(unsigned long long)statistics.Overruns, (unsigned long long)statistics.OverrunBytes);
+	if (statistics.FirstAudioUs != AUDIOMIRROR_NO_FIRST_AUDIO)
+	{
+		printf("first audio        %u us after RUN, %u bytes pre-roll\n", statistics.FirstAudioUs, statistics.PrerollBytes);
+	}
+	printf("discontinuities    %llu\n", (unsigned long long)m_ullDiscontinuities);
+	printf("misaligned frames  %llu\n", (unsigned long long)m_ullMisalignedFrames);
+	printf("silent frames      %llu\n", (unsigned long long)m_ullSilentFrames);
+	printf("timer ticks        render %llu, %llu idle, capture %llu, %llu idle\n",
+		(unsigned long long)renderStatistics.TimerTicks, (unsigned long long)renderStatistics.IdleTimerTicks,
+		(unsigned long long)statistics.TimerTicks, (unsigned long long)statistics.IdleTimerTicks);
+	printf("timer lateness     p50 %u, p99 %u, max %u us\n",
+		statistics.TimerLateness.P50Us, statistics.TimerLateness.P99Us, statistics.TimerLateness.MaxUs);
+	if (ringLatency.SampleCount > 0)
+	{
+		printf("ring latency       mean %llu, max %u us\n",
+			(unsigned long long)(ringLatency.SumUs / ringLatency.SampleCount), ringLatency.MaxUs);
+	}
+
+	if (!m_LatenciesUs.empty())
+	{
+		std::sort(m_LatenciesUs.begin(), m_LatenciesUs.end());
+		printf("latency            p50 %u, p99 %u, p999 %u, max %u us\n",
+			Percentile(m_LatenciesUs, 50.0), Percentile(m_LatenciesUs, 99.0),
+			Percentile(m_LatenciesUs, 99.9), m_LatenciesUs.back());
+	}
+	else
+	{
+		printf("latency            no audio reached the capture client\n");
+	}
+
+	bool glitched = statistics.Underruns || statistics.Overruns || statistics.DroppedPackets ||
+		m_Render.LatePackets || m_ullSkippedPackets || m_ullRejectedPackets ||
+		m_ullDiscontinuities || m_ullMisalignedFrames || m_ullSilentFrames || m_LatenciesUs.empty();
+
+	return (m_Config.FailOnGlitch && glitched) ? 2 : 0;
+}
+
+static bool ParseArguments(int argc, char** argv, SimConfig* config)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+		if (strcmp(arg, "--help") == 0)
+		{
+			return false;
+		}
+		if (strcmp(arg, "--fail-on-glitch") == 0)
+		{
+			config->FailOnGlitch = true;
+			continue;
+		}
+		if (strcmp(arg, "--clock-lock") == 0)
+		{
+			config->ClockLock = true;
+			continue;
+		}
+		if (value == nullptr)
+		{
+			fprintf(stderr, "missing value for %s\n", arg);
+			return false;
+		}
+		i++;
+
+		if (strcmp(arg, "--sample-rate") == 0) config->SampleRate = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--channels") == 0) config->Channels = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--buffer-ms") == 0) config->BufferMs = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--notifications") == 0) config->Notifications = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--ring-buffers") == 0) config->RingBuffers = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--duration-ms") == 0) config->DurationMs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--capture-start-us") == 0) config->CaptureStartUs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--jitter-us") == 0) config->JitterUs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--stall-us") == 0) config->StallUs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--stalls-per-s") == 0) config->StallsPerSecond = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--client") == 0)
+		{
+			if (strcmp(value, "event") == 0) config->PollClients = false;
+			else if (strcmp(value, "poll") == 0) config->PollClients = true;
+			else
+			{
+				fprintf(stderr, "unknown client mode %s\n", value);
+				return false;
+			}
+		}
+		else if (strcmp(arg, "--poll-ms") == 0) config->PollMs = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--client-delay-us") == 0) config->ClientDelayUs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--client-jitter-us") == 0) config->ClientJitterUs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--path") == 0)
+		{
+			if (strcmp(value, "mixer") == 0) config->Mixer = true;
+			else if (strcmp(value, "paired") == 0) config->Mixer = false;
+			else
+			{
+				fprintf(stderr, "unknown path %s\n", value);
+				return false;
+			}
+		}
+		else if (strcmp(arg, "--preroll-ms") == 0) config->PrerollMs = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--overrun") == 0)
+		{
+			if (strcmp(value, "oldest") == 0) config->OverrunPolicy = RingOverrunDropOldest;
+			else if (strcmp(value, "newest") == 0) config->OverrunPolicy = RingOverrunDropNewest;
+			else if (strcmp(value, "skip") == 0) config->OverrunPolicy = RingOverrunSkipToLatency;
+			else
+			{
+				fprintf(stderr, "unknown overrun policy %s\n", value);
+				return false;
+			}
+		}
+		else if (strcmp(arg, "--seed") == 0) config->Seed = (ULONG)strtoul(value, nullptr, 10);
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", arg);
+			return false;
+		}
+	}
+
+	if (config->SampleRate < 1000 || config->Channels < 2 || config->Channels > ENDPOINT_GAIN_MAX_CHANNELS ||
+		config->BufferMs == 0 || config->Notifications == 0 || config->RingBuffers == 0 ||
+		config->PollMs == 0 || config->StallsPerSecond > 1000 || config->PrerollMs > AUDIOMIRROR_PREROLL_MAX_MS)
+	{
+		fprintf(stderr, "invalid configuration\n");
+		return false;
+	}
+	return true;
+}
+
+static void PrintUsage()
+{
+	printf(
+		"usage: CableSim [options]\n"
+		"  --sample-rate N        frames per second (48000)\n"
+		"  --channels N           2 to 8, 16 bit samples (2)\n"
+		"  --buffer-ms N          WaveRT buffer duration (10)\n"
+		"  --notifications N      packets per WaveRT buffer (2)\n"
+		"  --ring-buffers N       cable ring size in WaveRT buffers (4)\n"
+		"  --path mixer|paired    render feeds the cable through the mixer or directly (mixer)\n"
+		"  --clock-lock           capture position follows the render side\n"
+		"  --overrun oldest|newest|skip\n"
+		"                         what a full cable ring discards (oldest)\n"
+		"  --preroll-ms N         render history the capture stream starts with (0)\n"
+		"  --duration-ms N        stream time to simulate (60000)\n"
+		"  --capture-start-us N   capture stream start relative to render (500)\n"
+		"  --jitter-us N          max random lateness of a timer expiry (0)\n"
+		"  --stall-us N           lateness of a stalled timer expiry (0)\n"
+		"  --stalls-per-s N       stalled expiries per second and timer (0)\n"
+		"  --client event|poll    clients wake on packet events or poll (event)\n"
+		"  --poll-ms N            polling period of the clients (1)\n"
+		"  --client-delay-us N    client wake up delay after a packet event (50)\n"
+		"  --client-jitter-us N   max random extra wake up delay (0)\n"
+		"  --seed N               random seed (1)\n"
+		"  --fail-on-glitch       exit with 2 if any glitch was seen\n");
+}
+
+int main(int argc, char** argv)
+{
+	SimConfig config;
+
+	if (!ParseArguments(argc, argv, &config))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// The driver picks its mixing kernels in DriverEntry.
+	CableSimdInitialize();
+
+	Simulation simulation(config);
+	if (!simulation.Init())
+	{
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	simulation.Run();
+	std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+	return simulation.Report(wall.count());
+}
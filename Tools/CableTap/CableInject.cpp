@@ -0,0 +1,136 @@
+/*++
+
+Module Name:
+
+	CableInject.cpp
+
+Abstract:
+
+	Plays a raw PCM file into the microphone through the injection ring.
+	The target is either the device path of an AudioMirror capture filter
+	(Windows only) or a file laid out like the ring. The file must already
+	be in the format the header announces.
+
+--*/
+
+#include "CableTapReader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: CableInject [--device] <target> <input.raw>\n"
+		"  --device   target is the device path of the AudioMirror capture filter\n");
+}
+
+int main(int argc, char** argv)
+{
+	bool device = false;
+	int arg = 1;
+
+	if (arg < argc && strcmp(argv[arg], "--device") == 0)
+	{
+		device = true;
+		arg++;
+	}
+	if (argc - arg < 2)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	const char* target = argv[arg];
+	const char* inputPath = argv[arg + 1];
+
+	TapView view;
+	bool opened = false;
+	if (device)
+	{
+#ifdef _WIN32
+		std::string path(target);
+		opened = view.OpenInjection(std::wstring(path.begin(), path.end()));
+#else
+		fprintf(stderr, "--device is only available on Windows\n");
+		return 1;
+#endif
+	}
+	else
+	{
+		opened = view.OpenFile(target, true);
+	}
+	if (!opened)
+	{
+		fprintf(stderr, "Cannot open the injection ring at %s\n", target);
+		return 1;
+	}
+
+	InjectWriter writer;
+	if (!writer.Attach(view.Base(), view.Size()))
+	{
+		fprintf(stderr, "%s does not hold an injection ring of version %u\n", target, AUDIOMIRROR_INJECT_VERSION);
+		return 1;
+	}
+
+	const AUDIOMIRROR_INJECT_HEADER* header = writer.Header();
+	printf("%u Hz, %u channels, %u bit, ring %u bytes\n",
+		header->SamplesPerSec, header->Channels, header->BitsPerSample, header->DataSize);
+
+	FILE* input = fopen(inputPath, "rb");
+	if (input == nullptr)
+	{
+		fprintf(stderr, "Cannot open %s\n", inputPath);
+		return 1;
+	}
+
+	std::vector<uint8_t> block(header->DataSize / 4);
+	size_t pending = 0;
+	size_t offset = 0;
+	uint64_t written = 0;
+	uint32_t idleMs = 0;
+
+	for (;;)
+	{
+		if (pending == 0)
+		{
+			pending = fread(block.data(), 1, block.size(), input);
+			offset = 0;
+			if (pending == 0)
+			{
+				break;
+			}
+		}
+
+		size_t count = writer.Write(block.data() + offset, pending);
+		offset += count;
+		pending -= count;
+		written += count;
+
+		// A trailing partial frame can never be written.
+		if (pending > 0 && pending < header->BlockAlign)
+		{
+			break;
+		}
+		if (count == 0)
+		{
+			if (view.Wait(100))
+			{
+				idleMs = 0;
+			}
+			else if ((idleMs += 100) >= 2000)
+			{
+				fprintf(stderr, "No capture stream consumes the ring\n");
+				break;
+			}
+		}
+	}
+
+	fclose(input);
+	printf("Wrote %llu bytes, %llu underruns, %llu bytes of silence\n",
+		(unsigned long long)written, (unsigned long long)writer.Underruns(),
+		(unsigned long long)writer.UnderrunBytes());
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*++
+
+Module Name:
+
+	CableTapDump.cpp
+
+Abstract:
+
+	Records the cable tap to a raw PCM file. The source is either the
+	device path of an AudioMirror render filter (Windows only) or a file
+	laid out like the tap.
+
+--*/
+
+#include "CableTapReader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: CableTapDump [--device] <source> <output.raw> [seconds]\n"
+		"  --device   source is the device path of the AudioMirror render filter\n"
+		"  seconds    recording length, default 10\n");
+}
+
+int main(int argc, char** argv)
+{
+	bool device = false;
+	int arg = 1;
+
+	if (arg < argc && strcmp(argv[arg], "--device") == 0)
+	{
+		device = true;
+		arg++;
+	}
+	if (argc - arg < 2)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	const char* source = argv[arg];
+	const char* outputPath = argv[arg + 1];
+	double seconds = (argc - arg > 2) ? atof(argv[arg + 2]) : 10.0;
+
+	TapView view;
+	bool opened = false;
+	if (device)
+	{
+#ifdef _WIN32
+		std::string path(source);
+		opened = view.OpenDevice(std::wstring(path.begin(), path.end()));
+#else
+		fprintf(stderr, "--device is only available on Windows\n");
+		return 1;
+#endif
+	}
+	else
+	{
+		opened = view.OpenFile(source);
+	}
+	if (!opened)
+	{
+		fprintf(stderr, "Cannot open the tap at %s\n", source);
+		return 1;
+	}
+
+	TapReader reader;
+	if (!reader.Attach(view.Base(), view.Size()))
+	{
+		fprintf(stderr, "%s does not hold a tap of version %u\n", source, AUDIOMIRROR_TAP_VERSION);
+		return 1;
+	}
+
+	const AUDIOMIRROR_TAP_HEADER* header = reader.Header();
+	printf("%u Hz, %u channels, %u bit, ring %u bytes\n",
+		header->SamplesPerSec, header->Channels, header->BitsPerSample, header->DataSize);
+
+	FILE* output = fopen(outputPath, "wb");
+	if (output == nullptr)
+	{
+		fprintf(stderr, "Cannot create %s\n", outputPath);
+		return 1;
+	}
+
+	uint64_t target = (uint64_t)(seconds * header->SamplesPerSec) * header->BlockAlign;
+	uint64_t written = 0;
+	uint32_t idleMs = 0;
+	std::vector<uint8_t> block(header->DataSize);
+
+	while (written < target && idleMs < 2000)
+	{
+		if (!view.Wait(100))
+		{
+			idleMs += 100;
+			continue;
+		}
+		idleMs = 0;
+
+		size_t count;
+		while ((count = reader.Read(block.data(), (size_t)std::min<uint64_t>(block.size(), target - written))) > 0)
+		{
+			fwrite(block.data(), 1, count, output);
+			written += count;
+		}
+	}
+
+	fclose(output);
+	printf("Recorded %llu bytes, lost %llu bytes\n",
+		(unsigned long long)written, (unsigned long long)reader.LostBytes());
+
+	return 0;
+}
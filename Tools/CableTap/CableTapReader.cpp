@@ -0,0 +1,439 @@
+/*++
+
+Module Name:
+
+	CableTapReader.cpp
+
+Abstract:
+
+	User mode side of the cable tap and the injection ring.
+
+--*/
+
+#include "CableTapReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include <initguid.h>
+#include <ks.h>
+#include <ksmedia.h>
+#include "../../AudioMirror/AudioMirrorProperties.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+TapView::~TapView()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool TapView::OpenFile(const std::string& path, bool writable)
+{
+	LARGE_INTEGER size;
+
+	Close();
+
+	m_hFile = CreateFileA(path.c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (m_hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_hFile, &size))
+	{
+		Close();
+		return false;
+	}
+
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+	m_pBase = m_hMapping ? MapViewOfFile(m_hMapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (m_pBase == nullptr)
+	{
+		Close();
+		return false;
+	}
+	m_Size = (size_t)size.QuadPart;
+
+	return true;
+}
+
+bool TapView::OpenDevice(const std::wstring& filterPath)
+{
+	return OpenDeviceView(filterPath, KSPROPERTY_AUDIOMIRROR_TAP, KSPROPERTY_AUDIOMIRROR_TAP_EVENT);
+}
+
+bool TapView::OpenInjection(const std::wstring& filterPath)
+{
+	return OpenDeviceView(filterPath, KSPROPERTY_AUDIOMIRROR_INJECT, KSPROPERTY_AUDIOMIRROR_INJECT_EVENT);
+}
+
+bool TapView::OpenDeviceView(const std::wstring& filterPath, ULONG mapPropertyId, ULONG eventPropertyId)
+{
+	KSPROPERTY              property = {};
+	AUDIOMIRROR_TAP_MAPPING mapping = {};
+	AUDIOMIRROR_TAP_EVENT   tapEvent = {};
+	DWORD                   returned = 0;
+
+	Close();
+
+	m_hDevice = CreateFileW(filterPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (m_hDevice == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	property.Set = KSPROPSETID_AudioMirror;
+	property.Id = mapPropertyId;
+	property.Flags = KSPROPERTY_TYPE_GET;
+	if (!DeviceIoControl(m_hDevice, IOCTL_KS_PROPERTY, &property, sizeof(property), &mapping, sizeof(mapping), &returned, nullptr) ||
+		returned < sizeof(mapping))
+	{
+		Close();
+		return false;
+	}
+	m_pBase = (void*)(ULONG_PTR)mapping.ViewAddress;
+	m_Size = (size_t)mapping.ViewSize;
+	m_EventPropertyId = eventPropertyId;
+
+	m_hEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+	if (m_hEvent != nullptr)
+	{
+		property.Id = eventPropertyId;
+		property.Flags = KSPROPERTY_TYPE_SET;
+		tapEvent.EventHandle = (ULONGLONG)(ULONG_PTR)m_hEvent;
+		tapEvent.Register = 1;
+		if (!DeviceIoControl(m_hDevice, IOCTL_KS_PROPERTY, &property, sizeof(property), &tapEvent, sizeof(tapEvent), &returned, nullptr))
+		{
+			// Still readable, Wait falls back to polling.
+			CloseHandle(m_hEvent);
+			m_hEvent = nullptr;
+		}
+	}
+
+	return true;
+}
+
+void TapView::Close()
+{
+	if (m_hDevice != INVALID_HANDLE_VALUE)
+	{
+		if (m_hEvent != nullptr)
+		{
+			KSPROPERTY              property = {};
+			AUDIOMIRROR_TAP_EVENT   tapEvent = {};
+			DWORD                   returned = 0;
+
+			property.Set = KSPROPSETID_AudioMirror;
+			property.Id = m_EventPropertyId;
+			property.Flags = KSPROPERTY_TYPE_SET;
+			tapEvent.EventHandle = (ULONGLONG)(ULONG_PTR)m_hEvent;
+			tapEvent.Register = 0;
+			DeviceIoControl(m_hDevice, IOCTL_KS_PROPERTY, &property, sizeof(property), &tapEvent, sizeof(tapEvent), &returned, nullptr);
+		}
+
+		// The driver mapped the view into this process, it is released like any other.
+		if (m_pBase != nullptr)
+		{
+			UnmapViewOfFile(m_pBase);
+		}
+		CloseHandle(m_hDevice);
+		m_hDevice = INVALID_HANDLE_VALUE;
+	}
+	else if (m_pBase != nullptr)
+	{
+		UnmapViewOfFile(m_pBase);
+	}
+	m_pBase = nullptr;
+	m_Size = 0;
+
+	if (m_hEvent != nullptr)
+	{
+		CloseHandle(m_hEvent);
+		m_hEvent = nullptr;
+	}
+	if (m_hMapping != nullptr)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = nullptr;
+	}
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+#else
+
+bool TapView::OpenFile(const std::string& path, bool writable)
+{
+	struct stat st;
+
+	Close();
+
+	m_Fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+	if (m_Fd < 0 || fstat(m_Fd, &st) != 0 || st.st_size <= 0)
+	{
+		Close();
+		return false;
+	}
+
+	void* base = mmap(nullptr, (size_t)st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_Fd, 0);
+	if (base == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	m_pBase = base;
+	m_Size = (size_t)st.st_size;
+
+	return true;
+}
+
+void TapView::Close()
+{
+	if (m_pBase != nullptr)
+	{
+		munmap(m_pBase, m_Size);
+		m_pBase = nullptr;
+		m_Size = 0;
+	}
+	if (m_Fd >= 0)
+	{
+		close(m_Fd);
+		m_Fd = -1;
+	}
+}
+
+#endif
+
+const volatile ULONGLONG* TapView::GetPacketCount() const
+{
+	if (m_pBase == nullptr || m_Size < AUDIOMIRROR_TAP_HEADER_SIZE)
+	{
+		return nullptr;
+	}
+
+	switch (*(const ULONG*)m_pBase)
+	{
+	case AUDIOMIRROR_TAP_MAGIC:
+		return &((const AUDIOMIRROR_TAP_HEADER*)m_pBase)->PacketCount;
+
+	case AUDIOMIRROR_INJECT_MAGIC:
+		return &((const AUDIOMIRROR_INJECT_HEADER*)m_pBase)->PacketCount;
+
+	default:
+		return nullptr;
+	}
+}
+
+bool TapView::Wait(uint32_t timeoutMs)
+{
+	const volatile ULONGLONG* packetCounter = GetPacketCount();
+
+	if (packetCounter == nullptr)
+	{
+		return false;
+	}
+
+#ifdef _WIN32
+	if (m_hEvent != nullptr)
+	{
+		return WaitForSingleObject(m_hEvent, timeoutMs) == WAIT_OBJECT_0;
+	}
+#endif
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	for (;;)
+	{
+		uint64_t packetCount = *packetCounter;
+		if (packetCount != m_LastPacketCount)
+		{
+			m_LastPacketCount = packetCount;
+			return true;
+		}
+		if (std::chrono::steady_clock::now() >= deadline)
+		{
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+bool TapReader::Attach(const void* view, size_t viewSize)
+{
+	const AUDIOMIRROR_TAP_HEADER* header = (const AUDIOMIRROR_TAP_HEADER*)view;
+
+	m_pHeader = nullptr;
+	if (view == nullptr || viewSize < sizeof(AUDIOMIRROR_TAP_HEADER) ||
+		header->Magic != AUDIOMIRROR_TAP_MAGIC || header->Version != AUDIOMIRROR_TAP_VERSION ||
+		header->DataSize == 0 || header->BlockAlign == 0 || header->DataSize % header->BlockAlign != 0 ||
+		(uint64_t)header->HeaderSize + header->DataSize > viewSize)
+	{
+		return false;
+	}
+
+	m_pHeader = header;
+	m_pData = (const uint8_t*)view + header->HeaderSize;
+	m_DataSize = header->DataSize;
+	m_BlockAlign = header->BlockAlign;
+	m_LostBytes = 0;
+	SeekToLive();
+
+	return true;
+}
+
+uint64_t TapReader::LoadCursor(const volatile ULONGLONG* cursor) const
+{
+	uint64_t value = *cursor;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return value;
+}
+
+void TapReader::SeekToLive()
+{
+	if (m_pHeader != nullptr)
+	{
+		m_ReadPosition = LoadCursor(&m_pHeader->WritePosition);
+	}
+}
+
+uint64_t TapReader::Available() const
+{
+	if (m_pHeader == nullptr)
+	{
+		return 0;
+	}
+	return LoadCursor(&m_pHeader->WritePosition) - m_ReadPosition;
+}
+
+size_t TapReader::Read(void* target, size_t maxBytes)
+{
+	uint8_t* pTarget = (uint8_t*)target;
+
+	if (m_pHeader == nullptr)
+	{
+		return 0;
+	}
+
+	uint64_t writePosition = LoadCursor(&m_pHeader->WritePosition);
+	if (writePosition - m_ReadPosition > m_DataSize)
+	{
+		m_LostBytes += writePosition - m_DataSize - m_ReadPosition;
+		m_ReadPosition = writePosition - m_DataSize;
+	}
+
+	uint64_t count = std::min<uint64_t>(writePosition - m_ReadPosition, maxBytes);
+	count -= count % m_BlockAlign;
+
+	uint64_t copied = 0;
+	while (copied < count)
+	{
+		uint64_t offset = (m_ReadPosition + copied) % m_DataSize;
+		uint64_t run = std::min(count - copied, m_DataSize - offset);
+		memcpy(pTarget + copied, m_pData + offset, (size_t)run);
+		copied += run;
+	}
+
+	// Anything below WriteLimit - DataSize may have been overwritten while
+	// it was copied. The driver writes whole frames, so the cut is aligned.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t writeLimit = LoadCursor(&m_pHeader->WriteLimit);
+	if (writeLimit > m_DataSize && m_ReadPosition < writeLimit - m_DataSize)
+	{
+		uint64_t torn = std::min(count, writeLimit - m_DataSize - m_ReadPosition);
+		memmove(pTarget, pTarget + torn, (size_t)(count - torn));
+		m_LostBytes += torn;
+		m_ReadPosition += torn;
+		count -= torn;
+	}
+
+	m_ReadPosition += count;
+	return (size_t)count;
+}
+
+bool InjectWriter::Attach(void* view, size_t viewSize)
+{
+	AUDIOMIRROR_INJECT_HEADER* header = (AUDIOMIRROR_INJECT_HEADER*)view;
+
+	m_pHeader = nullptr;
+	if (view == nullptr || viewSize < sizeof(AUDIOMIRROR_INJECT_HEADER) ||
+		header->Magic != AUDIOMIRROR_INJECT_MAGIC || header->Version != AUDIOMIRROR_INJECT_VERSION ||
+		header->DataSize == 0 || header->BlockAlign == 0 || header->DataSize % header->BlockAlign != 0 ||
+		(uint64_t)header->HeaderSize + header->DataSize > viewSize)
+	{
+		return false;
+	}
+
+	m_pHeader = header;
+	m_pData = (uint8_t*)view + header->HeaderSize;
+	m_DataSize = header->DataSize;
+	m_BlockAlign = header->BlockAlign;
+
+	// Whatever a previous writer left unconsumed is kept.
+	m_WritePosition = std::max<uint64_t>((uint64_t)header->WritePosition, LoadReadPosition());
+	m_WritePosition -= m_WritePosition % m_BlockAlign;
+
+	return true;
+}
+
+uint64_t InjectWriter::LoadReadPosition() const
+{
+	uint64_t value = m_pHeader->ReadPosition;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return value;
+}
+
+uint64_t InjectWriter::Space() const
+{
+	if (m_pHeader == nullptr)
+	{
+		return 0;
+	}
+	return m_DataSize - Queued();
+}
+
+uint64_t InjectWriter::Queued() const
+{
+	if (m_pHeader == nullptr)
+	{
+		return 0;
+	}
+
+	uint64_t readPosition = LoadReadPosition();
+	return (m_WritePosition > readPosition) ? std::min(m_WritePosition - readPosition, m_DataSize) : 0;
+}
+
+size_t InjectWriter::Write(const void* source, size_t bytes)
+{
+	const uint8_t* pSource = (const uint8_t*)source;
+
+	if (m_pHeader == nullptr)
+	{
+		return 0;
+	}
+
+	uint64_t count = std::min<uint64_t>(Space(), bytes);
+	count -= count % m_BlockAlign;
+
+	uint64_t copied = 0;
+	while (copied < count)
+	{
+		uint64_t offset = (m_WritePosition + copied) % m_DataSize;
+		uint64_t run = std::min(count - copied, m_DataSize - offset);
+		memcpy(m_pData + offset, pSource + copied, (size_t)run);
+		copied += run;
+	}
+
+	// The driver must see the data before the cursor that covers it.
+	m_WritePosition += count;
+	std::atomic_thread_fence(std::memory_order_release);
+	m_pHeader->WritePosition = m_WritePosition;
+
+	return (size_t)count;
+}
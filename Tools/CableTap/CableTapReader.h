@@ -0,0 +1,155 @@
+#pragma once
+
+/*++
+
+Module Name:
+
+	CableTapReader.h
+
+Abstract:
+
+	User mode side of the cable tap and the injection ring (see
+	AudioMirror/AudioMirrorTap.h).
+
+	TapView owns a mapping of either section, the view the driver maps
+	through KSPROPERTY_AUDIOMIRROR_TAP or KSPROPERTY_AUDIOMIRROR_INJECT or a
+	plain file holding the same layout, which stands in for the driver on
+	systems without it. TapReader follows the cursor of a tap, InjectWriter
+	fills an injection ring. Both use memory loads and stores only.
+
+--*/
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+typedef uint16_t USHORT;
+typedef uint32_t ULONG;
+typedef uint64_t ULONGLONG;
+#endif
+
+#include "../../AudioMirror/AudioMirrorTap.h"
+
+class TapView
+{
+public:
+	TapView() = default;
+	~TapView();
+
+	TapView(const TapView&) = delete;
+	TapView& operator=(const TapView&) = delete;
+
+	// Maps a file laid out like the tap or the injection ring.
+	bool OpenFile(const std::string& path, bool writable = false);
+
+#ifdef _WIN32
+	// Maps the tap of an AudioMirror render filter and registers an event
+	// the driver sets for every block it writes.
+	bool OpenDevice(const std::wstring& filterPath);
+
+	// Maps the injection ring of an AudioMirror capture filter and registers
+	// an event the driver sets whenever it consumed injected audio.
+	bool OpenInjection(const std::wstring& filterPath);
+#endif
+
+	void Close();
+
+	void* Base() const { return m_pBase; }
+	size_t Size() const { return m_Size; }
+
+	// Waits until the driver wrote (tap) or consumed (injection) a block or
+	// the timeout elapsed. Without a driver event the packet counter is
+	// polled.
+	bool Wait(uint32_t timeoutMs);
+
+private:
+	void*       m_pBase = nullptr;
+	size_t      m_Size = 0;
+	uint64_t    m_LastPacketCount = 0;
+#ifdef _WIN32
+	ULONG       m_EventPropertyId = 0;
+	HANDLE      m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE      m_hMapping = nullptr;
+	HANDLE      m_hDevice = INVALID_HANDLE_VALUE;
+	HANDLE      m_hEvent = nullptr;
+
+	bool OpenDeviceView(const std::wstring& filterPath, ULONG mapPropertyId, ULONG eventPropertyId);
+#else
+	int         m_Fd = -1;
+#endif
+
+	const volatile ULONGLONG* GetPacketCount() const;
+};
+
+class TapReader
+{
+public:
+	// Checks the header of a view. Fails on a view that is too small or a
+	// layout version this reader does not know.
+	bool Attach(const void* view, size_t viewSize);
+
+	const AUDIOMIRROR_TAP_HEADER* Header() const { return m_pHeader; }
+
+	// Moves the read position to the newest data, dropping anything older.
+	void SeekToLive();
+
+	// Bytes the driver has written past the read position.
+	uint64_t Available() const;
+
+	uint64_t Position() const { return m_ReadPosition; }
+	uint64_t LostBytes() const { return m_LostBytes; }
+
+	// Copies up to maxBytes of whole frames into target and returns the
+	// number of bytes copied. Bytes the driver overwrote before they could
+	// be read are skipped and counted in LostBytes.
+	size_t Read(void* target, size_t maxBytes);
+
+private:
+	const AUDIOMIRROR_TAP_HEADER*   m_pHeader = nullptr;
+	const uint8_t*                  m_pData = nullptr;
+	uint64_t                        m_DataSize = 0;
+	uint64_t                        m_BlockAlign = 1;
+	uint64_t                        m_ReadPosition = 0;
+	uint64_t                        m_LostBytes = 0;
+
+	uint64_t LoadCursor(const volatile ULONGLONG* cursor) const;
+};
+
+class InjectWriter
+{
+public:
+	// Checks the header of a writable injection view and continues at the
+	// position the driver has consumed up to.
+	bool Attach(void* view, size_t viewSize);
+
+	const AUDIOMIRROR_INJECT_HEADER* Header() const { return m_pHeader; }
+
+	// Bytes that can be written without overwriting audio the driver has
+	// not consumed yet.
+	uint64_t Space() const;
+
+	// Bytes written but not consumed by every capture stream yet.
+	uint64_t Queued() const;
+
+	uint64_t Position() const { return m_WritePosition; }
+
+	// Underruns the driver reported, see AUDIOMIRROR_INJECT_HEADER.
+	uint64_t Underruns() const { return m_pHeader ? m_pHeader->Underruns : 0; }
+	uint64_t UnderrunBytes() const { return m_pHeader ? m_pHeader->UnderrunBytes : 0; }
+
+	// Copies up to bytes of whole frames into the ring and publishes them.
+	// Returns the number of bytes written.
+	size_t Write(const void* source, size_t bytes);
+
+private:
+	AUDIOMIRROR_INJECT_HEADER*  m_pHeader = nullptr;
+	uint8_t*                    m_pData = nullptr;
+	uint64_t                    m_DataSize = 0;
+	uint64_t                    m_BlockAlign = 1;
+	uint64_t                    m_WritePosition = 0;
+
+	uint64_t LoadReadPosition() const;
+};
@@ -0,0 +1,322 @@
+/*++
+
+Module Name:
+
+	LatencySim.cpp
+
+Abstract:
+
+	Render to capture latency of the cable for a given buffer configuration.
+	Runs the driver's own CableStream, RingBuffer and LatencyProbe against the
+	host kernel shim: a render stream paired with a capture stream that
+	measures, both on the virtual performance counter. Reports the histogram
+	the capture stream exposes through KSPROPERTY_AUDIOMIRROR_LATENCY_MEASUREMENT
+	as p50/p99/p999 latency.
+
+	The 1 ms notification timers either expire with random lateness or replay
+	a schedule from a file with one "render <us>" or "capture <us>" line per
+	timer expiry. The n-th line of a stream delays its n-th expiry to that
+	time, a line before the nominal expiry leaves it on time.
+
+--*/
+
+// The standard headers go first, the kernel headers define min and max.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CableStream.h"
+#include "CableSimd.h"
+
+struct SimConfig
+{
+	ULONG       SampleRate = 48000;
+	ULONG       Channels = 2;
+	ULONG       BitsPerSample = 32;
+	ULONG       BufferMs = 10;
+	ULONG       Notifications = 2;
+	ULONGLONG   DurationMs = 10000;
+	ULONGLONG   CaptureStartUs = 500;
+	ULONGLONG   JitterUs = 0;
+	ULONG       Seed = 1;
+	std::string ScheduleFile;
+	bool        FailOnGlitch = false;
+};
+
+/*
+	A stream with a DMA buffer the simulation owns. Nobody reads or writes
+	packets, the render buffer holds a constant so the capture side never
+	sees the silence that would let its timer go idle.
+*/
+class LatencyStream : public CableStream
+{
+public:
+	std::vector<BYTE>   Buffer;
+	ULONG               PacketSize = 0;
+	std::deque<ULONGLONG> Expiries;     // Replayed expiry times, QPC.
+
+	VOID GetLatencyHistogram(_Out_ PAUDIOMIRROR_LATENCY_HISTOGRAM Histogram)
+	{
+		m_LatencyProbe.Snapshot(Histogram);
+	}
+
+	ULONG GetRingSize()
+	{
+		return m_RingBuffer ? (ULONG)m_RingBuffer->GetSize() : 0;
+	}
+};
+
+static ULONGLONG UsToQpc(ULONGLONG us)
+{
+	return us * HOST_QPC_FREQUENCY / 1000000;
+}
+
+static bool ParseArguments(int argc, char** argv, SimConfig* config)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+		if (strcmp(arg, "--help") == 0)
+		{
+			return false;
+		}
+		if (strcmp(arg, "--fail-on-glitch") == 0)
+		{
+			config->FailOnGlitch = true;
+			continue;
+		}
+		if (value == nullptr)
+		{
+			fprintf(stderr, "missing value for %s\n", arg);
+			return false;
+		}
+		i++;
+
+		if (strcmp(arg, "--sample-rate") == 0) config->SampleRate = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--channels") == 0) config->Channels = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--bits") == 0) config->BitsPerSample = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--buffer-ms") == 0) config->BufferMs = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--notifications") == 0) config->Notifications = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--duration-ms") == 0) config->DurationMs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--capture-start-us") == 0) config->CaptureStartUs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--jitter-us") == 0) config->JitterUs = strtoull(value, nullptr, 10);
+		else if (strcmp(arg, "--seed") == 0) config->Seed = (ULONG)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--schedule") == 0) config->ScheduleFile = value;
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", arg);
+			return false;
+		}
+	}
+
+	if (config->SampleRate == 0 || config->Channels == 0 || config->BitsPerSample == 0 ||
+		config->BitsPerSample % 8 != 0 || config->BufferMs == 0 || config->Notifications == 0)
+	{
+		fprintf(stderr, "invalid buffer configuration\n");
+		return false;
+	}
+	return true;
+}
+
+static bool LoadSchedule(const std::string& path, LatencyStream* render, LatencyStream* capture, ULONGLONG* lastUs)
+{
+	std::ifstream file(path);
+	std::string stream;
+	ULONGLONG timeUs;
+
+	if (!file)
+	{
+		fprintf(stderr, "cannot open %s\n", path.c_str());
+		return false;
+	}
+	*lastUs = 0;
+	while (file >> stream >> timeUs)
+	{
+		if (stream != "render" && stream != "capture")
+		{
+			fprintf(stderr, "bad schedule entry '%s'\n", stream.c_str());
+			return false;
+		}
+		(stream == "capture" ? capture : render)->Expiries.push_back(UsToQpc(timeUs));
+		*lastUs = (std::max)(*lastUs, timeUs);
+	}
+	for (LatencyStream* s : { render, capture })
+	{
+		std::sort(s->Expiries.begin(), s->Expiries.end());
+	}
+	return true;
+}
+
+static bool InitStream(LatencyStream* stream, WAVEFORMATEX* format, const SimConfig& config, BOOLEAN capture)
+{
+	CABLE_STREAM_CONFIG streamConfig = {};
+	ULONG size = format->nAvgBytesPerSec / 1000 * config.BufferMs;
+
+	streamConfig.Capture = capture;
+	streamConfig.MeasureLatency = capture;
+	streamConfig.RingBufferCount = CABLE_RING_BUFFERS_DEFAULT;
+
+	if (!NT_SUCCESS(stream->InitCable(format, &streamConfig)) ||
+		!NT_SUCCESS(stream->PrepareBuffer(config.Notifications, &size, &stream->PacketSize)))
+	{
+		return false;
+	}
+	stream->Buffer.assign(size, capture ? 0 : 0x5A);
+	stream->AttachDmaBuffer(stream->Buffer.data(), size, config.Notifications, stream->PacketSize);
+	return true;
+}
+
+static VOID RunStream(LatencyStream* stream)
+{
+	stream->SetCableState(KSSTATE_ACQUIRE);
+	stream->SetCableState(KSSTATE_PAUSE);
+	stream->SetCableState(KSSTATE_RUN);
+}
+
+// Percentiles out of the fixed buckets, as a client of the property gets
+// them. A bucket reports its upper edge, the overflow bucket the maximum.
+static ULONG HistogramPercentile(const AUDIOMIRROR_LATENCY_HISTOGRAM& histogram, double percentile)
+{
+	ULONGLONG rank = (ULONGLONG)(percentile / 100.0 * histogram.SampleCount + 0.999999);
+	ULONGLONG seen = 0;
+
+	rank = (std::max<ULONGLONG>)(rank, 1);
+	for (ULONG i = 0; i + 1 < histogram.BucketCount; ++i)
+	{
+		seen += histogram.Buckets[i];
+		if (seen >= rank)
+		{
+			return (std::min)((i + 1) * histogram.BucketWidthUs, histogram.MaxUs);
+		}
+	}
+	return histogram.MaxUs;
+}
+
+static void PrintUsage()
+{
+	printf(
+		"usage: LatencySim [options]\n"
+		"  --sample-rate N       frames per second (48000)\n"
+		"  --channels N          (2)\n"
+		"  --bits N              bits per sample (32)\n"
+		"  --buffer-ms N         WaveRT buffer duration (10)\n"
+		"  --notifications N     packets per WaveRT buffer (2)\n"
+		"  --duration-ms N       simulated time (10000)\n"
+		"  --capture-start-us N  capture stream start relative to render (500)\n"
+		"  --jitter-us N         max random timer lateness (0)\n"
+		"  --seed N              random seed for the jitter (1)\n"
+		"  --schedule FILE       replay 'render <us>' / 'capture <us>' timer expiries\n"
+		"  --fail-on-glitch      exit with 2 if a marker was lost or the ring ran over or dry\n");
+}
+
+int main(int argc, char** argv)
+{
+	SimConfig config;
+	WAVEFORMATEX format = {};
+	LatencyStream render;
+	LatencyStream capture;
+	ULONGLONG endUs;
+
+	if (!ParseArguments(argc, argv, &config))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// The driver picks its mixing kernels in DriverEntry.
+	CableSimdInitialize();
+
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = (WORD)config.Channels;
+	format.nSamplesPerSec = config.SampleRate;
+	format.wBitsPerSample = (WORD)config.BitsPerSample;
+	format.nBlockAlign = (WORD)(config.Channels * config.BitsPerSample / 8);
+	format.nAvgBytesPerSec = config.SampleRate * format.nBlockAlign;
+
+	HostSetTime(0);
+	if (!InitStream(&render, &format, config, FALSE) || !InitStream(&capture, &format, config, TRUE))
+	{
+		fprintf(stderr, "invalid buffer configuration\n");
+		return 1;
+	}
+	CableStream::PairStreams(&render, &capture);
+
+	endUs = config.DurationMs * 1000;
+	std::mt19937 random(config.Seed);
+	if (!config.ScheduleFile.empty())
+	{
+		if (!LoadSchedule(config.ScheduleFile, &render, &capture, &endUs))
+		{
+			return 1;
+		}
+		HostSetTimerLateness([](PEX_TIMER timer, PVOID context) -> LONGLONG
+		{
+			std::deque<ULONGLONG>& expiries = ((LatencyStream*)(CableStream*)context)->Expiries;
+			ULONGLONG dueQpc = HostGetTimerDue(timer);
+			LONGLONG lateness = 0;
+
+			if (!expiries.empty())
+			{
+				lateness = (LONGLONG)(expiries.front() - dueQpc) * 10000000 / (LONGLONG)HOST_QPC_FREQUENCY;
+				expiries.pop_front();
+			}
+			return lateness;
+		});
+	}
+	else
+	{
+		// The high resolution timer does not drift, lateness does not accumulate.
+		HostSetTimerLateness([&](PEX_TIMER, PVOID) -> LONGLONG
+		{
+			return (LONGLONG)std::uniform_int_distribution<ULONGLONG>(0, config.JitterUs)(random) * 10;
+		});
+	}
+
+	RunStream(&render);
+	HostRunTimers(UsToQpc(config.CaptureStartUs));
+	RunStream(&capture);
+	HostRunTimers(UsToQpc(endUs));
+	HostSetTimerLateness(nullptr);
+
+	AUDIOMIRROR_LATENCY_HISTOGRAM histogram;
+	AUDIOMIRROR_STREAM_STATISTICS statistics;
+
+	capture.GetLatencyHistogram(&histogram);
+	capture.GetStreamStatistics()->Snapshot(&statistics);
+
+	printf("buffer           %u ms, %u packets, %u bytes\n", config.BufferMs, config.Notifications, (ULONG)render.Buffer.size());
+	printf("packet           %u bytes\n", render.PacketSize);
+	printf("ring             %u bytes\n", capture.GetRingSize());
+	printf("samples          %llu\n", (unsigned long long)histogram.SampleCount);
+	printf("lost markers     %llu\n", (unsigned long long)histogram.LostMarkers);
+	printf("overruns         %llu\n", (unsigned long long)statistics.Overruns);
+	printf("underruns        %llu\n", (unsigned long long)statistics.Underruns);
+
+	bool glitched = histogram.SampleCount == 0 || histogram.LostMarkers || statistics.Overruns || statistics.Underruns;
+	int result = (config.FailOnGlitch && glitched) ? 2 : 0;
+
+	if (histogram.SampleCount == 0)
+	{
+		printf("no marker reached the capture side\n");
+	}
+	else
+	{
+		printf("p50              %u us\n", HistogramPercentile(histogram, 50.0));
+		printf("p99              %u us\n", HistogramPercentile(histogram, 99.0));
+		printf("p999             %u us\n", HistogramPercentile(histogram, 99.9));
+		printf("max              %u us\n", histogram.MaxUs);
+		printf("above histogram  %u\n", histogram.Buckets[histogram.BucketCount - 1]);
+	}
+
+	render.ShutdownCable();
+	capture.ShutdownCable();
+	return result;
+}